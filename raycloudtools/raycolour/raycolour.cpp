@@ -5,8 +5,10 @@
 // Author: Thomas Lowe
 #include "raylib/extraction/raysegment.h"
 #include "raylib/raycloud.h"
+#include "raylib/raycloudstream.h"
 #include "raylib/raycloudwriter.h"
 #include "raylib/rayparse.h"
+#include "raylib/raysort.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "raylib/imageread.h"
 
@@ -32,6 +34,7 @@ void usage(int exit_code = 1)
   std::cout << "                   branches      - red and green are lidar intensity and cylindricality respectively, greater for branches than for leaves" << std::endl;
   std::cout << "                   image planview.png - colour all points from image, stretched to fit the point bounds" << std::endl;
   std::cout << "                         --lit   - shaded (slow on large datasets)" << std::endl;
+  std::cout << "                         --sorted - spatially sort the rays while shading, or colouring by shape, normal or branches. Faster on large unordered clouds" << std::endl;
   // clang-format on
   exit(exit_code);
 }
@@ -100,14 +103,14 @@ int rayColour(int argc, char *argv[])
 {
   ray::FileArgument cloud_file, image_file;
   ray::KeyChoice colour_type({ "time", "height", "shape", "normal", "alpha", "branches" });
-  ray::OptionalFlagArgument lit("lit", 'l');
+  ray::OptionalFlagArgument lit("lit", 'l'), sorted("sorted", 's');
   ray::Vector3dArgument col(0.0, 1.0);
   ray::DoubleArgument alpha(0.0, 1.0);
   ray::TextArgument alpha_text("alpha"), image_text("image");
-  const bool standard_format = ray::parseCommandLine(argc, argv, { &cloud_file, &colour_type }, { &lit });
-  const bool flat_colour = ray::parseCommandLine(argc, argv, { &cloud_file, &col }, { &lit });
-  const bool flat_alpha = ray::parseCommandLine(argc, argv, { &cloud_file, &alpha_text, &alpha }, { &lit });
-  const bool image_format = ray::parseCommandLine(argc, argv, { &cloud_file, &image_text, &image_file }, { &lit });
+  const bool standard_format = ray::parseCommandLine(argc, argv, { &cloud_file, &colour_type }, { &lit, &sorted });
+  const bool flat_colour = ray::parseCommandLine(argc, argv, { &cloud_file, &col }, { &lit, &sorted });
+  const bool flat_alpha = ray::parseCommandLine(argc, argv, { &cloud_file, &alpha_text, &alpha }, { &lit, &sorted });
+  const bool image_format = ray::parseCommandLine(argc, argv, { &cloud_file, &image_text, &image_file }, { &lit, &sorted });
   if (!standard_format && !flat_colour && !flat_alpha && !image_format)
     usage();
 
@@ -118,72 +121,46 @@ int rayColour(int argc, char *argv[])
 
   if (type != "shape" && type != "normal" && type != "branches")  // chunk loading possible for simple cases
   {
-    ray::CloudWriter writer;
-    if (!writer.begin(out_file))
-      usage();
-
-    auto colour_rays = [flat_colour, flat_alpha, &type, &col, &alpha, &writer, &split_alpha](
-                         std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
-                         std::vector<double> &times, std::vector<ray::RGBA> &colours) {
+    if (image_format)
+    {
+      ray::CloudWriter writer;
+      if (!writer.begin(out_file))
+        usage();
+      colourFromImage(cloud_file.name(), image_file.name(), writer);
+      writer.end();
+    }
+    else
+    {
+      ray::CloudStream stream;
       if (flat_colour)
       {
-        for (auto &colour : colours)
-        {
-          colour.red = (uint8_t)(255.0 * col.value()[0]);
-          colour.green = (uint8_t)(255.0 * col.value()[1]);
-          colour.blue = (uint8_t)(255.0 * col.value()[2]);
-        }
+        ray::RGBA colour;
+        colour.red = (uint8_t)(255.0 * col.value()[0]);
+        colour.green = (uint8_t)(255.0 * col.value()[1]);
+        colour.blue = (uint8_t)(255.0 * col.value()[2]);
+        stream.setColour(colour);
       }
       else if (flat_alpha)
       {
-        for (auto &colour : colours)
-        {
-          colour.alpha = (uint8_t)(255.0 * alpha.value());
-        }
+        stream.setAlpha((uint8_t)(255.0 * alpha.value()));
       }
-      else  // standard_format
+      else if (type == "time")
       {
-        if (type == "time")
-        {
-          const double colour_repeat_period = 60.0;  // repeating per minute gives a quick way to assess the scan length
-          for (size_t i = 0; i < ends.size(); i++)
-          {
-            spectrumRGB(times[i] / colour_repeat_period, colours[i]);
-          }
-        }
-        else if (type == "height")
-        {
-          const double wavelength = 10.0;
-          for (size_t i = 0; i < ends.size(); i++)
-          {
-            spectrumRGB(ends[i][2] / wavelength, colours[i]);
-          }
-        }
-        else if (type == "alpha")
-        {
-          for (auto &colour : colours)
-          {
-            const Eigen::Vector3d col_vec = ray::redGreenBlueGradient(colour.alpha / 255.0);
-            colour.red = uint8_t(255.0 * col_vec[0]);
-            colour.green = uint8_t(255.0 * col_vec[1]);
-            colour.blue = uint8_t(255.0 * col_vec[2]);
-          }
-        }
-        else
-          usage();
+        stream.colourByTime();
       }
-      writer.writeChunk(starts, ends, times, colours);
-    };
-
-    if (image_format)
-    {
-      colourFromImage(cloud_file.name(), image_file.name(), writer);
-    }
-    else if (!ray::Cloud::read(cloud_file.name(), colour_rays))
-    {
-      usage();
+      else if (type == "height")
+      {
+        stream.colourByHeight();
+      }
+      else if (type == "alpha")
+      {
+        stream.colourByAlpha();
+      }
+      else
+        usage();
+      if (!stream.write(out_file).run(cloud_file.name()))
+        usage();
     }
-    writer.end();
     if (!lit.isSet())
       return 0;
     in_file = out_file;  // when lit we have to load again, from the saved output file
@@ -194,6 +171,10 @@ int rayColour(int argc, char *argv[])
   ray::Cloud cloud;
   if (!cloud.load(in_file))
     usage();
+  // the neighbourhood searches below have better memory locality on a spatially sorted cloud
+  std::vector<size_t> order;
+  if (sorted.isSet())
+    ray::sortCloudSpatially(cloud, order);
 
   // what I need is the normal, curvature, eigenvalues, per point.
   struct Data
@@ -363,6 +344,8 @@ int rayColour(int argc, char *argv[])
       cloud.colours[i].blue = (uint8_t)((double)cloud.colours[i].blue * s);
     }
   }
+  if (sorted.isSet())
+    ray::restoreCloudOrder(cloud, order);
   cloud.save(out_file);
 
   return 0;
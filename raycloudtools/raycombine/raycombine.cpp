@@ -70,15 +70,7 @@ int rayCombine(int argc, char *argv[])
     (threeway || threeway_concatenate) ? base_cloud.nameStub() : cloud_files.files()[0].nameStub();
 
   std::vector<ray::Cloud> clouds;
-  if (threeway || threeway_concatenate)
-  {
-    clouds.resize(2);
-    if (!clouds[0].load(cloud_1.name(), false))
-      usage();
-    if (!clouds[1].load(cloud_2.name(), false))
-      usage();
-  }
-  else if (!concatenate_all)
+  if (!concatenate_all && !threeway && !threeway_concatenate)
   {
     clouds.resize(cloud_files.files().size());
     for (int i = 0; i < (int)cloud_files.files().size(); i++)
@@ -151,10 +143,11 @@ int rayCombine(int argc, char *argv[])
 
   if (threeway || threeway_concatenate)
   {
-    ray::Cloud base_cloud;
-    if (!base_cloud.load(argv[1], false))
-      usage();
-    merger.mergeThreeWay(base_cloud, clouds[0], clouds[1], &progress);
+    // the clouds are streamed from disk, with only the changed rays loaded, and the result written directly
+    const bool merged =
+      merger.mergeThreeWay(base_cloud.name(), cloud_1.name(), cloud_2.name(), combined_file, &progress);
+    progress_thread.join();
+    return merged ? 0 : 1;
   }
   else
   {
@@ -172,4 +165,4 @@ int rayCombine(int argc, char *argv[])
 int main(int argc, char *argv[])
 {
   return ray::runWithMemoryCheck(rayCombine, argc, argv);
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -5,6 +5,7 @@
 // Author: Thomas Lowe
 #include "raylib/raybuildinggen.h"
 #include "raylib/raycloud.h"
+#include "raylib/raycloudwriter.h"
 #include "raylib/rayforestgen.h"
 #include "raylib/rayparse.h"
 #include "raylib/rayroomgen.h"
@@ -89,8 +90,44 @@ int rayCreate(int argc, char *argv[])
     const std::vector<bool> &bounded = building_gen.rayBounded();
     for (int i = 0; i < (int)cloud.colours.size(); i++) cloud.colours[i].alpha = bounded[i] ? 255 : 0;
   }
-  else if (type == "tree" || type == "forest")
+  else if (type == "tree" || type == "forest" || type == "terrain")
   {
+    // these generators pass their rays on in chunks, which are timed, coloured and written as they arrive
+    ray::CloudWriter writer;
+    if (!writer.begin(type + ".ply"))
+      usage();
+    ray::Cloud chunk;
+    double time = 0.0;
+    auto write_rays = [&](const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends) 
+    {
+      chunk.starts = starts;
+      chunk.ends = ends;
+      chunk.times.resize(ends.size());
+      for (size_t i = 0; i < ends.size(); i++)
+      {
+        chunk.times[i] = time;
+        time += time_delta;
+      }
+      colourByTime(chunk.times, chunk.colours);
+      writer.writeChunk(chunk);
+    };
+
+    if (type == "terrain")
+    {
+      ray::TerrainGen terrain;
+      if (from_file)  // generate ray cloud terrain from a .ply mesh file
+      {
+        terrain.generateFromFile(input_file.name());
+        write_rays(terrain.rayStarts(), terrain.rayEnds());
+      }
+      else
+      {
+        terrain.generate(ray::TerrainParams(), write_rays);
+      }
+      writer.end();
+      return 0;
+    }
+
     const double density = 500.0;                   // density of points on the branches of the trees
     const double tree_ground_extent = 2.0;          // extent (from centre) is the half-width
     const double ground_noise_extent = 0.025;       // vertical noise in the ground
@@ -101,7 +138,6 @@ int rayCreate(int argc, char *argv[])
     ray::fillBranchAngleLookup();
     Eigen::Vector3d box_min(-tree_ground_extent, -tree_ground_extent, -ground_noise_extent);
     Eigen::Vector3d box_max(tree_ground_extent, tree_ground_extent, ground_noise_extent);
-    double time = 0.0;
     if (type == "tree")  // create a single tree
     {
       ray::TreeGen tree_gen;
@@ -111,16 +147,7 @@ int rayCreate(int argc, char *argv[])
       tree_gen.segments()[0].tip = Eigen::Vector3d(0, 0, 0);
       tree_gen.segments()[0].radius = 0.1;
       tree_gen.make(params);
-      tree_gen.generateRays(density);
-      cloud.starts = tree_gen.rayStarts();
-      cloud.ends = tree_gen.rayEnds();
-      cloud.times.resize(cloud.ends.size());
-      for (size_t i = 0; i < cloud.starts.size(); i++)
-      {
-        cloud.times[i] = time;
-        time += time_delta;
-      }
-      colourByTime(cloud.times, cloud.colours);
+      tree_gen.generateRays(density, write_rays);
     }
     else if (type == "forest")  // create multiple trees on a plane
     {
@@ -138,61 +165,27 @@ int rayCreate(int argc, char *argv[])
       {
         forest_gen.make(params);
       }
-      forest_gen.generateRays(density);
-      for (auto &tree : forest_gen.trees())
-      {
-        const std::vector<Eigen::Vector3d> &ray_starts = tree.rayStarts();
-        const std::vector<Eigen::Vector3d> &ray_ends = tree.rayEnds();
-        cloud.starts.insert(cloud.starts.end(), ray_starts.begin(), ray_starts.end());
-        cloud.ends.insert(cloud.ends.end(), ray_ends.begin(), ray_ends.end());
-      }
-      cloud.times.resize(cloud.starts.size());
-      for (size_t i = 0; i < cloud.starts.size(); i++)
-      {
-        cloud.times[i] = time;
-        time += time_delta;
-      }
+      forest_gen.generateRays(density, write_rays);
       box_min *= forest_ground_multiplier;  // for a forest, we need a larger ground
       box_max *= forest_ground_multiplier;
     }
     if (!from_file)
     {
       int num = int(0.25 * density * (box_max[0] - box_min[0]) * (box_max[1] - box_min[1]));
+      std::vector<Eigen::Vector3d> starts, ends;
       for (int i = 0; i < num; i++)
       {
         Eigen::Vector3d pos(ray::random(box_min[0], box_max[0]), ray::random(box_min[1], box_max[1]),
                             ray::random(box_min[2], box_max[2]));
-        cloud.ends.push_back(pos);
-        cloud.starts.push_back(pos + Eigen::Vector3d(ray::random(-ground_ray_deviation, ground_ray_deviation),
-                                                     ray::random(-ground_ray_deviation, ground_ray_deviation),
-                                                     ground_ray_vertical_height));
-        cloud.times.push_back(time);
-        time += time_delta;
+        ends.push_back(pos);
+        starts.push_back(pos + Eigen::Vector3d(ray::random(-ground_ray_deviation, ground_ray_deviation),
+                                               ray::random(-ground_ray_deviation, ground_ray_deviation),
+                                               ground_ray_vertical_height));
       }
+      write_rays(starts, ends);
     }
-    colourByTime(cloud.times, cloud.colours);
-  }
-  else if (type == "terrain")
-  {
-    ray::TerrainGen terrain;
-    if (from_file)  // generate ray cloud terrain from a .ply mesh file
-    {
-      terrain.generateFromFile(input_file.name());
-    }
-    else
-    {
-      terrain.generate();
-    }
-    cloud.starts = terrain.rayStarts();
-    cloud.ends = terrain.rayEnds();
-    cloud.times.resize(cloud.starts.size());
-    double time = 0.0;
-    for (size_t i = 0; i < cloud.starts.size(); i++)
-    {
-      cloud.times[i] = time;
-      time += time_delta;
-    }
-    colourByTime(cloud.times, cloud.colours);
+    writer.end();
+    return 0;
   }
   else
     usage();
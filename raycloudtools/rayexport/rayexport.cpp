@@ -19,7 +19,7 @@ void usage(int exit_code = 1)
   // clang-format off
   std::cout << "Export a ray cloud into a point cloud amd trajectory file" << std::endl;
   std::cout << "usage:" << std::endl;
-  std::cout << "rayexport raycloudfile.ply pointcloud.ply/.laz/.txt/.xyz trajectoryfile.ply/.txt - output in the chosen point cloud and trajectory formats" << std::endl;
+  std::cout << "rayexport raycloudfile.ply pointcloud.ply/.las/.laz/.txt/.xyz trajectoryfile.ply/.txt - output in the chosen point cloud and trajectory formats" << std::endl;
   std::cout << "                           --traj_delta 0.1 - trajectory temporal decimation period in s. Default is 0.1" << std::endl;
   // clang-format on
   exit(exit_code);
@@ -34,14 +34,18 @@ int rayExport(int argc, char *argv[])
     usage();
 
   // Saving to a cloud file is fairly simple, we use chunk reading and writing:
-  if (pointcloud_file.nameExt() == "laz")
+  if (pointcloud_file.nameExt() == "laz" || pointcloud_file.nameExt() == "las")
   {
     ray::LasWriter las_writer(pointcloud_file.name());
-    auto add_chunk = [&las_writer](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
-                                   std::vector<double> &times,
-                                   std::vector<ray::RGBA> &colours) { las_writer.writeChunk(ends, times, colours); };
+    bool written = true;  // a chunk that fails to write leaves the file incomplete
+    auto add_chunk = [&las_writer, &written](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                                             std::vector<double> &times, std::vector<ray::RGBA> &colours) {
+      written = las_writer.writeChunk(ends, times, colours) && written;
+    };
     if (!ray::readPly(raycloud_file.name(), true, add_chunk, 0))
       usage();
+    if (!las_writer.end() || !written)
+      usage();
   }
   else if (pointcloud_file.nameExt() == "ply")
   {
@@ -190,4 +194,4 @@ int rayExport(int argc, char *argv[])
 int main(int argc, char *argv[])
 {
   return ray::runWithMemoryCheck(rayExport, argc, argv);
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "raylib/extraction/rayforest.h"
 #include "raylib/extraction/rayterrain.h"
 #include "raylib/extraction/raytrees.h"
+#include "raylib/extraction/raytiledtrees.h"
 #include "raylib/extraction/raytrunks.h"
 #include "raylib/extraction/rayleaves.h"
 #include "raylib/raycloud.h"
@@ -62,6 +63,9 @@ void usage(int exit_code = 1)
     std::cout << "                            --branch_segmentation- (-b) _segmented.ply is per branch segment" << std::endl;
     std::cout << "                            --grid_width 10      - (-w) crops results assuming cloud has been gridded with given width" << std::endl;
     std::cout << "                            --use_rays           - (-u) use rays to reduce trunk radius overestimation in noisy cloud data" << std::endl;
+    std::cout << "                            --tile_width 50      - (-l) process large clouds as overlapping tiles of this width, in parallel" << std::endl;
+    std::cout << "                            --tile_overlap 20    - (-e) overlap between tiles, should exceed the widest tree crown" << std::endl;
+    std::cout << "                            --memory_budget 8    - (-y) approximate GB of memory shared by the tiles processed at once" << std::endl;
     std::cout << "                            (for internal constants -c -g -s see source file rayextract)" << std::endl;
   // These are the internal parameters that I don't expose as they are 'advanced' only, you shouldn't need to adjust them
   //  std::cout << "                            --cylinder_length_to_width 4- (-c) how slender the cylinders are" << std::endl;
@@ -105,6 +109,7 @@ int rayExtract(int argc, char *argv[])
     span_ratio(0.01, 10.0);
   ray::DoubleArgument gravity_factor(0.0, 100.0), grid_width(1.0, 100000.0),
     grid_overlap(0.0, 0.9);
+  ray::DoubleArgument tile_width(1.0, 100000.0), tile_overlap(0.0, 1000.0), memory_budget(0.01, 100000.0);
   ray::OptionalKeyValueArgument max_diameter_option("max_diameter", 'm', &max_diameter);
   ray::OptionalKeyValueArgument crop_length_option("crop_length", 'n', &crop_length);
   ray::OptionalKeyValueArgument distance_limit_option("distance_limit", 'd', &distance_limit);
@@ -118,6 +123,9 @@ int rayExtract(int argc, char *argv[])
   ray::OptionalKeyValueArgument grid_width_option("grid_width", 'w', &grid_width);
   ray::OptionalKeyValueArgument global_taper_option("global_taper", 'a', &global_taper);
   ray::OptionalKeyValueArgument global_taper_factor_option("global_taper_factor", 'o', &global_taper_factor);
+  ray::OptionalKeyValueArgument tile_width_option("tile_width", 'l', &tile_width);
+  ray::OptionalKeyValueArgument tile_overlap_option("tile_overlap", 'e', &tile_overlap);
+  ray::OptionalKeyValueArgument memory_budget_option("memory_budget", 'y', &memory_budget);
   ray::OptionalKeyValueArgument leaf_option("leaf", 'l', &leaf_file);
   ray::OptionalKeyValueArgument leaf_area_option("leaf_area", 'a', &leaf_area);
   ray::OptionalKeyValueArgument leaf_droop_option("leaf_droop", 'd', &leaf_droop);
@@ -137,7 +145,8 @@ int rayExtract(int argc, char *argv[])
     argc, argv, { &trees, &cloud_file, &mesh_file },
     { &max_diameter_option, &distance_limit_option, &height_min_option, &crop_length_option, &girth_height_ratio_option,
       &cylinder_length_to_width_option, &gap_ratio_option, &span_ratio_option, &gravity_factor_option,
-      &segment_branches, &grid_width_option, &global_taper_option, &global_taper_factor_option, &use_rays, &verbose });
+      &segment_branches, &grid_width_option, &global_taper_option, &global_taper_factor_option, &use_rays,
+      &tile_width_option, &tile_overlap_option, &memory_budget_option, &verbose });
   bool extract_leaves = ray::parseCommandLine(argc, argv, { &leaves, &cloud_file, &trees_file }, { &leaf_option, &leaf_area_option, &leaf_droop_option, &stalks });
 
 
@@ -163,21 +172,6 @@ int rayExtract(int argc, char *argv[])
   // finds full tree structures (piecewise cylindrical representation) and saves to file
   else if (extract_trees)
   {
-    ray::Cloud cloud;
-    const int min_num_rays = 40;
-    if (!cloud.load(cloud_file.name(), true, min_num_rays))
-    {
-      usage(true);
-    }
-    Eigen::Vector3d offset = cloud.removeStartPos();
-
-    ray::Mesh mesh;
-    if (!ray::readPlyMesh(mesh_file.name(), mesh))
-    {
-      usage(true);
-    }
-    mesh.translate(-offset);
-
     ray::TreesParams params;
     if (max_diameter_option.isSet())
     {
@@ -230,6 +224,46 @@ int rayExtract(int argc, char *argv[])
     params.use_rays = use_rays.isSet(); 
     params.segment_branches = segment_branches.isSet();
 
+    // large clouds can be split into overlapping tiles, which are processed in parallel then merged
+    if (tile_width_option.isSet())
+    {
+      ray::Mesh mesh;
+      if (!ray::readPlyMesh(mesh_file.name(), mesh))
+      {
+        usage(true);
+      }
+      ray::TiledTreesParams tile_params;
+      tile_params.tile_width = tile_width.value();
+      if (tile_overlap_option.isSet())
+      {
+        tile_params.overlap = tile_overlap.value();
+      }
+      if (memory_budget_option.isSet())
+      {
+        tile_params.memory_budget = memory_budget.value();
+      }
+      if (!ray::extractTreesTiled(cloud_file.name(), cloud_file.nameStub(), mesh, params, tile_params))
+      {
+        usage(true);
+      }
+      return 0;
+    }
+
+    ray::Cloud cloud;
+    const int min_num_rays = 40;
+    if (!cloud.load(cloud_file.name(), true, min_num_rays))
+    {
+      usage(true);
+    }
+    Eigen::Vector3d offset = cloud.removeStartPos();
+
+    ray::Mesh mesh;
+    if (!ray::readPlyMesh(mesh_file.name(), mesh))
+    {
+      usage(true);
+    }
+    mesh.translate(-offset);
+
     ray::Trees trees(cloud, offset, mesh, params, verbose.isSet());
 
     // output the picewise cylindrical description of the trees
@@ -245,9 +279,10 @@ int rayExtract(int argc, char *argv[])
     {
       usage();
     }
-    ray::Mesh tree_mesh;
-    forest.generateSmoothMesh(tree_mesh, -1, 1, 1, 1);
-    ray::writePlyMesh(cloud_file.nameStub() + "_trees_mesh.ply", tree_mesh, true);    
+    if (!forest.writeSmoothMesh(cloud_file.nameStub() + "_trees_mesh.ply", -1, 1, 1, 1, true))
+    {
+      usage(true);
+    }
   }
   // extract the tree locations from a larger, aerial view of a forest
   else if (extract_forest)
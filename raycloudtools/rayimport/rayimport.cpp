@@ -11,6 +11,7 @@
 #include "raylib/raycloud.h"
 #include "raylib/raylaz.h"
 #include "raylib/rayparse.h"
+#include "raylib/raypipeline.h"
 #include "raylib/rayply.h"
 #include "raylib/raytrajectory.h"
 
@@ -93,6 +94,7 @@ int rayImport(int argc, char *argv[])
   size_t num_bounded;
   std::ofstream ofs;
   ray::RayPlyBuffer buffer;
+  ray::CloudStatistics stats;
   if (!ray::writeRayCloudChunkStart(save_file + ".ply", ofs))
     usage();
   Eigen::Vector3d start_pos(0, 0, 0);
@@ -127,21 +129,13 @@ int rayImport(int argc, char *argv[])
         start += offset;
       }
     }
-    // otherwise, a trajectory has been passed in
+    // otherwise, the starts have been interpolated from the trajectory
     else
     {
-      // find the corresponding sensor locations for each point in the cloud
-      trajectory.calculateStartPoints(times, starts);
-      for (size_t i = 0; i < colours.size(); i++)
+      for (auto &time : times)
       {
-        min_time = std::min(min_time, times[i]);
-        max_time = std::max(max_time, times[i]);
-        if (colours[i].alpha == 0 && ends[i][2] < starts[i][2])  // a nonreturn, we need to remove downward ones
-        {
-          Eigen::Vector3d dir = (ends[i] - starts[i]).normalized();
-          const double minimal_distance_for_nonreturns = 0.1;
-          ends[i] = starts[i] + dir * minimal_distance_for_nonreturns;
-        }
+        min_time = std::min(min_time, time);
+        max_time = std::max(max_time, time);
       }
     }
     // option to remove the start position, for data that is in a global frame
@@ -157,38 +151,15 @@ int rayImport(int argc, char *argv[])
         start -= start_pos;
       }
     }
-    if (maximum_intensity == 0.0)
-    {
-      for (auto &c : colours) 
-      {
-        c.alpha = 255;
-      }
-    }
-    if (!ray::writeRayCloudChunk(ofs, buffer, starts, ends, times, colours, has_warned))
+    if (!ray::writeRayCloudChunk(ofs, buffer, starts, ends, times, colours, has_warned, &stats))
     {
       usage();
     }
   };
   Eigen::Vector3d *offset = remove.isSet() ? &start_pos : nullptr;
-  if (cloud_file.nameExt() == "ply")
-  {
-    bool can_times_be_missing = position_format || ray_format;
-    if (!ray::readPly(cloud_file.name(), false, add_chunk,
-                      maximum_intensity, can_times_be_missing))  // special case of reading a non-ray-cloud ply
-    {
-      usage();
-    }
-  }
-  else if (cloud_file.nameExt() == "laz" || cloud_file.nameExt() == "las")
-  {
-    if (!ray::readLas(cloud_file.name(), add_chunk, num_bounded, maximum_intensity, offset))
-    {
-      usage();
-    }
-  }
-  else
+  if (!ray::importCloud(cloud_file.name(), standard_format ? &trajectory : nullptr, maximum_intensity, add_chunk,
+                        &num_bounded, offset))
   {
-    std::cout << "Error converting unknown type: " << cloud_file.name() << std::endl;
     usage();
   }
   if (standard_format)
@@ -217,7 +188,7 @@ int rayImport(int argc, char *argv[])
     std::cout << "If your sensor lacks intensity information, set them to full using:" << std::endl;
     std::cout << "rayimport <point cloud> <trajectory file> --max_intensity 0" << std::endl;
   }
-  ray::writeRayCloudChunkEnd(ofs);
+  ray::writeRayCloudChunkEnd(ofs, save_file + ".ply", &stats);
   // if we remove the start position, then it is useful to print this value that is removed
   // so that the user hasn't lost information
   if (remove.isSet())
@@ -230,4 +201,4 @@ int rayImport(int argc, char *argv[])
 int main(int argc, char *argv[])
 {
   return ray::runWithMemoryCheck(rayImport, argc, argv);
-}
\ No newline at end of file
+}
\ No newline at end of file
@@ -0,0 +1,40 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raylib/raycloudindex.h"
+#include "raylib/rayparse.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+void usage(int exit_code = 1)
+{
+  // clang-format off
+  std::cout << "Build a spatial index of the ray cloud's end points, saved alongside it as raycloud.ply.index" << std::endl;
+  std::cout << "This is used in place of rebuilding the index in raydenoise (sigmas) and raysmooth, until the cloud changes." << std::endl;
+  std::cout << "usage:" << std::endl;
+  std::cout << "rayindex raycloud.ply" << std::endl;
+  // clang-format on
+  exit(exit_code);
+}
+
+int rayIndex(int argc, char *argv[])
+{
+  ray::FileArgument cloud_file;
+  if (!ray::parseCommandLine(argc, argv, { &cloud_file }))
+    usage();
+
+  ray::CloudIndex index;
+  if (!index.build(cloud_file.name()))
+    usage();
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  return ray::runWithMemoryCheck(rayIndex, argc, argv);
+}
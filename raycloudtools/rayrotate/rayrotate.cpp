@@ -45,6 +45,8 @@ int rayRotate(int argc, char *argv[])
     usage();
 
   std::rename(temp_name.c_str(), cloud_file.name().c_str());
+  std::rename(ray::CloudStatistics::fileName(temp_name).c_str(),
+              ray::CloudStatistics::fileName(cloud_file.name()).c_str());  // and its statistics
   return 0;
 }
 
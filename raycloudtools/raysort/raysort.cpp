@@ -0,0 +1,49 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raylib/rayparse.h"
+#include "raylib/raysort.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+void usage(int exit_code = 1)
+{
+  // clang-format off
+  std::cout << "Sort a ray cloud into Morton (Z-curve) order of its end points, so nearby rays are together in the file." << std::endl;
+  std::cout << "The sort is out of core, and an 'order' property is added to each ray so its original order can be restored." << std::endl;
+  std::cout << "usage:" << std::endl;
+  std::cout << "raysort raycloud          - sort the cloud to raycloud_sorted.ply" << std::endl;
+  std::cout << "raysort raycloud restore  - restore a sorted cloud to its original order, in raycloud_restored.ply" << std::endl;
+  // clang-format on
+  exit(exit_code);
+}
+
+int raySort(int argc, char *argv[])
+{
+  ray::FileArgument cloud_file;
+  ray::TextArgument restore_text("restore");
+  const bool sort = ray::parseCommandLine(argc, argv, { &cloud_file });
+  const bool restore = ray::parseCommandLine(argc, argv, { &cloud_file, &restore_text });
+  if (!sort && !restore)
+    usage();
+
+  if (restore)
+  {
+    if (!ray::restoreCloudOrder(cloud_file.name(), cloud_file.nameStub() + "_restored.ply"))
+      usage();
+  }
+  else if (!ray::sortCloudSpatially(cloud_file.name(), cloud_file.nameStub() + "_sorted.ply"))
+    usage();
+
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  return ray::runWithMemoryCheck(raySort, argc, argv);
+}
\ No newline at end of file
@@ -27,7 +27,7 @@ void usage(int exit_code = 1)
   std::cout << "                  single_colour 255,0,0  - splits out a single colour, in 0-255 units" << std::endl;
   std::cout << "                  seg_colour             - splits to one cloud per colour, converting _segmented.ply colours to their index suffix" << std::endl;
   std::cout << "                  alpha 0.0              - splits out unbounded rays, which have zero intensity" << std::endl;
-  std::cout << "                  file distance 0.2      - splits raycloud at 0.2m from the (ply mesh or trees) file surface" << std::endl;
+  std::cout << "                  file distance 0.2      - splits raycloud at 0.2m from the (ply mesh, trees txt or bin) file surface" << std::endl;
   std::cout << "                  raydir 0,0,0.8         - splits based on ray direction, here around nearly vertical rays" << std::endl;
   std::cout << "                  range 10               - splits out rays more than 10 m long" << std::endl;
   std::cout << "                  time 1000 (or time 3 %)- splits at given time stamp (or percentage along)" << std::endl;
@@ -103,15 +103,21 @@ int raySplit(int argc, char *argv[])
         usage();
       }
     }
-    else if (mesh_file.nameExt() == "txt") // assume a tree file
+    else if (mesh_file.nameExt() == "txt" || mesh_file.nameExt() == "bin") // assume a (text or binary) tree file
     {
-      ray::ForestStructure forest;
-      forest.load(mesh_file.name());
       ray::Cloud cloud;  // because forest splitCloud currently not chunk loaded
       if (!cloud.load(rc_name))
       {
         usage();
       }
+      // only the trees near to the cloud are needed, which avoids reading the whole of a large binary tree file
+      ray::Cuboid bounds;
+      cloud.calcBounds(&bounds.min_bound_, &bounds.max_bound_);
+      const Eigen::Vector3d offset(mesh_offset.value(), mesh_offset.value(), mesh_offset.value());
+      bounds.min_bound_ -= offset;
+      bounds.max_bound_ += offset;
+      ray::ForestStructure forest;
+      forest.load(mesh_file.name(), bounds);
       ray::Cloud inside, outside;
       forest.splitCloud(cloud, mesh_offset.value(), inside, outside);
       inside.save(in_name);
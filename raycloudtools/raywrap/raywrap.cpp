@@ -24,6 +24,9 @@ void usage(int exit_code = 1)
   std::cout << "raywrap raycloud upwards 1.0 - wraps raycloud from the bottom upwards, or: downwards, inwards, outwards" << std::endl;
   std::cout << "                               the 1.0 is the maximum curvature to bend to" << std::endl;
   std::cout << "--full                       - the full (slower) method accounts for overhangs." << std::endl;
+  std::cout << "--tile 20                    - with --full, wraps 20 m wide tiles in parallel and joins them. This bounds" << std::endl;
+  std::cout << "                               the memory of the tetrahedralisation for large (e.g. building or cave scale)" << std::endl;
+  std::cout << "                               clouds, but the end points are all still held in memory." << std::endl;
   // clang-format on
   exit(exit_code);
 }
@@ -34,9 +37,54 @@ int rayWrap(int argc, char *argv[])
   ray::KeyChoice direction({ "upwards", "downwards", "inwards", "outwards" });
   ray::DoubleArgument curvature;
   ray::OptionalFlagArgument full("full", 'f');
-  if (!ray::parseCommandLine(argc, argv, { &cloud_file, &direction, &curvature }, { &full }))
+  ray::DoubleArgument tile_width(0.1, 100000.0);
+  ray::OptionalKeyValueArgument tile_option("tile", 't', &tile_width);
+  if (!ray::parseCommandLine(argc, argv, { &cloud_file, &direction, &curvature }, { &full, &tile_option }))
     usage();
 
+  if (full.isSet() && tile_option.isSet())
+  {
+    // keep only the bounded end points, rather than loading the whole cloud
+    ray::TiledConcaveHull tiled_hull(tile_width.value(), 0.25 * tile_width.value());
+    bool has_offset = false;
+    Eigen::Vector3d offset(0, 0, 0);  // to aid in floating point accuracy
+    auto add_chunk = [&](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                         std::vector<double> &, std::vector<ray::RGBA> &colours) {
+      std::vector<Eigen::Vector3d> points;
+      points.reserve(ends.size());
+      for (size_t i = 0; i < ends.size(); i++)
+      {
+        if (colours[i].alpha == 0)
+          continue;
+        if (!has_offset)
+        {
+          offset = ends[i];
+          has_offset = true;
+        }
+        points.push_back(ends[i] - offset);
+      }
+      tiled_hull.addPoints(points);
+    };
+    if (!ray::Cloud::read(cloud_file.name(), add_chunk))
+      usage();
+    const std::string &key = direction.selectedKey();
+    const double max_curvature = curvature.value();
+    tiled_hull.grow([&key, max_curvature](ray::ConcaveHull &hull) {
+      if (key == "inwards")
+        hull.growInwards(max_curvature);
+      else if (key == "outwards")
+        hull.growOutwards(max_curvature);
+      else if (key == "upwards")
+        hull.growUpwards(max_curvature);
+      else
+        hull.growDownwards(max_curvature);
+    });
+    tiled_hull.mesh().translate(offset);
+    writePlyMesh(cloud_file.nameStub() + "_mesh.ply", tiled_hull.mesh(), true);
+    std::cout << "Completed, output: " << cloud_file.nameStub() << "_mesh.ply" << std::endl;
+    return 0;
+  }
+
   ray::Cloud cloud;
   if (!cloud.load(cloud_file.name()))
     usage();
@@ -4,7 +4,7 @@
 //
 // Author: Thomas Lowe
 #include "rayclusters.h"
-#include <nabo/nabo.h>
+#include "../rayneighbours.h"
 
 namespace ray
 {
@@ -14,19 +14,9 @@ void clustersAgglomerate(const std::vector<Eigen::Vector3d> &points, double min_
                          std::vector<std::vector<int>> &point_clusters)
 {
   // 1. get nearest neighbours for each point
-  const int search_size = std::min(8, static_cast<int>(points.size()) - 1);
-  Eigen::MatrixXd points_p(3, points.size());
-  for (unsigned int i = 0; i < points.size(); i++)
-  {
-    points_p.col(i) = points[i];
-  }
-  Nabo::NNSearchD *nns = Nabo::NNSearchD::createKDTreeLinearHeap(points_p, 3);
-  // Run the search
-  Eigen::MatrixXi indices;
-  Eigen::MatrixXd dists2;
-  indices.resize(search_size, points.size());
-  dists2.resize(search_size, points.size());
-  nns->knn(points_p, indices, dists2, search_size, kNearestNeighbourEpsilon, 0, min_diameter);
+  const int search_size = 8;
+  NeighbourGraph graph;
+  graph.build(points, search_size, min_diameter);
 
   // temporary node structure in order to sort the neighbours by distance
   struct Nd
@@ -42,11 +32,13 @@ void clustersAgglomerate(const std::vector<Eigen::Vector3d> &points, double min_
   std::vector<Nd> nds;
   for (size_t i = 0; i < points.size(); i++)
   {
-    for (int j = 0; j < search_size && indices(j, i) != Nabo::NNSearchD::InvalidIndex; j++)
+    const NeighbourGraph::Neighbours neighbours = graph.neighbours(i);
+    for (int j = 0; j < neighbours.size; j++)
     {
-      nds.push_back(Nd(static_cast<int>(i), indices(j, i), dists2(j, i)));
+      nds.push_back(Nd(static_cast<int>(i), static_cast<int>(neighbours.ids[j]), neighbours.dists2[j]));
     }
   }
+  graph.clear();
   std::sort(nds.begin(), nds.end(), [](const Nd &nd1, const Nd &nd2) { return nd1.dist2 < nd2.dist2; });
 
   // temporary cluster structure
@@ -16,6 +16,10 @@
 #include <cstring>
 #include <iostream>
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
 /// find space in the forest in which a trunk could reside
@@ -203,35 +207,61 @@ void Forest::addTrunkHeights()
 /// Smooth the height field to remove noise that can interfere with the signal of tree crowns
 void Forest::smoothHeightfield()
 {
-  Eigen::ArrayXXd smooth_heights = heightfield_;
-  for (int x = 0; x < heightfield_.rows(); x++)
+  // The Moore neighbourhood mean is separable, so it is summed in two 3-cell passes, first down each column
+  // (contiguous in the column-major arrays) and then across the columns. Each column is processed in parallel.
+  const Eigen::Index rows = heightfield_.rows();
+  const Eigen::Index cols = heightfield_.cols();
+  if (rows == 0 || cols == 0)
   {
-    for (int y = 0; y < heightfield_.cols(); y++)
+    return;
+  }
+  const Eigen::ArrayXXd valid = (heightfield_ != std::numeric_limits<double>::lowest()).cast<double>();
+  const Eigen::ArrayXXd heights = (valid > 0.0).select(heightfield_, 0.0);
+  Eigen::ArrayXXd height_sums(rows, cols), counts(rows, cols);
+  auto sum_column = [&](size_t c) {
+    const Eigen::Index y = static_cast<Eigen::Index>(c);
+    height_sums.col(y) = heights.col(y);
+    counts.col(y) = valid.col(y);
+    if (rows > 1)
     {
-      double &h = heightfield_(x, y);
-      if (h == std::numeric_limits<double>::lowest())
-      {
-        continue;
-      }
-      double mean = h;
-      double count = 1;
-      // use a mean of the valid heights in the Moore neighbourhood of each cell
-      for (int xx = std::max(0, x - 1); xx <= std::min(x + 1, static_cast<int>(heightfield_.rows()) - 1); xx++)
-      {
-        for (int yy = std::max(0, y - 1); yy <= std::min(y + 1, static_cast<int>(heightfield_.cols()) - 1); yy++)
-        {
-          const double &h2 = heightfield_(xx, yy);
-          if (h2 != std::numeric_limits<double>::lowest())
-          {
-            mean += h2;
-            count++;
-          }
-        }
-      }
-      smooth_heights(x, y) = mean / count;
+      height_sums.col(y).head(rows - 1) += heights.col(y).tail(rows - 1);
+      height_sums.col(y).tail(rows - 1) += heights.col(y).head(rows - 1);
+      counts.col(y).head(rows - 1) += valid.col(y).tail(rows - 1);
+      counts.col(y).tail(rows - 1) += valid.col(y).head(rows - 1);
+    }
+  };
+  auto smooth_column = [&](size_t c) {
+    const Eigen::Index y = static_cast<Eigen::Index>(c);
+    // the central height is counted twice, weighting it over its neighbours
+    Eigen::ArrayXd mean = heights.col(y) + height_sums.col(y);
+    Eigen::ArrayXd count = 1.0 + counts.col(y);
+    if (y > 0)
+    {
+      mean += height_sums.col(y - 1);
+      count += counts.col(y - 1);
     }
+    if (y < cols - 1)
+    {
+      mean += height_sums.col(y + 1);
+      count += counts.col(y + 1);
+    }
+    heightfield_.col(y) = (valid.col(y) > 0.0).select(mean / count, heightfield_.col(y));
+  };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, static_cast<size_t>(cols), sum_column);
+  tbb::parallel_for<size_t>(0, static_cast<size_t>(cols), smooth_column);
+#else
+  #pragma omp parallel for
+  for (int64_t y = 0; y < static_cast<int64_t>(cols); y++)
+  {
+    sum_column(static_cast<size_t>(y));
+  }
+  #pragma omp parallel for
+  for (int64_t y = 0; y < static_cast<int64_t>(cols); y++)
+  {
+    smooth_column(static_cast<size_t>(y));
   }
-  heightfield_ = smooth_heights;
+#endif  // RAYLIB_WITH_TBB
 }
 
 /// extract tree locations from a set of three 2D arrays, a height field (the canopy) a low field (the ground)
@@ -60,7 +60,7 @@ private:
   void drawHeightField(const std::string &filename, const Eigen::ArrayXXd &heightfield);
   /// find space below the tree node, and output the found space as the @c tip position
   bool findSpace(const TreeNode &node, Eigen::Vector3d &tip);
-  /// smooth the height field using repeated averaging of the Moore neighbourhood
+  /// smooth the height field by averaging the Moore neighbourhood, as a separable stencil run in parallel
   void smoothHeightfield();
   /// include the trunks in the canopy height, as a soft hint for segmentation
   void addTrunkHeights();
@@ -12,6 +12,10 @@
 #include <queue>
 #include "../rayply.h"
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
 void Forest::renderWatershed(const std::string &cloud_name_stub, std::vector<TreeNode> &trees, std::set<int> &indices)
@@ -133,17 +137,20 @@ void Forest::hierarchicalWatershed(std::vector<TreeNode> &trees, std::set<int> &
   }
 
   std::priority_queue<Point, std::vector<Point>, PointCmp> basins;
-  // 1. find highest points
-  for (int x = 0; x < heightfield_.rows(); x++)
-  {
-    for (int y = 0; y < heightfield_.cols(); y++)
+  // 1. find highest points. Each row is searched in parallel, then the peaks are added in row order
+  const int rows = static_cast<int>(heightfield_.rows());
+  const int cols = static_cast<int>(heightfield_.cols());
+  std::vector<std::vector<int>> row_peaks(rows);
+  auto find_row_peaks = [&](size_t row) {
+    const int x = static_cast<int>(row);
+    for (int y = 0; y < cols; y++)
     {
       // Moore neighbourhood
       const double height = heightfield_(x, y);
       double max_h = 0.0;
-      for (int i = std::max(0, x - 1); i <= std::min(x + 1, static_cast<int>(heightfield_.rows()) - 1); i++)
+      for (int i = std::max(0, x - 1); i <= std::min(x + 1, rows - 1); i++)
       {
-        for (int j = std::max(0, y - 1); j <= std::min(y + 1, static_cast<int>(heightfield_.cols()) - 1); j++)
+        for (int j = std::max(0, y - 1); j <= std::min(y + 1, cols - 1); j++)
         {
           if (!(i == x && j == y))
           {
@@ -153,19 +160,57 @@ void Forest::hierarchicalWatershed(std::vector<TreeNode> &trees, std::set<int> &
       }
       if (height > max_h && height > std::numeric_limits<double>::lowest())
       {
-        Point p;
-        p.x = x;
-        p.y = y;
-        p.height = height;
-        p.index = static_cast<int>(basins.size());
-        basins.push(p);
-        heads.insert(p.index);
-        indexfield_(x, y) = p.index;
-        trees.push_back(TreeNode(x, y, height, voxel_width_, trunkfield(x, y)));
+        row_peaks[x].push_back(y);
       }
     }
+  };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, static_cast<size_t>(rows), find_row_peaks);
+#else
+  #pragma omp parallel for schedule(dynamic, 16)
+  for (int x = 0; x < rows; x++)
+  {
+    find_row_peaks(static_cast<size_t>(x));
+  }
+#endif  // RAYLIB_WITH_TBB
+  for (int x = 0; x < rows; x++)
+  {
+    for (const int y : row_peaks[x])
+    {
+      Point p;
+      p.x = x;
+      p.y = y;
+      p.height = heightfield_(x, y);
+      p.index = static_cast<int>(basins.size());
+      basins.push(p);
+      heads.insert(p.index);
+      indexfield_(x, y) = p.index;
+      trees.push_back(TreeNode(x, y, p.height, voxel_width_, trunkfield(x, y)));
+    }
   }
 
+  // The head of a tree node is found by following its attaches_to chain, which grows by one for each merge. To keep
+  // this lookup fast on large height fields, each node caches a node further up its chain (path compression)
+  std::vector<int> chain_shortcut;
+  auto find_head = [&](int node) {
+    while (chain_shortcut.size() < trees.size())
+    {
+      chain_shortcut.push_back(static_cast<int>(chain_shortcut.size()));
+    }
+    int head = node;
+    while (trees[head].attaches_to != -1)
+    {
+      head = chain_shortcut[head] != head ? chain_shortcut[head] : trees[head].attaches_to;
+    }
+    while (node != head)
+    {
+      const int next = chain_shortcut[node] != node ? chain_shortcut[node] : trees[node].attaches_to;
+      chain_shortcut[node] = head;
+      node = next;
+    }
+    return head;
+  };
+
   std::cout << "initial number of peaks: " << trees.size() << std::endl;
   int cnt = 0;
   // now iterate until basins is empty
@@ -189,24 +234,13 @@ void Forest::hierarchicalWatershed(std::vector<TreeNode> &trees, std::set<int> &
       {
         continue;
       }
-      int p_head = p.index;
-      while (trees[p_head].attaches_to != -1)
-      {
-        p_head = trees[p_head].attaches_to;
-      }
+      int p_head = find_head(p.index);
 
       const int xx = xs[i];
       const int yy = ys[i];
       int &ind = indexfield_(xx, yy);
 
-      int q_head = ind;
-      if (q_head != -1)
-      {
-        while (trees[q_head].attaches_to != -1)
-        {
-          q_head = trees[q_head].attaches_to;
-        }
-      }
+      const int q_head = ind == -1 ? -1 : find_head(ind);
 
       if (ind != -1 && p_head != q_head)  // connecting separate trees, so trigger a future merge event
       {
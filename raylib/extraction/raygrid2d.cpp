@@ -5,6 +5,14 @@
 // Author: Thomas Lowe
 #include "raygrid2d.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
 /// initialise for a given bounds and pixel width
@@ -59,132 +67,120 @@ void OccupancyGrid2D::fillDensities(const std::string &cloudname, const Eigen::A
   bounds_.max_bound_ = min_bound_ + dims_.cast<double>() * pixel_width_ - Eigen::Vector3d(eps, eps, eps);
   const double scale = static_cast<double>(GRID2D_SUBPIXELS);
 
+  // the subpixel bits are shared between the threads, so they are set and cleared atomically, and copied back into
+  // pixels_ at the end
+  std::unique_ptr<std::atomic<uint16_t>[]> bits(new std::atomic<uint16_t>[pixels_.size()]());
+  auto subpixelBit = [&](const Eigen::Vector3i &inds, Eigen::Vector3i &index) {
+    index = Eigen::Vector3i(inds[0] / GRID2D_SUBPIXELS, inds[1] / GRID2D_SUBPIXELS, 0);
+    const Eigen::Vector3i rem = inds - GRID2D_SUBPIXELS * index;
+    return uint16_t(1 << uint16_t(GRID2D_SUBPIXELS * rem[0] + rem[1]));
+  };
+
   // filling in the free space per chunk of ray cloud
+  std::vector<Eigen::Vector3d> clipped_starts, clipped_ends;
+  std::vector<bool> clipped;
   auto addFreeSpace = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                           std::vector<double> &, std::vector<ray::RGBA> &) {
-    for (size_t i = 0; i < ends.size(); ++i)
-    {
-      Eigen::Vector3d start = starts[i];
-      Eigen::Vector3d end = ends[i];
-      if (!bounds_.clipRay(start, end)) // clip the ray within the bounds
+    bounds_.clipRays(starts, ends, clipped_starts, clipped_ends, clipped);  // clip the rays within the bounds
+    auto add_ray = [&](size_t i) {
+      if (!clipped[i])
       {
-        continue;
-      }  
-
-      // now walk the pixels
-      const Eigen::Vector3d dir = scale * (end - start);
-      const Eigen::Vector3d source = scale * (start - min_bound_) / pixel_width_;
-      const Eigen::Vector3d target = scale * (end - min_bound_) / pixel_width_;
-      const double length = dir.norm();
-      const double eps = 1e-9;  // to stay away from edge cases
+        return;
+      }
+      const Eigen::Vector3d &start = clipped_starts[i];
+      const Eigen::Vector3d &end = clipped_ends[i];
+      // walk the subpixels in the horizontal plane, the fixed height of 0.5 keeps the walk away from the z boundaries
+      Eigen::Vector3d source = scale * (start - min_bound_) / pixel_width_;
+      Eigen::Vector3d target = scale * (end - min_bound_) / pixel_width_;
       // remove 2 GRID2D_SUBPIXELS to give a small buffer around the object
-      const double maxDist = (target - source).norm() - 2.0;
-
-      // cached values to speed up the loop below
-      Eigen::Vector3i adds;
-      Eigen::Vector3d offsets;
-      for (int k = 0; k < 3; ++k)
-      {
-        if (dir[k] > 0.0)
+      const double max_fraction = 1.0 - 2.0 / std::max(eps, (target - source).norm());
+      source[2] = target[2] = 0.5;
+      auto fill_subpixel = [&](const Eigen::Vector3i &inds, const Eigen::Vector3i &, double in_length, double,
+                               double max_length) {
+        if (in_length == 0.0)  // the walk starts at the sensor, so only the subpixels that it enters are free space
         {
-          adds[k] = 1;
-          offsets[k] = 0.5;
+          return false;
         }
-        else
-        {
-          adds[k] = -1;
-          offsets[k] = -0.5;
-        }
-      }
-
-      Eigen::Vector3d p = source;  // our moving variable as we walk over the grid
-      Eigen::Vector3i inds = p.cast<int>();
-      double depth = 0;
-      // walk over the grid, one pixel at a time.
-      do
-      {
-        // deltas in each axis
-        const double ls[2] = { (round(p[0] + offsets[0]) - p[0]) / dir[0], (round(p[1] + offsets[1]) - p[1]) / dir[1] };
-        // shift in the axis with smallest delta
-        int axis = (ls[0] < ls[1]) ? 0 : 1;
-        // update the index to the new cell
-        inds[axis] += adds[axis];
-        if (inds[axis] < 0 || inds[axis] >= GRID2D_SUBPIXELS * dims_[axis])
+        const double fraction = in_length / max_length;
+        if (inds[0] < 0 || inds[1] < 0 || inds[0] >= GRID2D_SUBPIXELS * dims_[0] ||
+            inds[1] >= GRID2D_SUBPIXELS * dims_[1])
         {
-          break;
+          return true;
         }
-        // minimum length of line segment within cell
-        const double minL = ls[axis] * length;
-        depth += minL + eps;
-        // update position p
-        p = source + dir * (depth / length);
-
-        // get the index of the pixel
-        Eigen::Vector3i index = inds / GRID2D_SUBPIXELS;
-
-        // find the world space location
-        Eigen::Vector3d world_point = start + (end - start) * (depth / length);
-        // get the height above ground at this location
-        const double height = world_point[2] - lows(index[0], index[1]);
+        Eigen::Vector3i index;
+        const uint16_t bit = subpixelBit(inds, index);
+        // get the height above ground at this location. The walk is horizontal, but its fraction is the same along the
+        // ray
+        const double height = start[2] + (end[2] - start[2]) * fraction - lows(index[0], index[1]);
         if (height > clip_min && height < clip_max)  // only update occupancy within height window
         {
-          // some bit trickery to fill in part of the 4x4 grid per pixel
-          const Eigen::Vector3i rem = inds - GRID2D_SUBPIXELS * index;
-          const uint16_t bit = uint16_t(GRID2D_SUBPIXELS * rem[0] + rem[1]);
-          pixel(index).bits |= uint16_t(1 << bit);
+          std::atomic<uint16_t> &pixel_bits = bits[dims_[1] * index[0] + index[1]];
+          if (!(pixel_bits.load(std::memory_order_relaxed) & bit))  // avoid the atomic write when already set
+          {
+            pixel_bits.fetch_or(bit, std::memory_order_relaxed);
+          }
         }
-      } while (depth <= maxDist);
+        return fraction > max_fraction;
+      };
+      walkGrid(source, target, fill_subpixel);
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, ends.size(), add_ray);
+#else
+    #pragma omp parallel for schedule(dynamic, 1024)
+    for (int64_t i = 0; i < static_cast<int64_t>(ends.size()); i++)
+    {
+      add_ray(static_cast<size_t>(i));
     }
+#endif  // RAYLIB_WITH_TBB
   };
   ray::Cloud::read(cloudname, addFreeSpace);
 
   // wherever these is an end point, we want to remove it as free space
   auto removeOccupiedSpace = [&](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
                                  std::vector<double> &, std::vector<ray::RGBA> &colours) {
-    for (size_t i = 0; i < ends.size(); ++i)
-    {
+    auto remove_end = [&](size_t i) {
       if (colours[i].alpha == 0)
       {
-        continue;
+        return;
       }
-//#define REMOVE_WHOLE_VOXEL
-#if defined REMOVE_WHOLE_VOXEL
-      const Eigen::Vector3d p = (ends[i] - min_bound_) / pixel_width_;
-      const Eigen::Vector3i index = p.cast<int>();
-
-      double height = ends[i][2] - lows(index[0], index[1]);
-      if (height > 0.5 && height < clip_height)
-        pixel(index).bits = 0;
-#else
       // find the subpixel that this point is in
       const Eigen::Vector3d p = scale * (ends[i] - min_bound_) / pixel_width_;
-      const Eigen::Vector3i inds = p.cast<int>();
-      const Eigen::Vector3i index = inds / GRID2D_SUBPIXELS;
-      const Eigen::Vector3i rem = inds - GRID2D_SUBPIXELS * index;
-      uint16_t bit = uint16_t(GRID2D_SUBPIXELS * rem[0] + rem[1]);
-
+      Eigen::Vector3i index;
+      const uint16_t bit = subpixelBit(p.cast<int>(), index);
+      if (index[0] < 0 || index[1] < 0 || index[0] >= dims_[0] || index[1] >= dims_[1])
+      {
+        return;
+      }
       double height = ends[i][2] - lows(index[0], index[1]);
-      if (height > clip_min && height < clip_max)               // if within the height window
-        pixel(index).bits &= (uint16_t) ~(uint16_t(1 << bit));  // then remove it
-#endif
+      if (height > clip_min && height < clip_max)  // if within the height window
+      {
+        bits[dims_[1] * index[0] + index[1]].fetch_and(uint16_t(~bit), std::memory_order_relaxed);  // remove it
+      }
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, ends.size(), remove_end);
+#else
+    #pragma omp parallel for
+    for (int64_t i = 0; i < static_cast<int64_t>(ends.size()); i++)
+    {
+      remove_end(static_cast<size_t>(i));
     }
+#endif  // RAYLIB_WITH_TBB
   };
   ray::Cloud::read(cloudname, removeOccupiedSpace);
 
   // convert the bit fields into subpixel counts
   unsigned long bitcount = 0;
-  for (auto &vox : pixels_)
+  for (size_t p = 0; p < pixels_.size(); p++)
   {
     uint16_t count = 0;
-    for (unsigned long i = 0; i < 16; i++)
+    for (uint16_t field = bits[p].load(std::memory_order_relaxed); field; field &= uint16_t(field - 1))
     {
-      if (vox.bits & ((uint16_t)1 << i))
-      {
-        count++;
-      }
+      count++;
     }
-    vox.bits = count;
-    bitcount += vox.bits;
+    pixels_[p].bits = count;
+    bitcount += count;
   }
 
   std::cout << "average bit count: " << static_cast<double>(bitcount) / static_cast<double>(pixels_.size())
@@ -213,63 +209,74 @@ void RayIndexGrid2D::fillRays(const Cloud &cloud)
   bounds_.min_bound_ = min_bound_ + Eigen::Vector3d(eps, eps, eps);
   bounds_.max_bound_ = min_bound_ + dims_.cast<double>() * pixel_width_ - Eigen::Vector3d(eps, eps, eps);
 
-  for (size_t i = 0; i < cloud.ends.size(); ++i)
+  // the rays are clipped a block at a time, so only a block's copy of the rays is needed
+  const size_t block_size = 65536;
+  std::vector<Eigen::Vector3d> starts, ends;
+  std::vector<bool> clipped;
+  for (size_t block_start = 0; block_start < cloud.ends.size(); block_start += block_size)
   {
-    Eigen::Vector3d start = cloud.starts[i];
-    Eigen::Vector3d end = cloud.ends[i];
-    if (!bounds_.clipRay(start, end))
+    const size_t block_end = std::min(block_start + block_size, cloud.ends.size());
+    starts.assign(cloud.starts.begin() + block_start, cloud.starts.begin() + block_end);
+    ends.assign(cloud.ends.begin() + block_start, cloud.ends.begin() + block_end);
+    bounds_.clipRays(starts, ends, starts, ends, clipped);
+    for (size_t i = block_start; i < block_end; ++i)
     {
-      continue;
-    }
-
-    // now walk the pixels
-    const Eigen::Vector3d dir = end - start;
-    const Eigen::Vector3d source = (start - min_bound_) / pixel_width_;
-    const Eigen::Vector3d target = (end - min_bound_) / pixel_width_;
-    const double length = dir.norm();
-    const double eps = 1e-9;  // to stay away from edge cases
-    const double maxDist =
-      (target - source).norm() - 2.0;  // remove 2 subpixels to give a small buffer around the object
-
-    // cached values to speed up the loop below
-    Eigen::Vector3i adds;
-    Eigen::Vector3d offsets;
-    for (int k = 0; k < 3; ++k)
-    {
-      if (dir[k] > 0.0)
+      if (!clipped[i - block_start])
       {
-        adds[k] = 1;
-        offsets[k] = 0.5;
-      }
-      else
-      {
-        adds[k] = -1;
-        offsets[k] = -0.5;
+        continue;
       }
-    }
+      const Eigen::Vector3d &start = starts[i - block_start];
+      const Eigen::Vector3d &end = ends[i - block_start];
 
-    Eigen::Vector3d p = source;  // our moving variable as we walk over the grid
-    Eigen::Vector3i inds = p.cast<int>();
-    double depth = 0;
-    // walk over the grid, one pixel at a time.
-    do
-    {
-      const double ls[2] = { (round(p[0] + offsets[0]) - p[0]) / dir[0], (round(p[1] + offsets[1]) - p[1]) / dir[1] };
-      const int axis = (ls[0] < ls[1]) ? 0 : 1;
-      inds[axis] += adds[axis];
-      if (inds[axis] < 0 || inds[axis] >= dims_[axis])
+      // now walk the pixels
+      const Eigen::Vector3d dir = end - start;
+      const Eigen::Vector3d source = (start - min_bound_) / pixel_width_;
+      const Eigen::Vector3d target = (end - min_bound_) / pixel_width_;
+      const double length = dir.norm();
+      const double eps = 1e-9;  // to stay away from edge cases
+      const double maxDist =
+        (target - source).norm() - 2.0;  // remove 2 subpixels to give a small buffer around the object
+
+      // cached values to speed up the loop below
+      Eigen::Vector3i adds;
+      Eigen::Vector3d offsets;
+      for (int k = 0; k < 3; ++k)
       {
-        break;
+        if (dir[k] > 0.0)
+        {
+          adds[k] = 1;
+          offsets[k] = 0.5;
+        }
+        else
+        {
+          adds[k] = -1;
+          offsets[k] = -0.5;
+        }
       }
-      const double minL = ls[axis] * length;
-      depth += minL + eps;
-      p = source + dir * (depth / length);
-      Pixel &pix = pixel(inds);
-      if (pix.filled)
+
+      Eigen::Vector3d p = source;  // our moving variable as we walk over the grid
+      Eigen::Vector3i inds = p.cast<int>();
+      double depth = 0;
+      // walk over the grid, one pixel at a time.
+      do
       {
-        pix.ray_ids.push_back(static_cast<int>(i));
-      }
-    } while (depth <= maxDist);
+        const double ls[2] = { (round(p[0] + offsets[0]) - p[0]) / dir[0], (round(p[1] + offsets[1]) - p[1]) / dir[1] };
+        const int axis = (ls[0] < ls[1]) ? 0 : 1;
+        inds[axis] += adds[axis];
+        if (inds[axis] < 0 || inds[axis] >= dims_[axis])
+        {
+          break;
+        }
+        const double minL = ls[axis] * length;
+        depth += minL + eps;
+        p = source + dir * (depth / length);
+        Pixel &pix = pixel(inds);
+        if (pix.filled)
+        {
+          pix.ray_ids.push_back(static_cast<int>(i));
+        }
+      } while (depth <= maxDist);
+    }
   }
 }
 }  // namespace ray
@@ -9,10 +9,16 @@
 #include "../raycuboid.h"
 #include "../rayply.h"
 #include "../raymesh.h"
+#include "../raymeshwriter.h"
+#include "../rayrandom.h"
 #include "../rayforeststructure.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "raylib/imageread.h"
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
 typedef std::complex<float> Cmp;
@@ -33,9 +39,71 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
   Eigen::Vector3i dims = (extent / vox_width).cast<int>() + Eigen::Vector3i(2, 2, 2); // so that we have extra space to convolve
   Cuboid grid_bounds = bounds;
   grid_bounds.min_bound_ -= Eigen::Vector3d(vox_width, vox_width, vox_width);
-  DensityGrid grid(grid_bounds, vox_width, dims);    
+  // The density is only needed in the voxels containing end points, which is where leaves are placed. So we use a
+  // sparse grid, allocated around these voxels, whose memory scales with the canopy volume rather than the bounds
+  SparseDensityGrid grid(grid_bounds, vox_width, dims);
+  std::vector<int64_t> end_voxels;  // dense grid index of each voxel containing end points, sorted
+  auto require_ends = [&](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                          std::vector<double> &, std::vector<ray::RGBA> &colours) 
+  {
+    const size_t num_sorted = end_voxels.size();
+    for (size_t i = 0; i<ends.size(); i++)
+    {
+      const Eigen::Vector3i inds = grid.getInds(ends[i]);
+      if (colours[i].alpha == 0 || !grid.inBounds(inds))
+        continue;
+      grid.requireVoxel(inds);
+      end_voxels.push_back(grid.getIndex(inds));
+    }
+    std::sort(end_voxels.begin() + num_sorted, end_voxels.end());
+    std::inplace_merge(end_voxels.begin(), end_voxels.begin() + num_sorted, end_voxels.end());
+    end_voxels.erase(std::unique(end_voxels.begin(), end_voxels.end()), end_voxels.end());
+  };
+  if (!ray::Cloud::read(cloud_name, require_ends))
+    return false;
   grid.calculateDensities(cloud_name);
-  grid.addNeighbourPriors();
+
+  // the voxels that leaves can be added to, and their density after neighbour priors
+  std::vector<int64_t> leaf_voxel_ids;
+  std::vector<DensityGrid::Voxel> leaf_voxels;
+  {
+    std::vector<DensityGrid::Voxel> voxels(end_voxels.size());
+    auto get_voxel = [&](size_t i)
+    {
+      const int64_t index = end_voxels[i];
+      const int64_t slice = static_cast<int64_t>(dims[0]) * dims[1];
+      const Eigen::Vector3i inds(static_cast<int>(index % dims[0]), static_cast<int>((index % slice) / dims[0]),
+                                 static_cast<int>(index / slice));
+      voxels[i] = grid.voxel(inds);
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, end_voxels.size(), get_voxel);
+#else
+    #pragma omp parallel for
+    for (int64_t i = 0; i < static_cast<int64_t>(end_voxels.size()); i++) 
+    {
+      get_voxel(static_cast<size_t>(i));
+    }
+#endif  // RAYLIB_WITH_TBB
+    for (size_t i = 0; i<voxels.size(); i++)
+    {
+      if (voxels[i].density() > 0.0)
+      {
+        leaf_voxel_ids.push_back(end_voxels[i]);
+        leaf_voxels.push_back(voxels[i]);
+      }
+    }
+    std::vector<int64_t>().swap(end_voxels);
+  }
+  std::cout << leaf_voxels.size() << " voxels with foliage" << std::endl;
+  auto leafVoxel = [&](const Eigen::Vector3d &pos)
+  {
+    const Eigen::Vector3i inds = grid.getInds(pos);
+    if (!grid.inBounds(inds))
+      return -1;
+    const auto it = std::lower_bound(leaf_voxel_ids.begin(), leaf_voxel_ids.end(), grid.getIndex(inds));
+    return it != leaf_voxel_ids.end() && *it == grid.getIndex(inds) ? static_cast<int>(it - leaf_voxel_ids.begin()) : -1;
+  };
 
   // we want to find the few branches that are nearest to each voxel
   // possibly we want there to be no maximum distance... which is weird, but more robust I guess.
@@ -43,38 +111,33 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
   // it tends not to align leaves to really thick trunks.
   std::vector<int> tree_ids;
   std::vector<int> segment_ids;
-  std::vector<std::vector<int> > neighbour_segments; // this looks up into the above two structures
+  const int search_size = 12; // find the twelve nearest branch segments. For larger voxels a larger value here would be helpful
+  std::vector<int> neighbour_segments(search_size * leaf_voxels.size(), -1); // per leaf voxel, looks up into the above two structures
   ForestStructure forest;
-  std::vector<int> dense_voxel_indices(grid.voxels().size(), -1);
   { // Tim: this block looks for the closest cylindrical branch segments to each voxel, in order to give the leaves a 'direction' value
     // The reason I use knn (K-nearest neighbour search) is that there is no maximum distance to worry about, and it is fast
-    if (!forest.load(trees_file))
+    const double max_distance = 2.0; 
+    // only the trees within the search distance of the voxels are needed
+    Cuboid search_bounds(grid_bounds.min_bound_ - Eigen::Vector3d(max_distance, max_distance, max_distance),
+                         grid_bounds.min_bound_ + vox_width * dims.cast<double>() +
+                         Eigen::Vector3d(max_distance, max_distance, max_distance));
+    if (!forest.load(trees_file, search_bounds))
     {
       return false;
     }
+    if (forest.trees.empty())
+    {
+      std::cerr << "Error: no trees in " << trees_file << " overlap the cloud" << std::endl;
+      return false;
+    }
 
     size_t num_segments = 0;
     for (auto &tree: forest.trees)
     {
       num_segments += tree.segments().size() - 1;
     }
-    size_t num_dense_voxels = 0;
+    Eigen::MatrixXd points_p(3, num_segments);
     int i = 0;
-    for (auto &vox: grid.voxels())
-    {
-      if (vox.density() > 0.0)
-      {
-        dense_voxel_indices[i] = (int)num_dense_voxels;
-        num_dense_voxels++;
-      }
-      i++;
-    }
-
-    const int search_size = 12; // find the twelve nearest branch segments. For larger voxels a larger value here would be helpful
-    size_t p_size = num_segments;
-    size_t q_size = num_dense_voxels;
-    Eigen::MatrixXd points_p(3, p_size);
-    i = 0;
     // 1. get branch centre positions
     for (int tree_id = 0; tree_id < (int)forest.trees.size(); tree_id++)
     {
@@ -91,146 +154,45 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
         segment_ids.push_back(segment_id);
       }
     }
-    // 2. get 
-    neighbour_segments.resize(grid.voxels().size());
-    Eigen::MatrixXd points_q(3, q_size);
-    int c = 0;
-    for (int k = 0; k<dims[2]; k++)
+    // 2. search from the voxel centres, one tile of voxels per task, against the prebuilt segment index
+    Nabo::NNSearchD *nns = Nabo::NNSearchD::createKDTreeLinearHeap(points_p, 3);
+    const size_t tile_size = 4096;
+    const size_t num_tiles = (leaf_voxels.size() + tile_size - 1) / tile_size;
+    const int64_t slice = static_cast<int64_t>(dims[0]) * dims[1];
+    auto search_tile = [&](size_t tile)
     {
-      for (int j = 0; j<dims[1]; j++)
+      const size_t first = tile * tile_size;
+      const size_t count = std::min(tile_size, leaf_voxels.size() - first);
+      Eigen::MatrixXd points_q(3, count);
+      for (size_t j = 0; j < count; j++)
       {
-        for (int i = 0; i<dims[0]; i++)
-        {
-          int index = grid.getIndex(Eigen::Vector3i(i,j,k));
-          double density = grid.voxels()[index].density();
-          if (density > 0.0)
-          {
-            points_q.col(c++) = grid_bounds.min_bound_ + vox_width * Eigen::Vector3d((double)i+0.5, (double)j+0.5, (double)k+0.5);
-          }         
-        }
+        const int64_t index = leaf_voxel_ids[first + j];
+        const Eigen::Vector3d inds(static_cast<double>(index % dims[0]), static_cast<double>((index % slice) / dims[0]),
+                                   static_cast<double>(index / slice));
+        points_q.col(j) = grid_bounds.min_bound_ + vox_width * (inds + Eigen::Vector3d(0.5, 0.5, 0.5));
       }
-    }
-    Nabo::NNSearchD *nns = Nabo::NNSearchD::createKDTreeLinearHeap(points_p, 3);
-    Eigen::MatrixXi indices;
-    Eigen::MatrixXd dists2;
-    indices.resize(search_size, q_size);
-    dists2.resize(search_size, q_size);
-    const double max_distance = 2.0; 
-    nns->knn(points_q, indices, dists2, search_size, kNearestNeighbourEpsilon, 0, max_distance);
-    delete nns;
-
-    // Convert these set of nearest neighbours into surfels
-    for (int i = 0; i < (int)grid.voxels().size(); i++)
-    {
-      int id = dense_voxel_indices[i];
-      if (id != -1)
+      Eigen::MatrixXi indices(search_size, count);
+      Eigen::MatrixXd dists2(search_size, count);
+      nns->knn(points_q, indices, dists2, search_size, kNearestNeighbourEpsilon, 0, max_distance);
+      for (size_t j = 0; j < count; j++)
       {
-        for (int j = 0; j < search_size && indices(j, id) != Nabo::NNSearchD::InvalidIndex; j++) 
+        for (int k = 0; k < search_size && indices(k, j) != Nabo::NNSearchD::InvalidIndex; k++) 
         {
-          neighbour_segments[i].push_back(indices(j, id));
+          neighbour_segments[search_size * (first + j) + k] = indices(k, j);
         }
       }
-    }
-  }
-
-
-  // the density is now stored in grid.voxels()[grid.getIndex(Eigen::Vector3i )].density().
-  struct Leaf
-  {
-    Eigen::Vector3d centre;
-    Eigen::Vector3d direction; 
-    Eigen::Vector3d origin;
-    double grad0;
-  };
-  std::vector<Leaf> leaves;
-  std::vector<double> leaf_counter(grid.voxels().size());
-  std::srand(1);
-  for (size_t i = 0; i<grid.voxels().size(); i++)
-  {
-    leaf_counter[i] = (double)(std::rand()%10000) / 10000.0; // a random start stops regions of low density have 0 leaves
-  }
-
-
-  // for each point in the cloud, possible add leaves...
-  auto add_leaves = [&](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
-                      std::vector<double> &, std::vector<ray::RGBA> &colours) 
-  {
-    for (size_t i = 0; i<ends.size(); i++)
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, num_tiles, search_tile);
+#else
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t t = 0; t < static_cast<int64_t>(num_tiles); t++) 
     {
-      if (colours[i].alpha == 0)
-        continue;
-      int index = grid.getIndexFromPos(ends[i]);
-      auto &voxel = grid.voxels()[index];
-      double leaf_area_per_voxel_volume = voxel.density();
-      if (leaf_area_per_voxel_volume <= 0.0)
-      {
-        continue;
-      }
-      double desired_leaf_area = leaf_area_per_voxel_volume * vox_width * vox_width * vox_width;
-      double num_leaves_d = desired_leaf_area / leaf_area;
-      double num_points = (double)voxel.numHits();
-      double &count = leaf_counter[index];
-      count += num_leaves_d / num_points;
-      bool add_leaf = false;
-      if (count >= 1.0)
-      {
-        add_leaf = true;
-        count--;
-      }
-
-      if (add_leaf)
-      {
-        Leaf new_leaf;
-        new_leaf.centre = ends[i];
-
-        double min_dist = 1e10;
-        Eigen::Vector3d closest_point_on_branch(0,0,0);
-        for (auto &ind: neighbour_segments[index])
-        {
-          auto &tree =  forest.trees[tree_ids[ind]];
-          // get a more accurate distance to each branch segment....
-          // e.g. point to branch surface.
-          Eigen::Vector3d line_closest;
-          Eigen::Vector3d closest = tree.closestPointOnSegment(segment_ids[ind], ends[i], line_closest);
-          double dist = (closest - ends[i]).norm();
-          double radius = tree.segments()[segment_ids[ind]].radius;
-          if (dist <= radius) // if we're inside any branch then don't add a leaf for this point
-          {
-            min_dist = 1e10;
-            break;
-          }
-          if (dist < min_dist)
-          {
-            min_dist = dist;
-            closest_point_on_branch = closest;
-          }
-        }
-        if (min_dist == 1e10)
-        {
-          continue;
-        }
-        // get leaf direction according to a droop factor. y=-droop * x^2
-        new_leaf.direction = new_leaf.centre - closest_point_on_branch;
-        Eigen::Vector3d flat = new_leaf.direction;
-        flat[2] = 0.0;
-        double dist_sqr = flat.squaredNorm();
-        double dist = std::sqrt(dist_sqr);
-        double h = new_leaf.direction[2];
-        new_leaf.direction /= dist;
-        double grad0 = (h+droop*dist_sqr)/dist;
-        double grad = grad0 + 2.0*-droop*dist;
-        new_leaf.direction[2] = grad;
-        new_leaf.direction.normalize();
-        new_leaf.origin = closest_point_on_branch;
-        new_leaf.grad0 = grad0;
-
-        leaves.push_back(new_leaf);
-      }  
+      search_tile(static_cast<size_t>(t));
     }
-  };
-
-  if (!ray::Cloud::read(cloud_name, add_leaves))
-    return false;
+#endif  // RAYLIB_WITH_TBB
+    delete nns;
+  }
 
   Mesh leaf_mesh;
   // could read it from file at this point
@@ -324,71 +286,198 @@ bool generateLeaves(const std::string &cloud_stub, const std::string &trees_file
     std::cerr << "Error: leaf file type unsupported: " << leaf_file << std::endl;
     return false;
   }
-  Mesh mesh;
-  auto &verts = mesh.vertices();
-  auto &inds = mesh.indexList(); // one per triangle, gives the index into the vertices_ array for each corner   
-  auto &uvs = mesh.uvList();
-  mesh.textureName() = leaf_mesh.textureName();
-  
-  for (auto &leaf: leaves)
+  // the density is now stored in leaf_voxels, for the voxels with ids leaf_voxel_ids.
+  struct Leaf
+  {
+    Eigen::Vector3d centre;
+    Eigen::Vector3d direction; 
+    Eigen::Vector3d origin;
+    double grad0;
+  };
+  if (stalks && !leaf_uvs.empty())
   {
-    // 1. convert direction into a transformation matrix...
-    Eigen::Matrix3d mat;
-    mat.col(1) = leaf.direction;
-    mat.col(0) = leaf.direction.cross(Eigen::Vector3d(0,0,1)).normalized();
-    mat.col(2) = mat.col(0).cross(mat.col(1));
+    std::cerr << "Error: multiple textures in one mesh are unsupported, so either turn off stalks or remove uvs/texture from leaves" << std::endl;
+    return false;
+  }
 
-    int num_verts = (int)verts.size();
-    for (auto &tri: leaf_inds)
+  // add the leaves for each chunk of the cloud, and write them out as we go
+  std::vector<double> leaf_counter(leaf_voxels.size());
+  for (size_t i = 0; i<leaf_voxel_ids.size(); i++)
+  {
+    // seeded per voxel, so the counters do not depend on the number or order of voxels
+    PCGRandomGenerator random;
+    random.seed(static_cast<unsigned>(leaf_voxel_ids[i]), static_cast<unsigned>(leaf_voxel_ids[i] >> 32), 1, 0);
+    leaf_counter[i] = (double)(random()%10000) / 10000.0; // a random start stops regions of low density have 0 leaves
+  }
+  MeshWriter writer;
+  if (!writer.begin(cloud_stub + "_leaves.ply", false, !leaf_uvs.empty(), leaf_mesh.textureName()))
+  {
+    return false;
+  }
+  std::vector<std::pair<size_t, int> > candidates; // the ray and leaf voxel of each leaf to try adding
+  std::vector<Leaf> leaves;
+  std::vector<bool> valid_leaves;
+  Mesh mesh;
+  bool written = true;
+  auto add_leaves = [&](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                      std::vector<double> &, std::vector<ray::RGBA> &colours) 
+  {
+    // for each point in the cloud, possibly add a leaf. This depends on the running count per voxel, so is in order
+    candidates.clear();
+    for (size_t i = 0; i<ends.size(); i++)
     {
-      inds.push_back(tri + Eigen::Vector3i(num_verts, num_verts, num_verts));
+      if (colours[i].alpha == 0)
+        continue;
+      const int id = leafVoxel(ends[i]);
+      if (id == -1)
+      {
+        continue;
+      }
+      auto &voxel = leaf_voxels[id];
+      double leaf_area_per_voxel_volume = voxel.density();
+      double desired_leaf_area = leaf_area_per_voxel_volume * vox_width * vox_width * vox_width;
+      double num_leaves_d = desired_leaf_area / leaf_area;
+      double num_points = (double)voxel.numHits();
+      double &count = leaf_counter[id];
+      count += num_leaves_d / num_points;
+      if (count >= 1.0)
+      {
+        candidates.push_back(std::make_pair(i, id));
+        count--;
+      }
     }
-    for (auto &uv: leaf_uvs)
+
+    // then orient the new leaves in parallel
+    leaves.resize(candidates.size());
+    valid_leaves.assign(candidates.size(), false);
+    auto orient_leaf = [&](size_t c)
     {
-      uvs.push_back(uv); // if UVs are present in the input, they are unchanged
-    }
-    for (auto &vert: leaf_verts)
+      const Eigen::Vector3d &end = ends[candidates[c].first];
+      const int *neighbours = &neighbour_segments[search_size * candidates[c].second];
+      Leaf &new_leaf = leaves[c];
+      new_leaf.centre = end;
+
+      double min_dist = 1e10;
+      Eigen::Vector3d closest_point_on_branch(0,0,0);
+      for (int j = 0; j < search_size && neighbours[j] != -1; j++)
+      {
+        const int ind = neighbours[j];
+        auto &tree =  forest.trees[tree_ids[ind]];
+        // get a more accurate distance to each branch segment....
+        // e.g. point to branch surface.
+        Eigen::Vector3d line_closest;
+        Eigen::Vector3d closest = tree.closestPointOnSegment(segment_ids[ind], end, line_closest);
+        double dist = (closest - end).norm();
+        double radius = tree.segments()[segment_ids[ind]].radius;
+        if (dist <= radius) // if we're inside any branch then don't add a leaf for this point
+        {
+          min_dist = 1e10;
+          break;
+        }
+        if (dist < min_dist)
+        {
+          min_dist = dist;
+          closest_point_on_branch = closest;
+        }
+      }
+      if (min_dist == 1e10)
+      {
+        return;
+      }
+      // get leaf direction according to a droop factor. y=-droop * x^2
+      new_leaf.direction = new_leaf.centre - closest_point_on_branch;
+      Eigen::Vector3d flat = new_leaf.direction;
+      flat[2] = 0.0;
+      double dist_sqr = flat.squaredNorm();
+      double dist = std::sqrt(dist_sqr);
+      double h = new_leaf.direction[2];
+      new_leaf.direction /= dist;
+      double grad0 = (h+droop*dist_sqr)/dist;
+      double grad = grad0 + 2.0*-droop*dist;
+      new_leaf.direction[2] = grad;
+      new_leaf.direction.normalize();
+      new_leaf.origin = closest_point_on_branch;
+      new_leaf.grad0 = grad0;
+      valid_leaves[c] = true;
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, candidates.size(), orient_leaf);
+#else
+    #pragma omp parallel for
+    for (int64_t c = 0; c < static_cast<int64_t>(candidates.size()); c++) 
     {
-      verts.push_back(mat * vert + leaf.centre);
-      mesh.colours().push_back(RGBA::leaves());
+      orient_leaf(static_cast<size_t>(c));
     }
-    num_verts = (int)verts.size();
-    if (stalks)
+#endif  // RAYLIB_WITH_TBB
+
+    // now convert this chunk's leaves to a mesh, and write it out
+    mesh = Mesh();
+    auto &verts = mesh.vertices();
+    auto &inds = mesh.indexList(); // one per triangle, gives the index into the vertices_ array for each corner   
+    auto &uvs = mesh.uvList();
+    for (size_t c = 0; c<leaves.size(); c++)
     {
-      if (!uvs.empty())
+      if (!valid_leaves[c])
       {
-        std::cerr << "Error: multiple textures in one mesh are unsupported, so either turn off stalks or remove uvs/texture from leaves" << std::endl;
-        return false;
+        continue;
       }
-      Eigen::Vector3d start = leaf.origin;
-      Eigen::Vector3d leaf_start = mat * leaf_root + leaf.centre;
-      Eigen::Vector3d flat = (leaf_start - leaf.origin);
-      flat[2] = 0.0;
-      double length = flat.norm();
-      flat /= length;
-      Eigen::Vector3d side(-flat[1], flat[0], flat[2]);
-      side *= leaf_width / 16.0;
-      const int num_segs = 4;
-      for (int i = 0; i<num_segs; i++)
+      const Leaf &leaf = leaves[c];
+      // 1. convert direction into a transformation matrix...
+      Eigen::Matrix3d mat;
+      mat.col(1) = leaf.direction;
+      mat.col(0) = leaf.direction.cross(Eigen::Vector3d(0,0,1)).normalized();
+      mat.col(2) = mat.col(0).cross(mat.col(1));
+
+      int num_verts = (int)verts.size();
+      for (auto &tri: leaf_inds)
+      {
+        inds.push_back(tri + Eigen::Vector3i(num_verts, num_verts, num_verts));
+      }
+      for (auto &uv: leaf_uvs)
+      {
+        uvs.push_back(uv); // if UVs are present in the input, they are unchanged
+      }
+      for (auto &vert: leaf_verts)
       {
-        double x = (double)i / (double)(num_segs - 1);
-        x *= length;
-        double h = leaf.grad0*x - droop*x*x;
-        Eigen::Vector3d pos = (i==num_segs-1) ? leaf_start : start + Eigen::Vector3d(0,0,h) + flat*x;
-        verts.push_back(pos - side);
-        verts.push_back(pos + side);
-        mesh.colours().push_back(RGBA::treetrunk());
-        mesh.colours().push_back(RGBA::treetrunk());
-        if (i != num_segs-1)
+        verts.push_back(mat * vert + leaf.centre);
+        mesh.colours().push_back(RGBA::leaves());
+      }
+      num_verts = (int)verts.size();
+      if (stalks)
+      {
+        Eigen::Vector3d start = leaf.origin;
+        Eigen::Vector3d leaf_start = mat * leaf_root + leaf.centre;
+        Eigen::Vector3d flat = (leaf_start - leaf.origin);
+        flat[2] = 0.0;
+        double length = flat.norm();
+        flat /= length;
+        Eigen::Vector3d side(-flat[1], flat[0], flat[2]);
+        side *= leaf_width / 16.0;
+        const int num_segs = 4;
+        for (int i = 0; i<num_segs; i++)
         {
-          int j = 2*i;
-          inds.push_back(Eigen::Vector3i(num_verts, num_verts, num_verts) + Eigen::Vector3i(j, j+2, j+1));
-          inds.push_back(Eigen::Vector3i(num_verts, num_verts, num_verts) + Eigen::Vector3i(j+3, j+1, j+2));
+          double x = (double)i / (double)(num_segs - 1);
+          x *= length;
+          double h = leaf.grad0*x - droop*x*x;
+          Eigen::Vector3d pos = (i==num_segs-1) ? leaf_start : start + Eigen::Vector3d(0,0,h) + flat*x;
+          verts.push_back(pos - side);
+          verts.push_back(pos + side);
+          mesh.colours().push_back(RGBA::treetrunk());
+          mesh.colours().push_back(RGBA::treetrunk());
+          if (i != num_segs-1)
+          {
+            int j = 2*i;
+            inds.push_back(Eigen::Vector3i(num_verts, num_verts, num_verts) + Eigen::Vector3i(j, j+2, j+1));
+            inds.push_back(Eigen::Vector3i(num_verts, num_verts, num_verts) + Eigen::Vector3i(j+3, j+1, j+2));
+          }
         }
       }
     }
-  }          
-  writePlyMesh(cloud_stub + "_leaves.ply", mesh);
-  return true;
+    written = written && writer.writeChunk(mesh);
+  };
+
+  if (!ray::Cloud::read(cloud_name, add_leaves))
+    return false;
+  return writer.end() && written;
 }
 }  // namespace ray
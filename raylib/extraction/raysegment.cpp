@@ -4,10 +4,15 @@
 //
 // Author: Thomas Lowe
 #include "raysegment.h"
-#include <nabo/nabo.h>
+#include "../rayneighbours.h"
 #include "rayterrain.h"
+#include <algorithm>
 #include <queue>
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
 /// nodes of priority queue used in shortest path algorithm
@@ -32,46 +37,40 @@ struct QueueNode
 class QueueNodeComparator
 {
 public:
-  bool operator()(const QueueNode &p1, const QueueNode &p2) { return p1.score > p2.score; }
-};
-
-/// Connect the supplied set of points @c points according to the shortest path to the ground, by filling in their
-/// parent indices
-/// @c distance_limit maximum distance between points that can be connected
-/// @c gravity_factor controls how far laterally the shortest paths can travel
-/// @c closest_node a priority queue
-void connectPointsShortestPath(
-  std::vector<Vertex> &points,
-  std::priority_queue<QueueNode, std::vector<QueueNode>, QueueNodeComparator> &closest_node, double distance_limit,
-  double gravity_factor)
-{
-  // 1. get nearest neighbours
-  const int search_size = std::min(20, static_cast<int>(points.size()) - 1);
-  Eigen::MatrixXd points_p(3, points.size());
-  for (unsigned int i = 0; i < points.size(); i++)
+  // ties are broken on the index, so the order of visiting is fully defined and independent of the queue's history
+  bool operator()(const QueueNode &p1, const QueueNode &p2)
   {
-    points_p.col(i) = points[i].pos;
+    return p1.score > p2.score || (p1.score == p2.score && p1.id > p2.id);
   }
-  Nabo::NNSearchD *nns = Nabo::NNSearchD::createKDTreeLinearHeap(points_p, 3);
-  // Run the search
-  Eigen::MatrixXi indices;
-  Eigen::MatrixXd dists2;
-  indices.resize(search_size, points.size());
-  dists2.resize(search_size, points.size());
-  nns->knn(points_p, indices, dists2, search_size, kNearestNeighbourEpsilon, 0, distance_limit);
+};
 
-  // 2. climb up from lowest points, this part is based on Djikstra's algorithm
+typedef std::priority_queue<QueueNode, std::vector<QueueNode>, QueueNodeComparator> ShortestPathQueue;
+
+/// Grow the shortest paths from the root nodes in @c closest_node, this part is based on Djikstra's algorithm
+/// When @c component_ids is supplied, only points with the id @c component are connected. Root points are only ever
+/// read in this case, so separate components can be connected concurrently
+void growShortestPaths(std::vector<Vertex> &points, ShortestPathQueue &closest_node, const NeighbourGraph &graph,
+                       double gravity_factor,
+                       const std::vector<int> *component_ids, int component)
+{
   while (!closest_node.empty())
   {
     QueueNode node = closest_node.top();
     closest_node.pop();
-    if (!points[node.id].visited)
+    // roots are only queued once, and their visited flag is shared between components, so is set by the caller
+    const bool is_root = node.id == node.root;
+    if (is_root || !points[node.id].visited)
     {
       // for each unvisited point, look at its nearest neighbours
-      for (int i = 0; i < search_size && indices(i, node.id) != Nabo::NNSearchD::InvalidIndex; i++)
+      const NeighbourGraph::Neighbours neighbours = graph.neighbours(node.id);
+      for (int i = 0; i < neighbours.size; i++)
       {
-        const int child = indices(i, node.id);
-        const double dist2 = dists2(i, node.id);  // square distance to neighbour
+        const int child = static_cast<int>(neighbours.ids[i]);
+        if (component_ids && (*component_ids)[child] != component)
+        {
+          continue;
+        }
+        const double dist2 = neighbours.dists2[i];  // square distance to neighbour
         const double dist = std::sqrt(dist2);
         double new_score = 0;
         const Eigen::Vector3d dif = (points[child].pos - points[node.id].pos).normalized();
@@ -121,8 +120,160 @@ void connectPointsShortestPath(
             QueueNode(points[child].distance_to_ground, points[child].score, node.radius, node.root, child));
         }
       }
-      points[node.id].visited = true;
+      if (!is_root)
+      {
+        points[node.id].visited = true;
+      }
+    }
+  }
+}
+
+/// Find the id of the set containing @c i, with path halving
+int findSet(std::vector<int> &sets, int i)
+{
+  while (sets[i] != i)
+  {
+    sets[i] = sets[sets[i]];
+    i = sets[i];
+  }
+  return i;
+}
+
+/// Connect the supplied set of points @c points according to the shortest path to the ground, by filling in their
+/// parent indices
+/// @c distance_limit maximum distance between points that can be connected
+/// @c gravity_factor controls how far laterally the shortest paths can travel
+/// @c closest_node a priority queue
+void connectPointsShortestPath(std::vector<Vertex> &points, ShortestPathQueue &closest_node, double distance_limit,
+                               double gravity_factor)
+{
+  // 1. get nearest neighbours
+  const int search_size = 20;
+  NeighbourGraph graph;
+  {
+    std::vector<Eigen::Vector3d> positions(points.size());
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      positions[i] = points[i].pos;
     }
+    graph.build(positions, search_size, distance_limit);
+  }
+
+  // 2. partition the non-root points into components connected by the neighbour graph. Roots have a score of 0
+  // so they are never improved upon, paths therefore only pass through roots at their start, and the paths in
+  // each component are independent of all other components.
+  std::vector<QueueNode> roots;
+  roots.reserve(closest_node.size());
+  while (!closest_node.empty())
+  {
+    roots.push_back(closest_node.top());
+    closest_node.pop();
+  }
+  const int num_points = static_cast<int>(points.size());
+  std::vector<int> component_ids(num_points);
+  for (int i = 0; i < num_points; i++)
+  {
+    component_ids[i] = i;
+  }
+  for (const auto &root : roots)
+  {
+    component_ids[root.id] = -1;
+  }
+  for (int i = 0; i < num_points; i++)
+  {
+    if (component_ids[i] == -1)
+    {
+      continue;
+    }
+    const NeighbourGraph::Neighbours neighbours = graph.neighbours(i);
+    for (int j = 0; j < neighbours.size; j++)
+    {
+      const int child = static_cast<int>(neighbours.ids[j]);
+      if (component_ids[child] == -1)
+      {
+        continue;
+      }
+      const int set1 = findSet(component_ids, i);
+      const int set2 = findSet(component_ids, child);
+      if (set1 != set2)
+      {
+        component_ids[std::max(set1, set2)] = std::min(set1, set2);
+      }
+    }
+  }
+  for (int i = 0; i < num_points; i++)
+  {
+    if (component_ids[i] != -1)
+    {
+      component_ids[i] = findSet(component_ids, i);
+    }
+  }
+
+  // 3. each component is grown from the roots that neighbour it
+  std::vector<int> component_index(num_points, -1);
+  std::vector<std::vector<QueueNode>> component_roots;
+  std::vector<int> components;
+  for (const auto &root : roots)
+  {
+    const NeighbourGraph::Neighbours neighbours = graph.neighbours(root.id);
+    for (int j = 0; j < neighbours.size; j++)
+    {
+      const int component = component_ids[neighbours.ids[j]];
+      if (component == -1)
+      {
+        continue;
+      }
+      int &index = component_index[component];
+      if (index == -1)
+      {
+        index = static_cast<int>(component_roots.size());
+        component_roots.push_back(std::vector<QueueNode>());
+        components.push_back(component);
+      }
+      // a root can neighbour the same component many times
+      if (component_roots[index].empty() || component_roots[index].back().id != root.id)
+      {
+        component_roots[index].push_back(root);
+      }
+    }
+  }
+  std::vector<int> component_sizes(components.size(), 0);
+  for (int i = 0; i < num_points; i++)
+  {
+    if (component_ids[i] != -1 && component_index[component_ids[i]] != -1)
+    {
+      component_sizes[component_index[component_ids[i]]]++;
+    }
+  }
+  // largest components first, to balance the load
+  std::vector<int> order(components.size());
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    order[i] = static_cast<int>(i);
+  }
+  std::sort(order.begin(), order.end(), [&](int a, int b) { return component_sizes[a] > component_sizes[b]; });
+
+  auto grow_component = [&](size_t i) {
+    const int index = order[i];
+    ShortestPathQueue queue;
+    for (const auto &root : component_roots[index])
+    {
+      queue.push(root);
+    }
+    growShortestPaths(points, queue, graph, gravity_factor, &component_ids, components[index]);
+  };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, order.size(), grow_component);
+#else
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < static_cast<int>(order.size()); i++)
+  {
+    grow_component(static_cast<size_t>(i));
+  }
+#endif  // RAYLIB_WITH_TBB
+  for (const auto &root : roots)
+  {
+    points[root.id].visited = true;
   }
 }
 
@@ -145,7 +296,7 @@ std::vector<std::vector<int>> getRootsAndSegment(std::vector<Vertex> &points, co
   const double pixel_width = max_diameter;
   Eigen::Vector3d box_min, box_max;
   cloud.calcBounds(&box_min, &box_max);
-  std::priority_queue<QueueNode, std::vector<QueueNode>, QueueNodeComparator> closest_node;
+  ShortestPathQueue closest_node;
 
   // also add points for every vertex on the ground mesh.
   const int roots_start = static_cast<int>(points.size());
@@ -9,6 +9,7 @@
 #include "../rayply.h"
 #include "../rayprogress.h"
 #include "../rayprogressthread.h"
+#include "../raytelemetry.h"
 
 #if RAYLIB_WITH_TBB
 #include <tbb/enumerable_thread_specific.h>
@@ -356,6 +357,8 @@ void Terrain::growUpwardsFast(const std::vector<Eigen::Vector3d> &ends, double p
 void Terrain::extract(const Cloud &cloud, const Eigen::Vector3d &offset, const std::string &file_prefix, double gradient, bool verbose)
 {
 #if RAYLIB_WITH_QHULL
+  TelemetryPhase telemetry("Terrain::extract");
+  telemetry.addRays(cloud.rayCount());
   // preprocessing to make the cloud smaller.
   Eigen::Vector3d min_bound, max_bound;
   cloud.calcBounds(&min_bound, &max_bound);
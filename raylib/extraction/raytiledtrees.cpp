@@ -0,0 +1,273 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raytiledtrees.h"
+#include "../raycloud.h"
+#include "../raycloudwriter.h"
+#include "../rayforeststructure.h"
+#include "../rayply.h"
+#include "../raysplitter.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
+namespace ray
+{
+namespace
+{
+// approximate peak memory use per ray in a Trees reconstruction, including the cloud, vertices and neighbour lists
+const double kTreesBytesPerRay = 600.0;
+// approximate size of each ray in the tile's .ply file
+const double kPlyBytesPerRay = 36.0;
+
+/// Blocks threads until enough of the shared memory budget is available for their tile.
+/// A tile larger than the whole budget is still processed, but only when no other tile is in progress.
+class MemoryBudget
+{
+public:
+  MemoryBudget(double bytes)
+    : available_(bytes)
+    , total_(bytes)
+  {}
+  void acquire(double bytes)
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    condition_.wait(lock, [&] { return bytes <= available_ || available_ == total_; });
+    available_ -= bytes;
+  }
+  void release(double bytes)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      available_ += bytes;
+    }
+    condition_.notify_all();
+  }
+
+private:
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  double available_;
+  double total_;
+};
+
+/// The inputs and outputs for each tile
+struct Tile
+{
+  std::string name;       // tile cloud file name stub
+  Eigen::Vector3d min_bound;  // horizontal bounds of the (non-overlapping) tile that owns the trees and rays
+  Eigen::Vector3d max_bound;
+  double memory;          // estimated memory in bytes to process the tile
+  ForestStructure forest; // the trees whose base is inside the (non-overlapping) tile
+  bool valid;
+};
+
+/// The triangles of @c mesh that are horizontally within the bounds @c min_bound to @c max_bound, so each tile only
+/// holds its own part of the ground mesh
+Mesh clipMesh(const Mesh &mesh, const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound)
+{
+  Mesh clipped;
+  clipped.vertices() = mesh.vertices();
+  for (const auto &tri : mesh.indexList())
+  {
+    const Eigen::Vector3d &v0 = mesh.vertices()[tri[0]];
+    const Eigen::Vector3d &v1 = mesh.vertices()[tri[1]];
+    const Eigen::Vector3d &v2 = mesh.vertices()[tri[2]];
+    const Eigen::Vector3d tri_min = minVector(v0, minVector(v1, v2));
+    const Eigen::Vector3d tri_max = maxVector(v0, maxVector(v1, v2));
+    if (tri_max[0] >= min_bound[0] && tri_min[0] <= max_bound[0] && tri_max[1] >= min_bound[1] &&
+        tri_min[1] <= max_bound[1])
+    {
+      clipped.indexList().push_back(tri);
+    }
+  }
+  clipped.reduce();  // removes the vertices of the other tiles
+  return clipped;
+}
+
+double fileSize(const std::string &file_name)
+{
+  std::ifstream ifs(file_name, std::ios::binary | std::ios::ate);
+  if (!ifs.is_open())
+  {
+    return -1.0;
+  }
+  return static_cast<double>(ifs.tellg());
+}
+}  // namespace
+
+TiledTreesParams::TiledTreesParams()
+  : tile_width(50.0)
+  , overlap(20.0)
+  , memory_budget(8.0)
+{}
+
+bool extractTreesTiled(const std::string &cloud_file, const std::string &cloud_stub, const Mesh &mesh,
+                       const TreesParams &params, const TiledTreesParams &tile_params)
+{
+  Cloud::Info info;
+  if (!Cloud::getInfo(cloud_file, info))
+  {
+    return false;
+  }
+  // 1. stream the cloud into overlapping tiles on disk, this is the same as raysplit grid
+  const std::string tile_stub = cloud_stub + "_tile";
+  const double width = tile_params.tile_width;
+  if (!splitGrid(cloud_file, tile_stub, Eigen::Vector3d(width, width, 0.0), tile_params.overlap))
+  {
+    return false;
+  }
+  // the same tile index range as used in splitGrid
+  const Eigen::Vector3d &min_bound = info.rays_bound.min_bound_;
+  const Eigen::Vector3d &max_bound = info.rays_bound.max_bound_;
+  const int min_x = static_cast<int>(std::floor(0.5 + min_bound[0] / width));
+  const int min_y = static_cast<int>(std::floor(0.5 + min_bound[1] / width));
+  const int max_x = static_cast<int>(std::ceil(0.5 + max_bound[0] / width));
+  const int max_y = static_cast<int>(std::ceil(0.5 + max_bound[1] / width));
+  std::vector<Tile> tiles;
+  for (int y = min_y; y < max_y; y++)
+  {
+    for (int x = min_x; x < max_x; x++)
+    {
+      Tile tile;
+      tile.name = tile_stub + "_" + std::to_string(x) + "_" + std::to_string(y);
+      const double size = fileSize(tile.name + ".ply");
+      if (size < 0.0)  // no rays in this cell
+      {
+        continue;
+      }
+      tile.memory = kTreesBytesPerRay * size / kPlyBytesPerRay;
+      tile.min_bound = Eigen::Vector3d((x - 0.5) * width, (y - 0.5) * width, 0.0);
+      tile.max_bound = Eigen::Vector3d((x + 0.5) * width, (y + 0.5) * width, 0.0);
+      tile.valid = false;
+      tiles.push_back(tile);
+    }
+  }
+  std::cout << "extracting trees from " << tiles.size() << " tiles" << std::endl;
+
+  // 2. process the largest tiles first, so the smaller ones can fill in the gaps at the end
+  std::vector<int> order(tiles.size());
+  for (size_t i = 0; i < order.size(); i++)
+  {
+    order[i] = static_cast<int>(i);
+  }
+  std::sort(order.begin(), order.end(), [&](int a, int b) { return tiles[a].memory > tiles[b].memory; });
+
+  MemoryBudget budget(tile_params.memory_budget * 1e9);
+  std::atomic<bool> saved(true);
+  auto process_tile = [&](size_t i) {
+    Tile &tile = tiles[order[i]];
+    budget.acquire(tile.memory);
+    Cloud cloud;
+    const int min_num_rays = 40;
+    if (cloud.load(tile.name + ".ply", true, min_num_rays))
+    {
+      Eigen::Vector3d offset = cloud.removeStartPos();
+      // the tile's rays are clipped to the tile plus half the overlap, so only that part of the ground is needed
+      const Eigen::Vector3d margin(0.5 * tile_params.overlap, 0.5 * tile_params.overlap, 0.0);
+      Mesh tile_mesh = clipMesh(mesh, tile.min_bound - margin, tile.max_bound + margin);
+      tile_mesh.translate(-offset);
+      // the tile is given explicitly, as the centre of its data may be nearer to a neighbouring tile
+      TreesParams tile_trees_params = params;
+      tile_trees_params.grid_width = width;
+      tile_trees_params.cell_min_bound = tile.min_bound;
+      tile_trees_params.cell_max_bound = tile.max_bound;
+      Trees trees(cloud, offset, tile_mesh, tile_trees_params, false);
+      trees.getForest(tile.forest, offset);
+      if (cloud.rayCount() > 0)  // a tile at the edge of the data may own none of its rays
+      {
+        cloud.translate(offset);
+        tile.valid = cloud.save(tile.name + "_segmented.ply");
+        if (!tile.valid)
+        {
+          saved = false;
+        }
+      }
+    }
+    std::remove((tile.name + ".ply").c_str());
+    budget.release(tile.memory);
+  };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, order.size(), process_tile);
+#else
+  #pragma omp parallel for schedule(dynamic, 1)
+  for (int i = 0; i < static_cast<int>(order.size()); i++)
+  {
+    process_tile(static_cast<size_t>(i));
+  }
+#endif  // RAYLIB_WITH_TBB
+
+  if (!saved)
+  {
+    return false;
+  }
+
+  // 3. merge the tiles in grid order. Section ids (and so segment colours) are offset to stay unique per tile
+  ForestStructure forest;
+  CloudWriter writer;
+  if (!writer.begin(cloud_stub + "_segmented.ply"))
+  {
+    return false;
+  }
+  int id_offset = 0;
+  for (auto &tile : tiles)
+  {
+    if (!tile.valid)
+    {
+      continue;
+    }
+    int max_id = -1;
+    for (auto &tree : tile.forest.trees)
+    {
+      for (auto &segment : tree.segments())
+      {
+        max_id = std::max(max_id, static_cast<int>(segment.attributes[0]));
+        segment.attributes[0] += static_cast<double>(id_offset);
+      }
+      forest.trees.push_back(tree);
+    }
+    const std::string segmented_name = tile.name + "_segmented.ply";
+    auto recolour = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                        std::vector<double> &times, std::vector<RGBA> &colours) {
+      for (auto &colour : colours)
+      {
+        if (colour.red == 0 && colour.green == 0 && colour.blue == 0)  // black is unsegmented
+        {
+          continue;
+        }
+        const int id = convertColourToInt(colour);
+        max_id = std::max(max_id, id);
+        convertIntToColour(id + id_offset, colour);
+      }
+      writer.writeChunk(starts, ends, times, colours);
+    };
+    if (!Cloud::read(segmented_name, recolour))
+    {
+      return false;
+    }
+    std::remove(segmented_name.c_str());
+    id_offset += max_id + 1;
+  }
+  writer.end();
+
+  if (forest.trees.empty())
+  {
+    std::cout << "no trees found in any tile" << std::endl;
+    return true;
+  }
+  if (!forest.save(cloud_stub + "_trees.txt"))
+  {
+    return false;
+  }
+  return forest.writeSmoothMesh(cloud_stub + "_trees_mesh.ply", -1, 1, 1, 1, true);
+}
+
+}  // namespace ray
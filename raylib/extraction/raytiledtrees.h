@@ -0,0 +1,34 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYTILEDTREES_H
+#define RAYLIB_RAYTILEDTREES_H
+
+#include "../raymesh.h"
+#include "../rayutils.h"
+#include "raylib/raylibconfig.h"
+#include "raytrees.h"
+
+namespace ray
+{
+/// structure containing the parameters used to divide a large cloud into overlapping tiles for tree reconstruction
+struct RAYLIB_EXPORT TiledTreesParams
+{
+  TiledTreesParams();
+  double tile_width;     // width of each (square) tile, trees are kept in the tile that contains their base
+  double overlap;        // total overlap between neighbouring tiles, this should exceed the widest tree crown
+  double memory_budget;  // approximate memory in GB shared between the tiles that are processed concurrently
+};
+
+/// Reconstruct the trees of the ray cloud @c cloud_file by streaming it into overlapping tiles of @c tile_params
+/// width, extracting the trees in each tile concurrently, then merging the results. Each tile keeps the trees whose base
+/// is inside it, the rays of those trees, and the other rays whose end point is inside it.
+/// This produces the same output files as a single @c Trees reconstruction: _trees.txt, _segmented.ply and
+/// _trees_mesh.ply, all named with @c cloud_stub. The ground @c mesh is in the cloud's (untranslated) coordinates.
+bool RAYLIB_EXPORT extractTreesTiled(const std::string &cloud_file, const std::string &cloud_stub, const Mesh &mesh,
+                                     const TreesParams &params, const TiledTreesParams &tile_params);
+
+}  // namespace ray
+#endif  // RAYLIB_RAYTILEDTREES_H
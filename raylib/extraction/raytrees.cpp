@@ -6,6 +6,8 @@
 #include "raytrees.h"
 #include <nabo/nabo.h>
 #include "rayclusters.h"
+#include "../rayforeststructure.h"
+#include "../raytelemetry.h"
 
 namespace ray
 {
@@ -20,6 +22,8 @@ TreesParams::TreesParams()
   , span_ratio(4.5)
   , gravity_factor(0.3)
   , grid_width(0.0)
+  , cell_min_bound(0, 0, 0)
+  , cell_max_bound(0, 0, 0)
   , segment_branches(false)
   , global_taper(0.012)
   , global_taper_factor(0.3)
@@ -30,6 +34,8 @@ TreesParams::TreesParams()
 /// by an agglomeration of paths, with repeated splitting from root to tips
 Trees::Trees(Cloud &cloud, const Eigen::Vector3d &offset, const Mesh &mesh, const TreesParams &params, bool verbose)
 {
+  TelemetryPhase telemetry("Trees");
+  telemetry.addRays(cloud.rayCount());
   // firstly, get the full set of shortest paths from ground to tips, and the set of roots
   params_ = &params;
 
@@ -1050,12 +1056,23 @@ void Trees::removeOutOfBoundSections(const Cloud &cloud, Eigen::Vector3d &min_bo
 {
   const double width = params_->grid_width;
   cloud.calcBounds(&min_bound, &max_bound);
-  const Eigen::Vector3d mid = (min_bound + max_bound)/2.0 + offset;
-  const Eigen::Vector2d inds(std::round(mid[0] / width), std::round(mid[1] / width));
-  min_bound[0] = width * (inds[0] - 0.5) - offset[0];
-  min_bound[1] = width * (inds[1] - 0.5) - offset[1];
-  max_bound[0] = width * (inds[0] + 0.5) - offset[0];
-  max_bound[1] = width * (inds[1] + 0.5) - offset[1];
+  if (params_->cell_min_bound[0] < params_->cell_max_bound[0])  // the cell is given explicitly
+  {
+    for (int i = 0; i < 2; i++)
+    {
+      min_bound[i] = params_->cell_min_bound[i] - offset[i];
+      max_bound[i] = params_->cell_max_bound[i] - offset[i];
+    }
+  }
+  else
+  {
+    const Eigen::Vector3d mid = (min_bound + max_bound)/2.0 + offset;
+    const Eigen::Vector2d inds(std::round(mid[0] / width), std::round(mid[1] / width));
+    min_bound[0] = width * (inds[0] - 0.5) - offset[0];
+    min_bound[1] = width * (inds[1] - 0.5) - offset[1];
+    max_bound[0] = width * (inds[0] + 0.5) - offset[0];
+    max_bound[1] = width * (inds[1] + 0.5) - offset[1];
+  }
   std::cout << "min bound: " << (min_bound+offset).transpose() << ", max bound: " << (max_bound+offset).transpose() << std::endl;
 
   // disable trees out of bounds
@@ -1156,11 +1173,9 @@ void Trees::removeOutOfBoundRays(Cloud &cloud, const Eigen::Vector3d &min_bound,
 {
   for (int i = static_cast<int>(cloud.ends.size()) - 1; i >= 0; i--)
   {
-    if (!cloud.rayBounded(i))
-    {
-      continue;
-    }
-    const Eigen::Vector3d pos = root_segs[i] == -1 ? cloud.ends[i] : sections_[root_segs[i]].tip;
+    // unbounded rays belong to the cell of their end point, so that neighbouring cells don't both keep them
+    const Eigen::Vector3d pos =
+      !cloud.rayBounded(i) || root_segs[i] == -1 ? cloud.ends[i] : sections_[root_segs[i]].tip;
 
     if (pos[0] < min_bound[0] || pos[0] > max_bound[0] || pos[1] < min_bound[1] ||
         pos[1] > max_bound[1])  // nope, can't do this here!
@@ -1230,4 +1245,40 @@ bool Trees::save(const std::string &filename, const Eigen::Vector3d &offset, boo
   return true;
 }
 
+// convert to the forest structure, this matches the (non-verbose) text file format
+void Trees::getForest(ForestStructure &forest, const Eigen::Vector3d &offset) const
+{
+  for (size_t sec = 0; sec < sections_.size(); sec++)
+  {
+    const auto &section = sections_[sec];
+    if (section.parent >= 0 || section.children.empty())  // not a root section, so move on
+    {
+      continue;
+    }
+    TreeStructure tree;
+    tree.attributeNames().push_back("section_id");
+    TreeStructure::Segment base;
+    base.tip = section.tip + offset;
+    base.radius = radius(section);
+    base.attributes.push_back(static_cast<double>(contiguous_section_ids_[sec]));
+    tree.segments().push_back(base);
+    std::vector<int> children = section.children;
+    for (unsigned int c = 0; c < children.size(); c++)
+    {
+      const BranchSection &node = sections_[children[c]];
+      TreeStructure::Segment segment;
+      segment.tip = node.tip + offset;
+      segment.radius = radius(node);
+      segment.parent_id = sections_[node.parent].id;
+      segment.attributes.push_back(static_cast<double>(contiguous_section_ids_[children[c]]));
+      tree.segments().push_back(segment);
+      for (auto i : node.children)
+      {
+        children.push_back(i);
+      }
+    }
+    forest.trees.push_back(tree);
+  }
+}
+
 }  // namespace ray
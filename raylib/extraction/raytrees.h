@@ -28,6 +28,8 @@ struct RAYLIB_EXPORT TreesParams
   double span_ratio;                // points that span a larger width determine that a branch has become two
   double gravity_factor;   // preferences branches that are less lateral, so penalises implausable horizontal branches
   double grid_width;       // used on a grid cell with overlap, to remove trees with a base in the overlap zone
+  Eigen::Vector3d cell_min_bound;  // the horizontal bounds of that grid cell, in the cloud's original coordinates. If
+  Eigen::Vector3d cell_max_bound;  // these are empty the cell is inferred as the one nearest the centre of the cloud
   bool segment_branches;   // flag to output the ray cloud coloured by branch segment index rather than by tree index
   double global_taper;     // forced global taper, uses global_taper_factor to define how much it is applied
   double global_taper_factor; // 0 estimates per-tree tapering, 1 uses per-scan tapering, 0.5 is mid-way on mid-weight trees
@@ -35,6 +37,7 @@ struct RAYLIB_EXPORT TreesParams
 };
 
 struct BranchSection;  // forwards declaration
+struct ForestStructure;
 
 /// The class for a set of trees, stored as a list of (connected) branch sections
 /// together with the function for their extrsction from a ray cloud
@@ -50,6 +53,9 @@ public:
   /// save the trees representation to a text file
   bool save(const std::string &filename, const Eigen::Vector3d &offset, bool verbose) const;
 
+  /// fill in @c forest with the same trees and section ids as written by @c save, without going via a file
+  void getForest(ForestStructure &forest, const Eigen::Vector3d &offset) const;
+
 private:
   /// The piecewise cylindrical represenation of all of the trees
   std::vector<BranchSection> sections_;
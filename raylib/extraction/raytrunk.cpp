@@ -5,6 +5,7 @@
 // Author: Thomas Lowe
 #include "raytrunk.h"
 #include <nabo/nabo.h>
+#include <algorithm>
 #include <map>
 #include <queue>
 #include "../raycuboid.h"
@@ -74,6 +75,88 @@ std::vector<Eigen::Vector3d> Trunk::getOverlappingPoints(const Grid<Eigen::Vecto
   return points;
 }
 
+void SortedPointGrid::init(const std::vector<Eigen::Vector3d> &points, const Eigen::Vector3d &box_min,
+                           const Eigen::Vector3d &box_max, double voxel_width)
+{
+  this->box_min = box_min;
+  this->voxel_width = voxel_width;
+  dims = Eigen::Vector3i(((box_max - box_min) / voxel_width).array().ceil().cast<int>());
+  dims = maxVector(dims, Eigen::Vector3i(1, 1, 1));
+  // like Grid<T>, positions are clamped to the bounds
+  std::vector<std::pair<uint64_t, int>> sorted;
+  sorted.reserve(points.size());
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    const Eigen::Vector3d pos = minVector(maxVector(points[i], box_min), box_max);
+    const Eigen::Vector3i index = ((pos - box_min) / voxel_width).cast<int>();
+    if (index[0] >= dims[0] || index[1] >= dims[1] || index[2] >= dims[2])
+    {
+      continue;  // on the upper boundary, which is outside the queryable voxels of Grid<T>
+    }
+    sorted.push_back(std::pair<uint64_t, int>(key(index), static_cast<int>(i)));
+  }
+  // the sort is stable on the point order, so each voxel lists its points in their original order
+  std::sort(sorted.begin(), sorted.end());
+  keys.resize(sorted.size());
+  this->points.resize(sorted.size());
+  for (size_t i = 0; i < sorted.size(); i++)
+  {
+    keys[i] = sorted[i].first;
+    this->points[i] = points[sorted[i].second];
+  }
+}
+
+void Trunk::getOverlappingPoints(const SortedPointGrid &grid, double spacing,
+                                 std::vector<Eigen::Vector3d> &points) const
+{
+  points.clear();
+  // get grid bounds
+  const Eigen::Vector3d base = centre - 0.5 * length * dir;
+  const Eigen::Vector3d top = centre + 0.5 * length * dir;
+  const double outer_radius = (radius + spacing) * boundary_radius_scale;
+  const Eigen::Vector3d rad(outer_radius, outer_radius, outer_radius);
+  const Cuboid cuboid(minVector(base, top) - rad, maxVector(base, top) + rad);
+  Eigen::Vector3i mins = ((cuboid.min_bound_ - grid.box_min) / grid.voxel_width).cast<int>();
+  Eigen::Vector3i maxs = ((cuboid.max_bound_ - grid.box_min) / grid.voxel_width).cast<int>();
+  mins = maxVector(mins, Eigen::Vector3i(0, 0, 0));
+  const Eigen::Vector3i min_dims = grid.dims - Eigen::Vector3i(1, 1, 1);
+  maxs = minVector(maxs, min_dims);
+  if (mins[2] > maxs[2])
+  {
+    return;
+  }
+
+  // each column of voxels in the bounds is a contiguous range of points
+  Eigen::Vector3i ind;
+  for (ind[0] = mins[0]; ind[0] <= maxs[0]; ind[0]++)
+  {
+    for (ind[1] = mins[1]; ind[1] <= maxs[1]; ind[1]++)
+    {
+      ind[2] = mins[2];
+      const uint64_t first_key = grid.key(ind);
+      const uint64_t last_key = first_key + static_cast<uint64_t>(maxs[2] - mins[2]);
+      auto it = std::lower_bound(grid.keys.begin(), grid.keys.end(), first_key);
+      for (size_t i = it - grid.keys.begin(); i < grid.keys.size() && grid.keys[i] <= last_key; i++)
+      {
+        // intersect against the trunk cylinder
+        const Eigen::Vector3d &pos = grid.points[i];
+        Eigen::Vector3d p = pos - centre;
+        const double h = p.dot(dir);
+        if (std::abs(h) > length * 0.5)
+        {
+          continue;
+        }
+        p -= dir * h;
+        const double dist2 = p.squaredNorm();
+        if (dist2 <= outer_radius * outer_radius)
+        {
+          points.push_back(pos);
+        }
+      }
+    }
+  }
+}
+
 // estimate the pose (centre and direction) of the trunk, from the set of points
 void Trunk::estimatePose(const std::vector<Eigen::Vector3d> &points)
 {
@@ -17,6 +17,29 @@ static const double trunk_height_to_width = 4.0;  // height to diameter ratio of
 static const double boundary_radius_scale = 3.0;  // how much farther out is the expected boundary compared to real
                                                   // branch radius? Larger requires more space to declare it a branch
 
+/// A flat spatial index of points, sorted by voxel so that each vertical column of voxels is contiguous in memory.
+/// This is read-only once built, so it can be queried from many threads at once.
+struct RAYLIB_EXPORT SortedPointGrid
+{
+  /// index the @c points into voxels of width @c voxel_width, over the bounds @c box_min to @c box_max
+  void init(const std::vector<Eigen::Vector3d> &points, const Eigen::Vector3d &box_min,
+            const Eigen::Vector3d &box_max, double voxel_width);
+
+  /// the voxel key, which orders the voxels by x, then y, then z
+  inline uint64_t key(const Eigen::Vector3i &index) const
+  {
+    return (static_cast<uint64_t>(index[0]) * static_cast<uint64_t>(dims[1]) + static_cast<uint64_t>(index[1])) *
+             static_cast<uint64_t>(dims[2]) +
+           static_cast<uint64_t>(index[2]);
+  }
+
+  Eigen::Vector3d box_min;
+  double voxel_width;
+  Eigen::Vector3i dims;
+  std::vector<uint64_t> keys;           // voxel key of each point, in increasing order
+  std::vector<Eigen::Vector3d> points;  // points sorted by voxel key
+};
+
 /// Structure defining a single trunk, as used by raytrunks in trunk extraction
 struct RAYLIB_EXPORT Trunk
 {
@@ -35,6 +58,10 @@ struct RAYLIB_EXPORT Trunk
   /// return the overlapping points to the trunk using the @c grid of points
   std::vector<Eigen::Vector3d> getOverlappingPoints(const Grid<Eigen::Vector3d> &grid, double spacing);
 
+  /// fill in @c points with the overlapping points to the trunk, using the sorted @c grid of points.
+  /// @c points is cleared first, so it can be reused as a scratch buffer between calls
+  void getOverlappingPoints(const SortedPointGrid &grid, double spacing, std::vector<Eigen::Vector3d> &points) const;
+
   /// estimate the centre and direction of the trunk from the shape of the points
   void estimatePose(const std::vector<Eigen::Vector3d> &points);
 
@@ -11,6 +11,10 @@
 #include "../rayply.h"
 #include "raygrid2d.h"
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
 namespace
@@ -352,15 +356,18 @@ Trunks::Trunks(const Cloud &cloud, const Eigen::Vector3d &offset, double midRadi
 
   // 1. voxel grid of points (an acceleration structure)
   const double voxel_width = midRadius * 2.0;
-  Grid<Eigen::Vector3d> grid(min_bound, max_bound, voxel_width);
-  for (size_t i = 0; i < cloud.ends.size(); i++)
+  SortedPointGrid grid;
   {
-    if (!cloud.rayBounded(i))
+    std::vector<Eigen::Vector3d> points;
+    points.reserve(cloud.ends.size());
+    for (size_t i = 0; i < cloud.ends.size(); i++)
     {
-      continue;
+      if (cloud.rayBounded(i))
+      {
+        points.push_back(cloud.ends[i]);
+      }
     }
-    const Eigen::Vector3d pos = cloud.ends[i];
-    grid.insert(grid.index(pos), pos);
+    grid.init(points, min_bound, max_bound, voxel_width);
   }
   const int min_num_points = 6;
 
@@ -375,23 +382,24 @@ Trunks::Trunks(const Cloud &cloud, const Eigen::Vector3d &offset, double midRadi
     trunk.active = false;
   }
   const int num_iterations = 5;
+  std::vector<uint8_t> above_minimum(trunks.size());
   for (int it = 0; it < num_iterations; it++)
   {
-    double above_count = 0;
-    double active_count = 0;
-    for (int trunk_id = 0; trunk_id < static_cast<int>(trunks.size()); trunk_id++)
-    {
+    // each candidate is refined independently, so they are processed concurrently
+    auto refine_trunk = [&](size_t trunk_id) {
       auto &trunk = trunks[trunk_id];
+      above_minimum[trunk_id] = 0;
       if (!trunk.active)
       {
-        continue;
+        return;
       }
-      // get overlapping points to this trunk
-      std::vector<Eigen::Vector3d> points = trunk.getOverlappingPoints(grid, spacing);
+      // get overlapping points to this trunk, into a per-thread scratch buffer
+      static thread_local std::vector<Eigen::Vector3d> points;
+      trunk.getOverlappingPoints(grid, spacing, points);
       if (points.size() < min_num_points)  // not enough data to use
       {
         trunk.active = false;
-        continue;
+        return;
       }
 
       // improve the estimation of the trunk's pose and size
@@ -415,12 +423,27 @@ Trunks::Trunks(const Cloud &cloud, const Eigen::Vector3d &offset, double midRadi
       {
         trunk.active = false;
       }
+      above_minimum[trunk_id] = trunk.score > minimum_score;
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, trunks.size(), refine_trunk);
+#else
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int trunk_id = 0; trunk_id < static_cast<int>(trunks.size()); trunk_id++)
+    {
+      refine_trunk(static_cast<size_t>(trunk_id));
+    }
+#endif  // RAYLIB_WITH_TBB
 
-      if (trunk.active)
+    double above_count = 0;
+    double active_count = 0;
+    for (size_t trunk_id = 0; trunk_id < trunks.size(); trunk_id++)
+    {
+      if (trunks[trunk_id].active)
       {
         active_count++;
       }
-      if (trunk.score > minimum_score)
+      if (above_minimum[trunk_id])
       {
         above_count++;
       }
@@ -500,21 +523,21 @@ void Trunks::removePermeableTrunks(bool verbose, const Cloud &cloud, const Eigen
   // set the grid's occupancy from the rays
   grid2D.fillRays(cloud);
 
-  std::vector<Eigen::Vector3d> closest_approach_points, pass_through_points;
-  int num_removed = 0;
   // now check how occupied the pixels are that overlap each trunk
-  for (auto &trunk : trunks)
-  {
+  std::vector<uint8_t> permeable(trunks.size(), 0);
+  std::vector<uint8_t> impermeable(trunks.size(), 0);
+  std::vector<std::vector<Eigen::Vector3d>> nearest_points(verbose ? trunks.size() : 0);
+  auto test_trunk = [&](size_t trunk_id) {
+    const Trunk &trunk = trunks[trunk_id];
     if (!trunk.active)
     {
-      continue;
+      return;
     }
 
     Eigen::Vector3d base = trunk.centre - trunk.length * 0.5 * trunk.dir;
     auto &ray_ids = grid2D.pixel(trunk.centre).ray_ids;
     double mean_rad = 0.0;
     double mean_num = 0.0;
-    std::vector<Eigen::Vector3d> nearest_points;
     for (size_t i = 0; i < ray_ids.size(); i++)
     {
       // check whether ray passes through trunk...
@@ -537,7 +560,10 @@ void Trunks::removePermeableTrunks(bool verbose, const Cloud &cloud, const Eigen
       {
         mean_rad += dist;
         mean_num++;
-        nearest_points.push_back(closest_point);
+        if (verbose)
+        {
+          nearest_points[trunk_id].push_back(closest_point);
+        }
       }
     }
     if (mean_num > 1)
@@ -545,15 +571,38 @@ void Trunks::removePermeableTrunks(bool verbose, const Cloud &cloud, const Eigen
       mean_rad /= mean_num;
       if (mean_rad < 0.7 * trunk.radius)  // too many pass through the trunk
       {
-        trunk.active = false;
-        num_removed++;
-        pass_through_points.insert(pass_through_points.begin(), nearest_points.begin(), nearest_points.end());
+        permeable[trunk_id] = 1;
       }
       else
       {
-        closest_approach_points.insert(closest_approach_points.begin(), nearest_points.begin(), nearest_points.end());
+        impermeable[trunk_id] = 1;
       }
     }
+  };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, trunks.size(), test_trunk);
+#else
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (int trunk_id = 0; trunk_id < static_cast<int>(trunks.size()); trunk_id++)
+  {
+    test_trunk(static_cast<size_t>(trunk_id));
+  }
+#endif  // RAYLIB_WITH_TBB
+
+  std::vector<Eigen::Vector3d> closest_approach_points, pass_through_points;
+  int num_removed = 0;
+  for (size_t trunk_id = 0; trunk_id < trunks.size(); trunk_id++)
+  {
+    if (permeable[trunk_id])
+    {
+      trunks[trunk_id].active = false;
+      num_removed++;
+    }
+    if (verbose && (permeable[trunk_id] || impermeable[trunk_id]))
+    {
+      auto &points = permeable[trunk_id] ? pass_through_points : closest_approach_points;
+      points.insert(points.begin(), nearest_points[trunk_id].begin(), nearest_points[trunk_id].end());
+    }
   }
   if (verbose)
   {
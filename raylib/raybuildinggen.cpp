@@ -5,6 +5,10 @@
 // Author: Thomas Lowe
 #include "raybuildinggen.h"
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
 void BuildingGen::splitRoom(const Cuboid &cuboid, std::vector<Cuboid> &cuboids,
@@ -228,15 +232,12 @@ void BuildingGen::generate()
         neighbours[i].push_back(j);
 
   size_t start_id = 0;  // if this is not the right initial cuboid, it will search to find the right one
-  // for each ray (points, dirs) intersect it with the negative spaces (cuboids) and the furniture to get a range
+  // first, find the starting room of each ray. This walks from the previous ray's room, so it is done in order
+  std::vector<size_t> ray_ids, start_ids;
   for (size_t i = 0; i < points.size(); i++)
   {
     Eigen::Vector3d &start = points[i];
-    Eigen::Vector3d &dir = dirs[i];
-
-    const double max_range = 20.0;
-    double range = max_range;
-    // first, adjust startID:
+    // adjust startID:
     if (!cuboids[start_id].intersects(start))  // if it doesn't intersect then search for an intersecting room
     {
       bool found_start = false;
@@ -264,6 +265,20 @@ void BuildingGen::generate()
           continue;
       }
     }
+    ray_ids.push_back(i);
+    start_ids.push_back(start_id);
+  }
+
+  // for each ray (points, dirs) intersect it with the negative spaces (cuboids) and the furniture to get a range.
+  // The rays are independent, so this is done in parallel
+  const double max_range = 20.0;
+  std::vector<double> ranges(ray_ids.size());
+  auto cast_ray = [&](size_t r)
+  {
+    const Eigen::Vector3d &start = points[ray_ids[r]];
+    const Eigen::Vector3d &dir = dirs[ray_ids[r]];
+    const size_t start_id = start_ids[r];
+    double range = max_range;
     // get range in box it already intersects
     cuboids[start_id].intersectsRay(start, dir, range, false);
     const double eps = 1e-6;
@@ -306,12 +321,29 @@ void BuildingGen::generate()
       }
     }
 
-    // finally we have a range value for the ray, so add it to the ray cloud
-    const double range_noise = 0.03;
-    Eigen::Vector3d ray_end = start + (range + random(-range_noise, range_noise)) * dir;
+    // finally we have a range value for the ray
+    ranges[r] = range;
+  };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, ray_ids.size(), cast_ray);
+#else
+  #pragma omp parallel for schedule(dynamic, 256)
+  for (int64_t r = 0; r < static_cast<int64_t>(ray_ids.size()); r++)
+  {
+    cast_ray(static_cast<size_t>(r));
+  }
+#endif  // RAYLIB_WITH_TBB
+
+  // add the rays to the ray cloud, with range noise drawn in ray order
+  const double range_noise = 0.03;
+  for (size_t r = 0; r < ray_ids.size(); r++)
+  {
+    const Eigen::Vector3d &start = points[ray_ids[r]];
+    const Eigen::Vector3d &dir = dirs[ray_ids[r]];
+    Eigen::Vector3d ray_end = start + (ranges[r] + random(-range_noise, range_noise)) * dir;
     ray_starts_.push_back(start);
     ray_ends_.push_back(ray_end);
-    ray_bounded_.push_back(range != max_range);
+    ray_bounded_.push_back(ranges[r] != max_range);
   }
 }
 }  // namespace ray
\ No newline at end of file
@@ -6,11 +6,10 @@
 #include "raycloud.h"
 
 #include "raylaz.h"
+#include "rayneighbours.h"
 #include "rayply.h"
 #include "rayprogress.h"
 
-#include <nabo/nabo.h>
-
 #include <iostream>
 #include <limits>
 #include <set>
@@ -26,10 +25,10 @@ void Cloud::clear()
   colours.clear();
 }
 
-void Cloud::save(const std::string &file_name) const
+bool Cloud::save(const std::string &file_name) const
 {
   std::string name = file_name;
-  writePlyRayCloud(name, starts, ends, times, colours);
+  return writePlyRayCloud(name, starts, ends, times, colours);
 }
 
 bool Cloud::load(const std::string &file_name, bool check_extension, int min_num_rays)
@@ -175,17 +174,16 @@ void Cloud::decimate(double voxel_width, std::set<Eigen::Vector3i, Vector3iLess>
   times.resize(subsample.size());
 }
 
-void Cloud::eigenSolve(const std::vector<int> &ray_ids, const Eigen::MatrixXi &indices, int index, int num_neighbours,
+void Cloud::eigenSolve(int ray_id, const uint32_t *neighbour_ids, int num_neighbours,
                        Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> &solver, Eigen::Vector3d &centroid) const
 {
-  int ray_id = ray_ids[index];
   centroid = ends[ray_id];
-  for (int j = 0; j < num_neighbours; j++) centroid += ends[ray_ids[indices(j, index)]];
+  for (int j = 0; j < num_neighbours; j++) centroid += ends[neighbour_ids[j]];
   centroid /= (double)(num_neighbours + 1);
   Eigen::Matrix3d scatter = (ends[ray_id] - centroid) * (ends[ray_id] - centroid).transpose();
   for (int j = 0; j < num_neighbours; j++)
   {
-    Eigen::Vector3d offset = ends[ray_ids[indices(j, index)]] - centroid;
+    Eigen::Vector3d offset = ends[neighbour_ids[j]] - centroid;
     scatter += offset * offset.transpose();
   }
   scatter /= (double)(num_neighbours + 1);
@@ -196,6 +194,26 @@ void Cloud::eigenSolve(const std::vector<int> &ray_ids, const Eigen::MatrixXi &i
 void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids, std::vector<Eigen::Vector3d> *normals,
                        std::vector<Eigen::Vector3d> *dimensions, std::vector<Eigen::Matrix3d> *mats,
                        Eigen::MatrixXi *neighbour_indices, double max_distance, bool reject_back_facing_rays) const
+{
+  NeighbourGraph graph;
+  getSurfels(search_size, centroids, normals, dimensions, mats, graph, max_distance, reject_back_facing_rays);
+  if (neighbour_indices)
+  {
+    neighbour_indices->setConstant(search_size, ends.size(), -1);
+    for (size_t i = 0; i < ends.size(); i++)
+    {
+      const NeighbourGraph::Neighbours neighbours = graph.neighbours(i);
+      for (int j = 0; j < neighbours.size; j++)
+      {
+        (*neighbour_indices)(j, i) = static_cast<int>(neighbours.ids[j]);
+      }
+    }
+  }
+}
+
+void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids, std::vector<Eigen::Vector3d> *normals,
+                       std::vector<Eigen::Vector3d> *dimensions, std::vector<Eigen::Matrix3d> *mats,
+                       NeighbourGraph &neighbours, double max_distance, bool reject_back_facing_rays) const
 {
   // simplest scheme... find 3 nearest neighbours and do cross product
   if (centroids)
@@ -206,57 +224,24 @@ void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids,
     dimensions->resize(ends.size());
   if (mats)
     mats->resize(ends.size());
-  Nabo::NNSearchD *nns;
-  std::vector<int> ray_ids;
-  ray_ids.reserve(ends.size());
-  for (unsigned int i = 0; i < ends.size(); i++)
-    if (rayBounded(i))
-      ray_ids.push_back(i);
-  Eigen::MatrixXd points_p(3, ray_ids.size());
-  for (unsigned int i = 0; i < ray_ids.size(); i++) points_p.col(i) = ends[ray_ids[i]];
-  nns = Nabo::NNSearchD::createKDTreeLinearHeap(points_p, 3);
-
-  // Run the search
-  Eigen::MatrixXi indices;
-  Eigen::MatrixXd dists2;
-  indices.resize(search_size, ray_ids.size());
-  dists2.resize(search_size, ray_ids.size());
-  if (max_distance != 0.0)
-    nns->knn(points_p, indices, dists2, search_size, kNearestNeighbourEpsilon, 0, max_distance);
-  else
-    nns->knn(points_p, indices, dists2, search_size, kNearestNeighbourEpsilon, 0);
-  delete nns;
+  std::vector<bool> bounded(ends.size());
+  for (size_t i = 0; i < ends.size(); i++) bounded[i] = rayBounded(i);
+  neighbours.build(ends, search_size, max_distance, &bounded);
 
-  if (neighbour_indices)
-  {
-    neighbour_indices->resize(search_size, ends.size());
-    for (int i = 0; i<neighbour_indices->rows(); i++)
-    {
-      for (int j = 0; j < neighbour_indices->cols(); j++)
-      {
-        (*neighbour_indices)(i, j) = -1;
-      }
-    }
-    for (int i = 0; i < (int)ray_ids.size(); i++)
-    {
-      int ray_id = ray_ids[i];
-      for (int j = 0; j < search_size && indices(j, i) != Nabo::NNSearchD::InvalidIndex; j++) 
-      {
-        (*neighbour_indices)(j, ray_id) = ray_ids[indices(j, i)];
-      }
-    }
-  }
   if (centroids || normals || dimensions || mats)
   {
-    for (int i = 0; i < (int)ray_ids.size(); i++)
+    std::vector<uint32_t> neighbour_ids;
+    for (int ray_id = 0; ray_id < (int)ends.size(); ray_id++)
     {
-      int ray_id = ray_ids[i];
+      if (!bounded[ray_id])
+        continue;
       Eigen::Vector3d centroid;
-      int num_neighbours;
-      for (num_neighbours = 0; num_neighbours < search_size && indices(num_neighbours, i) != Nabo::NNSearchD::InvalidIndex; num_neighbours++){}
+      const NeighbourGraph::Neighbours ray_neighbours = neighbours.neighbours(ray_id);
+      neighbour_ids.assign(ray_neighbours.ids, ray_neighbours.ids + ray_neighbours.size);
+      int num_neighbours = ray_neighbours.size;
 
       Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> eigen_solver(3);
-      eigenSolve(ray_ids, indices, i, num_neighbours, eigen_solver, centroid);
+      eigenSolve(ray_id, neighbour_ids.data(), num_neighbours, eigen_solver, centroid);
       if (reject_back_facing_rays)
       {
         Eigen::Vector3d normal = eigen_solver.eigenvectors().col(0);
@@ -265,18 +250,18 @@ void Cloud::getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids,
         bool changed = false;
         for (int j = num_neighbours - 1; j >= 0; j--)
         {
-          int id = ray_ids[indices(j, i)];
+          int id = neighbour_ids[j];
           if ((ends[id] - starts[id]).dot(normal) > 0.0)
           {
-            indices(j, i) = indices(--num_neighbours, i);
+            neighbour_ids[j] = neighbour_ids[--num_neighbours];
             changed = true;
           }
         }
         if (changed)
         {
-          eigenSolve(ray_ids, indices, i, num_neighbours, eigen_solver, centroid);
+          eigenSolve(ray_id, neighbour_ids.data(), num_neighbours, eigen_solver, centroid);
         }
-      }   
+      }
       if (centroids)
         (*centroids)[ray_id] = centroid;
       if (normals)
@@ -320,6 +305,22 @@ bool RAYLIB_EXPORT Cloud::getInfo(const std::string &file_name, Info &info)
   info.centroid.setZero();
   info.start_pos.setZero();
   info.end_pos.setZero();
+  // use the statistics saved alongside the file, when these are up to date
+  CloudStatistics stats;
+  if (stats.load(file_name))
+  {
+    info.ends_bound = Cuboid(stats.ends_min, stats.ends_max);
+    info.starts_bound = Cuboid(stats.starts_min, stats.starts_max);
+    info.rays_bound = Cuboid(stats.rays_min, stats.rays_max);
+    info.num_rays = static_cast<int>(stats.num_rays);
+    info.num_bounded = static_cast<int>(stats.num_bounded);
+    info.min_time = stats.min_time;
+    info.max_time = stats.max_time;
+    info.centroid = stats.ends_sum / static_cast<double>(info.num_bounded);
+    info.start_pos = stats.start_pos;
+    info.end_pos = stats.end_pos;
+    return true;
+  }
   auto find_bounds = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                          std::vector<double> &times, std::vector<ray::RGBA> &colours) {
     for (size_t i = 0; i < ends.size(); i++)
@@ -17,6 +17,7 @@
 namespace ray
 {
 class Progress;
+class NeighbourGraph;
 
 /// Flags for use with @c Cloud::calcBounds()
 enum BoundsFlag
@@ -54,7 +55,8 @@ public:
   /// the number of rays
   inline size_t rayCount() const { return ends.size(); }
 
-  void save(const std::string &file_name) const;
+  /// save the cloud to a .ply file, returning false on failure
+  bool save(const std::string &file_name) const;
   /// load a ray cloud file. @c check_extension checks the file extension before proceeding
   bool load(const std::string &file_name, bool check_extension = true, int min_num_rays = 4);
 
@@ -109,6 +111,11 @@ public:
                   std::vector<Eigen::Vector3d> *dimensions, std::vector<Eigen::Matrix3d> *mats,
                   Eigen::MatrixXi *neighbour_indices, double max_distance = 0.0,
                   bool reject_back_facing_rays = true) const;
+  /// As above, but the neighbours of each bounded ray are returned in the compact @c neighbours graph.
+  /// Unbounded rays have no neighbours.
+  void getSurfels(int search_size, std::vector<Eigen::Vector3d> *centroids, std::vector<Eigen::Vector3d> *normals,
+                  std::vector<Eigen::Vector3d> *dimensions, std::vector<Eigen::Matrix3d> *mats,
+                  NeighbourGraph &neighbours, double max_distance = 0.0, bool reject_back_facing_rays = true) const;
   /// Get first and second order moments of cloud. This can be used as a simple way to compare clouds
   /// numerically. Note that different stats guarantee different clouds, but same stats do not guarantee same clouds
   /// These stats are arranged as: start mean, start sigma, end mean, end sigma, colour mean, time mean, time sigma,
@@ -171,7 +178,7 @@ public:
 private:
   bool loadPLY(const std::string &file, int min_num_rays);
   // Convert the set of neighbouring indices into a eigen solution, which is an ellipsoid of best fit.
-  inline void eigenSolve(const std::vector<int> &ray_ids, const Eigen::MatrixXi &indices, int index, int num_neighbours,
+  inline void eigenSolve(int ray_id, const uint32_t *neighbour_ids, int num_neighbours,
                          Eigen::SelfAdjointEigenSolver<Eigen::Matrix3d> &solver, Eigen::Vector3d &centroid) const;
 };
 
@@ -0,0 +1,395 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raycloudindex.h"
+#include "raycloud.h"
+#include "raymappedfile.h"
+
+#include <cstring>
+#include <limits>
+
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
+namespace ray
+{
+namespace
+{
+const char index_magic[8] = { 'R', 'A', 'Y', 'I', 'N', 'D', 'X', '1' };
+
+/// run @c func(i) for i in [0, size), in parallel
+template <class Function>
+void parallelFor(size_t size, const Function &func)
+{
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, size, func);
+#else
+  #pragma omp parallel for
+  for (int64_t i = 0; i < static_cast<int64_t>(size); i++)
+  {
+    func(static_cast<size_t>(i));
+  }
+#endif  // RAYLIB_WITH_TBB
+}
+
+/// sort blocks of @c values in parallel, then merge pairs of neighbouring blocks in parallel until they are all merged
+template <class T>
+void parallelSort(std::vector<T> &values)
+{
+  const size_t block_size = 65536;
+  const size_t num_blocks = (values.size() + block_size - 1) / block_size;
+  parallelFor(num_blocks, [&](size_t b) {
+    std::sort(values.begin() + b * block_size, values.begin() + std::min(values.size(), (b + 1) * block_size));
+  });
+  for (size_t width = block_size; width < values.size(); width *= 2)
+  {
+    const size_t num_merges = (values.size() + 2 * width - 1) / (2 * width);
+    parallelFor(num_merges, [&](size_t m) {
+      const size_t middle = std::min(values.size(), (2 * m + 1) * width);
+      const size_t end = std::min(values.size(), (2 * m + 2) * width);
+      std::inplace_merge(values.begin() + 2 * m * width, values.begin() + middle, values.begin() + end);
+    });
+  }
+}
+
+/// square distance from @c point to the nearest point in the box
+inline double boxDistance2(const CloudIndex::Node &node, const Eigen::Vector3d &point)
+{
+  const Eigen::Vector3d nearest = point.cwiseMax(node.min_bound).cwiseMin(node.max_bound);
+  return (nearest - point).squaredNorm();
+}
+
+/// the state of a single nearest neighbour search
+struct KnnSearch
+{
+  const CloudIndex *index;
+  Eigen::Vector3d query;
+  size_t search_size;
+  double max_distance2;
+  std::vector<std::pair<double, uint32_t>> heap;  // max heap of the nearest points so far, by square distance
+
+  inline double bound() const
+  {
+    return heap.size() < search_size ? max_distance2 : std::min(max_distance2, heap.front().first);
+  }
+
+  void search(const CloudIndex::Node &node)
+  {
+    if (node.num_children == 0)
+    {
+      for (uint64_t i = node.first_point; i < node.first_point + node.num_points; i++)
+      {
+        const double dist2 = (index->point(i) - query).squaredNorm();
+        // like the default kd-tree search, points at the query position are considered to be the query point itself
+        if (dist2 > max_distance2 || dist2 <= std::numeric_limits<float>::epsilon())
+          continue;
+        if (heap.size() < search_size)
+        {
+          heap.push_back(std::make_pair(dist2, static_cast<uint32_t>(i)));
+          std::push_heap(heap.begin(), heap.end());
+        }
+        else if (dist2 < heap.front().first)
+        {
+          std::pop_heap(heap.begin(), heap.end());
+          heap.back() = std::make_pair(dist2, static_cast<uint32_t>(i));
+          std::push_heap(heap.begin(), heap.end());
+        }
+      }
+      return;
+    }
+    // visit the nearest children first, as they are likely to shrink the search bound the most
+    std::pair<double, uint32_t> children[8];
+    for (uint32_t c = 0; c < node.num_children; c++)
+    {
+      children[c] = std::make_pair(boxDistance2(index->node(node.first_child + c), query), node.first_child + c);
+    }
+    std::sort(children, children + node.num_children);
+    for (uint32_t c = 0; c < node.num_children; c++)
+    {
+      if (children[c].first > bound())
+        break;
+      search(index->node(children[c].second));
+    }
+  }
+};
+
+/// add the octree node covering the sorted @c codes from @c first to @c last to @c nodes, splitting it on the
+/// three code bits at @c shift and below
+void buildNode(const std::vector<std::pair<uint64_t, uint32_t>> &codes, const std::vector<Eigen::Vector3d> &points,
+               size_t first, size_t last, int shift, size_t node_id, std::vector<CloudIndex::Node> &nodes)
+{
+  CloudIndex::Node node;
+  node.first_point = first;
+  node.num_points = last - first;
+  node.first_child = 0;
+  node.num_children = 0;
+  node.min_bound = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+  node.max_bound = Eigen::Vector3d::Constant(std::numeric_limits<double>::lowest());
+  if (last - first <= static_cast<size_t>(CloudIndex::kLeafSize) || shift < 0)
+  {
+    for (size_t i = first; i < last; i++)
+    {
+      node.min_bound = minVector(node.min_bound, points[i]);
+      node.max_bound = maxVector(node.max_bound, points[i]);
+    }
+    nodes[node_id] = node;
+    return;
+  }
+  // the codes within the node share all the bits above shift, so each child is a contiguous range
+  size_t ends[8];
+  size_t start = first;
+  for (uint64_t c = 0; c < 8; c++)
+  {
+    ends[c] = std::partition_point(codes.begin() + start, codes.begin() + last,
+                                   [&](const std::pair<uint64_t, uint32_t> &code) {
+                                     return ((code.first >> shift) & 7) <= c;
+                                   }) -
+              codes.begin();
+    node.num_children += ends[c] > start ? 1 : 0;
+    start = ends[c];
+  }
+  node.first_child = static_cast<uint32_t>(nodes.size());
+  nodes.resize(nodes.size() + node.num_children);
+  start = first;
+  uint32_t child_id = node.first_child;
+  for (int c = 0; c < 8; c++)
+  {
+    if (ends[c] == start)
+      continue;
+    buildNode(codes, points, start, ends[c], shift - 3, child_id, nodes);
+    node.min_bound = minVector(node.min_bound, nodes[child_id].min_bound);
+    node.max_bound = maxVector(node.max_bound, nodes[child_id].max_bound);
+    child_id++;
+    start = ends[c];
+  }
+  nodes[node_id] = node;
+}
+}  // namespace
+
+CloudIndex::CloudIndex()
+{
+  clear();
+}
+
+CloudIndex::~CloudIndex() = default;
+
+void CloudIndex::clear()
+{
+  num_points_ = num_nodes_ = 0;
+  nodes_ = nullptr;
+  points_ = nullptr;
+  point_ids_ = nullptr;
+  node_list_.clear();
+  point_list_.clear();
+  point_id_list_.clear();
+  file_.reset();
+}
+
+void CloudIndex::build(const std::vector<Eigen::Vector3d> &points, const std::vector<bool> *mask)
+{
+  clear();
+  std::vector<uint32_t> ids;
+  Eigen::Vector3d min_bound = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+  Eigen::Vector3d max_bound = Eigen::Vector3d::Constant(std::numeric_limits<double>::lowest());
+  for (size_t i = 0; i < points.size(); i++)
+  {
+    if (mask && !(*mask)[i])
+      continue;
+    ids.push_back(static_cast<uint32_t>(i));
+    min_bound = minVector(min_bound, points[i]);
+    max_bound = maxVector(max_bound, points[i]);
+  }
+  if (ids.empty())
+  {
+    return;
+  }
+
+  // sort the points by their Morton code, in parallel
+  const double max_extent = std::max(1e-10, (max_bound - min_bound).maxCoeff());
+  const double scale = static_cast<double>((1 << kMortonBits) - 1) / max_extent;
+  std::vector<std::pair<uint64_t, uint32_t>> codes(ids.size());
+  parallelFor(ids.size(), [&](size_t i) {
+    codes[i].first = mortonCode(points[ids[i]], min_bound, scale);
+    codes[i].second = ids[i];
+  });
+  parallelSort(codes);
+
+  point_list_.resize(codes.size());
+  point_id_list_.resize(codes.size());
+  parallelFor(codes.size(), [&](size_t i) {
+    point_id_list_[i] = codes[i].second;
+    point_list_[i] = points[codes[i].second];
+  });
+
+  // the octree's top level splits on the most significant three bits of the code
+  node_list_.resize(1);
+  buildNode(codes, point_list_, 0, codes.size(), 3 * (kMortonBits - 1), 0, node_list_);
+
+  num_points_ = point_list_.size();
+  num_nodes_ = node_list_.size();
+  nodes_ = node_list_.data();
+  points_ = point_list_.data();
+  point_ids_ = point_id_list_.data();
+}
+
+bool CloudIndex::build(const std::string &cloud_file_name)
+{
+  std::vector<Eigen::Vector3d> ends;
+  std::vector<bool> bounded;
+  auto add_chunk = [&](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &chunk_ends,
+                       std::vector<double> &, std::vector<RGBA> &colours) {
+    ends.insert(ends.end(), chunk_ends.begin(), chunk_ends.end());
+    for (auto &colour : colours)
+    {
+      bounded.push_back(colour.alpha > 0);
+    }
+  };
+  if (!Cloud::read(cloud_file_name, add_chunk))
+  {
+    return false;
+  }
+  if (ends.size() > std::numeric_limits<uint32_t>::max())
+  {
+    std::cerr << "Error: cannot index more than " << std::numeric_limits<uint32_t>::max() << " rays" << std::endl;
+    return false;
+  }
+  build(ends, &bounded);
+  return save(cloud_file_name);
+}
+
+bool CloudIndex::save(const std::string &cloud_file_name) const
+{
+  uint64_t size;
+  int64_t modified;
+  if (!fileStamp(cloud_file_name, size, modified))
+  {
+    return false;
+  }
+  const std::string file_name = fileName(cloud_file_name);
+  std::ofstream out(file_name.c_str(), std::ios::binary | std::ios::out);
+  out.write(index_magic, sizeof(index_magic));
+  writePlainOldData(out, size);
+  writePlainOldData(out, modified);
+  writePlainOldData(out, static_cast<uint64_t>(num_points_));
+  writePlainOldData(out, static_cast<uint64_t>(num_nodes_));
+  out.write(reinterpret_cast<const char *>(nodes_), sizeof(Node) * num_nodes_);
+  out.write(reinterpret_cast<const char *>(points_), sizeof(Eigen::Vector3d) * num_points_);
+  out.write(reinterpret_cast<const char *>(point_ids_), sizeof(uint32_t) * num_points_);
+  if (!out.good())
+  {
+    std::cerr << "Error writing to file " << file_name << std::endl;
+    return false;
+  }
+  std::cout << "spatial index of " << num_points_ << " points saved to " << file_name << std::endl;
+  return true;
+}
+
+bool CloudIndex::load(const std::string &cloud_file_name)
+{
+  clear();
+  std::unique_ptr<MappedFile> file(new MappedFile);
+  const size_t header_size = sizeof(index_magic) + 4 * sizeof(uint64_t);
+  if (!file->open(fileName(cloud_file_name)) || file->size() < header_size)
+  {
+    return false;
+  }
+  const uint8_t *header = file->data(0, header_size);
+  if (std::memcmp(header, index_magic, sizeof(index_magic)) != 0)
+  {
+    return false;
+  }
+  uint64_t values[4];  // size, modified, number of points and number of nodes
+  std::memcpy(values, header + sizeof(index_magic), sizeof(values));
+  uint64_t file_size;
+  int64_t file_modified;
+  if (!fileStamp(cloud_file_name, file_size, file_modified) || values[0] != file_size ||
+      static_cast<int64_t>(values[1]) != file_modified)
+  {
+    return false;
+  }
+  const size_t num_points = static_cast<size_t>(values[2]);
+  const size_t num_nodes = static_cast<size_t>(values[3]);
+  const size_t points_offset = header_size + sizeof(Node) * num_nodes;
+  const size_t ids_offset = points_offset + sizeof(Eigen::Vector3d) * num_points;
+  if (file->size() != ids_offset + sizeof(uint32_t) * num_points)
+  {
+    std::cerr << "Error: index file " << fileName(cloud_file_name) << " is the wrong size" << std::endl;
+    return false;
+  }
+  const Node *nodes = reinterpret_cast<const Node *>(file->data(header_size, sizeof(Node) * num_nodes));
+  // the search follows the stored child and point ranges, so these must all be within the tables. Children are always
+  // stored after their parent, which also rules out cycles
+  for (size_t i = 0; i < num_nodes; i++)
+  {
+    const Node &node = nodes[i];
+    if (node.num_children > 8 ||
+        (node.num_children > 0 && (node.first_child <= i || static_cast<size_t>(node.first_child) + node.num_children > num_nodes)) ||
+        node.first_point > num_points || node.num_points > num_points - node.first_point)
+    {
+      std::cerr << "Error: index file " << fileName(cloud_file_name) << " has an invalid node " << i << std::endl;
+      return false;
+    }
+  }
+  nodes_ = nodes;
+  points_ =reinterpret_cast<const Eigen::Vector3d *>(file->data(points_offset, sizeof(Eigen::Vector3d) * num_points));
+  point_ids_ = reinterpret_cast<const uint32_t *>(file->data(ids_offset, sizeof(uint32_t) * num_points));
+  num_points_ = num_points;
+  num_nodes_ = num_nodes;
+  file_ = std::move(file);
+  return true;
+}
+
+bool CloudIndex::indexes(const std::vector<Eigen::Vector3d> &points, const std::vector<bool> *mask) const
+{
+  size_t num_masked = points.size();
+  if (mask)
+  {
+    num_masked = static_cast<size_t>(std::count(mask->begin(), mask->end(), true));
+  }
+  if (num_masked != num_points_)
+  {
+    return false;
+  }
+  // the ids are distinct, so it is enough to check that each indexed point is in the masked set
+  for (size_t i = 0; i < num_points_; i++)
+  {
+    const uint32_t id = point_ids_[i];
+    if (id >= points.size() || (mask && !(*mask)[id]) || points[id] != points_[i])
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void CloudIndex::knn(const Eigen::Vector3d &query, int search_size, double max_distance, std::vector<uint32_t> &ids,
+                     std::vector<double> &dists2) const
+{
+  ids.clear();
+  dists2.clear();
+  if (num_nodes_ == 0 || search_size <= 0)
+  {
+    return;
+  }
+  static thread_local KnnSearch search;
+  search.index = this;
+  search.query = query;
+  search.search_size = static_cast<size_t>(search_size);
+  search.max_distance2 = max_distance > 0.0 ? max_distance * max_distance : std::numeric_limits<double>::infinity();
+  search.heap.clear();
+  if (boxDistance2(nodes_[0], query) <= search.max_distance2)
+  {
+    search.search(nodes_[0]);
+  }
+  std::sort_heap(search.heap.begin(), search.heap.end());
+  for (auto &neighbour : search.heap)
+  {
+    ids.push_back(point_ids_[neighbour.second]);
+    dists2.push_back(neighbour.first);
+  }
+}
+
+}  // namespace ray
@@ -0,0 +1,93 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYCLOUDINDEX_H
+#define RAYLIB_RAYCLOUDINDEX_H
+
+#include "raylib/raylibconfig.h"
+#include "rayutils.h"
+
+#include <memory>
+
+namespace ray
+{
+class MappedFile;
+
+/// A spatial index of the bounded end points of a ray cloud, which can be saved alongside the cloud file (the cloud's
+/// file name with the suffix .index) and memory mapped by later tools, so they don't each rebuild a kd-tree of the
+/// same cloud. The points are sorted in Morton (Z) order, and split into an octree whose nodes each cover a
+/// contiguous range of the sorted points. As with the .stats sidecar, the saved index is only used while the cloud
+/// file's size and modification time match.
+class RAYLIB_EXPORT CloudIndex
+{
+public:
+  /// A node of the octree. The children of a node are contiguous in the node list
+  struct Node
+  {
+    Eigen::Vector3d min_bound, max_bound;  // bounds of the points within the node
+    uint64_t first_point;                  // index of the node's first point in the sorted point list
+    uint64_t num_points;
+    uint32_t first_child;
+    uint32_t num_children;  // 0 for a leaf node
+  };
+  /// nodes with no more than this many points are not split further
+  static const int kLeafSize = 32;
+
+  CloudIndex();
+  ~CloudIndex();
+  CloudIndex(const CloudIndex &) = delete;
+  CloudIndex &operator=(const CloudIndex &) = delete;
+
+  /// build the index of the @c points for which @c mask is true, or of all points when @c mask is null
+  void build(const std::vector<Eigen::Vector3d> &points, const std::vector<bool> *mask = nullptr);
+  /// build the index of the bounded end points of the ray cloud file @c cloud_file_name, and save it alongside
+  bool build(const std::string &cloud_file_name);
+
+  /// save the index alongside @c cloud_file_name. The cloud file must be complete and flushed
+  bool save(const std::string &cloud_file_name) const;
+  /// memory map the index saved alongside @c cloud_file_name. Returns false if it is missing or out of date
+  bool load(const std::string &cloud_file_name);
+
+  /// the index file name for a cloud file
+  static std::string fileName(const std::string &cloud_file_name) { return cloud_file_name + ".index"; }
+
+  /// whether this indexes exactly the @c points for which @c mask is true (or all points when @c mask is null)
+  bool indexes(const std::vector<Eigen::Vector3d> &points, const std::vector<bool> *mask = nullptr) const;
+
+  /// find up to @c search_size nearest indexed points to @c query that are no further than @c max_distance (0 for no
+  /// limit), in order of increasing distance. Points at the query position are not included, matching the default
+  /// kd-tree search. The results are the point indices passed to build(). This is thread safe
+  void knn(const Eigen::Vector3d &query, int search_size, double max_distance, std::vector<uint32_t> &ids,
+           std::vector<double> &dists2) const;
+
+  /// number of indexed points
+  inline size_t size() const { return num_points_; }
+  inline size_t numNodes() const { return num_nodes_; }
+  /// node 0 is the root
+  inline const Node &node(size_t i) const { return nodes_[i]; }
+  /// the indexed points, in Morton order
+  inline const Eigen::Vector3d &point(size_t i) const { return points_[i]; }
+  /// the index passed to build() of each point, in Morton order
+  inline uint32_t pointId(size_t i) const { return point_ids_[i]; }
+
+private:
+  void clear();
+
+  size_t num_points_;
+  size_t num_nodes_;
+  const Node *nodes_;
+  const Eigen::Vector3d *points_;
+  const uint32_t *point_ids_;
+  // storage when the index is built in memory
+  std::vector<Node> node_list_;
+  std::vector<Eigen::Vector3d> point_list_;
+  std::vector<uint32_t> point_id_list_;
+  // storage when the index is loaded
+  std::unique_ptr<MappedFile> file_;
+};
+
+}  // namespace ray
+
+#endif  // RAYLIB_RAYCLOUDINDEX_H
@@ -0,0 +1,303 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raycloudstats.h"
+
+#include <algorithm>
+#include <bitset>
+#include <cstring>
+#include <limits>
+
+namespace ray
+{
+namespace
+{
+const char stats_magic[8] = { 'R', 'A', 'Y', 'S', 'T', 'A', 'T', '1' };
+
+/// key of a 2D block of occupancy cells
+inline uint64_t blockKey(int x, int y)
+{
+  return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+}
+inline Eigen::Vector2i blockCoord(uint64_t key)
+{
+  return Eigen::Vector2i(static_cast<int32_t>(static_cast<uint32_t>(key >> 32)),
+                         static_cast<int32_t>(static_cast<uint32_t>(key)));
+}
+
+/// the block containing @c cell, rounding down for negative coordinates
+inline int blockIndex(int cell)
+{
+  return cell >= 0 ? cell / CloudStatistics::kOccupancyCellsPerBlock
+                   : -1 - (-1 - cell) / CloudStatistics::kOccupancyCellsPerBlock;
+}
+}  // namespace
+
+constexpr double CloudStatistics::kOccupancyWidth;
+
+CloudStatistics::CloudStatistics()
+{
+  clear();
+}
+
+void CloudStatistics::clear()
+{
+  const double min_s = std::numeric_limits<double>::max();
+  const double max_s = std::numeric_limits<double>::lowest();
+  ends_min = starts_min = rays_min = Eigen::Vector3d(min_s, min_s, min_s);
+  ends_max = starts_max = rays_max = Eigen::Vector3d(max_s, max_s, max_s);
+  num_rays = num_bounded = 0;
+  min_time = min_s;
+  max_time = max_s;
+  ends_sum.setZero();
+  start_pos.setZero();
+  end_pos.setZero();
+  min_colour = RGBA(255, 255, 255, 255);
+  max_colour = RGBA(0, 0, 0, 0);
+  min_ray_length = min_s;
+  max_ray_length = max_bounded_ray_length = max_s;
+  out_of_order = time_jumps = space_jumps = num_jumps = 0;
+  path_length = path_period = 0.0;
+  occupancy_.clear();
+  last_block_ = nullptr;
+  last_block_key_ = 0;
+  last_time_ = max_s;
+  last_start_.setZero();
+}
+
+void CloudStatistics::add(const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time, const RGBA &colour)
+{
+  const bool bounded = colour.alpha > 0;
+  num_rays++;
+  if (bounded)
+  {
+    ends_min = minVector(ends_min, end);
+    ends_max = maxVector(ends_max, end);
+    num_bounded++;
+    ends_sum += end;
+
+    // mark the occupied 2D cell
+    const int x = int(std::floor(end[0] / kOccupancyWidth));
+    const int y = int(std::floor(end[1] / kOccupancyWidth));
+    const int block_x = blockIndex(x), block_y = blockIndex(y);
+    const uint64_t key = blockKey(block_x, block_y);
+    if (!last_block_ || key != last_block_key_)
+    {
+      last_block_ = &occupancy_.emplace(key, OccupancyBits{ { 0, 0, 0, 0 } }).first->second;
+      last_block_key_ = key;
+    }
+    const int bit = (x - block_x * kOccupancyCellsPerBlock) * kOccupancyCellsPerBlock +
+                    (y - block_y * kOccupancyCellsPerBlock);
+    (*last_block_)[bit >> 6] |= uint64_t(1) << (bit & 63);
+  }
+  starts_min = minVector(starts_min, start);
+  starts_max = maxVector(starts_max, start);
+  rays_min = minVector(rays_min, minVector(start, end));
+  rays_max = maxVector(rays_max, maxVector(start, end));
+  if (time < min_time)
+  {
+    start_pos = start;
+  }
+  min_time = std::min(min_time, time);
+  if (time > max_time)
+  {
+    end_pos = start;
+  }
+  max_time = std::max(max_time, time);
+
+  // discontinuities in the sensor location and time stamp
+  if (last_time_ != std::numeric_limits<double>::lowest())
+  {
+    if (time < last_time_)
+    {
+      out_of_order++;
+    }
+    const double distance = (start - last_start_).norm();
+    const double time_delta = std::abs(time - last_time_);
+    const bool time_jump = time_delta > 1.00001;
+    const bool space_jump = distance > 1.00001;
+    if (time_jump || space_jump)
+    {
+      time_jumps += time_jump ? 1 : 0;
+      space_jumps += space_jump ? 1 : 0;
+      num_jumps++;
+    }
+    else
+    {
+      path_length += distance;
+      path_period += time_delta;
+    }
+  }
+  last_start_ = start;
+  last_time_ = time;
+
+  const double ray_length = (end - start).norm();
+  min_ray_length = std::min(min_ray_length, ray_length);
+  max_ray_length = std::max(max_ray_length, ray_length);
+  if (bounded)
+  {
+    max_bounded_ray_length = std::max(max_bounded_ray_length, ray_length);
+    min_colour.red = std::min(min_colour.red, colour.red);
+    min_colour.green = std::min(min_colour.green, colour.green);
+    min_colour.blue = std::min(min_colour.blue, colour.blue);
+    min_colour.alpha = std::min(min_colour.alpha, colour.alpha);
+    max_colour.red = std::max(max_colour.red, colour.red);
+    max_colour.green = std::max(max_colour.green, colour.green);
+    max_colour.blue = std::max(max_colour.blue, colour.blue);
+    max_colour.alpha = std::max(max_colour.alpha, colour.alpha);
+  }
+  else
+  {
+    min_colour.alpha = 0;
+  }
+}
+
+void CloudStatistics::add(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                          const std::vector<double> &times, const std::vector<RGBA> &colours)
+{
+  for (size_t i = 0; i < ends.size(); i++)
+  {
+    add(starts[i], ends[i], times[i], colours[i]);
+  }
+}
+
+size_t CloudStatistics::numOccupiedCells() const
+{
+  size_t count = 0;
+  for (auto &block : occupancy_)
+  {
+    for (auto &bits : block.second)
+    {
+      count += static_cast<size_t>(std::bitset<64>(bits).count());
+    }
+  }
+  return count;
+}
+
+std::vector<Eigen::Vector2i> CloudStatistics::occupiedBlocks() const
+{
+  std::vector<Eigen::Vector2i> blocks;
+  blocks.reserve(occupancy_.size());
+  for (auto &block : occupancy_)
+  {
+    blocks.push_back(blockCoord(block.first));
+  }
+  std::sort(blocks.begin(), blocks.end(), [](const Eigen::Vector2i &a, const Eigen::Vector2i &b) {
+    return a[0] != b[0] ? a[0] < b[0] : a[1] < b[1];
+  });
+  return blocks;
+}
+
+bool CloudStatistics::save(const std::string &cloud_file_name) const
+{
+  uint64_t size;
+  int64_t modified;
+  if (!fileStamp(cloud_file_name, size, modified))
+  {
+    return false;
+  }
+  const std::string file_name = fileName(cloud_file_name);
+  std::ofstream out(file_name.c_str(), std::ios::binary | std::ios::out);
+  out.write(stats_magic, sizeof(stats_magic));
+  writePlainOldData(out, size);
+  writePlainOldData(out, modified);
+  writePlainOldData(out, ends_min);
+  writePlainOldData(out, ends_max);
+  writePlainOldData(out, starts_min);
+  writePlainOldData(out, starts_max);
+  writePlainOldData(out, rays_min);
+  writePlainOldData(out, rays_max);
+  writePlainOldData(out, num_rays);
+  writePlainOldData(out, num_bounded);
+  writePlainOldData(out, min_time);
+  writePlainOldData(out, max_time);
+  writePlainOldData(out, ends_sum);
+  writePlainOldData(out, start_pos);
+  writePlainOldData(out, end_pos);
+  writePlainOldData(out, min_colour);
+  writePlainOldData(out, max_colour);
+  writePlainOldData(out, min_ray_length);
+  writePlainOldData(out, max_ray_length);
+  writePlainOldData(out, max_bounded_ray_length);
+  writePlainOldData(out, out_of_order);
+  writePlainOldData(out, time_jumps);
+  writePlainOldData(out, space_jumps);
+  writePlainOldData(out, num_jumps);
+  writePlainOldData(out, path_length);
+  writePlainOldData(out, path_period);
+  writePlainOldData(out, static_cast<uint64_t>(occupancy_.size()));
+  for (auto &block : occupancy_)
+  {
+    writePlainOldData(out, block.first);
+    writePlainOldData(out, block.second);
+  }
+  if (out.fail())
+  {
+    std::cerr << "Warning: cannot write statistics file " << file_name << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool CloudStatistics::load(const std::string &cloud_file_name)
+{
+  std::ifstream in(fileName(cloud_file_name).c_str(), std::ios::binary | std::ios::in);
+  char magic[sizeof(stats_magic)];
+  if (!in || !in.read(magic, sizeof(magic)) || std::memcmp(magic, stats_magic, sizeof(magic)) != 0)
+  {
+    return false;
+  }
+  uint64_t size, file_size;
+  int64_t modified, file_modified;
+  readPlainOldData(in, size);
+  readPlainOldData(in, modified);
+  if (!fileStamp(cloud_file_name, file_size, file_modified) || size != file_size || modified != file_modified)
+  {
+    return false;
+  }
+  clear();
+  readPlainOldData(in, ends_min);
+  readPlainOldData(in, ends_max);
+  readPlainOldData(in, starts_min);
+  readPlainOldData(in, starts_max);
+  readPlainOldData(in, rays_min);
+  readPlainOldData(in, rays_max);
+  readPlainOldData(in, num_rays);
+  readPlainOldData(in, num_bounded);
+  readPlainOldData(in, min_time);
+  readPlainOldData(in, max_time);
+  readPlainOldData(in, ends_sum);
+  readPlainOldData(in, start_pos);
+  readPlainOldData(in, end_pos);
+  readPlainOldData(in, min_colour);
+  readPlainOldData(in, max_colour);
+  readPlainOldData(in, min_ray_length);
+  readPlainOldData(in, max_ray_length);
+  readPlainOldData(in, max_bounded_ray_length);
+  readPlainOldData(in, out_of_order);
+  readPlainOldData(in, time_jumps);
+  readPlainOldData(in, space_jumps);
+  readPlainOldData(in, num_jumps);
+  readPlainOldData(in, path_length);
+  readPlainOldData(in, path_period);
+  uint64_t num_blocks = 0;
+  readPlainOldData(in, num_blocks);
+  for (uint64_t i = 0; i < num_blocks && in; i++)
+  {
+    uint64_t key;
+    OccupancyBits bits;
+    readPlainOldData(in, key);
+    readPlainOldData(in, bits);
+    occupancy_[key] = bits;
+  }
+  if (!in)
+  {
+    clear();
+    return false;
+  }
+  return true;
+}
+
+}  // namespace ray
@@ -0,0 +1,84 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYCLOUDSTATS_H
+#define RAYLIB_RAYCLOUDSTATS_H
+
+#include "raylib/raylibconfig.h"
+#include "rayutils.h"
+
+#include <array>
+#include <unordered_map>
+
+namespace ray
+{
+/// Summary statistics of a ray cloud file. These are accumulated as the file is written, and saved alongside it in a
+/// sidecar file (the cloud's file name with the suffix .stats), so the bounds, counts and ranges of a cloud can be
+/// found without reading it. The sidecar is only used while the cloud file's size and modification time match.
+class RAYLIB_EXPORT CloudStatistics
+{
+public:
+  /// width of the 2D cells used to measure the area covered by end points
+  static constexpr double kOccupancyWidth = 0.5;
+  /// the coarse occupancy map has cells of kOccupancyCellsPerBlock*kOccupancyWidth (8 m) in width
+  static const int kOccupancyCellsPerBlock = 16;
+
+  CloudStatistics();
+  CloudStatistics(const CloudStatistics &) = delete;
+  CloudStatistics &operator=(const CloudStatistics &) = delete;
+  void clear();
+
+  /// add a single ray. The rays should be added in the order they are stored in the file
+  void add(const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time, const RGBA &colour);
+  /// add a set of rays
+  void add(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+           const std::vector<double> &times, const std::vector<RGBA> &colours);
+
+  /// save the sidecar for @c cloud_file_name. The cloud file must be complete and flushed
+  bool save(const std::string &cloud_file_name) const;
+  /// load the sidecar for @c cloud_file_name. Returns false if it is missing or out of date
+  bool load(const std::string &cloud_file_name);
+
+  /// the sidecar file name for a cloud file
+  static std::string fileName(const std::string &cloud_file_name) { return cloud_file_name + ".stats"; }
+
+  /// number of kOccupancyWidth 2D cells that contain a bounded end point
+  size_t numOccupiedCells() const;
+  /// the 2D blocks (of kOccupancyCellsPerBlock cells in width) that contain a bounded end point, in ascending order
+  std::vector<Eigen::Vector2i> occupiedBlocks() const;
+
+  // bounds of the bounded end points, all start points, and all ray extents
+  Eigen::Vector3d ends_min, ends_max;
+  Eigen::Vector3d starts_min, starts_max;
+  Eigen::Vector3d rays_min, rays_max;
+  uint64_t num_rays;
+  uint64_t num_bounded;
+  double min_time, max_time;
+  Eigen::Vector3d ends_sum;            // sum of the bounded end points, for the centroid
+  Eigen::Vector3d start_pos, end_pos;  // ray starts at the minimum and maximum times
+  RGBA min_colour, max_colour;         // range of the bounded rays' colours, min_colour alpha is 0 if any are unbounded
+  double min_ray_length, max_ray_length, max_bounded_ray_length;
+
+  // continuity of the sensor path, in the order of the rays in the file
+  uint64_t out_of_order;  // number of rays with an earlier time than the previous ray
+  uint64_t time_jumps;    // number of gaps of more than 1 s between consecutive rays
+  uint64_t space_jumps;   // number of gaps of more than 1 m between consecutive ray starts
+  uint64_t num_jumps;     // number of consecutive ray pairs with either type of gap
+  double path_length;     // length of the sensor path, excluding the jumps
+  double path_period;     // duration of the sensor path, excluding the jumps
+
+private:
+  using OccupancyBits = std::array<uint64_t, 4>;  // 16x16 cells
+  /// occupancy of kOccupancyWidth cells, grouped into blocks. Indexed by the block's packed x,y coordinates
+  std::unordered_map<uint64_t, OccupancyBits> occupancy_;
+  OccupancyBits *last_block_;
+  uint64_t last_block_key_;
+  double last_time_;
+  Eigen::Vector3d last_start_;
+};
+
+}  // namespace ray
+
+#endif  // RAYLIB_RAYCLOUDSTATS_H
@@ -0,0 +1,380 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raycloudstream.h"
+#include "raycloudstats.h"
+#include "raycloudwriter.h"
+#include "raylaz.h"
+#include "raysplitter.h"
+
+#include <iostream>
+
+namespace ray
+{
+/// A single per-ray operation in the stream. Only the member for its type is set
+struct CloudStream::Node
+{
+  Transform transform;
+  Predicate keep;
+  Predicate is_outside;
+  Splitter splitter;
+  std::unique_ptr<CloudStream> branch;  // destination of the rays that are split off
+  Cloud inside, outside;                // the parts of the current ray from the splitter
+};
+
+namespace
+{
+// place the red green blue spectrum into the RGBA structure
+inline void spectrumRGB(double value, RGBA &colour)
+{
+  const Eigen::Vector3d col = redGreenBlueSpectrum(value);
+  colour.red = static_cast<uint8_t>(255.0 * col[0]);
+  colour.green = static_cast<uint8_t>(255.0 * col[1]);
+  colour.blue = static_cast<uint8_t>(255.0 * col[2]);
+}
+}  // namespace
+
+CloudStream::CloudStream() {}
+
+CloudStream::~CloudStream() {}
+
+CloudStream &CloudStream::transform(const Transform &transform)
+{
+  nodes_.emplace_back(new Node);
+  nodes_.back()->transform = transform;
+  return *this;
+}
+
+CloudStream &CloudStream::filter(const Predicate &keep)
+{
+  nodes_.emplace_back(new Node);
+  nodes_.back()->keep = keep;
+  return *this;
+}
+
+CloudStream &CloudStream::split(const Predicate &is_outside)
+{
+  nodes_.emplace_back(new Node);
+  nodes_.back()->is_outside = is_outside;
+  nodes_.back()->branch.reset(new CloudStream);
+  return *nodes_.back()->branch;
+}
+
+CloudStream &CloudStream::splitRays(const Splitter &splitter)
+{
+  nodes_.emplace_back(new Node);
+  nodes_.back()->splitter = splitter;
+  nodes_.back()->branch.reset(new CloudStream);
+  return *nodes_.back()->branch;
+}
+
+CloudStream &CloudStream::translate(const Eigen::Vector3d &offset, double time_delta)
+{
+  return transform([offset, time_delta](Eigen::Vector3d &start, Eigen::Vector3d &end, double &time, RGBA &) {
+    start += offset;
+    end += offset;
+    time += time_delta;
+  });
+}
+
+CloudStream &CloudStream::rotate(const Eigen::Quaterniond &rotation)
+{
+  return transform([rotation](Eigen::Vector3d &start, Eigen::Vector3d &end, double &, RGBA &) {
+    start = rotation * start;
+    end = rotation * end;
+  });
+}
+
+CloudStream &CloudStream::colourByTime()
+{
+  return transform([](Eigen::Vector3d &, Eigen::Vector3d &, double &time, RGBA &colour) {
+    const double colour_repeat_period = 60.0;  // repeating per minute gives a quick way to assess the scan length
+    spectrumRGB(time / colour_repeat_period, colour);
+  });
+}
+
+CloudStream &CloudStream::colourByHeight()
+{
+  return transform([](Eigen::Vector3d &, Eigen::Vector3d &end, double &, RGBA &colour) {
+    const double wavelength = 10.0;
+    spectrumRGB(end[2] / wavelength, colour);
+  });
+}
+
+CloudStream &CloudStream::colourByAlpha()
+{
+  return transform([](Eigen::Vector3d &, Eigen::Vector3d &, double &, RGBA &colour) {
+    const Eigen::Vector3d col_vec = redGreenBlueGradient(colour.alpha / 255.0);
+    colour.red = uint8_t(255.0 * col_vec[0]);
+    colour.green = uint8_t(255.0 * col_vec[1]);
+    colour.blue = uint8_t(255.0 * col_vec[2]);
+  });
+}
+
+CloudStream &CloudStream::setColour(const RGBA &new_colour)
+{
+  return transform([new_colour](Eigen::Vector3d &, Eigen::Vector3d &, double &, RGBA &colour) {
+    colour.red = new_colour.red;
+    colour.green = new_colour.green;
+    colour.blue = new_colour.blue;
+  });
+}
+
+CloudStream &CloudStream::setAlpha(uint8_t alpha)
+{
+  return transform([alpha](Eigen::Vector3d &, Eigen::Vector3d &, double &, RGBA &colour) { colour.alpha = alpha; });
+}
+
+CloudStream &CloudStream::decimateTemporal(int num_rays)
+{
+  auto count = std::make_shared<size_t>(0);
+  const size_t decimation = static_cast<size_t>(num_rays);
+  return filter([count, decimation](const Eigen::Vector3d &, const Eigen::Vector3d &, double, const RGBA &) {
+    return (*count)++ % decimation == 0;
+  });
+}
+
+CloudStream &CloudStream::splitPlane(const Eigen::Vector3d &plane)
+{
+  return splitRays([plane](const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time, const RGBA &colour,
+                           Cloud &inside, Cloud &outside) {
+    splitRayPlane(plane, start, end, time, colour, inside, outside);
+  });
+}
+
+CloudStream &CloudStream::splitBox(const Eigen::Vector3d &centre, const Eigen::Vector3d &extents)
+{
+  const Cuboid cuboid(centre - extents, centre + extents);
+  return splitRays([cuboid](const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time, const RGBA &colour,
+                            Cloud &inside, Cloud &outside) {
+    splitRayBox(cuboid, start, end, time, colour, inside, outside);
+  });
+}
+
+CloudStream &CloudStream::splitCapsule(const Eigen::Vector3d &end1, const Eigen::Vector3d &end2, double radius)
+{
+  return splitRays([end1, end2, radius](const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time,
+                                        const RGBA &colour, Cloud &inside, Cloud &outside) {
+    splitRayCapsule(end1, end2, radius, start, end, time, colour, inside, outside);
+  });
+}
+
+CloudStream &CloudStream::write(const std::string &file_name)
+{
+  auto writer = std::make_shared<CloudWriter>();
+  Sink sink;
+  sink.begin = [writer, file_name]() { return writer->begin(file_name); };
+  sink.write = [writer](const Cloud &chunk) { return writer->writeChunk(chunk); };
+  sink.end = [writer]() 
+  {
+    writer->end();
+    return true;
+  };
+  sinks_.push_back(sink);
+  return *this;
+}
+
+CloudStream &CloudStream::writeLas(const std::string &file_name)
+{
+  auto writer = std::make_shared<std::unique_ptr<LasWriter>>();  // constructed by begin, as it opens the file
+  Sink sink;
+  sink.begin = [writer, file_name]() 
+  {
+    writer->reset(new LasWriter(file_name));
+    return (*writer)->isOpen();
+  };
+  sink.write = [writer](const Cloud &chunk) { return (*writer)->writeChunk(chunk.ends, chunk.times, chunk.colours); };
+  sink.end = [writer]() { return (*writer)->end(); };
+  sinks_.push_back(sink);
+  return *this;
+}
+
+CloudStream &CloudStream::statistics(CloudStatistics &stats)
+{
+  CloudStatistics *stats_ptr = &stats;
+  Sink sink;
+  sink.begin = [stats_ptr]() 
+  {
+    stats_ptr->clear();
+    return true;
+  };
+  sink.write = [stats_ptr](const Cloud &chunk) 
+  {
+    stats_ptr->add(chunk.starts, chunk.ends, chunk.times, chunk.colours);
+    return true;
+  };
+  sink.end = []() { return true; };
+  sinks_.push_back(sink);
+  return *this;
+}
+
+CloudStream &CloudStream::sink(const ChunkSink &chunk_sink)
+{
+  Sink sink;
+  sink.begin = sink.end = []() { return true; };
+  sink.write = chunk_sink;
+  sinks_.push_back(sink);
+  return *this;
+}
+
+bool CloudStream::transformRay(Eigen::Vector3d &start, Eigen::Vector3d &end, double &time, RGBA &colour)
+{
+  for (auto &node : nodes_)
+  {
+    if (node->transform)
+      node->transform(start, end, time, colour);
+    else if (!node->keep(start, end, time, colour))
+      return false;
+  }
+  return true;
+}
+
+void CloudStream::processRay(size_t first_node, Eigen::Vector3d start, Eigen::Vector3d end, double time,
+                             RGBA colour)
+{
+  for (size_t n = first_node; n < nodes_.size(); n++)
+  {
+    Node &node = *nodes_[n];
+    if (node.transform)
+    {
+      node.transform(start, end, time, colour);
+    }
+    else if (node.keep)
+    {
+      if (!node.keep(start, end, time, colour))
+        return;
+    }
+    else if (node.is_outside)
+    {
+      if (node.is_outside(start, end, time, colour))
+      {
+        node.branch->processRay(0, start, end, time, colour);
+        return;
+      }
+    }
+    else  // a splitter, whose outside parts go down the branch and inside parts continue down this stream
+    {
+      node.inside.clear();
+      node.outside.clear();
+      node.splitter(start, end, time, colour, node.inside, node.outside);
+      for (size_t i = 0; i < node.outside.ends.size(); i++)
+      {
+        node.branch->processRay(0, node.outside.starts[i], node.outside.ends[i], node.outside.times[i],
+                                node.outside.colours[i]);
+      }
+      for (size_t i = 0; i < node.inside.ends.size(); i++)
+      {
+        processRay(n + 1, node.inside.starts[i], node.inside.ends[i], node.inside.times[i], node.inside.colours[i]);
+      }
+      return;
+    }
+  }
+  chunk_.addRay(start, end, time, colour);
+}
+
+bool CloudStream::beginSinks()
+{
+  bool success = true;
+  for (auto &sink : sinks_)
+  {
+    success &= sink.begin();
+  }
+  for (auto &node : nodes_)
+  {
+    if (node->branch)
+      success &= node->branch->beginSinks();
+  }
+  return success;
+}
+
+bool CloudStream::flushSinks()
+{
+  bool success = true;
+  for (auto &sink : sinks_)
+  {
+    success &= sink.write(chunk_);
+  }
+  chunk_.clear();
+  for (auto &node : nodes_)
+  {
+    if (node->branch)
+      success &= node->branch->flushSinks();
+  }
+  return success;
+}
+
+bool CloudStream::endSinks()
+{
+  bool success = true;
+  for (auto &sink : sinks_)
+  {
+    success &= sink.end();
+  }
+  for (auto &node : nodes_)
+  {
+    if (node->branch)
+      success &= node->branch->endSinks();
+  }
+  return success;
+}
+
+bool CloudStream::run(const std::string &file_name)
+{
+  if (!beginSinks())
+    return false;
+  bool has_branches = false;
+  for (auto &node : nodes_)
+  {
+    has_branches |= node->branch != nullptr;
+  }
+  bool sinks_ok = true;
+  auto per_chunk = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                       std::vector<double> &times, std::vector<RGBA> &colours) {
+    if (has_branches)
+    {
+      for (size_t i = 0; i < ends.size(); i++)
+      {
+        processRay(0, starts[i], ends[i], times[i], colours[i]);
+      }
+    }
+    else  // only transforms and filters, so the chunk can be modified and compacted in place
+    {
+      size_t num_kept = 0;
+      for (size_t i = 0; i < ends.size(); i++)
+      {
+        if (!transformRay(starts[i], ends[i], times[i], colours[i]))
+          continue;
+        if (num_kept != i)
+        {
+          starts[num_kept] = starts[i];
+          ends[num_kept] = ends[i];
+          times[num_kept] = times[i];
+          colours[num_kept] = colours[i];
+        }
+        num_kept++;
+      }
+      chunk_.starts.swap(starts);
+      chunk_.ends.swap(ends);
+      chunk_.times.swap(times);
+      chunk_.colours.swap(colours);
+      chunk_.resize(num_kept);
+      sinks_ok &= flushSinks();
+      chunk_.starts.swap(starts);  // return the buffers, so the reader can reuse their memory
+      chunk_.ends.swap(ends);
+      chunk_.times.swap(times);
+      chunk_.colours.swap(colours);
+      return;
+    }
+    sinks_ok &= flushSinks();
+  };
+  if (!Cloud::read(file_name, per_chunk))
+  {
+    endSinks();  // close the outputs, even though they are incomplete
+    return false;
+  }
+  return endSinks() && sinks_ok;
+}
+
+}  // namespace ray
@@ -0,0 +1,115 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYCLOUDSTREAM_H
+#define RAYLIB_RAYCLOUDSTREAM_H
+
+#include "raylib/raylibconfig.h"
+#include "raycloud.h"
+
+#include <functional>
+#include <memory>
+
+namespace ray
+{
+class CloudStatistics;
+
+/// A graph of per-ray operations that is streamed over a ray cloud file one chunk at a time. The transform, filter and
+/// split nodes are applied in the order they are added, fused into a single loop over each chunk, and the resulting
+/// rays are passed to any number of sinks. So a chain such as translate, rotate, crop, colour and split costs one read
+/// of the input file. For example:
+///   CloudStream stream;
+///   CloudStream &late = stream.translate(offset).rotate(rotation).colourByHeight().split(is_late);
+///   stream.write("early.ply");
+///   late.write("late.ply");
+///   stream.run("cloud.ply");
+class RAYLIB_EXPORT CloudStream
+{
+public:
+  /// modifies a ray in place
+  using Transform = std::function<void(Eigen::Vector3d &start, Eigen::Vector3d &end, double &time, RGBA &colour)>;
+  /// a test on a single ray
+  using Predicate =
+    std::function<bool(const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time, const RGBA &colour)>;
+  /// adds the parts of a ray to @c inside and @c outside, allowing rays to be cut in two
+  using Splitter = std::function<void(const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time,
+                                      const RGBA &colour, Cloud &inside, Cloud &outside)>;
+  /// receives the rays that reach the end of the stream, one chunk at a time
+  using ChunkSink = std::function<bool(const Cloud &chunk)>;
+
+  CloudStream();
+  ~CloudStream();
+  CloudStream(const CloudStream &) = delete;
+  CloudStream &operator=(const CloudStream &) = delete;
+
+  /// apply @c transform to each ray
+  CloudStream &transform(const Transform &transform);
+  /// only pass on the rays for which @c keep is true
+  CloudStream &filter(const Predicate &keep);
+  /// rays for which @c is_outside is true leave this stream and go to the returned branch
+  CloudStream &split(const Predicate &is_outside);
+  /// the inside parts of each ray from @c splitter continue along this stream, and the outside parts go to the
+  /// returned branch
+  CloudStream &splitRays(const Splitter &splitter);
+
+  // Common nodes, matching the raycloudtools of the same name
+  CloudStream &translate(const Eigen::Vector3d &offset, double time_delta = 0.0);
+  CloudStream &rotate(const Eigen::Quaterniond &rotation);
+  /// colour with a spectrum that repeats every minute
+  CloudStream &colourByTime();
+  /// colour with a spectrum that repeats every 10 metres in height
+  CloudStream &colourByHeight();
+  /// colour with a red to blue gradient on the alpha (intensity) value
+  CloudStream &colourByAlpha();
+  /// set the red, green and blue values, leaving alpha unchanged
+  CloudStream &setColour(const RGBA &colour);
+  /// set the alpha value. An alpha of 0 makes every ray unbounded
+  CloudStream &setAlpha(uint8_t alpha);
+  /// keep every @c num_rays ray, counted over the whole file
+  CloudStream &decimateTemporal(int num_rays);
+  /// splits around the plane @c plane, as in @c splitPlane(). Returns the branch on the far side of the plane
+  CloudStream &splitPlane(const Eigen::Vector3d &plane);
+  /// crops to the box of half-width @c extents around @c centre. Returns the branch outside the box
+  CloudStream &splitBox(const Eigen::Vector3d &centre, const Eigen::Vector3d &extents);
+  /// crops to a capsule between @c end1 and @c end2. Returns the branch outside the capsule
+  CloudStream &splitCapsule(const Eigen::Vector3d &end1, const Eigen::Vector3d &end2, double radius);
+
+  /// save the rays reaching this point as a ray cloud file
+  CloudStream &write(const std::string &file_name);
+  /// save the end points reaching this point as a .las or .laz file
+  CloudStream &writeLas(const std::string &file_name);
+  /// accumulate the statistics of the rays reaching this point into @c stats
+  CloudStream &statistics(CloudStatistics &stats);
+  /// pass the rays reaching this point to @c chunk_sink, one chunk at a time
+  CloudStream &sink(const ChunkSink &chunk_sink);
+
+  /// stream the ray cloud @c file_name through the graph. Returns false if the file or any sink fails
+  bool run(const std::string &file_name);
+
+private:
+  struct Node;
+  struct Sink
+  {
+    std::function<bool()> begin;
+    ChunkSink write;
+    std::function<bool()> end;
+  };
+
+  /// apply the transforms and filters of a stream that has no splits, returns false if the ray is filtered out
+  bool transformRay(Eigen::Vector3d &start, Eigen::Vector3d &end, double &time, RGBA &colour);
+  /// pass a ray through the nodes from @c first_node onwards, adding the result to this stream or its branches
+  void processRay(size_t first_node, Eigen::Vector3d start, Eigen::Vector3d end, double time, RGBA colour);
+  bool beginSinks();
+  bool flushSinks();
+  bool endSinks();
+
+  std::vector<std::unique_ptr<Node>> nodes_;
+  std::vector<Sink> sinks_;
+  Cloud chunk_;  // the rays reaching the end of this stream for the current chunk
+};
+
+}  // namespace ray
+
+#endif  // RAYLIB_RAYCLOUDSTREAM_H
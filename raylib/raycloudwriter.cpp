@@ -17,6 +17,8 @@ bool CloudWriter::begin(const std::string &file_name)
   }
   has_warned_ = false;
   file_name_ = file_name;
+  stats_.clear();
+  telemetry_.reset(new TelemetryPhase("CloudWriter"));
   if (!writeRayCloudChunkStart(file_name_, ofs_))
   {
     return false;
@@ -30,14 +32,22 @@ void CloudWriter::end()
   {
     return;
   }
-  const unsigned long num_rays = ray::writeRayCloudChunkEnd(ofs_);
+  const unsigned long num_rays = ray::writeRayCloudChunkEnd(ofs_, file_name_, &stats_);
   std::cout << num_rays << " rays saved to " << file_name_ << std::endl;
+  if (telemetry_)
+  {
+    telemetry_->addRays(num_rays);
+    ofs_.seekp(0, std::ios::end);
+    telemetry_->addBytes(static_cast<size_t>(ofs_.tellp()));
+    telemetry_.reset();
+  }
   ofs_.close();
 }
 
 bool CloudWriter::writeChunk(const Cloud &chunk)
 {
-  return writeRayCloudChunk(ofs_, buffer_, chunk.starts, chunk.ends, chunk.times, chunk.colours, has_warned_);
+  return writeRayCloudChunk(ofs_, buffer_, chunk.starts, chunk.ends, chunk.times, chunk.colours, has_warned_,
+                            &stats_);
 }
 
 
@@ -8,6 +8,9 @@
 
 #include "raylib/raylibconfig.h"
 #include "rayply.h"
+#include "raytelemetry.h"
+
+#include <memory>
 
 namespace ray
 {
@@ -26,7 +29,7 @@ public:
   bool writeChunk(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends, std::vector<double> &times,
                   std::vector<RGBA> &colours)
   {
-    return writeRayCloudChunk(ofs_, buffer_, starts, ends, times, colours, has_warned_);
+    return writeRayCloudChunk(ofs_, buffer_, starts, ends, times, colours, has_warned_, &stats_);
   }
 
   /// finish writing, and adjust the vertex count at the start.
@@ -44,6 +47,10 @@ private:
   RayPlyBuffer buffer_;
   /// whether a warning has been issued or not. This prevents multiple warnings.
   bool has_warned_;
+  /// statistics of the rays written, saved alongside the file by end()
+  CloudStatistics stats_;
+  /// records the time from begin() to end(), when telemetry is enabled
+  std::unique_ptr<TelemetryPhase> telemetry_;
 };
 
 }  // namespace ray
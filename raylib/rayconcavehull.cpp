@@ -14,9 +14,16 @@
 #include <libqhullcpp/QhullPoints.h>
 #include <libqhullcpp/QhullRidge.h>
 #include <libqhullcpp/QhullVertexSet.h>
+#include <algorithm>
+#include <array>
+#include <limits>
 #include <map>
 #include <unordered_map>
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 #ifdef __unix__
 #include <cstdio>
 #include <sys/time.h>
@@ -31,18 +38,32 @@ namespace ray
 {
 static const double deadFace = 1e10;
 
-class Hasher
+/// Hash of an edge's (ordered) vertex pair. Summing the ids maps all edges with the same id sum into one bucket, so
+/// the ids are packed into 64 bits and mixed with the 64-bit finaliser of MurmurHash3
+class EdgeHasher
 {
 public:
-  size_t operator()(const Eigen::Vector2i &key) const { return key[0] + key[1]; }
+  size_t operator()(const Eigen::Vector2i &key) const
+  {
+    uint64_t h = (static_cast<uint64_t>(static_cast<uint32_t>(key[0])) << 32) | static_cast<uint32_t>(key[1]);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h);
+  }
 };
 
-ConcaveHull::ConcaveHull(const std::vector<Eigen::Vector3d> &points)
+ConcaveHull::ConcaveHull(const std::vector<Eigen::Vector3d> &points, bool verbose)
+  : new_tri_count_(0)
+  , verbose_(verbose)
 {
   centre_ = mean(points);
-  std::unordered_map<Eigen::Vector2i, int, Hasher> edgeLookup(points.size() * 2);
+  std::unordered_map<Eigen::Vector2i, int, EdgeHasher> edgeLookup(points.size() * 2);
 
-  std::cout << "number of points: " << points.size() << std::endl;
+  if (verbose_)
+    std::cout << "number of points: " << points.size() << std::endl;
   vertices_ = points;
   vertex_on_surface_.resize(vertices_.size());
   for (int i = 0; i < (int)vertex_on_surface_.size(); i++) vertex_on_surface_[i] = false;
@@ -56,13 +77,14 @@ ConcaveHull::ConcaveHull(const std::vector<Eigen::Vector3d> &points)
   }
 
   orgQhull::Qhull hull;
-  hull.setOutputStream(&std::cout);
+  hull.setOutputStream(verbose_ ? &std::cout : nullptr);
   hull.runQhull("", 3, int(points.size()), coordinates.data(), "d Qbb Qt");
 
   orgQhull::QhullFacetList facets = hull.facetList();
   int maxFacets = 0;
   for (const orgQhull::QhullFacet &f : facets) maxFacets = std::max(maxFacets, f.id() + 1);
-  std::cout << "number of total facets: " << facets.size() << std::endl;
+  if (verbose_)
+    std::cout << "number of total facets: " << facets.size() << std::endl;
   tetrahedra_.resize(maxFacets);
 
   int maxTris = 0;
@@ -74,7 +96,8 @@ ConcaveHull::ConcaveHull(const std::vector<Eigen::Vector3d> &points)
     for (const orgQhull::QhullRidge &r : f.ridges()) maxTris = std::max(maxTris, r.id() + 1);
   }
   triangles_.resize(maxTris);
-  std::cout << "maximum number of triangles: " << maxTris << std::endl;
+  if (verbose_)
+    std::cout << "maximum number of triangles: " << maxTris << std::endl;
 
   int c = 0;
   for (const orgQhull::QhullFacet &f : facets)
@@ -154,7 +177,8 @@ ConcaveHull::ConcaveHull(const std::vector<Eigen::Vector3d> &points)
 
     c++;
   }
-  std::cout << "number of tetrahedrons: " << c << std::endl;
+  if (verbose_)
+    std::cout << "number of tetrahedrons: " << c << std::endl;
 }
 
 double ConcaveHull::circumcurvature(const ConcaveHull::Tetrahedron &tetra, int triangleID)
@@ -226,8 +250,6 @@ double ConcaveHull::circumcurvature(const ConcaveHull::Tetrahedron &tetra, int t
   return 1.0 / circumradius;
 }
 
-static int newTriCount = 0;
-
 bool ConcaveHull::growFront(double maxCurvature)
 {
   SurfaceFace face = *surface_.begin();
@@ -296,7 +318,7 @@ bool ConcaveHull::growFront(double maxCurvature)
     return true;
   }
 
-  newTriCount++;
+  new_tri_count_++;
   for (int i = 0; i < 4; i++)
   {
     if (tetra.triangles[i] == face.triangle || (numFaceIntersects == 1 && i == faceIntersects))
@@ -322,7 +344,7 @@ void ConcaveHull::growSurface(double maxCurvature)
 {
   do
   {
-    if (!(newTriCount % 1600))
+    if (verbose_ && !(new_tri_count_ % 1600))
     {
       std::cout << "max curvature of structure: " << surface_.begin()->curvature << std::endl;
       std::vector<std::vector<Eigen::Vector3d>> tris;
@@ -453,8 +475,230 @@ void ConcaveHull::convertToMesh()
       num_bads++;
     mesh_.indexList().push_back(tri_verts);
   }
-  if (num_bads > 0)
+  if (verbose_ && num_bads > 0)
     std::cout << "number of surfaces that didn't have enough information to orient: " << num_bads << std::endl;
 }
+
+namespace
+{
+const int kNoSeam = std::numeric_limits<int>::min();
+
+/// A vertex of a hull triangle that has been clipped to a tile. Its @c key identifies it independently of the tile:
+/// {id, -1, -1, -1, 0, 0} for an original vertex, {a, b, -1, axis, seam, 0} where the edge from vertex a to b crosses
+/// a seam, and {a, b, c, 2, x seam, y seam} where a tile corner is inside triangle abc, with a < b < c. Neighbouring
+/// tiles that clip the same triangle produce the same keys and positions, which is what welds the seams
+struct ClipVertex
+{
+  Eigen::Vector3d pos;
+  std::array<int, 6> key;
+  int edges;     // bit mask of the triangle edges (0: v0v1, 1: v1v2, 2: v2v0) that the vertex lies on
+  int seams[2];  // the x and y seams that the vertex lies on, or kNoSeam
+};
+
+/// The point where the edge between vertices @c a and @c b crosses the seam at @c coord on @c axis. The vertices are
+/// ordered by id first, so that every tile computes exactly the same point
+ClipVertex edgeSeamVertex(int a, int b, const std::vector<Eigen::Vector3d> &points, int axis, int seam, double coord)
+{
+  if (a > b)
+    std::swap(a, b);
+  const Eigen::Vector3d &p0 = points[a];
+  const Eigen::Vector3d &p1 = points[b];
+  ClipVertex vertex;
+  vertex.pos = p0 + (p1 - p0) * ((coord - p0[axis]) / (p1[axis] - p0[axis]));
+  vertex.pos[axis] = coord;
+  vertex.key = { a, b, -1, axis, seam, 0 };
+  vertex.seams[0] = vertex.seams[1] = kNoSeam;
+  vertex.seams[axis] = seam;
+  return vertex;
+}
+
+/// The point of triangle @c ids that is above or below the tile corner at seams @c seam_x, @c seam_y
+ClipVertex cornerVertex(const Eigen::Vector3i &ids, const std::vector<Eigen::Vector3d> &points, int seam_x, int seam_y,
+                        double tile_width, const ClipVertex &from, const ClipVertex &to)
+{
+  int sorted[3] = { ids[0], ids[1], ids[2] };
+  std::sort(sorted, sorted + 3);
+  const Eigen::Vector3d &p0 = points[sorted[0]];
+  const Eigen::Vector3d normal = (points[sorted[1]] - p0).cross(points[sorted[2]] - p0);
+  ClipVertex vertex;
+  vertex.pos = Eigen::Vector3d(seam_x * tile_width, seam_y * tile_width, 0.0);
+  if (std::abs(normal[2]) > 1e-10 * normal.norm())
+  {
+    vertex.pos[2] = p0[2] - (normal[0] * (vertex.pos[0] - p0[0]) + normal[1] * (vertex.pos[1] - p0[1])) / normal[2];
+  }
+  else  // a vertical triangle, so interpolate along the clipped edge instead
+  {
+    const double t = (vertex.pos[1] - from.pos[1]) / (to.pos[1] - from.pos[1]);
+    vertex.pos[2] = from.pos[2] + (to.pos[2] - from.pos[2]) * t;
+  }
+  vertex.key = { sorted[0], sorted[1], sorted[2], 2, seam_x, seam_y };
+  vertex.edges = 0;
+  vertex.seams[0] = seam_x;
+  vertex.seams[1] = seam_y;
+  return vertex;
+}
+
+/// Clip the convex @c polygon, which is part of triangle @c ids, to the side of the seam @c seam on @c axis given by
+/// @c sign (1 to keep the greater side, -1 the lesser side)
+void clipToSeam(std::vector<ClipVertex> &polygon, const Eigen::Vector3i &ids, const std::vector<Eigen::Vector3d> &points,
+                int axis, int seam, double sign, double tile_width)
+{
+  const double coord = seam * tile_width;
+  std::vector<ClipVertex> clipped;
+  for (size_t i = 0; i < polygon.size(); i++)
+  {
+    const ClipVertex &from = polygon[i];
+    const ClipVertex &to = polygon[(i + 1) % polygon.size()];
+    const double d0 = sign * (from.pos[axis] - coord);
+    const double d1 = sign * (to.pos[axis] - coord);
+    if (d0 >= 0.0)
+      clipped.push_back(from);
+    if ((d0 > 0.0 && d1 < 0.0) || (d0 < 0.0 && d1 > 0.0))
+    {
+      const int common_edges = from.edges & to.edges;
+      if (common_edges)  // a segment of an original edge
+      {
+        const int edge = common_edges & 1 ? 0 : (common_edges & 2 ? 1 : 2);
+        ClipVertex vertex = edgeSeamVertex(ids[edge], ids[(edge + 1) % 3], points, axis, seam, coord);
+        vertex.edges = 1 << edge;
+        clipped.push_back(vertex);
+      }
+      else  // a segment along a seam of the other axis, which only the y clip can cross
+      {
+        const int other_seam = from.seams[0] != kNoSeam ? from.seams[0] : to.seams[0];
+        clipped.push_back(cornerVertex(ids, points, other_seam, seam, tile_width, from, to));
+      }
+    }
+  }
+  polygon.swap(clipped);
+}
+}  // namespace
+
+TiledConcaveHull::TiledConcaveHull(double tile_width, double overlap)
+  : tile_width_(tile_width)
+  , overlap_(overlap)
+{}
+
+void TiledConcaveHull::addPoints(const std::vector<Eigen::Vector3d> &points)
+{
+  for (const auto &point : points)
+  {
+    const int id = static_cast<int>(points_.size());
+    points_.push_back(point);
+    // add the point to its own tile and to any neighbouring tile whose overlap region it is in
+    const Eigen::Vector2i min_index = tileIndex(point, -overlap_, -overlap_);
+    const Eigen::Vector2i max_index = tileIndex(point, overlap_, overlap_);
+    for (int x = min_index[0]; x <= max_index[0]; x++)
+    {
+      for (int y = min_index[1]; y <= max_index[1]; y++)
+      {
+        tiles_[Eigen::Vector2i(x, y)].push_back(id);
+      }
+    }
+  }
+}
+
+void TiledConcaveHull::grow(const std::function<void(ConcaveHull &hull)> &grow_hull)
+{
+  std::vector<Eigen::Vector2i> keys;
+  keys.reserve(tiles_.size());
+  for (const auto &tile : tiles_)
+  {
+    keys.push_back(tile.first);
+  }
+  // the triangles of each tile's hull after clipping to the tile
+  std::vector<std::vector<std::array<ClipVertex, 3>>> tile_triangles(keys.size());
+  auto grow_tile = [&](size_t t) {
+    const std::vector<int> &ids = tiles_.at(keys[t]);
+    const size_t min_points_per_tile = 10;  // too few points to form a meaningful tetrahedralisation
+    if (ids.size() < min_points_per_tile)
+      return;
+    std::vector<Eigen::Vector3d> points(ids.size());
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+      points[i] = points_[ids[i]];
+    }
+    try
+    {
+      ConcaveHull hull(points, false);  // the tiles run concurrently, so their progress is not printed
+      grow_hull(hull);
+      const Eigen::Vector2i &tile = keys[t];
+      std::vector<ClipVertex> polygon;
+      for (const auto &tri : hull.mesh().indexList())
+      {
+        const Eigen::Vector3i tri_ids(ids[tri[0]], ids[tri[1]], ids[tri[2]]);
+        polygon.resize(3);
+        for (int i = 0; i < 3; i++)
+        {
+          polygon[i].pos = points_[tri_ids[i]];
+          polygon[i].key = { tri_ids[i], -1, -1, -1, 0, 0 };
+          polygon[i].edges = (1 << i) | (1 << ((i + 2) % 3));
+          polygon[i].seams[0] = polygon[i].seams[1] = kNoSeam;
+        }
+        bool inside = true;  // most triangles are inside the tile, and need no clipping
+        for (int i = 0; i < 3; i++)
+        {
+          for (int axis = 0; axis < 2; axis++)
+          {
+            const double coord = polygon[i].pos[axis];
+            inside = inside && coord >= tile[axis] * tile_width_ && coord <= (tile[axis] + 1) * tile_width_;
+          }
+        }
+        for (int axis = 0; axis < 2 && !inside && polygon.size() >= 3; axis++)
+        {
+          clipToSeam(polygon, tri_ids, points_, axis, tile[axis], 1.0, tile_width_);
+          if (polygon.size() >= 3)
+            clipToSeam(polygon, tri_ids, points_, axis, tile[axis] + 1, -1.0, tile_width_);
+        }
+        // the clipped polygon is convex, so it is split into a fan of triangles
+        for (size_t i = 2; i < polygon.size(); i++)
+        {
+          tile_triangles[t].push_back({ polygon[0], polygon[i - 1], polygon[i] });
+        }
+      }
+    }
+    catch (const std::exception &e)  // qhull throws on degenerate input, such as coplanar points
+    {
+      std::cerr << "Warning: skipping tile " << keys[t].transpose() << ", " << e.what() << std::endl;
+    }
+  };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, keys.size(), grow_tile);
+#else
+  #pragma omp parallel for schedule(dynamic)
+  for (int t = 0; t < static_cast<int>(keys.size()); t++)
+  {
+    grow_tile(static_cast<size_t>(t));
+  }
+#endif  // RAYLIB_WITH_TBB
+
+  // weld the tiles together, by giving each seam vertex a single index in the shared vertex list
+  mesh_.vertices() = points_;
+  mesh_.indexList().clear();
+  std::map<std::array<int, 6>, int> seam_vertices;
+  for (const auto &triangles : tile_triangles)
+  {
+    for (const auto &triangle : triangles)
+    {
+      Eigen::Vector3i tri;
+      for (int i = 0; i < 3; i++)
+      {
+        const ClipVertex &vertex = triangle[i];
+        if (vertex.key[1] == -1)  // an original vertex
+        {
+          tri[i] = vertex.key[0];
+          continue;
+        }
+        const auto inserted = seam_vertices.insert({ vertex.key, static_cast<int>(mesh_.vertices().size()) });
+        if (inserted.second)
+          mesh_.vertices().push_back(vertex.pos);
+        tri[i] = inserted.first->second;
+      }
+      if (tri[0] != tri[1] && tri[1] != tri[2] && tri[2] != tri[0])
+        mesh_.indexList().push_back(tri);
+    }
+  }
+  mesh_.reduce();
+}
 }  // namespace ray
 #endif
@@ -6,6 +6,8 @@
 #ifndef RAYLIB_RAYCONCAVEHULL_H
 #define RAYLIB_RAYCONCAVEHULL_H
 
+#include <functional>
+#include <map>
 #include <set>
 #include "raylib/raylibconfig.h"
 #include "raylib/raymesh.h"
@@ -21,8 +23,8 @@ namespace ray
 class RAYLIB_EXPORT ConcaveHull
 {
 public:
-  /// construct the hull from the ray cloud's end points
-  ConcaveHull(const std::vector<Eigen::Vector3d> &points);
+  /// construct the hull from the ray cloud's end points. Progress is printed to std::cout when @c verbose
+  ConcaveHull(const std::vector<Eigen::Vector3d> &points, bool verbose = true);
 
   /// inwards growth is for wrapping an object from the outside, such as a plane
   void growInwards(double maxCurvature);
@@ -141,6 +143,46 @@ private:
   Eigen::Vector3d centre_;
   std::set<SurfaceFace, FaceComp> surface_;
   Mesh mesh_;
+  int new_tri_count_;
+  bool verbose_;
+};
+
+/// Concave hull of a large cloud, computed in square tiles (in x and y) of width @c tile_width. Each tile also contains
+/// the points within @c overlap of its edges, so that the hulls agree along the seams. The tiles are tetrahedralised
+/// and grown independently and in parallel, then each tile's hull is clipped to its own (non-overlapping) square.
+/// The vertices that the clipping adds on a seam are welded to those of the neighbouring tile, so the mesh is closed
+/// across the seam wherever the two hulls agree there. This bounds the size of each Delaunay tetrahedralisation, which
+/// is the main memory cost of the concave hull. It is not out of core: all of the added points are held in memory
+/// until grow() is called, so the cloud's points must still fit in memory.
+class RAYLIB_EXPORT TiledConcaveHull
+{
+public:
+  TiledConcaveHull(double tile_width, double overlap);
+
+  /// add a set of points, this can be called one chunk at a time
+  void addPoints(const std::vector<Eigen::Vector3d> &points);
+
+  /// construct the hull of each tile and grow it using @c grow_hull, e.g. calling @c growUpwards(). Then stitch the
+  /// tiles together into the single mesh()
+  void grow(const std::function<void(ConcaveHull &hull)> &grow_hull);
+
+  /// access the generated mesh
+  Mesh &mesh() { return mesh_; }
+  const Mesh &mesh() const { return mesh_; }
+
+private:
+  /// the tile containing the horizontal position of @c pos, given an extra offset @c shift
+  inline Eigen::Vector2i tileIndex(const Eigen::Vector3d &pos, double shift_x, double shift_y) const
+  {
+    return Eigen::Vector2i(int(std::floor((pos[0] + shift_x) / tile_width_)),
+                           int(std::floor((pos[1] + shift_y) / tile_width_)));
+  }
+
+  double tile_width_;
+  double overlap_;
+  std::vector<Eigen::Vector3d> points_;
+  std::map<Eigen::Vector2i, std::vector<int>, Vector2iLess> tiles_;  // point indices per tile, including the overlap
+  Mesh mesh_;
 };
 }  // namespace ray
 
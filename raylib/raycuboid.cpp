@@ -4,6 +4,13 @@
 //
 // Author: Thomas Lowe
 #include "raycuboid.h"
+
+// the batched clipping has an AVX2 version, chosen at run time, for compilers that can target it per function
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define RAYLIB_CLIP_AVX2 1
+#include <immintrin.h>
+#endif
+
 namespace ray
 {
 Cuboid::Cuboid(const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound)
@@ -45,6 +52,102 @@ bool Cuboid::clipRay(Eigen::Vector3d &start, Eigen::Vector3d &end, double eps) c
   return true;
 }
 
+#if RAYLIB_CLIP_AVX2
+namespace
+{
+/// clip the rays four at a time, up to the last whole set of four, returning the number of rays clipped. This matches
+/// Cuboid::clipRay() lane by lane, including which operand is kept by max and min when one is a nan
+__attribute__((target("avx2"))) size_t clipRaysAVX2(const Eigen::Vector3d &centre, const Eigen::Vector3d &extent,
+                                                    const std::vector<Eigen::Vector3d> &starts,
+                                                    const std::vector<Eigen::Vector3d> &ends,
+                                                    std::vector<Eigen::Vector3d> &clipped_starts,
+                                                    std::vector<Eigen::Vector3d> &clipped_ends, std::vector<bool> &valid)
+{
+  const __m256i lanes = _mm256_set_epi64x(9, 6, 3, 0);  // the x coordinates of four consecutive Vector3ds
+  const __m256d zero = _mm256_setzero_pd();
+  const __m256d one = _mm256_set1_pd(1.0);
+  const size_t num_rays = ends.size() & ~static_cast<size_t>(3);
+  for (size_t i = 0; i < num_rays; i += 4)
+  {
+    __m256d start[3], end[3], dir[3];
+    __m256d max_near_d = zero;
+    __m256d min_far_d = one;
+    __m256d outside = zero;
+    for (int ax = 0; ax < 3; ax++)
+    {
+      start[ax] = _mm256_i64gather_pd(starts[i].data() + ax, lanes, 8);
+      end[ax] = _mm256_i64gather_pd(ends[i].data() + ax, lanes, 8);
+      dir[ax] = _mm256_sub_pd(end[ax], start[ax]);
+      const __m256d to_centre = _mm256_sub_pd(_mm256_set1_pd(centre[ax]), start[ax]);
+      const __m256d low = _mm256_sub_pd(to_centre, _mm256_set1_pd(extent[ax]));
+      const __m256d high = _mm256_add_pd(to_centre, _mm256_set1_pd(extent[ax]));
+      const __m256d positive = _mm256_cmp_pd(dir[ax], zero, _CMP_GT_OQ);
+      const __m256d near_d = _mm256_blendv_pd(high, low, positive);
+      const __m256d far_d = _mm256_blendv_pd(low, high, positive);
+      const __m256d moving = _mm256_cmp_pd(dir[ax], zero, _CMP_NEQ_UQ);
+      max_near_d = _mm256_blendv_pd(max_near_d, _mm256_max_pd(_mm256_div_pd(near_d, dir[ax]), max_near_d), moving);
+      min_far_d = _mm256_blendv_pd(min_far_d, _mm256_min_pd(_mm256_div_pd(far_d, dir[ax]), min_far_d), moving);
+      // a ray that is still along this axis is outside when the box extents are on the same side of its start
+      const __m256d same_side =
+        _mm256_xor_pd(_mm256_cmp_pd(near_d, zero, _CMP_GT_OQ), _mm256_cmp_pd(far_d, zero, _CMP_NGT_UQ));
+      outside = _mm256_or_pd(outside, _mm256_andnot_pd(moving, same_side));
+    }
+    const __m256d inside = _mm256_andnot_pd(outside, _mm256_cmp_pd(min_far_d, max_near_d, _CMP_NLE_UQ));
+    const __m256d end_d = _mm256_sub_pd(one, min_far_d);
+    alignas(32) double new_starts[3][4], new_ends[3][4];
+    for (int ax = 0; ax < 3; ax++)
+    {
+      _mm256_store_pd(new_starts[ax], _mm256_add_pd(start[ax], _mm256_mul_pd(dir[ax], max_near_d)));
+      _mm256_store_pd(new_ends[ax], _mm256_sub_pd(end[ax], _mm256_mul_pd(dir[ax], end_d)));
+    }
+    const int inside_mask = _mm256_movemask_pd(inside);
+    for (int j = 0; j < 4; j++)
+    {
+      valid[i + j] = ((inside_mask >> j) & 1) != 0;
+      if (valid[i + j])  // rays with nothing left are returned unchanged
+      {
+        clipped_starts[i + j] = Eigen::Vector3d(new_starts[0][j], new_starts[1][j], new_starts[2][j]);
+        clipped_ends[i + j] = Eigen::Vector3d(new_ends[0][j], new_ends[1][j], new_ends[2][j]);
+      }
+      else
+      {
+        clipped_starts[i + j] = starts[i + j];
+        clipped_ends[i + j] = ends[i + j];
+      }
+    }
+  }
+  return num_rays;
+}
+}  // namespace
+#endif  // RAYLIB_CLIP_AVX2
+
+void Cuboid::clipRays(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                      std::vector<Eigen::Vector3d> &clipped_starts, std::vector<Eigen::Vector3d> &clipped_ends,
+                      std::vector<bool> &valid, double eps) const
+{
+  clipped_starts.resize(ends.size());
+  clipped_ends.resize(ends.size());
+  valid.resize(ends.size());
+  size_t first_ray = 0;
+#if RAYLIB_CLIP_AVX2
+  static const bool has_avx2 = __builtin_cpu_supports("avx2");
+  if (has_avx2)
+  {
+    const Eigen::Vector3d centre = (min_bound_ + max_bound_) / 2.0;
+    const Eigen::Vector3d extent = (max_bound_ - min_bound_) / 2.0 - Eigen::Vector3d(eps, eps, eps);
+    first_ray = clipRaysAVX2(centre, extent, starts, ends, clipped_starts, clipped_ends, valid);
+  }
+#endif  // RAYLIB_CLIP_AVX2
+  for (size_t i = first_ray; i < ends.size(); i++)
+  {
+    Eigen::Vector3d start = starts[i];
+    Eigen::Vector3d end = ends[i];
+    valid[i] = clipRay(start, end, eps);
+    clipped_starts[i] = start;
+    clipped_ends[i] = end;
+  }
+}
+
 bool Cuboid::intersectsRay(const Eigen::Vector3d &start, const Eigen::Vector3d &dir, double &depth,
                            bool positive_box) const
 {
@@ -39,6 +39,13 @@ public:
   /// clip ray to cuboid. Return false if no ray left.
   bool clipRay(Eigen::Vector3d &start, Eigen::Vector3d &end, double eps = 0.0) const;
 
+  /// clip each ray from @c starts to @c ends to the cuboid, as clipRay() does. The clipped rays are returned in
+  /// @c clipped_starts and @c clipped_ends (which may be the input vectors), and @c valid is false for rays with
+  /// nothing left, these rays are returned unchanged. Where the processor supports AVX2, four rays are clipped at once
+  void clipRays(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                std::vector<Eigen::Vector3d> &clipped_starts, std::vector<Eigen::Vector3d> &clipped_ends,
+                std::vector<bool> &valid, double eps = 0.0) const;
+
   Eigen::Vector3d min_bound_, max_bound_;
 };
 }  // namespace ray
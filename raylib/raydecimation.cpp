@@ -5,17 +5,34 @@
 // Author: Thomas Lowe
 #include "raydecimation.h"
 #include <iostream>
+#include <functional>
 #include <limits>
 #include <map>
 #include "raycloudwriter.h"
+#include "raytelemetry.h"
 
 namespace ray
 {
-bool decimateSpatial(const std::string &file_stub, double vox_width)
+namespace
 {
-  ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
-    return false;
+using ChunkFunction = std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                         std::vector<double> &times, std::vector<ray::RGBA> &colours)>;
+/// supplies the rays to a decimation in chunks, from a ray cloud file or from memory
+using ChunkSource = std::function<bool(ChunkFunction apply)>;
+/// receives the decimated rays one chunk at a time
+using ChunkSink = std::function<void(const Cloud &chunk)>;
+
+void appendChunk(Cloud &cloud, const Cloud &chunk)
+{
+  cloud.starts.insert(cloud.starts.end(), chunk.starts.begin(), chunk.starts.end());
+  cloud.ends.insert(cloud.ends.end(), chunk.ends.begin(), chunk.ends.end());
+  cloud.times.insert(cloud.times.end(), chunk.times.begin(), chunk.times.end());
+  cloud.colours.insert(cloud.colours.end(), chunk.colours.begin(), chunk.colours.end());
+}
+
+bool decimateSpatialChunks(const ChunkSource &read, const ChunkSink &write, double vox_width)
+{
+  TelemetryPhase telemetry("decimateSpatial");
 
   // By maintaining these buffers below, we avoid almost all memory fragmentation
   ray::Cloud chunk;
@@ -25,6 +42,7 @@ bool decimateSpatial(const std::string &file_stub, double vox_width)
   auto decimate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                       std::vector<double> &times, std::vector<ray::RGBA> &colours) 
   {
+    telemetry.addRays(ends.size());
     double width = 0.01 * vox_width;
     subsample.clear();
     voxelSubsample(ends, width, subsample, voxel_set);
@@ -37,50 +55,44 @@ bool decimateSpatial(const std::string &file_stub, double vox_width)
       chunk.colours[i] = colours[id];
       chunk.times[i] = times[id];
     }
-    writer.writeChunk(chunk);
+    write(chunk);
   };
 
-  if (!ray::Cloud::read(file_stub + ".ply", decimate))
-    return false;
-  writer.end();
-  return true;
+  return read(decimate);
 }
 
-bool decimateTemporal(const std::string &file_stub, int num_rays)
+bool decimateTemporalChunks(const ChunkSource &read, const ChunkSink &write, int num_rays)
 {
-  ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
-    return false;
+  TelemetryPhase telemetry("decimateTemporal");
 
   // By maintaining these buffers below, we avoid almost all memory fragmentation
   ray::Cloud chunk;
+  size_t next = 0;  // index of the next ray to keep, relative to the start of the chunk. This carries across chunks
   auto decimate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                       std::vector<double> &times, std::vector<ray::RGBA> &colours) 
   {
+    telemetry.addRays(ends.size());
     size_t decimation = (size_t)num_rays;
-    size_t count = (ends.size() + decimation - 1) / decimation;
+    size_t count = next < ends.size() ? (ends.size() - next + decimation - 1) / decimation : 0;
     chunk.resize(count);
-    for (size_t i = 0, c = 0; i < ends.size(); i += decimation, c++)
+    size_t i = next;
+    for (size_t c = 0; i < ends.size(); i += decimation, c++)
     {
       chunk.starts[c] = starts[i];
       chunk.ends[c] = ends[i];
       chunk.times[c] = times[i];
       chunk.colours[c] = colours[i];
     }
-    writer.writeChunk(chunk);
+    next = i - ends.size();
+    write(chunk);
   };
 
-  if (!ray::Cloud::read(file_stub + ".ply", decimate))
-    return false;
-  writer.end();
-  return true;
+  return read(decimate);
 }
 
-bool decimateSpatioTemporal(const std::string &file_stub, double vox_width, int num_rays)
+bool decimateSpatioTemporalChunks(const ChunkSource &read, const ChunkSink &write, double vox_width, int num_rays)
 {
-  ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
-    return false;
+  TelemetryPhase telemetry("decimateSpatioTemporal");
 
   // By maintaining these buffers below, we avoid almost all memory fragmentation
   ray::Cloud chunk;
@@ -90,6 +102,7 @@ bool decimateSpatioTemporal(const std::string &file_stub, double vox_width, int
   auto decimate = [&](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
                       std::vector<double> &, std::vector<ray::RGBA> &) 
   {
+    telemetry.addRays(ends.size());
     double voxel_width = 0.01 * vox_width;
     // firstly we store a count per cell
     for (size_t i = 0; i<ends.size(); i++)
@@ -107,10 +120,10 @@ bool decimateSpatioTemporal(const std::string &file_stub, double vox_width, int
         found->second[0]++;
       }      
     }
-    writer.writeChunk(chunk);
+    write(chunk);
   };
 
-  if (!ray::Cloud::read(file_stub + ".ply", decimate))
+  if (!read(decimate))
     return false;
 
   double voxel_width = 0.01 * vox_width;
@@ -156,20 +169,17 @@ bool decimateSpatioTemporal(const std::string &file_stub, double vox_width, int
         ends_left--;
       }
     }
-    writer.writeChunk(chunk);
+    write(chunk);
   };
-  if (!ray::Cloud::read(file_stub + ".ply", finalise))
+  if (!read(finalise))
     return false;   
-  writer.end();
   return true;
 }
 
 
-bool decimateRaysSpatial(const std::string &file_stub, double vox_width)
+bool decimateRaysSpatialChunks(const ChunkSource &read, const ChunkSink &write, double vox_width)
 {
-  ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
-    return false;
+  TelemetryPhase telemetry("decimateRaysSpatial");
 
   // By maintaining these buffers below, we avoid almost all memory fragmentation
   ray::Cloud chunk;
@@ -178,6 +188,7 @@ bool decimateRaysSpatial(const std::string &file_stub, double vox_width)
   auto decimate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                       std::vector<double> &times, std::vector<ray::RGBA> &colours) 
   {
+    telemetry.addRays(ends.size());
     double width = 0.01 * vox_width;
     subsampler.subsample.clear();
     for (int i = 0; i < (int)ends.size(); i++)
@@ -199,20 +210,15 @@ bool decimateRaysSpatial(const std::string &file_stub, double vox_width)
       chunk.colours[i] = colours[id];
       chunk.times[i] = times[id];
     }
-    writer.writeChunk(chunk);
+    write(chunk);
   };
 
-  if (!ray::Cloud::read(file_stub + ".ply", decimate))
-    return false;
-  writer.end();
-  return true;
+  return read(decimate);
 }
 
-bool decimateAngular(const std::string &file_stub, double radius_per_length)
+bool decimateAngularChunks(const ChunkSource &read, const ChunkSink &write, double radius_per_length)
 {
-  ray::CloudWriter writer;
-  if (!writer.begin(file_stub + "_decimated.ply"))
-    return false;
+  TelemetryPhase telemetry("decimateAngular");
 
   ray::Cloud chunk;
 
@@ -233,6 +239,7 @@ bool decimateAngular(const std::string &file_stub, double radius_per_length)
   auto decimate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                       std::vector<double> &, std::vector<ray::RGBA> &) 
   {
+    telemetry.addRays(ends.size());
     for (size_t i = 0; i<ends.size(); i++)
     {
       index++;
@@ -260,10 +267,10 @@ bool decimateAngular(const std::string &file_stub, double radius_per_length)
         }         
       }
     }
-    writer.writeChunk(chunk);
+    write(chunk);
   };
 
-  if (!ray::Cloud::read(file_stub + ".ply", decimate))
+  if (!read(decimate))
     return false;
 
   std::cout << "finalising" << std::endl;
@@ -295,11 +302,110 @@ bool decimateAngular(const std::string &file_stub, double radius_per_length)
         chunk.times.push_back(times[i]);
       }
     }
-    writer.writeChunk(chunk);
+    write(chunk);
   };
-  if (!ray::Cloud::read(file_stub + ".ply", finalise))
+  return read(finalise);
+}
+using Decimation = std::function<bool(const ChunkSource &read, const ChunkSink &write)>;
+
+/// apply @c decimation to the file @c file_stub.ply, streaming the result to @c file_stub_decimated.ply
+bool decimateFile(const std::string &file_stub, const Decimation &decimation)
+{
+  ray::CloudWriter writer;
+  if (!writer.begin(file_stub + "_decimated.ply"))
+    return false;
+  auto read = [&](ChunkFunction apply) { return ray::Cloud::read(file_stub + ".ply", apply); };
+  auto write = [&](const Cloud &chunk) { writer.writeChunk(chunk); };
+  if (!decimation(read, write))
     return false;
   writer.end();
   return true;
 }
+
+/// apply @c decimation to the in-memory @c cloud, passed as a single chunk
+bool decimateCloud(Cloud &cloud, const Decimation &decimation)
+{
+  Cloud decimated;
+  auto read = [&](ChunkFunction apply) 
+  {
+    apply(cloud.starts, cloud.ends, cloud.times, cloud.colours);
+    return true;
+  };
+  auto write = [&](const Cloud &chunk) { appendChunk(decimated, chunk); };
+  if (!decimation(read, write))
+    return false;
+  cloud = std::move(decimated);
+  return true;
+}
+}  // namespace
+
+bool decimateSpatial(const std::string &file_stub, double vox_width)
+{
+  return decimateFile(file_stub, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateSpatialChunks(read, write, vox_width);
+  });
+}
+
+bool decimateSpatial(Cloud &cloud, double vox_width)
+{
+  return decimateCloud(cloud, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateSpatialChunks(read, write, vox_width);
+  });
+}
+
+bool decimateTemporal(const std::string &file_stub, int num_rays)
+{
+  return decimateFile(file_stub, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateTemporalChunks(read, write, num_rays);
+  });
+}
+
+bool decimateTemporal(Cloud &cloud, int num_rays)
+{
+  return decimateCloud(cloud, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateTemporalChunks(read, write, num_rays);
+  });
+}
+
+bool decimateSpatioTemporal(const std::string &file_stub, double vox_width, int num_rays)
+{
+  return decimateFile(file_stub, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateSpatioTemporalChunks(read, write, vox_width, num_rays);
+  });
+}
+
+bool decimateSpatioTemporal(Cloud &cloud, double vox_width, int num_rays)
+{
+  return decimateCloud(cloud, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateSpatioTemporalChunks(read, write, vox_width, num_rays);
+  });
+}
+
+bool decimateRaysSpatial(const std::string &file_stub, double vox_width)
+{
+  return decimateFile(file_stub, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateRaysSpatialChunks(read, write, vox_width);
+  });
+}
+
+bool decimateRaysSpatial(Cloud &cloud, double vox_width)
+{
+  return decimateCloud(cloud, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateRaysSpatialChunks(read, write, vox_width);
+  });
+}
+
+bool decimateAngular(const std::string &file_stub, double radius_per_length)
+{
+  return decimateFile(file_stub, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateAngularChunks(read, write, radius_per_length);
+  });
+}
+
+bool decimateAngular(Cloud &cloud, double radius_per_length)
+{
+  return decimateCloud(cloud, [&](const ChunkSource &read, const ChunkSink &write) {
+    return decimateAngularChunks(read, write, radius_per_length);
+  });
+}
 }  // namespace ray
@@ -37,6 +37,13 @@ bool RAYLIB_EXPORT decimateRaysSpatial(const std::string &file_stub, double vox_
 /// This is used when error is proportional to ray length, prioritising closer measurements and leaving distant areas sparse
 bool RAYLIB_EXPORT decimateAngular(const std::string &file_stub, double radius_per_length);
 
+/// In-memory versions of the above decimations, which replace @c cloud with its decimated rays. These give the same
+/// result as the file versions, so can be chained with other operations without saving intermediate files
+bool RAYLIB_EXPORT decimateSpatial(Cloud &cloud, double vox_width);
+bool RAYLIB_EXPORT decimateTemporal(Cloud &cloud, int num_rays);
+bool RAYLIB_EXPORT decimateSpatioTemporal(Cloud &cloud, double vox_width, int num_rays);
+bool RAYLIB_EXPORT decimateRaysSpatial(Cloud &cloud, double vox_width);
+bool RAYLIB_EXPORT decimateAngular(Cloud &cloud, double radius_per_length);
 
 struct Subsampler
 {
@@ -76,6 +76,24 @@ void ForestGen::generateRays(double ray_density)
   }
 }
 
+void ForestGen::generateRays(double ray_density, const RayChunkFunction &add_rays)
+{
+  // the random values are drawn in tree order, so the runs of all the trees are planned before any are generated
+  const int run_size = 65536;
+  std::vector<std::pair<const TreeGen *, TreeGen::RayRun>> tree_runs;
+  std::vector<TreeGen::RayRun> runs;
+  for (auto &tree : trees_)
+  {
+    runs.clear();
+    tree.planRays(ray_density, run_size, runs);
+    for (auto &run : runs)
+    {
+      tree_runs.push_back(std::make_pair(&tree, run));
+    }
+  }
+  TreeGen::generateRuns(tree_runs, add_rays);
+}
+
 std::vector<Eigen::Vector3d> ForestGen::getCanopy()
 {
   std::vector<Eigen::Vector3d> canopy;
@@ -38,6 +38,9 @@ public:
   bool makeFromFile(const std::string &filename, const TreeParams &params);
   /// converts the forest geometry into a set of rays, for a chosen @c ray_density
   void generateRays(double ray_density);
+  /// generate the same rays as generateRays(), passing them to @c add_rays one chunk at a time, in tree order, rather
+  /// than storing them in the trees. The rays of several trees are generated in parallel
+  void generateRays(double ray_density, const RayChunkFunction &add_rays);
 
   /// returns just the leaf points of the forest
   std::vector<Eigen::Vector3d> getCanopy();
@@ -4,9 +4,16 @@
 //
 // Author: Thomas Lowe
 #include "rayforeststructure.h"
+#include "raymeshwriter.h"
 // #define OUTPUT_MOMENTS  // used in unit tests
 #include <unordered_map>
 #include <complex>
+#include <cstring>
+#include <functional>
+
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
 
 namespace ray
 {
@@ -92,6 +99,11 @@ Eigen::Array<double, 9, 1> ForestStructure::getMoments() const
 // Parse the tree file into a vector of tree structures
 bool ForestStructure::load(const std::string &filename)
 {
+  if (ForestFile::isBinary(filename))
+  {
+    const double inf = std::numeric_limits<double>::infinity();
+    return load(filename, Cuboid(Eigen::Vector3d(-inf, -inf, -inf), Eigen::Vector3d(inf, inf, inf)));
+  }
   std::cout << "loading tree file: " << filename << std::endl;
   std::ifstream ifs(filename.c_str(), std::ios::in);
   if (!ifs.is_open())
@@ -380,6 +392,403 @@ bool ForestStructure::save(const std::string &filename)
   return true;
 }
 
+namespace
+{
+const char kBinarySignature[8] = { 'r', 'a', 'y', 't', 'r', 'e', 'e', 's' };
+const uint32_t kBinaryVersion = 1;
+
+/// the bounds of the tree's segments, including their radii
+Cuboid treeBounds(const TreeStructure &tree)
+{
+  const double inf = std::numeric_limits<double>::infinity();
+  Cuboid bounds(Eigen::Vector3d(inf, inf, inf), Eigen::Vector3d(-inf, -inf, -inf));
+  for (auto &segment: tree.segments())
+  {
+    const Eigen::Vector3d radius(segment.radius, segment.radius, segment.radius);
+    bounds.min_bound_ = minVector<Eigen::Vector3d>(bounds.min_bound_, segment.tip - radius);
+    bounds.max_bound_ = maxVector<Eigen::Vector3d>(bounds.max_bound_, segment.tip + radius);
+  }
+  return bounds;
+}
+
+template <typename T>
+inline void writeValue(std::ofstream &ofs, const T &value)
+{
+  ofs.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+void writeStrings(std::ofstream &ofs, const std::vector<std::string> &strings)
+{
+  writeValue(ofs, static_cast<uint32_t>(strings.size()));
+  for (auto &str: strings)
+  {
+    writeValue(ofs, static_cast<uint32_t>(str.length()));
+    ofs.write(str.data(), str.length());
+  }
+}
+
+/// reads values from the file, failing rather than reading past its end
+class ByteReader
+{
+public:
+  ByteReader(const uint8_t *data, size_t size, size_t offset) : data_(data), size_(size), offset_(offset) {}
+
+  template <typename T>
+  bool read(T &value)
+  {
+    if (offset_ + sizeof(T) > size_)
+    {
+      return false;
+    }
+    std::memcpy(&value, data_ + offset_, sizeof(T));
+    offset_ += sizeof(T);
+    return true;
+  }
+  bool readStrings(std::vector<std::string> &strings)
+  {
+    uint32_t num_strings;
+    if (!read(num_strings))
+    {
+      return false;
+    }
+    strings.resize(num_strings);
+    for (auto &str: strings)
+    {
+      uint32_t length;
+      if (!read(length) || offset_ + length > size_)
+      {
+        return false;
+      }
+      str.assign(reinterpret_cast<const char *>(data_ + offset_), length);
+      offset_ += length;
+    }
+    return true;
+  }
+  size_t offset() const { return offset_; }
+
+private:
+  const uint8_t *data_;
+  size_t size_;
+  size_t offset_;
+};
+}  // namespace
+
+bool ForestStructure::load(const std::string &filename, const Cuboid &bounds)
+{
+  if (!ForestFile::isBinary(filename))
+  {
+    if (!load(filename))
+    {
+      return false;
+    }
+    trees.erase(std::remove_if(trees.begin(), trees.end(),
+                               [&](const TreeStructure &tree) { return !treeBounds(tree).overlaps(bounds); }),
+                trees.end());
+    return true;
+  }
+  std::cout << "loading tree file: " << filename << std::endl;
+  ForestFile file;
+  if (!file.open(filename))
+  {
+    return false;
+  }
+  comments = file.comments();
+  const std::vector<size_t> ids = file.treesOverlapping(bounds);
+  trees.clear();
+  trees.resize(ids.size());
+  std::vector<uint8_t> loaded(ids.size(), 0);
+  auto load_tree = [&](size_t i) { loaded[i] = file.loadTree(ids[i], trees[i]); };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, ids.size(), load_tree);
+#else
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (int64_t i = 0; i < static_cast<int64_t>(ids.size()); i++)
+  {
+    load_tree(static_cast<size_t>(i));
+  }
+#endif  // RAYLIB_WITH_TBB
+  if (std::find(loaded.begin(), loaded.end(), 0) != loaded.end())
+  {
+    std::cerr << "Error: corrupt tree data in " << filename << std::endl;
+    return false;
+  }
+  std::cout << trees.size() << " of " << file.numTrees() << " trees loaded" << std::endl;
+  return true;
+}
+
+bool ForestStructure::saveBinary(const std::string &filename) const
+{
+  if (trees.empty())
+  {
+    std::cerr << "No data to save to " << filename << std::endl;
+    return false;
+  }
+  std::cout << "outputting binary tree file: " << filename << std::endl;
+  std::ofstream ofs(filename.c_str(), std::ios::out | std::ios::binary);
+  if (!ofs.is_open())
+  {
+    std::cerr << "Error: cannot open " << filename << " for writing." << std::endl;
+    return false;
+  }
+  const size_t num_tree_attributes = trees[0].treeAttributeNames().size();
+  const size_t num_attributes = trees[0].attributeNames().size();
+  for (auto &tree: trees)
+  {
+    if (tree.treeAttributes().size() != num_tree_attributes)
+    {
+      std::cerr << "Error: all trees must have the same number of attributes to save to " << filename << std::endl;
+      return false;
+    }
+    for (auto &segment: tree.segments())
+    {
+      if (segment.attributes.size() != num_attributes)
+      {
+        std::cerr << "Error: all segments must have the same number of attributes to save to " << filename
+                  << std::endl;
+        return false;
+      }
+    }
+  }
+
+  // the header
+  ofs.write(kBinarySignature, sizeof(kBinarySignature));
+  writeValue(ofs, kBinaryVersion);
+  writeStrings(ofs, comments);
+  writeStrings(ofs, trees[0].treeAttributeNames());
+  writeStrings(ofs, trees[0].attributeNames());
+  writeValue(ofs, static_cast<uint64_t>(trees.size()));
+
+  // the table of trees
+  const size_t segment_size = sizeof(double) * (4 + num_attributes) + 2 * sizeof(int32_t);
+  uint64_t offset = static_cast<uint64_t>(ofs.tellp()) + trees.size() * ForestFile::kEntrySize;
+  for (auto &tree: trees)
+  {
+    writeValue(ofs, offset);
+    writeValue(ofs, static_cast<uint32_t>(tree.segments().size()));
+    writeValue(ofs, static_cast<uint32_t>(0));  // reserved
+    const Eigen::Vector3d root = tree.segments().empty() ? Eigen::Vector3d(0, 0, 0) : tree.root();
+    const Cuboid bounds = treeBounds(tree);
+    ofs.write(reinterpret_cast<const char *>(root.data()), 3 * sizeof(double));
+    ofs.write(reinterpret_cast<const char *>(bounds.min_bound_.data()), 3 * sizeof(double));
+    ofs.write(reinterpret_cast<const char *>(bounds.max_bound_.data()), 3 * sizeof(double));
+    offset += sizeof(double) * num_tree_attributes + segment_size * tree.segments().size();
+  }
+
+  // the tree data
+  for (auto &tree: trees)
+  {
+    ofs.write(reinterpret_cast<const char *>(tree.treeAttributes().data()), sizeof(double) * num_tree_attributes);
+    for (auto &segment: tree.segments())
+    {
+      ofs.write(reinterpret_cast<const char *>(segment.tip.data()), 3 * sizeof(double));
+      writeValue(ofs, segment.radius);
+      ofs.write(reinterpret_cast<const char *>(segment.attributes.data()), sizeof(double) * num_attributes);
+      writeValue(ofs, static_cast<int32_t>(segment.parent_id));
+      writeValue(ofs, static_cast<int32_t>(0));  // reserved
+    }
+  }
+  if (!ofs.good())
+  {
+    std::cerr << "Error writing to file " << filename << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool ForestFile::isBinary(const std::string &filename)
+{
+  std::ifstream ifs(filename.c_str(), std::ios::in | std::ios::binary);
+  char signature[sizeof(kBinarySignature)];
+  if (!ifs.read(signature, sizeof(signature)))
+  {
+    return false;
+  }
+  return std::memcmp(signature, kBinarySignature, sizeof(signature)) == 0;
+}
+
+bool ForestFile::open(const std::string &filename)
+{
+  filename_ = filename;
+  if (!file_.open(filename))
+  {
+    std::cerr << "Error: cannot open " << filename << std::endl;
+    return false;
+  }
+  data_ = file_.data(0, file_.size());
+  ByteReader reader(data_, file_.size(), 0);
+  char signature[sizeof(kBinarySignature)];
+  uint32_t version = 0;
+  for (auto &c: signature)
+  {
+    reader.read(c);
+  }
+  if (!reader.read(version) || std::memcmp(signature, kBinarySignature, sizeof(signature)) != 0)
+  {
+    std::cerr << "Error: " << filename << " is not a binary trees file" << std::endl;
+    return false;
+  }
+  if (version != kBinaryVersion)
+  {
+    std::cerr << "Error: " << filename << " has unsupported binary trees version " << version << std::endl;
+    return false;
+  }
+  uint64_t num_trees = 0;
+  if (!reader.readStrings(comments_) || !reader.readStrings(tree_attribute_names_) ||
+      !reader.readStrings(branch_attribute_names_) || !reader.read(num_trees) ||
+      reader.offset() + num_trees * kEntrySize > file_.size())
+  {
+    std::cerr << "Error: " << filename << " has an incomplete header" << std::endl;
+    return false;
+  }
+  num_trees_ = static_cast<size_t>(num_trees);
+  table_ = data_ + reader.offset();
+  buildIndex();
+  return true;
+}
+
+Eigen::Vector3d ForestFile::root(size_t id) const
+{
+  Eigen::Vector3d root;
+  std::memcpy(root.data(), entry(id) + 16, 3 * sizeof(double));
+  return root;
+}
+
+Cuboid ForestFile::treeBounds(size_t id) const
+{
+  Cuboid bounds;
+  std::memcpy(bounds.min_bound_.data(), entry(id) + 40, 3 * sizeof(double));
+  std::memcpy(bounds.max_bound_.data(), entry(id) + 64, 3 * sizeof(double));
+  return bounds;
+}
+
+void ForestFile::buildIndex()
+{
+  if (num_trees_ == 0)
+  {
+    return;
+  }
+  // size the cells to hold a few trees each, on average
+  Eigen::Vector2d min_bound(std::numeric_limits<double>::max(), std::numeric_limits<double>::max());
+  Eigen::Vector2d max_bound = -min_bound;
+  max_reach_ = 0.0;
+  for (size_t i = 0; i < num_trees_; i++)
+  {
+    const Eigen::Vector2d root2 = root(i).head<2>();
+    min_bound = min_bound.cwiseMin(root2);
+    max_bound = max_bound.cwiseMax(root2);
+    const Cuboid bounds = treeBounds(i);
+    if (bounds.min_bound_[0] <= bounds.max_bound_[0])
+    {
+      max_reach_ = std::max(max_reach_, (root2 - bounds.min_bound_.head<2>()).maxCoeff());
+      max_reach_ = std::max(max_reach_, (bounds.max_bound_.head<2>() - root2).maxCoeff());
+    }
+  }
+  const Eigen::Vector2d extent = max_bound - min_bound;
+  const double trees_per_cell = 4.0;
+  cell_width_ = std::sqrt(std::max(extent[0], 1e-3) * std::max(extent[1], 1e-3) * trees_per_cell / (double)num_trees_);
+  cell_width_ = std::max(cell_width_, 1e-3);
+  index_min_bound_ = min_bound;
+  cell_dims_ = (extent / cell_width_).cast<int>() + Eigen::Vector2i(1, 1);
+
+  // bucket the trees by cell, keeping file order within each cell
+  auto cell_index = [&](const Eigen::Vector2d &pos) {
+    const Eigen::Vector2i inds = ((pos - index_min_bound_) / cell_width_).cast<int>().cwiseMin(cell_dims_ - Eigen::Vector2i(1, 1));
+    return static_cast<size_t>(inds[0]) + static_cast<size_t>(inds[1]) * cell_dims_[0];
+  };
+  cell_starts_.assign(static_cast<size_t>(cell_dims_[0]) * cell_dims_[1] + 1, 0);
+  std::vector<size_t> cells(num_trees_);
+  for (size_t i = 0; i < num_trees_; i++)
+  {
+    cells[i] = cell_index(root(i).head<2>());
+    cell_starts_[cells[i] + 1]++;
+  }
+  for (size_t c = 1; c < cell_starts_.size(); c++)
+  {
+    cell_starts_[c] += cell_starts_[c - 1];
+  }
+  cell_trees_.resize(num_trees_);
+  std::vector<size_t> fill(cell_starts_.begin(), cell_starts_.end() - 1);
+  for (size_t i = 0; i < num_trees_; i++)
+  {
+    cell_trees_[fill[cells[i]]++] = i;
+  }
+}
+
+std::vector<size_t> ForestFile::treesOverlapping(const Cuboid &bounds) const
+{
+  std::vector<size_t> ids;
+  if (num_trees_ == 0)
+  {
+    return ids;
+  }
+  // a tree can only overlap if its root is within max_reach_ of the bounds
+  const Eigen::Vector2d reach(max_reach_, max_reach_);
+  const Eigen::Vector2d min_cell = (bounds.min_bound_.head<2>() - reach - index_min_bound_) / cell_width_;
+  const Eigen::Vector2d max_cell = (bounds.max_bound_.head<2>() + reach - index_min_bound_) / cell_width_;
+  if (max_cell[0] < 0.0 || max_cell[1] < 0.0 || min_cell[0] >= (double)cell_dims_[0] ||
+      min_cell[1] >= (double)cell_dims_[1])
+  {
+    return ids;
+  }
+  const Eigen::Vector2d max_ind_d = (cell_dims_ - Eigen::Vector2i(1, 1)).cast<double>();
+  const Eigen::Vector2i min_ind = min_cell.cwiseMax(Eigen::Vector2d(0, 0)).cwiseMin(max_ind_d).cast<int>();
+  const Eigen::Vector2i max_ind = max_cell.cwiseMax(Eigen::Vector2d(0, 0)).cwiseMin(max_ind_d).cast<int>();
+  for (int y = min_ind[1]; y <= max_ind[1]; y++)
+  {
+    for (int x = min_ind[0]; x <= max_ind[0]; x++)
+    {
+      const size_t cell = static_cast<size_t>(x) + static_cast<size_t>(y) * cell_dims_[0];
+      for (size_t c = cell_starts_[cell]; c < cell_starts_[cell + 1]; c++)
+      {
+        if (treeBounds(cell_trees_[c]).overlaps(bounds))
+        {
+          ids.push_back(cell_trees_[c]);
+        }
+      }
+    }
+  }
+  std::sort(ids.begin(), ids.end());
+  return ids;
+}
+
+bool ForestFile::loadTree(size_t id, TreeStructure &tree) const
+{
+  uint64_t offset;
+  uint32_t num_segments;
+  std::memcpy(&offset, entry(id), sizeof(offset));
+  std::memcpy(&num_segments, entry(id) + 8, sizeof(num_segments));
+  const size_t num_tree_attributes = tree_attribute_names_.size();
+  const size_t num_attributes = branch_attribute_names_.size();
+  const size_t segment_size = sizeof(double) * (4 + num_attributes) + 2 * sizeof(int32_t);
+  if (offset + sizeof(double) * num_tree_attributes + segment_size * num_segments > file_.size())
+  {
+    return false;
+  }
+  const uint8_t *data = data_ + offset;
+  tree.treeAttributeNames() = tree_attribute_names_;
+  tree.attributeNames() = branch_attribute_names_;
+  tree.treeAttributes().resize(num_tree_attributes);
+  std::memcpy(tree.treeAttributes().data(), data, sizeof(double) * num_tree_attributes);
+  data += sizeof(double) * num_tree_attributes;
+  tree.segments().resize(num_segments);
+  for (auto &segment: tree.segments())
+  {
+    std::memcpy(segment.tip.data(), data, 3 * sizeof(double));
+    std::memcpy(&segment.radius, data + 3 * sizeof(double), sizeof(double));
+    segment.attributes.resize(num_attributes);
+    std::memcpy(segment.attributes.data(), data + 4 * sizeof(double), sizeof(double) * num_attributes);
+    int32_t parent_id;
+    std::memcpy(&parent_id, data + sizeof(double) * (4 + num_attributes), sizeof(parent_id));
+    segment.parent_id = parent_id;
+    if (parent_id < -1 || parent_id >= static_cast<int32_t>(num_segments))
+    {
+      return false;
+    }
+    data += segment_size;
+  }
+  return true;
+}
+
 void ForestStructure::splitCloud(const Cloud &cloud, double offset, Cloud &inside, Cloud &outside)
 {
   // first implementation is gonna be slow I guess... 
@@ -528,119 +937,186 @@ void addCapsulePiece(Mesh &mesh, int wind, const Eigen::Vector3d &pos, const Eig
   }
 }
 
-/// @brief This converts the piecewise cylindrical model into a smoother mesh than individual capsule meshes
-///        Specifically, each branch (from its base up through the widest radius at each bifurcation) is a continuous
-///        mesh with 6 vertices around its circumference. This is equivalent to the capsules being connected
-///        wherever it is a continuation of the branch. The result is fewer triangles and a smoother result.
-/// @param mesh the mesh object to generate into
-/// @param red_id the first colour channel id, used to colour the trees
-/// @param red_scale scale on the red colour component
-/// @param green_scale scale on the green channel
-/// @param blue_scale scale on the blue channel
-void ForestStructure::generateSmoothMesh(Mesh &mesh, int red_id, double red_scale,
-                        double green_scale, double blue_scale, bool add_uvs)
+namespace
+{
+/// generate the smooth mesh of a single tree, see ForestStructure::generateSmoothMesh()
+void generateTreeMesh(const TreeStructure &tree, Mesh &mesh, int red_id, double red_scale, double green_scale,
+                      double blue_scale, bool add_uvs)
 {
-  for (const auto &tree : trees)
+  const auto &segments = tree.segments();
+  // first generate the list of children for each segment
+  std::vector<std::vector<int>> children(segments.size());
+  for (size_t i = 0; i < segments.size(); i++)
   {
-    const auto &segments = tree.segments();
-    // first generate the list of children for each segment
-    std::vector<std::vector<int>> children(segments.size());
-    for (size_t i = 0; i < segments.size(); i++)
+    const auto &segment = segments[i];
+    int parent = segment.parent_id;
+    if (parent != -1)
     {
-      const auto &segment = segments[i];
-      int parent = segment.parent_id;
-      if (parent != -1)
-      {
-        children[parent].push_back(static_cast<int>(i));
-      }
+      children[parent].push_back(static_cast<int>(i));
     }
-    // now generate the set of root segments
-    std::vector<int> roots;
-    for (int i = 1; i < static_cast<int>(segments.size()); i++)
+  }
+  // now generate the set of root segments
+  std::vector<int> roots;
+  for (int i = 1; i < static_cast<int>(segments.size()); i++)
+  {
+    if (segments[i].parent_id > 0)
     {
-      if (segments[i].parent_id > 0)
-      {
-        break;
-      }
-      roots.push_back(i);
+      break;
     }
+    roots.push_back(i);
+  }
 
-    RGBA rgba;
-    // for each root, we follow up through the largest child to make a contiguous branch
-    for (size_t i = 0; i < roots.size(); i++)
-    {
-      int root_id = roots[i];
-      Eigen::Vector3d normal(1, 2, 3);  // unspecial 'up' direction for placing vertices along the circumference
+  RGBA rgba;
+  // for each root, we follow up through the largest child to make a contiguous branch
+  for (size_t i = 0; i < roots.size(); i++)
+  {
+    int root_id = roots[i];
+    Eigen::Vector3d normal(1, 2, 3);  // unspecial 'up' direction for placing vertices along the circumference
 
-      // we iterate through this list and grow it at the same time
-      std::vector<int> childlist = { root_id };
-      int wind = 0;  // this is what rotates the vertices half a triangle width at each segment, to keep the triangles isoceles
-      for (size_t j = 0; j < childlist.size(); j++)
+    // we iterate through this list and grow it at the same time
+    std::vector<int> childlist = { root_id };
+    int wind = 0;  // this is what rotates the vertices half a triangle width at each segment, to keep the triangles isoceles
+    for (size_t j = 0; j < childlist.size(); j++)
+    {
+      int child_id = childlist[j];
+      int par_id = segments[child_id].parent_id;
+      // generate an orthogonal frame for each ring of vertices to sit on
+      Eigen::Vector3d dir = (segments[child_id].tip - segments[par_id].tip).normalized();
+      Eigen::Vector3d axis1 = normal.cross(dir).normalized();
+      Eigen::Vector3d axis2 = axis1.cross(dir);
+      rgba = RGBA::treetrunk();  // standardised colour in raycloudtools
+      if (red_id != -1)               // use the per-segment colour if it exists (e.g. from treecolour)
       {
-        int child_id = childlist[j];
-        int par_id = segments[child_id].parent_id;
-        // generate an orthogonal frame for each ring of vertices to sit on
-        Eigen::Vector3d dir = (segments[child_id].tip - segments[par_id].tip).normalized();
-        Eigen::Vector3d axis1 = normal.cross(dir).normalized();
-        Eigen::Vector3d axis2 = axis1.cross(dir);
-        rgba = RGBA::treetrunk();  // standardised colour in raycloudtools
-        if (red_id != -1)               // use the per-segment colour if it exists (e.g. from treecolour)
-        {
-          rgba.red = uint8_t(std::min(red_scale * segments[child_id].attributes[red_id], 255.0));
-          rgba.green = uint8_t(std::min(green_scale * segments[child_id].attributes[red_id + 1], 255.0));
-          rgba.blue = uint8_t(std::min(blue_scale * segments[child_id].attributes[red_id + 2], 255.0));
-        }
+        rgba.red = uint8_t(std::min(red_scale * segments[child_id].attributes[red_id], 255.0));
+        rgba.green = uint8_t(std::min(green_scale * segments[child_id].attributes[red_id + 1], 255.0));
+        rgba.blue = uint8_t(std::min(blue_scale * segments[child_id].attributes[red_id + 2], 255.0));
+      }
 
-        if (child_id == root_id)  // add the base cap of the cylinder if we are at the root of the branch
-        {
-          addCapsulePiece(mesh, wind, segments[par_id].tip, axis1, axis2, segments[child_id].radius, rgba, true, false, add_uvs);
-        }
+      if (child_id == root_id)  // add the base cap of the cylinder if we are at the root of the branch
+      {
+        addCapsulePiece(mesh, wind, segments[par_id].tip, axis1, axis2, segments[child_id].radius, rgba, true, false, add_uvs);
+      }
 
-        wind++;
-        std::vector<int> kids = children[child_id];
-        if (kids.empty())  // add the end cap of the cylinder if we are at the end of the whole branch
-        {
-          addCapsulePiece(mesh, wind, segments[child_id].tip, axis1, axis2, segments[child_id].radius, rgba, false, true, add_uvs);
-          break;
-        }
-        // now find the maximum radius subbranch
-        double max_rad = 0.0;
-        int max_k = 0;
-        for (int k = 0; k < static_cast<int>(kids.size()); k++)
+      wind++;
+      std::vector<int> kids = children[child_id];
+      if (kids.empty())  // add the end cap of the cylinder if we are at the end of the whole branch
+      {
+        addCapsulePiece(mesh, wind, segments[child_id].tip, axis1, axis2, segments[child_id].radius, rgba, false, true, add_uvs);
+        break;
+      }
+      // now find the maximum radius subbranch
+      double max_rad = 0.0;
+      int max_k = 0;
+      for (int k = 0; k < static_cast<int>(kids.size()); k++)
+      {
+        double rad = segments[kids[k]].radius;
+        if (rad > max_rad)
         {
-          double rad = segments[kids[k]].radius;
-          if (rad > max_rad)
-          {
-            max_rad = rad;
-            max_k = k;
-          }
+          max_rad = rad;
+          max_k = k;
         }
-        for (int k = 0; k < static_cast<int>(kids.size()); k++)
+      }
+      for (int k = 0; k < static_cast<int>(kids.size()); k++)
+      {
+        if (k != max_k)
         {
-          if (k != max_k)
-          {
-            roots.push_back(kids[k]);  // all other subbranches get added to the list, to be iterated over on their turn
-          }
+          roots.push_back(kids[k]);  // all other subbranches get added to the list, to be iterated over on their turn
         }
-
-        int next_id = kids[max_k];
-        Eigen::Vector3d dir2 = (segments[next_id].tip - segments[child_id].tip).normalized();
-
-        Eigen::Vector3d top_dir = (dir2 + dir).normalized();  // here we average the directions of the two segments
-        // and generate an orthogonal basis for the ring of points on the branch
-        Eigen::Vector3d mid_axis1 = normal.cross(top_dir).normalized();
-        Eigen::Vector3d mid_axis2 = mid_axis1.cross(top_dir);
-        normal = -mid_axis2;
-        // add the ring of points
-        addCapsulePiece(mesh, wind, segments[child_id].tip, mid_axis1, mid_axis2, segments[child_id].radius, rgba,
-                        false, false, add_uvs);
-        // add the biggest subbranch to the list, so we continue to build the branch
-        childlist.push_back(kids[max_k]);
       }
+
+      int next_id = kids[max_k];
+      Eigen::Vector3d dir2 = (segments[next_id].tip - segments[child_id].tip).normalized();
+
+      Eigen::Vector3d top_dir = (dir2 + dir).normalized();  // here we average the directions of the two segments
+      // and generate an orthogonal basis for the ring of points on the branch
+      Eigen::Vector3d mid_axis1 = normal.cross(top_dir).normalized();
+      Eigen::Vector3d mid_axis2 = mid_axis1.cross(top_dir);
+      normal = -mid_axis2;
+      // add the ring of points
+      addCapsulePiece(mesh, wind, segments[child_id].tip, mid_axis1, mid_axis2, segments[child_id].radius, rgba,
+                      false, false, add_uvs);
+      // add the biggest subbranch to the list, so we continue to build the branch
+      childlist.push_back(kids[max_k]);
     }
   }
 }
 
+/// mesh the trees in parallel, one block of trees at a time, passing the mesh of each block to @c add_block in
+/// tree order. This bounds the memory used to that of the block's meshes
+bool meshTreeBlocks(const std::vector<TreeStructure> &trees, int red_id, double red_scale, double green_scale,
+                    double blue_scale, bool add_uvs, std::function<bool(const Mesh &block_mesh)> add_block)
+{
+  const size_t block_size = 1024;
+  std::vector<Mesh> tree_meshes;
+  Mesh block_mesh;
+  for (size_t block_start = 0; block_start < trees.size(); block_start += block_size)
+  {
+    const size_t num_trees = std::min(block_size, trees.size() - block_start);
+    tree_meshes.assign(num_trees, Mesh());
+    auto mesh_tree = [&](size_t i) 
+    { 
+      generateTreeMesh(trees[block_start + i], tree_meshes[i], red_id, red_scale, green_scale, blue_scale, add_uvs);
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, num_trees, mesh_tree);
+#else
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < static_cast<int64_t>(num_trees); i++)
+    {
+      mesh_tree(static_cast<size_t>(i));
+    }
+#endif  // RAYLIB_WITH_TBB
+    block_mesh = Mesh();
+    for (auto &tree_mesh : tree_meshes)
+    {
+      block_mesh.append(tree_mesh);
+    }
+    if (!add_block(block_mesh))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+/// @brief This converts the piecewise cylindrical model into a smoother mesh than individual capsule meshes
+///        Specifically, each branch (from its base up through the widest radius at each bifurcation) is a continuous
+///        mesh with 6 vertices around its circumference. This is equivalent to the capsules being connected
+///        wherever it is a continuation of the branch. The result is fewer triangles and a smoother result.
+///        The trees are meshed in parallel.
+/// @param mesh the mesh object to generate into
+/// @param red_id the first colour channel id, used to colour the trees
+/// @param red_scale scale on the red colour component
+/// @param green_scale scale on the green channel
+/// @param blue_scale scale on the blue channel
+void ForestStructure::generateSmoothMesh(Mesh &mesh, int red_id, double red_scale,
+                        double green_scale, double blue_scale, bool add_uvs)
+{
+  meshTreeBlocks(trees, red_id, red_scale, green_scale, blue_scale, add_uvs, [&](const Mesh &block_mesh) 
+  {
+    mesh.append(block_mesh);
+    return true;
+  });
+}
+
+bool ForestStructure::writeSmoothMesh(const std::string &filename, int red_id, double red_scale, double green_scale,
+                                      double blue_scale, bool flip_normals, bool add_uvs)
+{
+  MeshWriter writer;
+  if (!writer.begin(filename, flip_normals, add_uvs))
+  {
+    return false;
+  }
+  if (!meshTreeBlocks(trees, red_id, red_scale, green_scale, blue_scale, add_uvs, 
+                      [&](const Mesh &block_mesh) { return writer.writeChunk(block_mesh); }))
+  {
+    writer.end();
+    return false;
+  }
+  return writer.end();
+}
+
 void ForestStructure::reindex()
 {
   for (auto &tree: trees)
@@ -9,6 +9,8 @@
 #include "raylib/raylibconfig.h"
 #include "raylib/raycloud.h"
 #include "raylib/raymesh.h"
+#include "raycuboid.h"
+#include "raymappedfile.h"
 #include "raytreestructure.h"
 #include "rayutils.h"
 
@@ -19,16 +21,76 @@ struct RAYLIB_EXPORT ForestStructure
 {
   std::vector<TreeStructure> trees;
 
+  /// load a trees file, in either the text format or the binary format of saveBinary()
   bool load(const std::string &filename);
+  /// load only the trees whose bounds overlap @c bounds. Only these trees are read from a binary file
+  bool load(const std::string &filename, const Cuboid &bounds);
   bool save(const std::string &filename);
+  /// save in the binary trees format, which is faster to load and can be loaded in part, see ForestFile
+  bool saveBinary(const std::string &filename) const;
   bool trunksOnly() { return trees.size() > 0 && trees[0].segments().size() == 1; }
   Eigen::Array<double, 9, 1> getMoments() const;
   void splitCloud(const Cloud &cloud, double offset, Cloud &inside, Cloud &outside);
   void generateSmoothMesh(Mesh &mesh, int red_id, double red_scale,
                           double green_scale, double blue_scale, bool add_uvs = false);
+  /// generate the same mesh as generateSmoothMesh(), streaming it to the .ply file @c filename a block of trees at a
+  /// time, so the whole mesh is never held in memory
+  bool writeSmoothMesh(const std::string &filename, int red_id, double red_scale, double green_scale,
+                       double blue_scale, bool flip_normals = false, bool add_uvs = false);
   /// reindex the segments to remove any disconnected segments, and order from root to tips
   void reindex();
   std::vector<std::string> comments; // just header comments
 };
+
+/// Read access to a binary trees file, as written by ForestStructure::saveBinary(). The file holds a table of the
+/// offset, root and bounds of each tree, followed by the tree data. It is memory mapped and each tree is only parsed on
+/// request, so the trees overlapping a tile of a large forest can be loaded using treesOverlapping() and loadTree()
+/// without reading the rest of the file. The trees are indexed spatially by their root position.
+/// The values are stored raw, in the byte order of the host that saved the file, so a file is only readable on hosts
+/// of the same endianness.
+class RAYLIB_EXPORT ForestFile
+{
+public:
+  /// the size of each tree's entry in the table: its offset, number of segments, root and bounds
+  static const size_t kEntrySize = 88;
+
+  bool open(const std::string &filename);
+  /// true if @c filename is in the binary trees format
+  static bool isBinary(const std::string &filename);
+
+  inline size_t numTrees() const { return num_trees_; }
+  /// the position of the base of the trunk of tree @c id
+  Eigen::Vector3d root(size_t id) const;
+  /// the bounds of tree @c id, including the branch radii
+  Cuboid treeBounds(size_t id) const;
+  /// the ids of the trees whose bounds overlap @c bounds, in file order
+  std::vector<size_t> treesOverlapping(const Cuboid &bounds) const;
+  /// parse tree @c id from the file. This can be called from multiple threads
+  bool loadTree(size_t id, TreeStructure &tree) const;
+
+  const std::vector<std::string> &comments() const { return comments_; }
+
+private:
+  /// the start of the table entry for tree @c id
+  inline const uint8_t *entry(size_t id) const { return table_ + id * kEntrySize; }
+  void buildIndex();
+
+  MappedFile file_;
+  std::string filename_;
+  size_t num_trees_ = 0;
+  const uint8_t *data_ = nullptr;   // the whole file
+  const uint8_t *table_ = nullptr;  // the table of trees within data_
+  std::vector<std::string> comments_;
+  std::vector<std::string> tree_attribute_names_;
+  std::vector<std::string> branch_attribute_names_;
+
+  // spatial index of the tree roots, a grid of cells in x and y with the tree ids of each cell stored contiguously
+  Eigen::Vector2d index_min_bound_;
+  double cell_width_ = 1.0;
+  Eigen::Vector2i cell_dims_;
+  std::vector<size_t> cell_starts_;  // the start of each cell in cell_trees_, with a final end marker
+  std::vector<size_t> cell_trees_;
+  double max_reach_ = 0.0;  // the furthest horizontal extent of any tree's bounds from its root
+};
 }  // namespace ray
 #endif  // RAYLIB_RAYFORESTSTRUCTURE_H
@@ -6,6 +6,7 @@
 #include "raylaz.h"
 #include "raylib/rayprogress.h"
 #include "raylib/rayprogressthread.h"
+#include "raymappedfile.h"
 #include "rayunused.h"
 
 #if RAYLIB_WITH_LAS
@@ -13,29 +14,136 @@
 #include <liblas/point.hpp>
 #endif  // RAYLIB_WITH_LAS
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <limits>
+#include <memory>
+#include <thread>
+
 namespace ray
 {
-bool readLas(const std::string &file_name,
-             std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
-                                std::vector<double> &times, std::vector<RGBA> &colours)>
-               apply,
-             size_t &num_bounded, double max_intensity, Eigen::Vector3d *offset_to_remove, size_t chunk_size)
+namespace
 {
-#if RAYLIB_WITH_LAS
-  std::cout << "readLas: filename: " << file_name << std::endl;
+/// read a little endian value from an unaligned position in the file
+template <typename T>
+inline T lasValue(const uint8_t *bytes)
+{
+  T value;
+  std::memcpy(&value, bytes, sizeof(T));
+  return value;
+}
 
-  std::ifstream ifs;
-  ifs.open(file_name.c_str(), std::ios::in | std::ios::binary);
+/// The parts of the las public header block that are needed to decode the point records, for versions 1.0 to 1.4
+struct LasHeader
+{
+  bool parse(MappedFile &file, const std::string &file_name)
+  {
+    const size_t min_header_size = 227;  // the size of a version 1.0-1.2 header
+    if (file.size() < min_header_size)
+    {
+      std::cerr << "readLas: " << file_name << " is too small to be a las file" << std::endl;
+      return false;
+    }
+    const uint8_t *bytes = file.data(0, std::min<size_t>(file.size(), 375));
+    if (std::memcmp(bytes, "LASF", 4) != 0)
+    {
+      std::cerr << "readLas: " << file_name << " is not a las file" << std::endl;
+      return false;
+    }
+    version_minor = bytes[25];
+    const uint16_t header_size = lasValue<uint16_t>(bytes + 94);
+    point_data_offset = lasValue<uint32_t>(bytes + 96);
+    const uint8_t format_id = bytes[104];
+    compressed = (format_id & 0xC0) != 0;  // LASzip flags compressed files in the top bits of the format id
+    point_format = format_id & 0x3F;
+    record_length = lasValue<uint16_t>(bytes + 105);
+    num_points = lasValue<uint32_t>(bytes + 107);
+    if (version_minor >= 4 && header_size >= 255 && file.size() >= 255)
+    {
+      const uint64_t num_points_64 = lasValue<uint64_t>(bytes + 247);
+      if (num_points_64 > 0)
+      {
+        num_points = num_points_64;
+      }
+    }
+    for (int i = 0; i < 3; i++)
+    {
+      scale[i] = lasValue<double>(bytes + 131 + 8 * i);
+      offset[i] = lasValue<double>(bytes + 155 + 8 * i);
+    }
+    return true;
+  }
 
-  if (ifs.fail())
+  /// set the byte offsets of the fields within a point record, and check that the records fit in the file
+  bool setLayout(size_t file_size, const std::string &file_name)
   {
-    std::cerr << "readLas: failed to open stream" << std::endl;
-    return false;
+    // minimum record length for each point data format, 0 to 10
+    const size_t format_lengths[11] = { 20, 28, 26, 34, 57, 63, 30, 36, 38, 59, 67 };
+    if (point_format > 10)
+    {
+      std::cerr << "readLas: unsupported point data format " << point_format << " in " << file_name << std::endl;
+      return false;
+    }
+    if (record_length < format_lengths[point_format] ||
+        point_data_offset + num_points * record_length > static_cast<uint64_t>(file_size))
+    {
+      std::cerr << "readLas: point records in " << file_name << " are inconsistent with the file size" << std::endl;
+      return false;
+    }
+    const bool extended = point_format >= 6;
+    has_time = point_format != 0 && point_format != 2;
+    time_offset = extended ? 22 : 20;
+    has_colour = point_format == 2 || point_format == 3 || point_format == 5 || point_format == 7 ||
+                 point_format == 8 || point_format == 10;
+    colour_offset = point_format == 2 ? 20 : (extended ? 30 : 28);
+    return true;
   }
 
-  liblas::ReaderFactory f;
-  liblas::Reader reader = f.CreateWithStream(ifs);
-  liblas::Header const &header = reader.GetHeader();
+  int version_minor = 0;
+  uint64_t point_data_offset = 0;
+  int point_format = 0;
+  bool compressed = false;
+  uint64_t record_length = 0;
+  uint64_t num_points = 0;
+  Eigen::Vector3d scale;
+  Eigen::Vector3d offset;
+  bool has_time = false;
+  bool has_colour = false;
+  size_t time_offset = 0;
+  size_t colour_offset = 0;
+};
+
+#if RAYLIB_WITH_LAS
+/// read a las or laz file through liblas. This is used for laz files, which need decompressing. Each chunk of points is
+/// divided between several readers of the same file, which LASzip lets seek to their first point using its chunk
+/// table, so that the chunk is decompressed in parallel
+bool readLasLibLas(const std::string &file_name,
+                   std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                      std::vector<double> &times, std::vector<RGBA> &colours)>
+                     apply,
+                   size_t &num_bounded, double max_intensity, Eigen::Vector3d *offset_to_remove, size_t chunk_size)
+{
+  // one reader, with its own stream, per thread
+  const size_t num_readers = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::unique_ptr<std::ifstream>> streams(num_readers);
+  std::vector<std::unique_ptr<liblas::Reader>> readers(num_readers);
+  liblas::ReaderFactory factory;
+  for (size_t r = 0; r < num_readers; r++)
+  {
+    streams[r].reset(new std::ifstream(file_name.c_str(), std::ios::in | std::ios::binary));
+    if (streams[r]->fail())
+    {
+      std::cerr << "readLas: failed to open stream" << std::endl;
+      return false;
+    }
+    readers[r].reset(new liblas::Reader(factory.CreateWithStream(*streams[r])));
+  }
+  liblas::Header const &header = readers[0]->GetHeader();
 
   Eigen::Vector3d offset(header.GetOffsetX(), header.GetOffsetY(), header.GetOffsetZ());
   if (offset_to_remove)
@@ -54,10 +162,10 @@ bool readLas(const std::string &file_name,
     return false;
   }
 
+  chunk_size = std::max<size_t>(1, std::min(number_of_points, chunk_size));
+  const size_t num_chunks = number_of_points == 0 ? 0 : 1 + (number_of_points - 1) / chunk_size;
   ray::Progress progress;
   ray::ProgressThread progress_thread(progress);
-  const size_t num_chunks = (number_of_points + (chunk_size - 1)) / chunk_size;
-  chunk_size = std::min(number_of_points, chunk_size);
   progress.begin("read and process", num_chunks);
 
   std::vector<Eigen::Vector3d> starts;
@@ -65,60 +173,227 @@ bool readLas(const std::string &file_name,
   std::vector<double> times;
   std::vector<RGBA> colours;
   std::vector<uint8_t> intensities;
-  starts.reserve(chunk_size);
-  ends.reserve(chunk_size);
-  times.reserve(chunk_size);
-  intensities.reserve(chunk_size);
-  colours.reserve(chunk_size);
 
   num_bounded = 0;
-  for (unsigned int i = 0; i < number_of_points; i++)
+  bool success = true;
+  for (size_t chunk_start = 0; chunk_start < number_of_points && success; chunk_start += chunk_size)
   {
-    reader.ReadNextPoint();
-    liblas::Point point = reader.GetPoint();
-
-    Eigen::Vector3d position;
-    position[0] = point.GetX();
-    position[1] = point.GetY();
-    position[2] = point.GetZ();
-
-    ends.push_back(position);
-    starts.push_back(position);  // equal to position for laz files, as we do not store the start points
+    const size_t count = std::min(chunk_size, number_of_points - chunk_start);
+    starts.resize(count);
+    ends.resize(count);
+    times.resize(count);
+    colours.resize(count);
+    intensities.resize(count);
+    const size_t part_size = 1 + (count - 1) / num_readers;
+    std::vector<char> part_success(num_readers, 1);
+    auto read_part = [&](size_t r) {
+      const size_t part_start = r * part_size;
+      const size_t part_end = std::min(count, part_start + part_size);
+      if (part_start >= part_end)
+      {
+        return;
+      }
+      liblas::Reader &reader = *readers[r];
+      try
+      {
+        reader.Seek(chunk_start + part_start);
+        for (size_t i = part_start; i < part_end; i++)
+        {
+          if (!reader.ReadNextPoint())
+          {
+            part_success[r] = 0;
+            return;
+          }
+          const liblas::Point &point = reader.GetPoint();
+          const Eigen::Vector3d position(point.GetX(), point.GetY(), point.GetZ());
+          ends[i] = position;
+          starts[i] = position;  // equal to position for laz files, as we do not store the start points
+          if (using_colour)
+          {
+            const liblas::Color colour = point.GetColor();
+            colours[i].red = static_cast<uint8_t>(colour.GetRed());
+            colours[i].green = static_cast<uint8_t>(colour.GetGreen());
+            colours[i].blue = static_cast<uint8_t>(colour.GetBlue());
+          }
+          times[i] = point.GetTime();
+          const double normalised_intensity = (255.0 * point.GetIntensity()) / max_intensity;
+          intensities[i] = static_cast<uint8_t>(std::min(normalised_intensity, 255.0));
+        }
+      }
+      catch (const std::exception &e)  // liblas throws on a corrupt file
+      {
+        std::cerr << "readLas: " << e.what() << std::endl;
+        part_success[r] = 0;
+      }
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, num_readers, read_part);
+#else
+    #pragma omp parallel for schedule(static, 1)
+    for (int64_t r = 0; r < static_cast<int64_t>(num_readers); r++)
+    {
+      read_part(static_cast<size_t>(r));
+    }
+#endif  // RAYLIB_WITH_TBB
+    for (auto part : part_success)
+    {
+      if (!part)
+      {
+        std::cerr << "readLas: failed to read the points of " << file_name << std::endl;
+        success = false;
+      }
+    }
+    if (!success)
+    {
+      break;
+    }
 
-    if (using_colour)
+    if (!using_colour)
+    {
+      colourByTime(times, colours);
+    }
+    for (size_t i = 0; i < count; i++)  // add intensity into alpha channel
     {
-      liblas::Color colour = point.GetColor();
-      RGBA col;
-      col.red = static_cast<uint8_t>(colour.GetRed());
-      col.green = static_cast<uint8_t>(colour.GetGreen());
-      col.blue = static_cast<uint8_t>(colour.GetBlue());
-      colours.push_back(col);
+      colours[i].alpha = intensities[i];
+      if (intensities[i] > 0)
+        num_bounded++;
     }
-    times.push_back(point.GetTime());
+    apply(starts, ends, times, colours);
+    progress.increment();
+  }
 
-    const double point_int = point.GetIntensity();
-    const double normalised_intensity = (255.0 * point_int) / max_intensity;
-    const uint8_t intensity = static_cast<uint8_t>(std::min(normalised_intensity, 255.0));
-    if (intensity > 0)
-      num_bounded++;
-    intensities.push_back(intensity);
+  progress.end();
+  progress_thread.requestQuit();
+  progress_thread.join();
+
+  if (success)
+  {
+    std::cout << "loaded " << file_name << " with " << number_of_points << " points" << std::endl;
+  }
+  return success;
+}
+#endif  // RAYLIB_WITH_LAS
+}  // namespace
 
-    if (ends.size() == chunk_size || i == number_of_points - 1)
+bool readLas(const std::string &file_name,
+             std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                std::vector<double> &times, std::vector<RGBA> &colours)>
+               apply,
+             size_t &num_bounded, double max_intensity, Eigen::Vector3d *offset_to_remove, size_t chunk_size)
+{
+  std::cout << "readLas: filename: " << file_name << std::endl;
+  MappedFile file;
+  if (!file.open(file_name, true))
+  {
+    std::cerr << "readLas: failed to open stream" << std::endl;
+    return false;
+  }
+  LasHeader header;
+  if (!header.parse(file, file_name))
+  {
+    return false;
+  }
+  if (header.compressed)
+  {
+#if RAYLIB_WITH_LAS
+    return readLasLibLas(file_name, apply, num_bounded, max_intensity, offset_to_remove, chunk_size);
+#else   // RAYLIB_WITH_LAS
+    std::cerr << "readLas: cannot read compressed file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
+              << std::endl;
+    return false;
+#endif  // RAYLIB_WITH_LAS
+  }
+
+  // uncompressed las files have fixed size point records, so these are decoded directly, in parallel
+  if (!header.setLayout(file.size(), file_name))
+  {
+    return false;
+  }
+  if (offset_to_remove)
+  {
+    *offset_to_remove = header.offset;
+    std::cout << "offset to remove: " << header.offset.transpose() << std::endl;
+  }
+  if (!header.has_time)
+  {
+    std::cerr << "No timestamps found on laz file, these are required" << std::endl;
+    return false;
+  }
+
+  const size_t number_of_points = static_cast<size_t>(header.num_points);
+  chunk_size = std::max<size_t>(1, std::min(number_of_points, chunk_size));
+  const size_t num_chunks = number_of_points == 0 ? 0 : 1 + (number_of_points - 1) / chunk_size;
+  ray::Progress progress;
+  ray::ProgressThread progress_thread(progress);
+  progress.begin("read and process", num_chunks);
+
+  std::vector<Eigen::Vector3d> starts;
+  std::vector<Eigen::Vector3d> ends;
+  std::vector<double> times;
+  std::vector<RGBA> colours;
+  std::vector<uint8_t> intensities;
+  // the records are decoded in blocks, so that only a bounded part of the file is buffered when it is not mapped
+  const size_t block_size = 1 << 20;
+
+  num_bounded = 0;
+  for (size_t chunk_start = 0; chunk_start < number_of_points; chunk_start += chunk_size)
+  {
+    const size_t count = std::min(chunk_size, number_of_points - chunk_start);
+    starts.resize(count);
+    ends.resize(count);
+    times.resize(count);
+    colours.resize(header.has_colour ? count : 0);
+    intensities.resize(count);
+    for (size_t block_start = 0; block_start < count; block_start += block_size)
     {
-      if (colours.size() == 0)
+      const size_t block_count = std::min(block_size, count - block_start);
+      const uint8_t *records = file.data(header.point_data_offset + (chunk_start + block_start) * header.record_length,
+                                         block_count * header.record_length);
+      auto decode_point = [&](size_t j) {
+        const uint8_t *record = records + j * header.record_length;
+        const size_t i = block_start + j;
+        Eigen::Vector3d position;
+        for (int k = 0; k < 3; k++)
+        {
+          position[k] = static_cast<double>(lasValue<int32_t>(record + 4 * k)) * header.scale[k] + header.offset[k];
+        }
+        ends[i] = position;
+        starts[i] = position;  // equal to position for laz files, as we do not store the start points
+        if (header.has_colour)
+        {
+          // truncated to the lower byte, as done when reading through liblas
+          colours[i].red = static_cast<uint8_t>(lasValue<uint16_t>(record + header.colour_offset));
+          colours[i].green = static_cast<uint8_t>(lasValue<uint16_t>(record + header.colour_offset + 2));
+          colours[i].blue = static_cast<uint8_t>(lasValue<uint16_t>(record + header.colour_offset + 4));
+        }
+        times[i] = lasValue<double>(record + header.time_offset);
+        const double normalised_intensity = (255.0 * lasValue<uint16_t>(record + 12)) / max_intensity;
+        intensities[i] = static_cast<uint8_t>(std::min(normalised_intensity, 255.0));
+      };
+#if RAYLIB_WITH_TBB
+      tbb::parallel_for<size_t>(0, block_count, decode_point);
+#else
+      #pragma omp parallel for
+      for (int64_t j = 0; j < static_cast<int64_t>(block_count); j++)
       {
-        colourByTime(times, colours);
+        decode_point(static_cast<size_t>(j));
       }
-      for (int i = 0; i < (int)colours.size(); i++)  // add intensity into alhpa channel
-        colours[i].alpha = intensities[i];
-      apply(starts, ends, times, colours);
-      starts.clear();
-      ends.clear();
-      times.clear();
-      colours.clear();
-      intensities.clear();
-      progress.increment();
+#endif  // RAYLIB_WITH_TBB
+    }
+
+    for (auto &intensity : intensities)
+    {
+      if (intensity > 0)
+        num_bounded++;
     }
+    if (colours.size() == 0)
+    {
+      colourByTime(times, colours);
+    }
+    for (size_t i = 0; i < colours.size(); i++)  // add intensity into alpha channel
+      colours[i].alpha = intensities[i];
+    apply(starts, ends, times, colours);
+    progress.increment();
   }
 
   progress.end();
@@ -127,16 +402,6 @@ bool readLas(const std::string &file_name,
 
   std::cout << "loaded " << file_name << " with " << number_of_points << " points" << std::endl;
   return true;
-#else   // RAYLIB_WITH_LAS
-  RAYLIB_UNUSED(max_intensity);
-  RAYLIB_UNUSED(file_name);
-  RAYLIB_UNUSED(apply);
-  RAYLIB_UNUSED(num_bounded);
-  RAYLIB_UNUSED(chunk_size);
-  RAYLIB_UNUSED(max_intensity);
-  std::cerr << "readLas: cannot read file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true" << std::endl;
-  return false;
-#endif  // RAYLIB_WITH_LAS
 }
 
 bool readLas(std::string file_name, std::vector<Eigen::Vector3d> &positions, std::vector<double> &times,
@@ -166,124 +431,279 @@ bool readLas(std::string file_name, std::vector<Eigen::Vector3d> &positions, std
 bool RAYLIB_EXPORT writeLas(std::string file_name, const std::vector<Eigen::Vector3d> &points,
                             const std::vector<double> &times, const std::vector<RGBA> &colours)
 {
-#if RAYLIB_WITH_LAS
-  std::cout << "saving LAZ file" << std::endl;
-
-  liblas::Header header;
-  header.SetDataFormatId(liblas::ePointFormat1);  // Time only
-
-  if (file_name.find(".laz") != std::string::npos)
-    header.SetCompressed(true);
-
-  std::cout << "Saving points to " << file_name << std::endl;
-
-  std::ofstream ofs;
-  ofs.open(file_name.c_str(), std::ios::out | std::ios::binary);
-  if (ofs.fail())
+  LasWriter writer(file_name);
+  if (!writer.writeChunk(points, times, colours))
   {
-    std::cerr << "Error: cannot open " << file_name << " for writing." << std::endl;
     return false;
   }
+  return writer.end();
+}
 
-  const double scale = 1e-4;
-  header.SetScale(scale, scale, scale);
+namespace
+{
+// The las files are written as version 1.2, point data format 1 (position, intensity and time)
+const double las_scale = 1e-4;
+const size_t las_header_size = 227;
+const size_t las_record_length = 28;
 
-  liblas::Writer writer(ofs, header);
-  liblas::Point point(&header);
-  point.SetHeader(&header);  // TODO HACK Version 1.7.0 does not correctly resize the data. Commit
-                             // 6e8657336ba445fcec3c9e70c2ebcd2e25af40b9 (1.8.0 3 July fixes it)
-  for (unsigned int i = 0; i < points.size(); i++)
-  {
-    point.SetCoordinates(points[i][0], points[i][1], points[i][2]);
-    point.SetIntensity(colours[i].alpha);
-    if (!times.empty())
-      point.SetTime(times[i]);
-    writer.WritePoint(point);
-  }
-  return true;
-#else   // RAYLIB_WITH_LAS
-  RAYLIB_UNUSED(file_name);
-  RAYLIB_UNUSED(points);
-  RAYLIB_UNUSED(times);
-  RAYLIB_UNUSED(colours);
-  std::cerr << "writeLas: cannot write file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
-            << std::endl;
-  return false;
-#endif  // RAYLIB_WITH_LAS
+/// write a little endian value into @c bytes
+template <typename T>
+inline void setLasValue(uint8_t *bytes, const T &value)
+{
+  std::memcpy(bytes, &value, sizeof(T));
 }
 
-#if RAYLIB_WITH_LAS
+/// the quantised coordinate of @c value, relative to @c offset. The value must be within range, see lasInRange()
+inline int32_t lasCoordinate(double value, double offset)
+{
+  return static_cast<int32_t>(std::llround((value - offset) / las_scale));
+}
+
+/// whether @c value can be quantised relative to @c offset without overflowing the 32 bit las coordinates
+inline bool lasInRange(double value, double offset)
+{
+  const double quantised = std::round((value - offset) / las_scale);
+  return quantised >= static_cast<double>(std::numeric_limits<int32_t>::min()) &&
+         quantised <= static_cast<double>(std::numeric_limits<int32_t>::max());
+}
+
+/// an offset for the points in a chunk, the centre of their bounds rounded to the nearest metre
+Eigen::Vector3d lasOffset(const Eigen::Vector3d &min_bound, const Eigen::Vector3d &max_bound)
+{
+  const Eigen::Vector3d centre = (min_bound + max_bound) / 2.0;
+  return Eigen::Vector3d(std::round(centre[0]), std::round(centre[1]), std::round(centre[2]));
+}
+}  // namespace
+
 LasWriter::LasWriter(const std::string &file_name)
   : file_name_(file_name)
+  , compressed_(file_name.find(".laz") != std::string::npos)
+  , ended_(false)
+  , failed_(false)
+  , num_points_(0)
+  , min_bound_(0, 0, 0)
+  , max_bound_(0, 0, 0)
+  , offset_(0, 0, 0)
+#if RAYLIB_WITH_LAS
+  , writer_(nullptr)
+#endif  // RAYLIB_WITH_LAS
 {
-  header_.SetDataFormatId(liblas::ePointFormat1);  // Time only
-  if (file_name_.find(".laz") != std::string::npos)
-    header_.SetCompressed(true);
-
   std::cout << "Saving points to " << file_name_ << std::endl;
+  if (compressed_)
+  {
+#if RAYLIB_WITH_LAS
+    header_.SetDataFormatId(liblas::ePointFormat1);  // Time only
+    header_.SetCompressed(true);
+    out_.open(file_name_.c_str(), std::ios::out | std::ios::binary);
+    if (out_.fail())
+    {
+      std::cerr << "Error: cannot open " << file_name << " for writing." << std::endl;
+      return;
+    }
+    header_.SetScale(las_scale, las_scale, las_scale);  // the writer is created with the first chunk's offset
+#else   // RAYLIB_WITH_LAS
+    std::cerr << "writeLas: cannot write compressed file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
+              << std::endl;
+#endif  // RAYLIB_WITH_LAS
+    return;
+  }
   out_.open(file_name_.c_str(), std::ios::out | std::ios::binary);
   if (out_.fail())
   {
     std::cerr << "Error: cannot open " << file_name << " for writing." << std::endl;
     return;
   }
-  const double scale = 1e-4;
-  header_.SetScale(scale, scale, scale);
-  writer_ = new liblas::Writer(out_, header_);
+  writeHeader();  // with no points, this is rewritten by end()
 }
-#else   // RAYLIB_WITH_LAS
-LasWriter::LasWriter(const std::string &file_name)
-  : file_name_(file_name)
+
+LasWriter::~LasWriter()
 {
-  RAYLIB_UNUSED(file_name);
-  std::cerr << "writeLas: cannot write file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
-            << std::endl;
+  end();
 }
-#endif  // RAYLIB_WITH_LAS
 
-LasWriter::~LasWriter()
+bool LasWriter::writeHeader()
 {
-#if RAYLIB_WITH_LAS
-  delete writer_;
-#else
-  std::cerr << "writeLas: cannot write file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
-            << std::endl;
-#endif
+  uint8_t header[las_header_size] = {};
+  std::memcpy(header, "LASF", 4);
+  header[24] = 1;  // version 1.2
+  header[25] = 2;
+  const char software[] = "raycloudtools";
+  std::memcpy(header + 26, software, sizeof(software));  // system identifier
+  std::memcpy(header + 58, software, sizeof(software));  // generating software
+  const std::time_t now = std::time(nullptr);
+  const std::tm *date = std::localtime(&now);
+  if (date)
+  {
+    setLasValue<uint16_t>(header + 90, static_cast<uint16_t>(date->tm_yday + 1));
+    setLasValue<uint16_t>(header + 92, static_cast<uint16_t>(date->tm_year + 1900));
+  }
+  setLasValue<uint16_t>(header + 94, static_cast<uint16_t>(las_header_size));
+  setLasValue<uint32_t>(header + 96, static_cast<uint32_t>(las_header_size));  // offset to the point data
+  header[104] = 1;                                                              // point data format
+  setLasValue<uint16_t>(header + 105, static_cast<uint16_t>(las_record_length));
+  const uint32_t num_points = static_cast<uint32_t>(num_points_);  // writeChunk() keeps this within range
+  setLasValue<uint32_t>(header + 107, num_points);
+  setLasValue<uint32_t>(header + 111, num_points);  // every point is a first return
+  for (int i = 0; i < 3; i++)
+  {
+    setLasValue<double>(header + 131 + 8 * i, las_scale);
+    setLasValue<double>(header + 155 + 8 * i, offset_[i]);
+    // the bounds of the quantised coordinates, as las readers compute them
+    setLasValue<double>(header + 179 + 16 * i,
+                        static_cast<double>(lasCoordinate(max_bound_[i], offset_[i])) * las_scale + offset_[i]);
+    setLasValue<double>(header + 187 + 16 * i,
+                        static_cast<double>(lasCoordinate(min_bound_[i], offset_[i])) * las_scale + offset_[i]);
+  }
+  out_.seekp(0, std::ios::beg);
+  out_.write(reinterpret_cast<const char *>(header), las_header_size);
+  out_.seekp(0, std::ios::end);
+  return !out_.fail();
 }
 
 bool LasWriter::writeChunk(const std::vector<Eigen::Vector3d> &points, const std::vector<double> &times,
                            const std::vector<RGBA> &colours)
 {
-#if RAYLIB_WITH_LAS
   if (points.size() == 0)
   {
     return true;  // this is acceptable behaviour. It avoids calling function checking for emptiness each time
   }
-  if (out_.fail())
+  Eigen::Vector3d min_bound = points[0];
+  Eigen::Vector3d max_bound = points[0];
+  for (auto &point : points)
+  {
+    min_bound = minVector(min_bound, point);
+    max_bound = maxVector(max_bound, point);
+  }
+  if (num_points_ == 0)
+  {
+    offset_ = lasOffset(min_bound, max_bound);
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    if (!lasInRange(min_bound[i], offset_[i]) || !lasInRange(max_bound[i], offset_[i]))
+    {
+      std::cerr << "Error: points from " << min_bound.transpose() << " to " << max_bound.transpose()
+                << " are too far from the offset " << offset_.transpose() << " to be written to " << file_name_
+                << std::endl;
+      failed_ = true;
+      return false;
+    }
+  }
+  // the version 1.2 header records the point count in 32 bits, so the chunk that would overflow it is not written
+  if (num_points_ + points.size() > std::numeric_limits<uint32_t>::max())
+  {
+    std::cerr << "Error: " << file_name_ << " cannot hold more than " << std::numeric_limits<uint32_t>::max()
+              << " points, the limit of a version 1.2 las file" << std::endl;
+    failed_ = true;
+    return false;
+  }
+  if (compressed_)
+  {
+#if RAYLIB_WITH_LAS
+    if (out_.fail())
+    {
+      std::cerr << "Error: cannot open " << file_name_ << " for writing." << std::endl;
+      failed_ = true;
+      return false;
+    }
+    if (!writer_)
+    {
+      header_.SetOffset(offset_[0], offset_[1], offset_[2]);
+      writer_ = new liblas::Writer(out_, header_);
+    }
+    liblas::Point point(&header_);
+    point.SetHeader(&header_);  // TODO HACK Version 1.7.0 does not correctly resize the data. Commit
+                                // 6e8657336ba445fcec3c9e70c2ebcd2e25af40b9 (1.8.0 3 July fixes it)
+    for (unsigned int i = 0; i < points.size(); i++)
+    {
+      point.SetCoordinates(points[i][0], points[i][1], points[i][2]);
+      point.SetIntensity(colours[i].alpha);
+      if (!times.empty())
+        point.SetTime(times[i]);
+      writer_->WritePoint(point);
+    }
+    num_points_ += points.size();
+    return true;
+#else   // RAYLIB_WITH_LAS
+    RAYLIB_UNUSED(times);
+    RAYLIB_UNUSED(colours);
+    std::cerr << "writeLas: cannot write compressed file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
+              << std::endl;
+    failed_ = true;
+    return false;
+#endif  // RAYLIB_WITH_LAS
+  }
+  if (out_.fail() || ended_)
   {
     std::cerr << "Error: cannot open " << file_name_ << " for writing." << std::endl;
+    failed_ = true;
     return false;
   }
-  liblas::Point point(&header_);
-  point.SetHeader(&header_);  // TODO HACK Version 1.7.0 does not correctly resize the data. Commit
-                              // 6e8657336ba445fcec3c9e70c2ebcd2e25af40b9 (1.8.0 3 July fixes it)
-  for (unsigned int i = 0; i < points.size(); i++)
+
+  // encode the point records in parallel, then write them in order
+  buffer_.assign(points.size() * las_record_length, 0);
+  auto encode_point = [&](size_t i) {
+    uint8_t *record = buffer_.data() + i * las_record_length;
+    for (int j = 0; j < 3; j++)
+    {
+      setLasValue<int32_t>(record + 4 * j, lasCoordinate(points[i][j], offset_[j]));
+    }
+    setLasValue<uint16_t>(record + 12, static_cast<uint16_t>(colours[i].alpha));
+    record[14] = 1 | (1 << 3);  // return 1 of 1
+    setLasValue<double>(record + 20, times.empty() ? 0.0 : times[i]);
+  };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, points.size(), encode_point);
+#else
+  #pragma omp parallel for
+  for (int64_t i = 0; i < static_cast<int64_t>(points.size()); i++)
+  {
+    encode_point(static_cast<size_t>(i));
+  }
+#endif  // RAYLIB_WITH_TBB
+  out_.write(reinterpret_cast<const char *>(buffer_.data()), buffer_.size());
+
+  if (num_points_ == 0)
   {
-    point.SetCoordinates(points[i][0], points[i][1], points[i][2]);
-    point.SetIntensity(colours[i].alpha);
-    if (!times.empty())
-      point.SetTime(times[i]);
-    writer_->WritePoint(point);
+    min_bound_ = min_bound;
+    max_bound_ = max_bound;
   }
-  return true;
-#else   // RAYLIB_WITH_LAS
-  RAYLIB_UNUSED(points);
-  RAYLIB_UNUSED(times);
-  RAYLIB_UNUSED(colours);
-  std::cerr << "writeLas: cannot write file as WITHLAS not enabled. Enable using: cmake .. -DWITH_LAS=true"
-            << std::endl;
-  return false;
+  min_bound_ = minVector(min_bound_, min_bound);
+  max_bound_ = maxVector(max_bound_, max_bound);
+  num_points_ += points.size();
+  failed_ = failed_ || out_.fail();
+  return !out_.fail();
+}
+
+bool LasWriter::end()
+{
+  if (ended_)
+  {
+    return true;
+  }
+  ended_ = true;
+  if (compressed_)
+  {
+#if RAYLIB_WITH_LAS
+    if (!writer_ && !out_.fail())  // no points were written
+    {
+      writer_ = new liblas::Writer(out_, header_);
+    }
+    delete writer_;  // liblas completes the file on destruction of the writer
+    writer_ = nullptr;
+    return !out_.fail() && !failed_;
+#else
+    return false;
 #endif  // RAYLIB_WITH_LAS
+  }
+  if (!out_.is_open() || out_.fail())
+  {
+    return false;
+  }
+  const bool success = writeHeader();
+  out_.close();
+  std::cout << num_points_ << " points saved to " << file_name_ << std::endl;
+  return success && !failed_;
 }
 
 }  // namespace ray
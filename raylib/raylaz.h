@@ -9,6 +9,8 @@
 #include "raylib/raylibconfig.h"
 #include "rayutils.h"
 
+#include <fstream>
+
 #if RAYLIB_WITH_LAS
 #include <liblas/reader.hpp>
 #endif  // RAYLIB_WITH_LAS
@@ -21,7 +23,9 @@ bool RAYLIB_EXPORT readLas(std::string file_name, std::vector<Eigen::Vector3d> &
                            std::vector<RGBA> &colours, double max_intensity,
                            Eigen::Vector3d *offset_to_remove = nullptr);
 
-/// Chunk-based version of readLas. This calls @c apply for every @c chunk_size points loaded
+/// Chunk-based version of readLas. This calls @c apply for every @c chunk_size points loaded.
+/// Uncompressed las files are decoded natively, in parallel. Laz files are decompressed through liblas, so require
+/// WITH_LAS. Each chunk is split between one liblas reader per thread, which seek using the LASzip chunk table
 bool RAYLIB_EXPORT readLas(const std::string &file_name,
                            std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                                               std::vector<double> &times, std::vector<RGBA> &colours)>
@@ -35,20 +39,41 @@ bool RAYLIB_EXPORT writeLas(std::string file_name, const std::vector<Eigen::Vect
                             const std::vector<double> &times, const std::vector<RGBA> &colours);
 
 /// Class for chunked writing of las/laz files.
+/// Las files are written directly: each chunk is encoded in parallel and appended, and the header's point count and
+/// bounds are filled in by @c end(). The coordinate offset is taken from the first chunk, and points beyond the range
+/// of the quantised coordinates (about 200 km from the offset) fail the write. The version 1.2 header limits the file
+/// to 2^32 - 1 points, and the chunk that would exceed this fails the write. Laz files are compressed serially
+/// through liblas, so require WITH_LAS.
 class RAYLIB_EXPORT LasWriter
 {
 public:
   /// construct the class with a file name, which is stored
   LasWriter(const std::string &file_name);
-  /// the destructor
+  /// the destructor, this calls @c end() if it has not already been called
   ~LasWriter();
   /// write a chunk of points to the file, described by the vector arguments
   bool writeChunk(const std::vector<Eigen::Vector3d> &points, const std::vector<double> &times,
                   const std::vector<RGBA> &colours);
+  /// finish writing, completing the file header. This fails if any chunk failed to be written, as the file is then
+  /// incomplete
+  bool end();
+  /// whether the file was opened for writing
+  inline bool isOpen() const { return out_.is_open() && !out_.fail(); }
 
 private:
-  const std::string &file_name_;
+  /// write the las public header block for the points written so far
+  bool writeHeader();
+
+  std::string file_name_;
   std::ofstream out_;
+  bool compressed_;
+  bool ended_;
+  bool failed_;  // a chunk has failed to be written
+  uint64_t num_points_;
+  Eigen::Vector3d min_bound_;
+  Eigen::Vector3d max_bound_;
+  Eigen::Vector3d offset_;  // subtracted from the point coordinates before they are quantised
+  std::vector<uint8_t> buffer_;  // encoded point records, retained to avoid reallocations
 #if RAYLIB_WITH_LAS
   liblas::Header header_;
   liblas::Writer *writer_;
@@ -0,0 +1,90 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raymappedfile.h"
+#include "rayunused.h"
+
+#if RAYLIB_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif  // RAYLIB_MMAP
+
+namespace ray
+{
+MappedFile::~MappedFile()
+{
+#if RAYLIB_MMAP
+  if (map_)
+  {
+    munmap(map_, size_);
+  }
+  if (file_descriptor_ != -1)
+  {
+    close(file_descriptor_);
+  }
+#endif  // RAYLIB_MMAP
+}
+
+bool MappedFile::open(const std::string &file_name, bool sequential)
+{
+#if RAYLIB_MMAP
+  file_descriptor_ = ::open(file_name.c_str(), O_RDONLY);
+  struct stat file_stat;
+  if (file_descriptor_ == -1 || fstat(file_descriptor_, &file_stat) != 0)
+  {
+    return false;
+  }
+  size_ = static_cast<size_t>(file_stat.st_size);
+  if (size_ == 0)
+  {
+    return true;
+  }
+  map_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, file_descriptor_, 0);
+  if (map_ == MAP_FAILED)
+  {
+    map_ = nullptr;
+    return false;
+  }
+  madvise(map_, size_, sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+  return true;
+#else
+  ifs_.open(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (ifs_.fail())
+  {
+    return false;
+  }
+  ifs_.seekg(0, std::ios::end);
+  size_ = static_cast<size_t>(ifs_.tellg());
+  sequential_ = sequential;
+  if (!sequential_)  // then read the whole file, so that data() can be called from multiple threads
+  {
+    buffer_.resize(size_);
+    ifs_.seekg(0, std::ios::beg);
+    ifs_.read(reinterpret_cast<char *>(buffer_.data()), size_);
+    return !ifs_.fail();
+  }
+  return true;
+#endif  // RAYLIB_MMAP
+}
+
+const uint8_t *MappedFile::data(size_t offset, size_t length)
+{
+#if RAYLIB_MMAP
+  RAYLIB_UNUSED(length);
+  return static_cast<const uint8_t *>(map_) + offset;
+#else
+  if (!sequential_)
+  {
+    return buffer_.data() + offset;
+  }
+  buffer_.resize(length);
+  ifs_.seekg(offset, std::ios::beg);
+  ifs_.read(reinterpret_cast<char *>(buffer_.data()), length);
+  return buffer_.data();
+#endif  // RAYLIB_MMAP
+}
+}  // namespace ray
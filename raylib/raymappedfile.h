@@ -0,0 +1,51 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYMAPPEDFILE_H
+#define RAYLIB_RAYMAPPEDFILE_H
+
+#include "raylib/raylibconfig.h"
+#include "rayutils.h"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RAYLIB_MMAP 1
+#endif
+
+namespace ray
+{
+/// Read-only access to the contents of a binary file. The file is memory mapped where available. Otherwise a
+/// @c sequential file has the requested blocks read into a buffer, and a random access file is read whole on open.
+class RAYLIB_EXPORT MappedFile
+{
+public:
+  MappedFile() = default;
+  ~MappedFile();
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+
+  /// open the file, @c sequential is a hint that it will be read from start to end
+  bool open(const std::string &file_name, bool sequential = false);
+  /// pointer to @c length bytes at @c offset into the file. For a sequential file without memory mapping this is
+  /// valid until the next call to @c data(), otherwise it is valid until the file is destroyed, and can be called
+  /// from multiple threads
+  const uint8_t *data(size_t offset, size_t length);
+  inline size_t size() const { return size_; }
+
+private:
+  size_t size_ = 0;
+#if RAYLIB_MMAP
+  int file_descriptor_ = -1;
+  void *map_ = nullptr;
+#else
+  std::ifstream ifs_;
+  bool sequential_ = false;
+  std::vector<uint8_t> buffer_;
+#endif  // RAYLIB_MMAP
+};
+}  // namespace ray
+
+#endif  // RAYLIB_RAYMAPPEDFILE_H
@@ -5,8 +5,11 @@
 // Author: Kazys Stepanas, Tom Lowe
 #include "raymerger.h"
 
+#include "raycloudwriter.h"
 #include "raygrid.h"
+#include "rayply.h"
 #include "rayprogress.h"
+#include "raytelemetry.h"
 #include "rayunused.h"
 
 #if RAYLIB_WITH_TBB
@@ -17,7 +20,6 @@
 #include <algorithm>
 #include <iomanip>
 #include <iostream>
-#include <set>
 
 #if RAYLIB_WITH_TBB
 // With threads we use std::atomic_bool for the transient marks. These are default initialised to false. No additional
@@ -67,44 +69,173 @@ private:
   std::vector<unsigned> pass_through_ids;
 };
 
-typedef Eigen::Matrix<double, 6, 1> Vector6i;
-class Vector6iLess
+// TODO: Make config value
+const double test_width = 0.01;  // allows a minor variation when checking for similarity of rays
+
+/// A 128-bit fingerprint of a quantised ray. The six voxel coordinates (at @c test_width) of the ray's start and end
+/// are packed as 21-bit values, so rays only share a fingerprint if they are in the same voxels, or in voxels that
+/// are a multiple of 2^21 voxels (about 21 km) apart
+struct RayFingerprint
 {
-public:
-  inline bool operator()(const Vector6i &a, const Vector6i &b) const
-  {
-    if (a[0] != b[0])
-      return a[0] < b[0];
-    if (a[1] != b[1])
-      return a[1] < b[1];
-    if (a[2] != b[2])
-      return a[2] < b[2];
-    if (a[3] != b[3])
-      return a[3] < b[3];
-    if (a[4] != b[4])
-      return a[4] < b[4];
-    return a[5] < b[5];
-  }
+  uint64_t low;
+  uint64_t high;
+  inline bool operator==(const RayFingerprint &other) const { return low == other.low && high == other.high; }
 };
 
-// TODO: Make config value
-const double test_width = 0.01;  // allows a minor variation when checking for similarity of rays
+inline RayFingerprint rayFingerprint(const Eigen::Vector3d &start, const Eigen::Vector3d &end)
+{
+  const uint64_t mask = (uint64_t(1) << 21) - 1;
+  RayFingerprint fingerprint = { 0, 0 };
+  for (int j = 0; j < 3; j++)
+  {
+    const uint64_t start_coord = static_cast<uint64_t>(static_cast<int64_t>(std::floor(start[j] / test_width)));
+    const uint64_t end_coord = static_cast<uint64_t>(static_cast<int64_t>(std::floor(end[j] / test_width)));
+    fingerprint.low |= (start_coord & mask) << (21 * j);
+    fingerprint.high |= (end_coord & mask) << (21 * j);
+  }
+  return fingerprint;
+}
+
+inline uint64_t fingerprintHash(const RayFingerprint &fingerprint)
+{
+  uint64_t hash = fingerprint.low * 0x9E3779B97F4A7C15ull ^ (fingerprint.high + 0x632BE59BD9B4E019ull);
+  hash ^= hash >> 31;
+  hash *= 0xBF58476D1CE4E5B9ull;
+  return hash ^ (hash >> 29);
+}
 
-void rayLookup(const Cloud *cloud, std::set<Vector6i, Vector6iLess> &ray_lookup)
+/// A flat (open addressing) hash set of the ray fingerprints of a cloud. The set is split into shards by the top bits
+/// of the hash, so that the shards can be filled concurrently
+class RayFingerprintSet
 {
-  for (size_t i = 0; i < cloud->rayCount(); i++)
+public:
+  void build(const Cloud &cloud)
   {
-    const Eigen::Vector3d &point = cloud->ends[i];
-    const Eigen::Vector3d &start = cloud->starts[i];
-    Vector6i ray;
-    for (int j = 0; j < 3; j++)
+    std::vector<RayFingerprint> fingerprints;
+    appendFingerprints(cloud.starts, cloud.ends, fingerprints);
+    build(fingerprints);
+  }
+
+  /// build the set from a list of @c fingerprints, which is emptied in the process
+  void build(std::vector<RayFingerprint> &fingerprints)
+  {
+    const size_t num_rays = fingerprints.size();
+    // bucket the fingerprints by shard
+    std::vector<size_t> offsets(kNumShards + 1, 0);
+    for (const auto &fingerprint : fingerprints)
+    {
+      offsets[shardIndex(fingerprintHash(fingerprint)) + 1]++;
+    }
+    for (size_t i = 0; i < kNumShards; i++)
+    {
+      offsets[i + 1] += offsets[i];
+    }
+    std::vector<RayFingerprint> bucketed(num_rays);
+    std::vector<size_t> heads(offsets.begin(), offsets.end() - 1);
+    for (const auto &fingerprint : fingerprints)
+    {
+      bucketed[heads[shardIndex(fingerprintHash(fingerprint))]++] = fingerprint;
+    }
+    fingerprints.clear();
+    fingerprints.shrink_to_fit();
+
+    // then fill each shard's table
+    std::vector<size_t> shard_sizes(kNumShards, 0);
+    auto fill_shard = [&](size_t shard_id) {
+      std::vector<RayFingerprint> &shard = shards_[shard_id];
+      size_t capacity = 16;
+      while (capacity < 2 * (offsets[shard_id + 1] - offsets[shard_id]))
+      {
+        capacity *= 2;
+      }
+      shard.assign(capacity, emptySlot());
+      for (size_t i = offsets[shard_id]; i < offsets[shard_id + 1]; i++)
+      {
+        RayFingerprint &slot = findSlot(shard, bucketed[i]);
+        if (slot.high == emptySlot().high)
+        {
+          slot = bucketed[i];
+          shard_sizes[shard_id]++;
+        }
+      }
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, kNumShards, fill_shard);
+#else
+    #pragma omp parallel for schedule(dynamic, 1)
+    for (int i = 0; i < static_cast<int>(kNumShards); i++)
     {
-      ray[j] = int(floor(start[j] / test_width));
-      ray[3 + j] = int(floor(point[j] / test_width));
+      fill_shard(static_cast<size_t>(i));
+    }
+#endif  // RAYLIB_WITH_TBB
+    size_ = 0;
+    for (auto &shard_size : shard_sizes)
+    {
+      size_ += shard_size;
     }
-    ray_lookup.insert(ray);
   }
-}
+
+  /// whether the set contains @c fingerprint. This is thread safe
+  inline bool contains(const RayFingerprint &fingerprint) const
+  {
+    const std::vector<RayFingerprint> &shard = shards_[shardIndex(fingerprintHash(fingerprint))];
+    const size_t mask = shard.size() - 1;
+    for (size_t i = fingerprintHash(fingerprint) & mask;; i = (i + 1) & mask)
+    {
+      if (shard[i] == fingerprint)
+      {
+        return true;
+      }
+      if (shard[i].high == emptySlot().high)
+      {
+        return false;
+      }
+    }
+  }
+
+  /// number of unique fingerprints
+  inline size_t size() const { return size_; }
+
+  /// append the fingerprints of the rays from @c starts to @c ends, to @c fingerprints
+  static void appendFingerprints(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends,
+                                 std::vector<RayFingerprint> &fingerprints)
+  {
+    const size_t first = fingerprints.size();
+    fingerprints.resize(first + ends.size());
+    auto fingerprint_ray = [&](size_t i) { fingerprints[first + i] = rayFingerprint(starts[i], ends[i]); };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, ends.size(), fingerprint_ray);
+#else
+    #pragma omp parallel for
+    for (int64_t i = 0; i < static_cast<int64_t>(ends.size()); i++)
+    {
+      fingerprint_ray(static_cast<size_t>(i));
+    }
+#endif  // RAYLIB_WITH_TBB
+  }
+
+private:
+  static const size_t kShardBits = 6;
+  static const size_t kNumShards = size_t(1) << kShardBits;
+
+  static inline size_t shardIndex(uint64_t hash) { return static_cast<size_t>(hash >> (64 - kShardBits)); }
+  /// fingerprints only use the lower 63 bits, so the top bit marks an empty slot
+  static inline RayFingerprint emptySlot() { return { 0, uint64_t(1) << 63 }; }
+  /// the slot containing @c fingerprint, or else the empty slot where it would be inserted
+  static inline RayFingerprint &findSlot(std::vector<RayFingerprint> &shard, const RayFingerprint &fingerprint)
+  {
+    const size_t mask = shard.size() - 1;
+    size_t i = fingerprintHash(fingerprint) & mask;
+    while (!(shard[i] == fingerprint) && shard[i].high != emptySlot().high)
+    {
+      i = (i + 1) & mask;
+    }
+    return shard[i];
+  }
+
+  std::vector<RayFingerprint> shards_[kNumShards];
+  size_t size_ = 0;
+};
 
 void EllipsoidTransientMarker::mark(Ellipsoid *ellipsoid, std::vector<Merger::Bool> *transient_ray_marks,
                                     const Cloud &cloud, const Grid<unsigned> &ray_grid, double num_rays,
@@ -323,6 +454,8 @@ Merger::~Merger() = default;
 
 bool Merger::filter(const Cloud &cloud, Progress *progress)
 {
+  TelemetryPhase telemetry("Merger::filter");
+  telemetry.addRays(cloud.rayCount());
   // Ensure we have a value progress pointer to update. This simplifies code below.
   Progress tracker;
   if (!progress)
@@ -358,6 +491,11 @@ bool Merger::filter(const Cloud &cloud, Progress *progress)
 
 bool Merger::mergeMultiple(std::vector<Cloud> &clouds, Progress *progress)
 {
+  TelemetryPhase telemetry("Merger::mergeMultiple");
+  for (const auto &cloud : clouds)
+  {
+    telemetry.addRays(cloud.rayCount());
+  }
   // Ensure we have a value progress pointer to update. This simplifies code below.
   Progress tracker;
   if (!progress)
@@ -443,6 +581,8 @@ bool Merger::mergeMultiple(std::vector<Cloud> &clouds, Progress *progress)
 
 bool Merger::mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2, Progress *progress)
 {
+  TelemetryPhase telemetry("Merger::mergeThreeWay");
+  telemetry.addRays(base_cloud.rayCount() + cloud1.rayCount() + cloud2.rayCount());
   // The 3-way merge is similar to those performed on text files for version control systems. It attempts to apply the
   // changes in both cloud 1 and cloud2 (compared to base_cloud). When there is a conflict (different changes in the
   // same location) it resolves that according to the selected merge_type. unlike with text, a change requires a small
@@ -451,10 +591,10 @@ bool Merger::mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2
 
   // generate quick lookup for the existance of a particular (quantised) ray
   Cloud *clouds[2] = { &cloud1, &cloud2 };
-  std::set<Vector6i, Vector6iLess> base_ray_lookup;
-  rayLookup(&base_cloud, base_ray_lookup);
-  std::set<Vector6i, Vector6iLess> ray_lookups[2];
-  for (int c = 0; c < 2; c++) rayLookup(clouds[c], ray_lookups[c]);
+  RayFingerprintSet base_ray_lookup;
+  base_ray_lookup.build(base_cloud);
+  RayFingerprintSet ray_lookups[2];
+  for (int c = 0; c < 2; c++) ray_lookups[c].build(*clouds[c]);
 
   std::cout << "set size " << ray_lookups[0].size() << ", " << ray_lookups[1].size() << ", " << base_ray_lookup.size()
             << std::endl;
@@ -465,42 +605,54 @@ bool Merger::mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2
   for (int c = 0; c < 2; c++)
   {
     Cloud &cloud = *clouds[c];
-    for (size_t i = 0; i < cloud.rayCount(); i++)
+    const int other = 1 - c;
+    std::vector<uint8_t> in_other(cloud.rayCount()), in_base(cloud.rayCount());
+    auto look_up_ray = [&](size_t i) {
+      const RayFingerprint ray = rayFingerprint(cloud.starts[i], cloud.ends[i]);
+      in_other[i] = ray_lookups[other].contains(ray);
+      in_base[i] = base_ray_lookup.contains(ray);
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, cloud.rayCount(), look_up_ray);
+#else
+    #pragma omp parallel for
+    for (int64_t i = 0; i < static_cast<int64_t>(cloud.rayCount()); i++)
     {
-      Eigen::Vector3d &point = cloud.ends[i];
-      Eigen::Vector3d &start = cloud.starts[i];
-      Vector6i ray;
-      for (int j = 0; j < 3; j++)
-      {
-        ray[j] = int(std::floor(start[j] / test_width));
-        ray[3 + j] = int(std::floor(point[j] / test_width));
-      }
-      int other = 1 - c;
-      // if the ray is in cloud1 and cloud2 there is no contention, so add the ray to the result
-      if (ray_lookups[other].find(ray) != ray_lookups[other].end())
+      look_up_ray(static_cast<size_t>(i));
+    }
+#endif  // RAYLIB_WITH_TBB
+
+    // if the ray is in cloud1 and cloud2 there is no contention, so add the ray to the result
+    if (c == preferred_cloud)
+    {
+      for (size_t i = 0; i < cloud.rayCount(); i++)
       {
-        if (c == preferred_cloud)
+        if (in_other[i])
         {
-          fixed_.addRay(start, point, cloud.times[i], cloud.colours[i]);
+          fixed_.addRay(cloud, i);
           u++;
         }
       }
-      // we want to run the combine (which revolves conflicts) on only the changed parts
-      // so we want to keep only the changes for cloud[0] and cloud[1]...
-      // which means removing rays that aren't changed:
-      if (base_ray_lookup.find(ray) != base_ray_lookup.end())
+    }
+    // we want to run the combine (which revolves conflicts) on only the changed parts
+    // so we want to keep only the changes for cloud[0] and cloud[1]...
+    // which means removing rays that aren't changed. This is a stable partition, so the ray order is kept:
+    size_t num_kept = 0;
+    for (size_t i = 0; i < cloud.rayCount(); i++)
+    {
+      if (!in_base[i])
       {
-        cloud.starts[i] = cloud.starts.back();
-        cloud.starts.pop_back();
-        cloud.ends[i] = cloud.ends.back();
-        cloud.ends.pop_back();
-        cloud.times[i] = cloud.times.back();
-        cloud.times.pop_back();
-        cloud.colours[i] = cloud.colours.back();
-        cloud.colours.pop_back();
-        i--;
+        if (num_kept != i)
+        {
+          cloud.starts[num_kept] = cloud.starts[i];
+          cloud.ends[num_kept] = cloud.ends[i];
+          cloud.times[num_kept] = cloud.times[i];
+          cloud.colours[num_kept] = cloud.colours[i];
+        }
+        num_kept++;
       }
     }
+    cloud.resize(num_kept);
   }
   std::cout << u << " unaltered rays have been moved into combined cloud" << std::endl;
   std::cout << clouds[0]->rayCount() << " and " << clouds[1]->rayCount() << " rays to combine, that are different"
@@ -510,6 +662,133 @@ bool Merger::mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2
   clouds[0]->save("changes_0.ply");
   clouds[1]->save("changes_1.ply");
 #endif
+  mergeThreeWayChanges(clouds, progress);
+  return true;
+}
+
+bool Merger::mergeThreeWay(const std::string &base_file, const std::string &cloud1_file,
+                           const std::string &cloud2_file, const std::string &combined_file, Progress *progress)
+{
+  TelemetryPhase telemetry("Merger::mergeThreeWay (streamed)");
+  clear();
+  // This is the same merge as the in-memory version, but only the fingerprints of the base cloud and the
+  // non-preferred cloud are held in memory, along with the changed rays. The base and non-preferred cloud files are
+  // read twice: once to fingerprint them, and once to classify their rays against the other fingerprint sets.
+  auto fingerprint_file = [&](const std::string &file_name, RayFingerprintSet &lookup) {
+    std::vector<RayFingerprint> fingerprints;
+    auto add_chunk = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                         std::vector<double> &times, std::vector<RGBA> &colours) {
+      RAYLIB_UNUSED(times);
+      RAYLIB_UNUSED(colours);
+      RayFingerprintSet::appendFingerprints(starts, ends, fingerprints);
+      telemetry.addRays(ends.size());
+    };
+    if (!Cloud::read(file_name, add_chunk))
+    {
+      return false;
+    }
+    lookup.build(fingerprints);
+    return true;
+  };
+
+  // the preferred cloud is chosen by the time of its first ray, so only the first ray of each cloud is read here
+  const std::string cloud_files[2] = { cloud1_file, cloud2_file };
+  double first_times[2] = { 0.0, 0.0 };
+  for (int c = 0; c < 2; c++)
+  {
+    auto first_time = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                          std::vector<double> &times, std::vector<RGBA> &colours) {
+      RAYLIB_UNUSED(starts);
+      RAYLIB_UNUSED(ends);
+      RAYLIB_UNUSED(colours);
+      first_times[c] = times[0];
+    };
+    if (!readPly(cloud_files[c], true, first_time, 0, false, 1, 1))
+    {
+      std::cerr << "Error: ray cloud " << cloud_files[c] << " has no rays" << std::endl;
+      return false;
+    }
+  }
+  // only the rays of the preferred cloud are looked up in the other cloud, so only that other set is needed
+  const int preferred_cloud = first_times[0] > first_times[1] ? 0 : 1;
+  RayFingerprintSet base_ray_lookup, other_ray_lookup;
+  if (!fingerprint_file(base_file, base_ray_lookup) ||
+      !fingerprint_file(cloud_files[1 - preferred_cloud], other_ray_lookup))
+  {
+    return false;
+  }
+
+  std::cout << "set size " << other_ray_lookup.size() << ", " << base_ray_lookup.size() << std::endl;
+
+  CloudWriter writer;
+  if (!writer.begin(combined_file))
+  {
+    return false;
+  }
+  // stream each cloud, writing rays common to both clouds, and keeping only the changes from the base cloud
+  Cloud changes[2];
+  size_t u = 0;
+  for (int c = 0; c < 2; c++)
+  {
+    Cloud common;
+    std::vector<uint8_t> in_other, in_base;
+    auto classify_chunk = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                              std::vector<double> &times, std::vector<RGBA> &colours) {
+      in_other.assign(ends.size(), 0);
+      in_base.resize(ends.size());
+      auto look_up_ray = [&](size_t i) {
+        const RayFingerprint ray = rayFingerprint(starts[i], ends[i]);
+        if (c == preferred_cloud)
+        {
+          in_other[i] = other_ray_lookup.contains(ray);
+        }
+        in_base[i] = base_ray_lookup.contains(ray);
+      };
+#if RAYLIB_WITH_TBB
+      tbb::parallel_for<size_t>(0, ends.size(), look_up_ray);
+#else
+      #pragma omp parallel for
+      for (int64_t i = 0; i < static_cast<int64_t>(ends.size()); i++)
+      {
+        look_up_ray(static_cast<size_t>(i));
+      }
+#endif  // RAYLIB_WITH_TBB
+
+      common.clear();
+      for (size_t i = 0; i < ends.size(); i++)
+      {
+        // if the ray is in cloud1 and cloud2 there is no contention, so add the ray to the result
+        if (in_other[i])
+        {
+          common.addRay(starts[i], ends[i], times[i], colours[i]);
+        }
+        if (!in_base[i])
+        {
+          changes[c].addRay(starts[i], ends[i], times[i], colours[i]);
+        }
+      }
+      u += common.rayCount();
+      writer.writeChunk(common);
+    };
+    if (!Cloud::read(cloud_files[c], classify_chunk))
+    {
+      return false;
+    }
+  }
+  std::cout << u << " unaltered rays have been moved into combined cloud" << std::endl;
+  std::cout << changes[0].rayCount() << " and " << changes[1].rayCount() << " rays to combine, that are different"
+            << std::endl;
+
+  Cloud *clouds[2] = { &changes[0], &changes[1] };
+  mergeThreeWayChanges(clouds, progress);
+  writer.writeChunk(fixed_);
+  writer.end();
+  fixed_.clear();
+  return true;
+}
+
+void Merger::mergeThreeWayChanges(Cloud *clouds[2], Progress *progress)
+{
   // This keeps all data only where there are conflicts.
   if (config_.merge_type == MergeType::All)
   {
@@ -520,7 +799,7 @@ bool Merger::mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2
       fixed_.times.insert(fixed_.times.end(), clouds[c]->times.begin(), clouds[c]->times.end());
       fixed_.colours.insert(fixed_.colours.end(), clouds[c]->colours.begin(), clouds[c]->colours.end());
     }
-    return true;
+    return;
   }
   // otherwise we run combine on the altered clouds
   // first, grid the rays for fast lookup
@@ -578,8 +857,6 @@ bool Merger::mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2
     }
     std::cout << removed_count << " removed rays, " << fixed_.rayCount() << " fixed rays." << std::endl;
   }
-
-  return true;
 }
 
 void Merger::clear()
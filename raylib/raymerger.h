@@ -13,6 +13,7 @@
 
 #include <atomic>
 #include <limits>
+#include <string>
 #include <vector>
 
 namespace ray
@@ -73,6 +74,12 @@ public:
   /// Three way merger
   bool mergeThreeWay(const Cloud &base_cloud, Cloud &cloud1, Cloud &cloud2, Progress *progress = nullptr);
 
+  /// Three way merger on files, for clouds too large to hold in memory together. The clouds are streamed from disk
+  /// and only the rays that differ from @c base_file are loaded for conflict resolution. The unaltered rays are
+  /// written straight to @c combined_file, followed by the merged changes, so @c fixedCloud() is empty afterwards.
+  bool mergeThreeWay(const std::string &base_file, const std::string &cloud1_file, const std::string &cloud2_file,
+                     const std::string &combined_file, Progress *progress = nullptr);
+
   /// Reset previous results. Memory is retained.
   void clear();
 
@@ -93,6 +100,9 @@ public:
 private:
   double voxelSizeForCloud(const Cloud &cloud) const;
 
+  /// Resolve the conflicts between the changed rays of a three way merge, adding the result to fixed_
+  void mergeThreeWayChanges(Cloud *clouds[2], Progress *progress);
+
   /// For all ellipsoids_ intersect with rays in @c cloud (accelerated using @c ray_grid)
   /// depending on config.merge_type, either mark the ellipsoid object as removed, or
   /// mark the ray (through @c transient_ray_marks) as removed.
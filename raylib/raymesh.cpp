@@ -96,6 +96,19 @@ void Mesh::reduce()
   vertices_ = verts;
 }
 
+void Mesh::append(const Mesh &other)
+{
+  const Eigen::Vector3i offset = Eigen::Vector3i::Constant(static_cast<int>(vertices_.size()));
+  index_list_.reserve(index_list_.size() + other.index_list_.size());
+  for (auto &ind : other.index_list_)
+  {
+    index_list_.push_back(ind + offset);
+  }
+  vertices_.insert(vertices_.end(), other.vertices_.begin(), other.vertices_.end());
+  uv_list_.insert(uv_list_.end(), other.uv_list_.begin(), other.uv_list_.end());
+  colours_.insert(colours_.end(), other.colours_.begin(), other.colours_.end());
+}
+
 // convert the mesh to a height field
 void Mesh::toHeightField(Eigen::ArrayXXd &field, const Eigen::Vector3d &box_min, Eigen::Vector3d box_max,
                          double width, bool fill_gaps) const
@@ -49,6 +49,9 @@ public:
   // remove surplus points that are not part of any triangles
   void reduce();
 
+  /// add the vertices and triangles of @c other to the end of this mesh
+  void append(const Mesh &other);
+
   void translate(const Eigen::Vector3d &offset)
   {
     for (auto &vert: vertices_)
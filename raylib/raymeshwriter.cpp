@@ -0,0 +1,224 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raymeshwriter.h"
+#include "raymesh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+namespace ray
+{
+namespace
+{
+#if RAYLIB_DOUBLE_RAYS
+struct Vert
+{
+  Eigen::Vector3d pos;
+  RGBA colour;
+};
+const size_t kVertRowSize = 28;
+#else
+struct Vert
+{
+  Eigen::Vector3f pos;
+  RGBA colour;
+};
+const size_t kVertRowSize = 16;
+#endif
+struct TexturedFace
+{
+  int num_corners;
+  Eigen::Vector3i ids;
+  int num_coords;
+  float uvs[6];
+  int texnumber;
+};
+
+/// write a zero-padded count into the header, whose rightmost characters are replaced in end()
+void writePaddedCount(std::ofstream &out, unsigned long &count_pos)
+{
+  const int num_zeros = std::numeric_limits<unsigned long>::digits10;
+  for (int i = 0; i < num_zeros; i++)
+  {
+    out << "0";
+  }
+  count_pos = static_cast<unsigned long>(out.tellp());
+}
+
+void patchCount(std::ofstream &out, unsigned long count_pos, unsigned long count)
+{
+  std::stringstream stream;
+  stream << count;
+  const std::string str = stream.str();
+  out.seekp(count_pos - str.length());
+  out << str;
+}
+}  // namespace
+
+bool MeshWriter::begin(const std::string &file_name, bool flip_normals, bool has_uvs,
+                       const std::string &texture_name)
+{
+  if (file_name.empty())
+  {
+    std::cerr << "Error: mesh writer begin called with empty file name" << std::endl;
+    return false;
+  }
+  file_name_ = file_name;
+  faces_file_name_ = file_name + ".faces";
+  flip_normals_ = flip_normals;
+  has_uvs_ = has_uvs;
+  num_vertices_ = num_faces_ = 0;
+  ofs_.open(file_name_, std::ios::binary | std::ios::out);
+  faces_ofs_.open(faces_file_name_, std::ios::binary | std::ios::out);
+  if (ofs_.fail() || faces_ofs_.fail())
+  {
+    std::cerr << "Error: cannot open " << file_name_ << " for writing." << std::endl;
+    return false;
+  }
+  ofs_ << "ply" << std::endl;
+  ofs_ << "format binary_little_endian 1.0" << std::endl;
+  ofs_ << "comment SDK generated" << std::endl;
+  if (has_uvs_)
+  {
+    ofs_ << "comment TextureFile " << (texture_name.empty() ? "wood_texture.png" : texture_name) << std::endl;
+  }
+  ofs_ << "element vertex ";
+  writePaddedCount(ofs_, vertex_count_pos_);
+  ofs_ << std::endl;
+#if RAYLIB_DOUBLE_RAYS
+  ofs_ << "property double x" << std::endl;
+  ofs_ << "property double y" << std::endl;
+  ofs_ << "property double z" << std::endl;
+#else
+  ofs_ << "property float x" << std::endl;
+  ofs_ << "property float y" << std::endl;
+  ofs_ << "property float z" << std::endl;
+#endif
+  ofs_ << "property uchar red" << std::endl;
+  ofs_ << "property uchar green" << std::endl;
+  ofs_ << "property uchar blue" << std::endl;
+  ofs_ << "property uchar alpha" << std::endl;
+  ofs_ << "element face ";
+  writePaddedCount(ofs_, face_count_pos_);
+  ofs_ << std::endl;
+  ofs_ << "property list int int vertex_indices" << std::endl;
+  if (has_uvs_)
+  {
+    ofs_ << "property list int float texcoord" << std::endl;
+    ofs_ << "property int texnumber" << std::endl;
+  }
+  ofs_ << "end_header" << std::endl;
+  return ofs_.good();
+}
+
+bool MeshWriter::writeChunk(const Mesh &chunk)
+{
+  if (!ofs_.is_open())
+  {
+    std::cerr << "Error: mesh file has not been opened, use begin" << std::endl;
+    return false;
+  }
+  const auto &list = chunk.indexList();
+  if (has_uvs_ && chunk.uvList().size() != list.size())
+  {
+    std::cerr << "Error: mesh chunk has " << chunk.uvList().size() << " uvs for " << list.size() << " triangles"
+              << std::endl;
+    return false;
+  }
+  if (chunk.vertices().empty())
+  {
+    return true;
+  }
+
+  buffer_.resize(kVertRowSize * chunk.vertices().size());
+  for (size_t i = 0; i < chunk.vertices().size(); i++)
+  {
+    Vert vert;
+#if RAYLIB_DOUBLE_RAYS
+    vert.pos = chunk.vertices()[i];
+#else
+    vert.pos = chunk.vertices()[i].cast<float>();
+#endif
+    vert.colour = chunk.colours().empty() ? RGBA(127, 127, 127, 255) : chunk.colours()[i];
+    memcpy(&buffer_[kVertRowSize * i], &vert, kVertRowSize);
+  }
+  ofs_.write(reinterpret_cast<const char *>(buffer_.data()), buffer_.size());
+
+  // the faces index into the whole file's vertex list
+  const int offset = static_cast<int>(num_vertices_);
+  if (has_uvs_)
+  {
+    std::vector<TexturedFace> faces(list.size());
+    const auto &uvs = chunk.uvList();
+    for (size_t i = 0; i < list.size(); i++)
+    {
+      faces[i].num_corners = 3;
+      if (flip_normals_)
+        faces[i].ids = Eigen::Vector3i(list[i][2], list[i][1], list[i][0]) + Eigen::Vector3i::Constant(offset);
+      else
+        faces[i].ids = list[i] + Eigen::Vector3i::Constant(offset);
+      faces[i].num_coords = 6;
+      for (int j = 0; j < 3; j++)
+      {
+        faces[i].uvs[2 * j] = uvs[i][j].real();
+        faces[i].uvs[2 * j + 1] = uvs[i][j].imag();
+      }
+      faces[i].texnumber = 0;
+    }
+    faces_ofs_.write(reinterpret_cast<const char *>(faces.data()), sizeof(TexturedFace) * faces.size());
+  }
+  else
+  {
+    std::vector<Eigen::Vector4i> triangles(list.size());
+    for (size_t i = 0; i < list.size(); i++)
+    {
+      if (flip_normals_)
+        triangles[i] = Eigen::Vector4i(3, list[i][2] + offset, list[i][1] + offset, list[i][0] + offset);
+      else
+        triangles[i] = Eigen::Vector4i(3, list[i][0] + offset, list[i][1] + offset, list[i][2] + offset);
+    }
+    faces_ofs_.write(reinterpret_cast<const char *>(triangles.data()), sizeof(Eigen::Vector4i) * triangles.size());
+  }
+  num_vertices_ += chunk.vertices().size();
+  num_faces_ += list.size();
+  if (!ofs_.good() || !faces_ofs_.good())
+  {
+    std::cerr << "Error writing to file " << file_name_ << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool MeshWriter::end()
+{
+  if (!ofs_.is_open())  // no effect if begin has not been called
+  {
+    return false;
+  }
+  faces_ofs_.close();
+  bool success = true;
+  if (num_faces_ > 0)
+  {
+    std::ifstream faces_in(faces_file_name_, std::ios::binary | std::ios::in);
+    ofs_ << faces_in.rdbuf();
+    success = ofs_.good();
+  }
+  patchCount(ofs_, vertex_count_pos_, num_vertices_);
+  patchCount(ofs_, face_count_pos_, num_faces_);
+  ofs_.close();
+  std::remove(faces_file_name_.c_str());
+  if (!success)
+  {
+    std::cerr << "Error writing to file " << file_name_ << std::endl;
+    return false;
+  }
+  std::cout << num_vertices_ << " vertices and " << num_faces_ << " triangles saved to " << file_name_ << std::endl;
+  return true;
+}
+
+}  // namespace ray
@@ -0,0 +1,56 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYMESHWRITER_H
+#define RAYLIB_RAYMESHWRITER_H
+
+#include "raylib/raylibconfig.h"
+#include "rayutils.h"
+
+#include <fstream>
+
+namespace ray
+{
+class Mesh;
+
+/// This helper class is for writing a triangular mesh to a .ply file, one chunk at a time, in the same format as
+/// writePlyMesh(). Each chunk is a self-contained Mesh, whose index list refers to its own vertices. A ply file lists
+/// all of its vertices before its faces, so the faces are buffered in a temporary file alongside the output, which is
+/// appended to the output in end(). The vertex and face counts in the header are filled in by end(), in the manner of
+/// writeRayCloudChunkStart and writeRayCloudChunkEnd.
+class RAYLIB_EXPORT MeshWriter
+{
+public:
+  /// Open the file to write to. When @c has_uvs is true, each chunk must have one uv entry per triangle, and
+  /// @c texture_name is recorded in the file
+  bool begin(const std::string &file_name, bool flip_normals = false, bool has_uvs = false,
+             const std::string &texture_name = std::string());
+
+  /// write a mesh chunk to the file. These chunks can be any size, even 0
+  bool writeChunk(const Mesh &chunk);
+
+  /// finish writing, fill in the vertex and face counts and remove the temporary face file
+  bool end();
+
+  /// return the stored file name
+  const std::string &fileName() { return file_name_; }
+
+private:
+  std::ofstream ofs_;
+  std::ofstream faces_ofs_;
+  std::string file_name_;
+  std::string faces_file_name_;
+  bool flip_normals_;
+  bool has_uvs_;
+  unsigned long num_vertices_;
+  unsigned long num_faces_;
+  unsigned long vertex_count_pos_;  // position just after the padded vertex count in the header
+  unsigned long face_count_pos_;    // position just after the padded face count in the header
+  std::vector<unsigned char> buffer_;  // to avoid repeated reallocations
+};
+
+}  // namespace ray
+
+#endif  // RAYLIB_RAYMESHWRITER_H
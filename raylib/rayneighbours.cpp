@@ -0,0 +1,215 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "rayneighbours.h"
+#include "raycloudindex.h"
+
+#include <nabo/nabo.h>
+
+#include <limits>
+
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
+namespace ray
+{
+/// The kd-tree and the points that it was built from
+struct NeighbourGraph::Search
+{
+  Search()
+    : nns(nullptr)
+    , index(nullptr)
+    , search_size(0)
+    , max_distance(std::numeric_limits<double>::infinity())
+  {}
+  ~Search() { delete nns; }
+  Eigen::MatrixXd points_p;    // the searchable points, the kd-tree references this so it must outlive nns
+  std::vector<int> point_ids;  // index of each searchable point, this is empty when there is no mask
+  std::vector<int> search_ids; // index of each point in points_p, or -1 when masked out
+  Nabo::NNSearchD *nns;
+  const CloudIndex *index;      // when set, this is searched in place of nns, and returns point ids
+  int search_size;
+  double max_distance;
+
+  inline int pointId(int search_id) const { return point_ids.empty() ? search_id : point_ids[search_id]; }
+
+  /// find the neighbours of each column in @c query, as search ids, or as point ids when using the index
+  void knn(const Eigen::MatrixXd &query, Eigen::MatrixXi &indices, Eigen::MatrixXd &dists2) const
+  {
+    indices.resize(search_size, query.cols());
+    dists2.resize(search_size, query.cols());
+    if (!index)
+    {
+      nns->knn(query, indices, dists2, search_size, kNearestNeighbourEpsilon, 0, max_distance);
+      return;
+    }
+    static thread_local std::vector<uint32_t> ids;
+    static thread_local std::vector<double> id_dists2;
+    for (int c = 0; c < static_cast<int>(query.cols()); c++)
+    {
+      index->knn(query.col(c), search_size, max_distance, ids, id_dists2);
+      for (int j = 0; j < search_size; j++)
+      {
+        indices(j, c) = j < static_cast<int>(ids.size()) ? static_cast<int>(ids[j]) : Nabo::NNSearchD::InvalidIndex;
+        dists2(j, c) = j < static_cast<int>(ids.size()) ? id_dists2[j] : std::numeric_limits<double>::infinity();
+      }
+    }
+  }
+  /// the point id of an index returned by knn()
+  inline int resultId(int result) const { return index ? result : pointId(result); }
+};
+
+NeighbourGraph::NeighbourGraph()
+  : num_points_(0)
+  , index_(nullptr)
+{}
+
+NeighbourGraph::~NeighbourGraph() = default;
+
+void NeighbourGraph::clear()
+{
+  num_points_ = 0;
+  offsets_.clear();
+  offsets_.shrink_to_fit();
+  ids_.clear();
+  ids_.shrink_to_fit();
+  dists2_.clear();
+  dists2_.shrink_to_fit();
+  search_.reset();
+}
+
+void NeighbourGraph::build(const std::vector<Eigen::Vector3d> &points, int search_size, double max_distance,
+                           const std::vector<bool> *mask, bool store)
+{
+  clear();
+  num_points_ = points.size();
+  search_.reset(new Search);
+  Search &search = *search_;
+  if (mask)
+  {
+    search.search_ids.resize(points.size(), -1);
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      if ((*mask)[i])
+      {
+        search.search_ids[i] = static_cast<int>(search.point_ids.size());
+        search.point_ids.push_back(static_cast<int>(i));
+      }
+    }
+  }
+  const size_t num_search = mask ? search.point_ids.size() : points.size();
+  search.points_p.resize(3, num_search);
+  for (size_t i = 0; i < num_search; i++)
+  {
+    search.points_p.col(i) = points[search.pointId(static_cast<int>(i))];
+  }
+  search.search_size = std::min(search_size, static_cast<int>(num_search) - 1);
+  if (max_distance > 0.0)
+  {
+    search.max_distance = max_distance;
+  }
+  if (search.search_size > 0)
+  {
+    if (index_ && index_->indexes(points, mask))
+      search.index = index_;
+    else
+      search.nns = Nabo::NNSearchD::createKDTreeLinearHeap(search.points_p, 3);
+  }
+  if (!store)
+  {
+    return;
+  }
+
+  // search in blocks, so only a small dense matrix of results is needed at any one time
+  offsets_.resize(num_points_ + 1, 0);
+  // reserving the most neighbours there can be avoids both the growth copies and a final shrinking copy, and at 8 bytes
+  // per neighbour it is still smaller than the dense matrices of the search results
+  ids_.reserve(num_search * std::max(0, search.search_size));
+  dists2_.reserve(num_search * std::max(0, search.search_size));
+  const size_t block_size = 65536;
+  const size_t sub_block_size = 1024;
+  size_t next_point = 0;
+  for (size_t block_start = 0; block_start < num_search && search.search_size > 0; block_start += block_size)
+  {
+    const size_t block_end = std::min(block_start + block_size, num_search);
+    const size_t num_sub_blocks = (block_end - block_start + sub_block_size - 1) / sub_block_size;
+    std::vector<Eigen::MatrixXi> indices(num_sub_blocks);
+    std::vector<Eigen::MatrixXd> dists2(num_sub_blocks);
+    auto search_sub_block = [&](size_t b) {
+      const size_t start = block_start + b * sub_block_size;
+      const size_t count = std::min(sub_block_size, block_end - start);
+      Eigen::MatrixXd query = search.points_p.middleCols(start, count);
+      search.knn(query, indices[b], dists2[b]);
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, num_sub_blocks, search_sub_block);
+#else
+    #pragma omp parallel for
+    for (int b = 0; b < static_cast<int>(num_sub_blocks); b++)
+    {
+      search_sub_block(static_cast<size_t>(b));
+    }
+#endif  // RAYLIB_WITH_TBB
+
+    // append the valid neighbours, in point order
+    for (size_t b = 0; b < num_sub_blocks; b++)
+    {
+      for (int c = 0; c < static_cast<int>(indices[b].cols()); c++)
+      {
+        const size_t point_id = search.pointId(static_cast<int>(block_start + b * sub_block_size + c));
+        while (next_point <= point_id)
+        {
+          offsets_[next_point++] = ids_.size();
+        }
+        for (int j = 0; j < search.search_size && indices[b](j, c) != Nabo::NNSearchD::InvalidIndex; j++)
+        {
+          ids_.push_back(static_cast<uint32_t>(search.resultId(indices[b](j, c))));
+          dists2_.push_back(static_cast<float>(dists2[b](j, c)));
+        }
+      }
+    }
+  }
+  while (next_point <= num_points_)
+  {
+    offsets_[next_point++] = ids_.size();
+  }
+  search_.reset();
+}
+
+NeighbourGraph::Neighbours NeighbourGraph::neighbours(size_t i) const
+{
+  Neighbours result;
+  if (stored())
+  {
+    result.ids = ids_.data() + offsets_[i];
+    result.dists2 = dists2_.data() + offsets_[i];
+    result.size = static_cast<int>(offsets_[i + 1] - offsets_[i]);
+    return result;
+  }
+  static thread_local std::vector<uint32_t> ids;
+  static thread_local std::vector<float> dists2;
+  ids.clear();
+  dists2.clear();
+  const int search_id = search_->search_ids.empty() ? static_cast<int>(i) : search_->search_ids[i];
+  if (search_id != -1 && (search_->nns || search_->index))
+  {
+    Eigen::MatrixXd query = search_->points_p.col(search_id);
+    Eigen::MatrixXi indices;
+    Eigen::MatrixXd point_dists2;
+    search_->knn(query, indices, point_dists2);
+    for (int j = 0; j < search_->search_size && indices(j, 0) != Nabo::NNSearchD::InvalidIndex; j++)
+    {
+      ids.push_back(static_cast<uint32_t>(search_->resultId(indices(j, 0))));
+      dists2.push_back(static_cast<float>(point_dists2(j, 0)));
+    }
+  }
+  result.ids = ids.data();
+  result.dists2 = dists2.data();
+  result.size = static_cast<int>(ids.size());
+  return result;
+}
+
+}  // namespace ray
@@ -0,0 +1,70 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYNEIGHBOURS_H
+#define RAYLIB_RAYNEIGHBOURS_H
+
+#include "raylib/raylibconfig.h"
+#include "rayutils.h"
+
+#include <cstdint>
+#include <memory>
+
+namespace ray
+{
+class CloudIndex;
+
+/// A compact k-nearest neighbour graph over a set of points.
+/// The neighbour lists are stored contiguously (compressed sparse row layout) using 32-bit indices and single
+/// precision square distances, with invalid (out of range) neighbours removed. This is around a third of the size of
+/// the dense index and distance matrices returned by a kd-tree search.
+/// Alternatively the lists need not be stored, in which case each one is searched for when it is requested.
+class RAYLIB_EXPORT NeighbourGraph
+{
+public:
+  /// The neighbours of a single point, in order of increasing distance
+  struct Neighbours
+  {
+    const uint32_t *ids;  // indices of the neighbouring points
+    const float *dists2;  // square distance to each neighbour
+    int size;             // number of neighbours
+  };
+
+  NeighbourGraph();
+  ~NeighbourGraph();
+
+  /// Find up to @c search_size nearest neighbours of each of the @c points, that are closer than @c max_distance
+  /// (0 for no limit). Points with a false @c mask value have no neighbours, and are not the neighbours of any point.
+  /// When @c store is false only the search structure is kept, and the lists are found in each call to @c neighbours()
+  void build(const std::vector<Eigen::Vector3d> &points, int search_size, double max_distance = 0.0,
+             const std::vector<bool> *mask = nullptr, bool store = true);
+
+  /// Search using a previously built @c index, rather than building a kd-tree, in calls to @c build() for the same
+  /// points. The index is ignored for other points. It must remain valid for the lifetime of the graph
+  inline void useIndex(const CloudIndex *index) { index_ = index; }
+
+  /// The neighbours of point @c i. This is thread safe. When the lists are not stored, the returned pointers are
+  /// to a per-thread buffer, which is valid until the next call to @c neighbours() on the same thread
+  Neighbours neighbours(size_t i) const;
+
+  /// number of points in the graph
+  inline size_t size() const { return num_points_; }
+  /// whether the neighbour lists are stored, or searched for on demand
+  inline bool stored() const { return !offsets_.empty(); }
+  void clear();
+
+private:
+  struct Search;
+  size_t num_points_;
+  std::vector<uint64_t> offsets_;  // start of each point's list, the final entry is the total number of neighbours
+  std::vector<uint32_t> ids_;
+  std::vector<float> dists2_;
+  std::unique_ptr<Search> search_;  // kd-tree for on-demand searches
+  const CloudIndex *index_;         // optional persisted index, used in place of the kd-tree
+};
+
+}  // namespace ray
+
+#endif  // RAYLIB_RAYNEIGHBOURS_H
@@ -0,0 +1,256 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raypipeline.h"
+#include "raylaz.h"
+#include "rayneighbours.h"
+#include "rayply.h"
+#include "raytelemetry.h"
+
+#include <iostream>
+
+namespace ray
+{
+bool importCloud(const std::string &point_cloud_file, Trajectory *trajectory, double max_intensity,
+                 std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                                    std::vector<double> &times, std::vector<RGBA> &colours)>
+                   apply,
+                 size_t *num_bounded, Eigen::Vector3d *offset_to_remove)
+{
+  if (trajectory && trajectory->times().empty())
+  {
+    std::cerr << "Error: cannot import " << point_cloud_file << " with an empty trajectory" << std::endl;
+    return false;
+  }
+  size_t bounded = 0;
+  auto import_chunk = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                          std::vector<double> &times, std::vector<RGBA> &colours)
+  {
+    if (trajectory)
+    {
+      // find the corresponding sensor locations for each point in the cloud
+      trajectory->calculateStartPoints(times, starts);
+      for (size_t i = 0; i < colours.size(); i++)
+      {
+        if (colours[i].alpha == 0 && ends[i][2] < starts[i][2])  // a nonreturn, we need to remove downward ones
+        {
+          Eigen::Vector3d dir = (ends[i] - starts[i]).normalized();
+          const double minimal_distance_for_nonreturns = 0.1;
+          ends[i] = starts[i] + dir * minimal_distance_for_nonreturns;
+        }
+      }
+    }
+    for (auto &colour : colours)
+    {
+      if (colour.alpha > 0)
+        bounded++;
+      if (max_intensity == 0.0)
+        colour.alpha = 255;
+    }
+    apply(starts, ends, times, colours);
+  };
+  bool success = false;
+  const std::string ext = point_cloud_file.substr(point_cloud_file.find_last_of('.') + 1);
+  if (ext == "ply")
+  {
+    // special case of reading a non-ray-cloud ply
+    success = readPly(point_cloud_file, false, import_chunk, max_intensity, trajectory == nullptr);
+  }
+  else if (ext == "las" || ext == "laz")
+  {
+    size_t las_bounded;
+    success = readLas(point_cloud_file, import_chunk, las_bounded, max_intensity, offset_to_remove);
+  }
+  else
+  {
+    std::cerr << "Error converting unknown type: " << point_cloud_file << std::endl;
+  }
+  if (num_bounded)
+  {
+    *num_bounded = bounded;
+  }
+  return success;
+}
+
+bool importCloud(const std::string &point_cloud_file, Trajectory &trajectory, double max_intensity, Cloud &cloud)
+{
+  cloud.clear();
+  auto add_chunk = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
+                       std::vector<double> &times, std::vector<RGBA> &colours)
+  {
+    cloud.starts.insert(cloud.starts.end(), starts.begin(), starts.end());
+    cloud.ends.insert(cloud.ends.end(), ends.begin(), ends.end());
+    cloud.times.insert(cloud.times.end(), times.begin(), times.end());
+    cloud.colours.insert(cloud.colours.end(), colours.begin(), colours.end());
+  };
+  return importCloud(point_cloud_file, &trajectory, max_intensity, add_chunk);
+}
+
+void denoiseRangeGaps(Cloud &cloud, double range_distance)
+{
+  Cloud new_cloud;
+  new_cloud.reserve(cloud.ends.size());
+  // Firstly look at adjacent rays by range. We don't want to throw away large changes,
+  // instead, the intermediate of 3 adjacent ranges that is too far from both ends...
+  for (int i = 1; i < (int)cloud.starts.size() - 1; i++)
+  {
+    double range0 = (cloud.ends[i - 1] - cloud.starts[i - 1]).norm();
+    double range1 = (cloud.ends[i] - cloud.starts[i]).norm();
+    double range2 = (cloud.ends[i + 1] - cloud.starts[i + 1]).norm();
+    double min_dist =
+      std::min(std::abs(range0 - range2), std::min(std::abs(range1 - range0), std::abs(range2 - range1)));
+    if (!cloud.rayBounded(i) || min_dist < range_distance)
+      new_cloud.addRay(cloud, i);
+  }
+  std::cout << cloud.starts.size() - new_cloud.starts.size() << " rays removed with range gaps > "
+            << range_distance * 100.0 << " cm." << std::endl;
+  cloud = std::move(new_cloud);
+}
+
+void denoiseDistance(Cloud &cloud, double distance)
+{
+  NeighbourGraph neighbours;
+  neighbours.build(cloud.ends, 1, distance);
+
+  Cloud new_cloud;
+  new_cloud.reserve(cloud.ends.size());
+  for (int i = 0; i < (int)cloud.ends.size(); i++)
+  {
+    if (!cloud.rayBounded(i) || neighbours.neighbours(i).size > 0)
+      new_cloud.addRay(cloud, i);
+  }
+  std::cout << cloud.starts.size() - new_cloud.starts.size() << " rays removed with ends further than "
+            << distance * 100.0 << " cm from any other." << std::endl;
+  cloud = std::move(new_cloud);
+}
+
+void denoiseSigmas(Cloud &cloud, double sigmas, const CloudIndex *index)
+{
+  std::vector<Eigen::Vector3d> centroids;
+  std::vector<Eigen::Vector3d> dimensions;
+  std::vector<Eigen::Matrix3d> matrices;
+  NeighbourGraph neighbours;
+  neighbours.useIndex(index);
+
+  const int search_size = std::min(10, (int)cloud.ends.size() - 1);
+  cloud.getSurfels(search_size, &centroids, nullptr, &dimensions, &matrices, neighbours);
+
+  Cloud new_cloud;
+  new_cloud.reserve(cloud.ends.size());
+  Eigen::Vector3d dims(0, 0, 0);
+  double cnt = 0.0;
+  double nums = 0;
+  for (size_t i = 0; i < matrices.size(); i++)
+  {
+    bool is_noise = false;
+    if (cloud.rayBounded(i))
+    {
+      const NeighbourGraph::Neighbours ray_neighbours = neighbours.neighbours(i);
+      if (ray_neighbours.size == 0)  // no neighbours in range, we consider this as noise
+        continue;
+      int other_i = ray_neighbours.ids[0];
+      Eigen::Vector3d vec = cloud.ends[i] - centroids[other_i];
+      Eigen::Vector3d newVec = matrices[other_i].transpose() * vec;
+      newVec[0] /= dimensions[other_i][0];
+      newVec[1] /= dimensions[other_i][1];
+      newVec[2] /= dimensions[other_i][2];
+      nums += (double)ray_neighbours.size;
+      dims += dimensions[other_i];
+      cnt++;
+      double scale2 = newVec.squaredNorm();
+      is_noise = scale2 > sigmas * sigmas;
+    }
+    if (!is_noise)
+      new_cloud.addRay(cloud, i);
+  }
+  dims /= cnt;
+  std::cout << "average dimensions: " << dims.transpose() << ", average num neighbours: " << nums / cnt << std::endl;
+  std::cout << cloud.starts.size() - new_cloud.starts.size() << " rays removed with nearest neighbour sigma more than "
+            << sigmas << std::endl;
+  cloud = std::move(new_cloud);
+}
+
+void smoothSurfaces(Cloud &cloud, const CloudIndex *index)
+{
+  // Method:
+  // 1. generate normals and neighbour indices
+  // 2. pull point along normal direction so as to match neighbours, weighted by normal similarity
+
+  const int num_neighbours = 16;
+  std::vector<Eigen::Vector3d> normals;
+  NeighbourGraph neighbours;
+  neighbours.useIndex(index);
+  cloud.getSurfels(num_neighbours, nullptr, &normals, nullptr, nullptr, neighbours);
+
+  std::vector<Eigen::Vector3d> centroids(cloud.ends.size());
+  for (size_t i = 0; i < cloud.ends.size(); i++)
+  {
+    if (!cloud.rayBounded(i))
+      continue;
+    double total_weight = 0.2;  // more averaging if it uses less of the central position, but 0 risks a divide by 0
+    Eigen::Vector3d weighted_sum = cloud.ends[i] * total_weight;
+    const NeighbourGraph::Neighbours ray_neighbours = neighbours.neighbours(i);
+    for (int j = 0; j < ray_neighbours.size; j++)
+    {
+      int k = ray_neighbours.ids[j];
+      double weight = std::max(0.0, 1.0 - (normals[k] - normals[i]).squaredNorm());
+      weighted_sum += cloud.ends[k] * weight;
+      total_weight += weight;
+    }
+    centroids[i] = weighted_sum / total_weight;
+  }
+  for (size_t i = 0; i < cloud.ends.size(); i++)
+  {
+    if (!cloud.rayBounded(i))
+      continue;
+    cloud.ends[i] += normals[i] * (centroids[i] - cloud.ends[i]).dot(normals[i]);
+  }
+}
+
+bool removeTransients(Cloud &cloud, const MergerConfig &config, Cloud *transients, Progress *progress)
+{
+  Merger merger(config);
+  if (!merger.filter(cloud, progress))
+    return false;
+  if (transients)
+    *transients = merger.differenceCloud();
+  cloud = merger.fixedCloud();
+  return true;
+}
+
+Pipeline &Pipeline::add(const std::string &name, const Stage &stage)
+{
+  stages_.push_back(std::make_pair(name, stage));
+  return *this;
+}
+
+bool Pipeline::run(Cloud &cloud) const
+{
+  for (auto &stage : stages_)
+  {
+    TelemetryPhase telemetry(stage.first);
+    telemetry.addRays(cloud.ends.size());
+    const size_t num_rays = cloud.ends.size();
+    if (!stage.second(cloud))
+    {
+      std::cerr << "Error: pipeline stage " << stage.first << " failed" << std::endl;
+      return false;
+    }
+    std::cout << stage.first << ": " << num_rays << " rays in, " << cloud.ends.size() << " rays out" << std::endl;
+  }
+  return true;
+}
+
+bool Pipeline::run(const std::string &in_file, const std::string &out_file) const
+{
+  Cloud cloud;
+  if (!cloud.load(in_file))
+    return false;
+  if (!run(cloud))
+    return false;
+  return cloud.save(out_file);
+}
+
+}  // namespace ray
@@ -0,0 +1,85 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYPIPELINE_H
+#define RAYLIB_RAYPIPELINE_H
+
+#include "raylib/raylibconfig.h"
+#include "raycloud.h"
+#include "raymerger.h"
+#include "raytrajectory.h"
+
+#include <functional>
+
+namespace ray
+{
+class CloudIndex;
+
+/// In-memory versions of the raycloudtools operations. Each modifies @c cloud in place, so that several can be
+/// applied in turn with a single load and save, rather than a file round-trip for each tool.
+
+/// import the point cloud @c point_cloud_file (.ply, .las or .laz) into a ray cloud, with the ray starts interpolated
+/// from @c trajectory. A @c max_intensity of 0 sets all points to full intensity (bounded rays)
+bool RAYLIB_EXPORT importCloud(const std::string &point_cloud_file, Trajectory &trajectory, double max_intensity,
+                               Cloud &cloud);
+
+/// Chunk-based version of importCloud, which calls @c apply for each chunk of imported rays, so that clouds larger
+/// than memory can be imported. With a null @c trajectory the ray starts are left for @c apply to set, and the point
+/// cloud does not need times. @c offset_to_remove is as for readLas, and @c num_bounded returns the number of points
+/// with a non-zero intensity
+bool RAYLIB_EXPORT importCloud(const std::string &point_cloud_file, Trajectory *trajectory, double max_intensity,
+                               std::function<void(std::vector<Eigen::Vector3d> &starts,
+                                                  std::vector<Eigen::Vector3d> &ends, std::vector<double> &times,
+                                                  std::vector<RGBA> &colours)>
+                                 apply,
+                               size_t *num_bounded = nullptr, Eigen::Vector3d *offset_to_remove = nullptr);
+
+/// remove mixed-signal noise: the middle ray of three adjacent rays whose ranges differ by more than
+/// @c range_distance (in metres)
+void RAYLIB_EXPORT denoiseRangeGaps(Cloud &cloud, double range_distance);
+
+/// remove rays whose end points are further than @c distance (in metres) from any other end point
+void RAYLIB_EXPORT denoiseDistance(Cloud &cloud, double distance);
+
+/// remove rays whose end points are more than @c sigmas standard deviations from their nearest neighbours.
+/// The optional @c index of the cloud's bounded end points is used for the neighbour search
+void RAYLIB_EXPORT denoiseSigmas(Cloud &cloud, double sigmas, const CloudIndex *index = nullptr);
+
+/// move off-surface end points onto the nearest surface. The optional @c index of the cloud's bounded end points is
+/// used for the neighbour search
+void RAYLIB_EXPORT smoothSurfaces(Cloud &cloud, const CloudIndex *index = nullptr);
+
+/// remove the transient rays from @c cloud, according to @c config. The removed rays are placed in @c transients
+/// when it is not null
+bool RAYLIB_EXPORT removeTransients(Cloud &cloud, const MergerConfig &config, Cloud *transients = nullptr,
+                                   Progress *progress = nullptr);
+
+/// A chain of processing stages applied to a single in-memory ray cloud. For example:
+///   Pipeline pipeline;
+///   pipeline.add("denoise", [](Cloud &cloud) { denoiseSigmas(cloud, 3.0); return true; })
+///           .add("decimate", [](Cloud &cloud) { return decimateSpatial(cloud, 4.0); });
+///   pipeline.run("cloud.ply", "cloud_processed.ply");
+class RAYLIB_EXPORT Pipeline
+{
+public:
+  /// a stage modifies the cloud in place, returning false on failure
+  using Stage = std::function<bool(Cloud &cloud)>;
+
+  /// append a stage, @c name is used in the progress output
+  Pipeline &add(const std::string &name, const Stage &stage);
+  inline size_t numStages() const { return stages_.size(); }
+
+  /// run the stages in order on @c cloud, stopping at the first one that fails
+  bool run(Cloud &cloud) const;
+  /// load the ray cloud @c in_file, run the stages and save the result to @c out_file
+  bool run(const std::string &in_file, const std::string &out_file) const;
+
+private:
+  std::vector<std::pair<std::string, Stage>> stages_;
+};
+
+}  // namespace ray
+
+#endif  // RAYLIB_RAYPIPELINE_H
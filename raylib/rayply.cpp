@@ -6,6 +6,8 @@
 #include "rayply.h"
 #include "raylib/rayprogress.h"
 #include "raylib/rayprogressthread.h"
+#include "raylib/raytelemetry.h"
+#include "raycloudstream.h"
 #include "raymesh.h"
 
 #include <fstream>
@@ -80,7 +82,7 @@ bool writeRayCloudChunkStart(const std::string &file_name, std::ofstream &out)
 
 bool writeRayCloudChunk(std::ofstream &out, RayPlyBuffer &vertices, const std::vector<Eigen::Vector3d> &starts,
                         const std::vector<Eigen::Vector3d> &ends, const std::vector<double> &times,
-                        const std::vector<RGBA> &colours, bool &has_warned)
+                        const std::vector<RGBA> &colours, bool &has_warned, CloudStatistics *stats)
 {
   if (ends.size() == 0)
   {
@@ -138,6 +140,23 @@ bool writeRayCloudChunk(std::ofstream &out, RayPlyBuffer &vertices, const std::v
     vertices[i] << (float)ends[i][0], (float)ends[i][1], (float)ends[i][2], u.f[0], u.f[1], (float)n[0], (float)n[1],
       (float)n[2], (float &)colours[i];
 #endif
+    if (stats)
+    {
+      // the ray as readPly will decode it from the row, skipping rays with nans
+#if RAYLIB_DOUBLE_RAYS
+      const Eigen::Vector3d end = (Eigen::Vector3d &)vertices[i][0];
+      const Eigen::Vector3f n_stored = (Eigen::Vector3f &)vertices[i][8];
+#else
+      const Eigen::Vector3f e = (Eigen::Vector3f &)vertices[i][0];
+      const Eigen::Vector3d end(e[0], e[1], e[2]);
+      const Eigen::Vector3f n_stored = (Eigen::Vector3f &)vertices[i][5];
+#endif
+      const Eigen::Vector3d normal(n_stored[0], n_stored[1], n_stored[2]);
+      if (end == end && normal == normal)
+      {
+        stats->add(end + normal, end, times[i], colours[i]);
+      }
+    }
   }
   out.write((const char *)&vertices[0], sizeof(RayPlyEntry) * vertices.size());
   if (!out.good())
@@ -148,7 +167,7 @@ bool writeRayCloudChunk(std::ofstream &out, RayPlyBuffer &vertices, const std::v
   return true;
 }
 
-unsigned long writeRayCloudChunkEnd(std::ofstream &out)
+unsigned long writeRayCloudChunkEnd(std::ofstream &out, const std::string &file_name, const CloudStatistics *stats)
 {
   const unsigned long size = static_cast<unsigned long>(out.tellp()) - chunk_header_length;
   const unsigned long number_of_rays = size / sizeof(RayPlyEntry);
@@ -157,6 +176,11 @@ unsigned long writeRayCloudChunkEnd(std::ofstream &out)
   std::string str = stream.str();
   out.seekp(vertex_size_pos - str.length());
   out << str;
+  if (stats && !file_name.empty())
+  {
+    out.flush();  // so the file's size and modification time are final
+    stats->save(file_name);
+  }
   return number_of_rays;
 }
 
@@ -176,12 +200,13 @@ bool writePlyRayCloud(const std::string &file_name, const std::vector<Eigen::Vec
     return false;
   RayPlyBuffer buffer;
   bool has_warned = false;
+  CloudStatistics stats;
   // TODO: could split this into chunks aswell, it would allow saving out files roughly twice as large
-  if (!writeRayCloudChunk(ofs, buffer, starts, ends, times, rgb, has_warned))
+  if (!writeRayCloudChunk(ofs, buffer, starts, ends, times, rgb, has_warned, &stats))
   {
     return false;
   }
-  const unsigned long num_rays = ray::writeRayCloudChunkEnd(ofs);
+  const unsigned long num_rays = ray::writeRayCloudChunkEnd(ofs, file_name, &stats);
   std::cout << num_rays << " rays saved to " << file_name << std::endl;
   return true;
 }
@@ -330,9 +355,10 @@ bool readPly(const std::string &file_name, bool is_ray_cloud,
              std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                                 std::vector<double> &times, std::vector<RGBA> &colours)>
                apply, 
-             double max_intensity, bool times_optional, size_t chunk_size)
+             double max_intensity, bool times_optional, size_t chunk_size, size_t max_rays)
 {
   std::cout << "reading: " << file_name << std::endl;
+  TelemetryPhase telemetry("readPly");
   std::ifstream input(file_name.c_str(), std::ios::in | std::ios::binary);
   if (input.fail())
   {
@@ -434,7 +460,9 @@ bool readPly(const std::string &file_name, bool is_ray_cloud,
   input.seekg(0, input.end);
   size_t length = input.tellg() - start;
   input.seekg(start);
-  size_t size = length / row_size;
+  size_t size = std::min(length / row_size, max_rays);
+  telemetry.addRays(size);
+  telemetry.addBytes(static_cast<size_t>(input.tellg()) + size * row_size);
 
   ray::Progress progress;
   ray::ProgressThread progress_thread(progress);
@@ -1013,31 +1041,10 @@ bool readPlyMesh(const std::string &file, Mesh &mesh)
 bool convertCloud(const std::string &in_name, const std::string &out_name,
                   std::function<void(Eigen::Vector3d &start, Eigen::Vector3d &ends, double &time, RGBA &colour)> apply)
 {
-  std::ofstream ofs;
-  if (!writeRayCloudChunkStart(out_name, ofs))
-  {
-    return false;
-  }
-  ray::RayPlyBuffer buffer;
-
-  bool has_warned = false;
   // run the function 'apply' on each ray as it is read in, and write it out, one chunk at a time
-  auto applyToChunk = [&apply, &buffer, &ofs, &has_warned](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
-                                              std::vector<double> &times, std::vector<ray::RGBA> &colours) {
-    for (size_t i = 0; i < ends.size(); i++)
-    {
-      // We can adjust the applyToChunk arguments directly as they are non-const and their modification doesn't have
-      // side effects
-      apply(starts[i], ends[i], times[i], colours[i]);
-    }
-    ray::writeRayCloudChunk(ofs, buffer, starts, ends, times, colours, has_warned);
-  };
-  if (!ray::readPly(in_name, true, applyToChunk, 0))
-  {
-    return false;
-  }
-  ray::writeRayCloudChunkEnd(ofs);
-  return true;
+  CloudStream stream;
+  stream.transform(apply).write(out_name);
+  return stream.run(in_name);
 }
 
 }  // namespace ray
@@ -8,6 +8,7 @@
 
 #include "raylib/raylibconfig.h"
 
+#include "raycloudstats.h"
 #include "rayutils.h"
 
 namespace ray
@@ -38,11 +39,13 @@ bool RAYLIB_EXPORT writePlyMesh(const std::string &file_name, const class Mesh &
 /// @c chunk_size is the number of rays to read at one time. This method can be used on large clouds where
 /// the full set of rays is not required to be in memory at one time.
 /// @c times_optional flag allows clouds to be read with no time stamps
+/// @c max_rays stops the read after this many rays, so the start of a large file can be inspected cheaply
 bool RAYLIB_EXPORT readPly(const std::string &file_name, bool is_ray_cloud,
                            std::function<void(std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
                                               std::vector<double> &times, std::vector<RGBA> &colours)>
                              apply, 
-                           double max_intensity, bool times_optional = false, size_t chunk_size = 1000000);
+                           double max_intensity, bool times_optional = false, size_t chunk_size = 1000000,
+                           size_t max_rays = std::numeric_limits<size_t>::max());
 
 
 /// write a .ply file representing a point cloud
@@ -54,13 +57,17 @@ bool RAYLIB_EXPORT writePlyRayCloud(const std::string &file_name, const std::vec
                                     const std::vector<Eigen::Vector3d> &ends, const std::vector<double> &times,
                                     const std::vector<RGBA> &colours);
 
-/// Chunked version of writePlyRayCloud
+/// Chunked version of writePlyRayCloud.
+/// When @c stats is given, the statistics of the rays (as they will be read back from the file) are accumulated into
+/// it, and writeRayCloudChunkEnd saves them alongside the file @c file_name
 bool RAYLIB_EXPORT writeRayCloudChunkStart(const std::string &file_name, std::ofstream &out);
 bool RAYLIB_EXPORT writeRayCloudChunk(std::ofstream &out, RayPlyBuffer &vertices,
                                       const std::vector<Eigen::Vector3d> &starts,
                                       const std::vector<Eigen::Vector3d> &ends, const std::vector<double> &times,
-                                      const std::vector<RGBA> &colours, bool &has_warned);
-unsigned long RAYLIB_EXPORT writeRayCloudChunkEnd(std::ofstream &out);
+                                      const std::vector<RGBA> &colours, bool &has_warned,
+                                      CloudStatistics *stats = nullptr);
+unsigned long RAYLIB_EXPORT writeRayCloudChunkEnd(std::ofstream &out, const std::string &file_name = std::string(),
+                                                  const CloudStatistics *stats = nullptr);
 
 /// Chunked version of writePlyPointCloud
 bool RAYLIB_EXPORT writePointCloudChunkStart(const std::string &file_name, std::ofstream &out);
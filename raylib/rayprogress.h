@@ -7,10 +7,12 @@
 #define RAYPROGRESS_H
 
 #include "raylib/raylibconfig.h"
+#include "raylib/raytelemetry.h"
 
 #include <atomic>
 #include <chrono>
 #include <cstddef>
+#include <memory>
 #include <mutex>
 #include <string>
 
@@ -27,6 +29,9 @@ namespace ray
 /// range. When @c target() is known, the progress may be reported as a ratio `[0, 1]`.
 ///
 /// Updating the progress value is threadsafe, however, the @c begin() operations are not.
+///
+/// When @c Telemetry is enabled, each named phase is also recorded as telemetry, with the final progress value
+/// reported as its item count.
 class RAYLIB_EXPORT Progress
 {
 public:
@@ -96,6 +101,7 @@ private:
   std::atomic_size_t target_;
   std::atomic_size_t progress_;
   bool last_phase_ended_ = false;
+  std::unique_ptr<TelemetryPhase> telemetry_;
 };
 
 
@@ -128,6 +134,7 @@ inline void Progress::begin(const std::string &phase, size_t target)
   progress_ = 0u;
   last_phase_ended_ = false;
   phase_start_ = Clock::now();
+  telemetry_.reset(!phase.empty() && Telemetry::enabled() ? new TelemetryPhase(phase) : nullptr);
 }
 
 
@@ -142,6 +149,11 @@ inline void Progress::end(bool set_progress)
     }
     last_duration_ = Clock::now() - phase_start_;
     last_phase_ended_ = true;
+    if (telemetry_)
+    {
+      telemetry_->addItems(progress_);
+      telemetry_.reset();
+    }
   }
 }
 
@@ -52,6 +52,28 @@ public:
     return (xor_shifted >> rot) | (xor_shifted << ((-rot) & 31));
   }
 
+  /// Skip forward @c delta numbers in the sequence, in O(log delta) time. This allows separate runs of the sequence to
+  /// be generated in parallel, giving the same numbers as generating them in order.
+  inline void advance(uint64_t delta)
+  {
+    uint64_t cur_mult = 6364136223846793005ULL;
+    uint64_t cur_plus = increment_ | 1;
+    uint64_t acc_mult = 1;
+    uint64_t acc_plus = 0;
+    while (delta > 0)
+    {
+      if (delta & 1)
+      {
+        acc_mult *= cur_mult;
+        acc_plus = acc_plus * cur_mult + cur_plus;
+      }
+      cur_plus = (cur_mult + 1) * cur_plus;
+      cur_mult *= cur_mult;
+      delta >>= 1;
+    }
+    state_ = acc_mult * state_ + acc_plus;
+  }
+
   static PCGRandomGenerator &instance();
 
 private:
@@ -72,6 +94,13 @@ inline double randUniformDouble()
   return static_cast<double>(ray::rand() % std::numeric_limits<int>::max()) /
          static_cast<double>(std::numeric_limits<int>::max());
 }
+
+/// Return a uniformed number between [0,1), from the given @c generator rather than the shared one.
+inline double randUniformDouble(PCGRandomGenerator &generator)
+{
+  return static_cast<double>(generator() % std::numeric_limits<int>::max()) /
+         static_cast<double>(std::numeric_limits<int>::max());
+}
 }  // namespace ray
 
 #endif  // RAY_RANDOM_H
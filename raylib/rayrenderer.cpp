@@ -8,6 +8,7 @@
 #include "raycloud.h"
 #include "raylib/raylibconfig.h"
 #include "rayparse.h"
+#include "raytelemetry.h"
 #if RAYLIB_WITH_TIFF   // build option to support outputting to geotif (.tif) format
 #include "geotiffio.h" /* for GeoTIFF */
 #include "xtiffio.h"   /* for TIFF */
@@ -273,36 +274,81 @@ bool writeGeoTiffFloat(const std::string &filename, int x, int y, const float *d
 /// of surface angles.
 void DensityGrid::calculateDensities(const std::string &file_name)
 {
+  TelemetryPhase telemetry("DensityGrid::calculateDensities");
+  std::vector<Eigen::Vector3d> clipped_starts, clipped_ends;
+  std::vector<bool> clipped;
   auto calculate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends, std::vector<double> &,
                        std::vector<RGBA> &colours) {
+    telemetry.addRays(ends.size());
+    bounds_.clipRays(starts, ends, clipped_starts, clipped_ends, clipped, 1e-10);
     for (size_t i = 0; i < ends.size(); ++i)
     {
-      Eigen::Vector3d start = starts[i];
-      Eigen::Vector3d end = ends[i];
-      if (!bounds_.clipRay(start, end, 1e-10))
+      if (!clipped[i])
       {
-        continue; // ray is outside of bounds
+        continue;  // ray is outside of bounds
       }
       bounded_ = colours[i].alpha > 0;
-      walkGrid((start - bounds_.min_bound_) / voxel_width_, (end - bounds_.min_bound_) / voxel_width_, *this);
+      walkGrid((clipped_starts[i] - bounds_.min_bound_) / voxel_width_,
+               (clipped_ends[i] - bounds_.min_bound_) / voxel_width_, *this);
     }
   };
   Cloud::read(file_name, calculate);
 }
 
+namespace
+{
+/// Fuse @c voxel with its Moore neighbourhood (3x3x3) until it has DENSITY_MIN_RAYS rays. The neighbours, returned by
+/// @c neighbour for each offset, are added in order of distance: the faces, then the edges, then the corners, with only
+/// the fraction of the last set that is needed to reach the minimum. Returns false if the minimum is not reached
+template <class NeighbourFunc>
+bool addNeighbourPrior(DensityGrid::Voxel &voxel, const NeighbourFunc &neighbour)
+{
+  static const int num_offsets = 26;
+  static const int set_ends[3] = { 6, 18, 26 };
+  static const int offsets[num_offsets][3] = {
+    // faces
+    { -1, 0, 0 }, { 1, 0, 0 }, { 0, -1, 0 }, { 0, 1, 0 }, { 0, 0, -1 }, { 0, 0, 1 },
+    // edges
+    { -1, -1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { 1, 1, 0 }, { -1, 0, -1 }, { -1, 0, 1 },
+    { 1, 0, -1 }, { 1, 0, 1 }, { 0, -1, -1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, 1, 1 },
+    // corners
+    { -1, -1, -1 }, { -1, -1, 1 }, { -1, 1, -1 }, { 1, -1, -1 }, { -1, 1, 1 }, { 1, -1, 1 }, { 1, 1, -1 }, { 1, 1, 1 }
+  };
+
+  float needed = DENSITY_MIN_RAYS - voxel.numRays();
+  if (needed < 0.0)
+    return true;
+  int i = 0;
+  for (int set = 0; set < 3; set++)
+  {
+    DensityGrid::Voxel neighbours = neighbour(Eigen::Vector3i(offsets[i][0], offsets[i][1], offsets[i][2]));
+    for (i++; i < set_ends[set]; i++)
+    {
+      neighbours += neighbour(Eigen::Vector3i(offsets[i][0], offsets[i][1], offsets[i][2]));
+    }
+    if (neighbours.numRays() >= needed)
+    {
+      voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
+      return true;
+    }
+    voxel += neighbours;
+    needed -= neighbours.numRays();
+  }
+  return false;
+}
+}  // namespace
+
 // This is a form of windowed average over the Moore neighbourhood (3x3x3) window.
 void DensityGrid::addNeighbourPriors()
 {
 #if DENSITY_MIN_RAYS > 0
-  const int X = 1;
-  const int Y = voxel_dims_[0];
-  const int Z = voxel_dims_[0] * voxel_dims_[1];
-  DensityGrid::Voxel neighbours;
+  const Eigen::Vector3i strides(1, voxel_dims_[0], voxel_dims_[0] * voxel_dims_[1]);
+  const int corner = strides.sum();
   double num_hit_points = 0.0;
   double num_hit_points_unsatisfied = 0.0;
 
   // This simple 3x3x3 convolution needs to be a bit sneaky to avoid having to double the memory cost.
-  // well, not that sneaky, we just shift the output -1,-1,-1 for each cell
+  // well, not that sneaky, we just shift the output -1,-1,-1 for each cell. No neighbour of a later cell is stored there
   for (int x = 1; x < voxel_dims_[0] - 1; x++)
   {
     for (int y = 1; y < voxel_dims_[1] - 1; y++)
@@ -310,66 +356,16 @@ void DensityGrid::addNeighbourPriors()
       for (int z = 1; z < voxel_dims_[2] - 1; z++)
       {
         const int ind = getIndex(Eigen::Vector3i(x, y, z));
+        DensityGrid::Voxel voxel = voxels_[ind];
+        const bool satisfied = addNeighbourPrior(
+          voxel, [&](const Eigen::Vector3i &offset) -> const Voxel & { return voxels_[ind + offset.dot(strides)]; });
         if (voxels_[ind].numHits() > 0)
-          num_hit_points++;
-        float needed = DENSITY_MIN_RAYS - voxels_[ind].numRays();
-        const DensityGrid::Voxel corner_vox = voxels_[ind - X - Y - Z];
-        voxels_[ind - X - Y - Z] = voxels_[ind];  // move centre up to corner
-        DensityGrid::Voxel &voxel = voxels_[ind - X - Y - Z];
-        if (needed < 0.0)
-          continue;
-        neighbours = voxels_[ind - X];
-        neighbours += voxels_[ind + X];
-        neighbours += voxels_[ind - Y];
-        neighbours += voxels_[ind + Y];
-        neighbours += voxels_[ind - Z];
-        neighbours += voxels_[ind + Z];
-        if (neighbours.numRays() >= needed)
-        {
-          voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
-          continue;
-        }
-        voxel += neighbours;
-        needed -= neighbours.numRays();
-
-        neighbours = voxels_[ind - X - Y];
-        neighbours += voxels_[ind - X + Y];
-        neighbours += voxels_[ind + X - Y];
-        neighbours += voxels_[ind + X + Y];
-
-        neighbours += voxels_[ind - X - Z];
-        neighbours += voxels_[ind - X + Z];
-        neighbours += voxels_[ind + X - Z];
-        neighbours += voxels_[ind + X + Z];
-
-        neighbours += voxels_[ind - Y - Z];
-        neighbours += voxels_[ind - Y + Z];
-        neighbours += voxels_[ind + Y - Z];
-        neighbours += voxels_[ind + Y + Z];
-        if (neighbours.numRays() >= needed)
-        {
-          voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
-          continue;
-        }
-        voxel += neighbours;
-        needed -= neighbours.numRays();
-
-        neighbours = corner_vox;
-        neighbours += voxels_[ind - X - Y + Z];
-        neighbours += voxels_[ind - X + Y - Z];
-        neighbours += voxels_[ind + X - Y - Z];
-        neighbours += voxels_[ind - X + Y + Z];
-        neighbours += voxels_[ind + X - Y + Z];
-        neighbours += voxels_[ind + X + Y - Z];
-        neighbours += voxels_[ind + X + Y + Z];
-        if (neighbours.numRays() >= needed)
         {
-          voxel += neighbours * (needed / neighbours.numRays());  // add minimal amount to reach DENSITY_MIN_RAYS
-          continue;
+          num_hit_points++;
+          if (!satisfied)
+            num_hit_points_unsatisfied++;
         }
-        voxel += neighbours;
-        if (voxels_[ind].numHits() > 0)
-          num_hit_points_unsatisfied++;
+        voxels_[ind - corner] = voxel;  // move centre up to corner
       }
     }
   }
@@ -390,6 +386,111 @@ void DensityGrid::addNeighbourPriors()
 #endif
 }
 
+SparseDensityGrid::SparseDensityGrid(const Cuboid &grid_bounds, double vox_width, const Eigen::Vector3i &dims)
+  : bounds_(grid_bounds)
+  , voxel_width_(vox_width)
+  , voxel_dims_(dims)
+  , bounded_(false)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    block_dims_[i] = (dims[i] + kBlockWidth - 1) / kBlockWidth;
+  }
+  block_ids_.resize(static_cast<size_t>(block_dims_[0]) * block_dims_[1] * block_dims_[2], -1);
+}
+
+void SparseDensityGrid::requireVoxel(const Eigen::Vector3i &inds)
+{
+#if DENSITY_MIN_RAYS > 0
+  // addNeighbourPriors stores the result for the voxel at inds + 1 in inds, using the 3x3x3 window around inds + 1
+  const Eigen::Vector3i max_inds = (inds + Eigen::Vector3i(2, 2, 2)).cwiseMin(voxel_dims_ - Eigen::Vector3i(1, 1, 1));
+#else
+  const Eigen::Vector3i max_inds = inds;
+#endif
+  const Eigen::Vector3i min_inds = inds.cwiseMax(Eigen::Vector3i(0, 0, 0));
+  for (int x = min_inds[0] >> kBlockShift; x <= max_inds[0] >> kBlockShift; x++)
+  {
+    for (int y = min_inds[1] >> kBlockShift; y <= max_inds[1] >> kBlockShift; y++)
+    {
+      for (int z = min_inds[2] >> kBlockShift; z <= max_inds[2] >> kBlockShift; z++)
+      {
+        int &id = block_ids_[blockIndex(Eigen::Vector3i(x, y, z) * kBlockWidth)];
+        if (id < 0)
+        {
+          id = static_cast<int>(voxels_.size() / kBlockSize);
+          voxels_.resize(voxels_.size() + kBlockSize);
+        }
+      }
+    }
+  }
+}
+
+void SparseDensityGrid::calculateDensities(const std::string &file_name)
+{
+  TelemetryPhase telemetry("SparseDensityGrid::calculateDensities");
+  std::cout << "density grid: " << voxels_.size() / kBlockSize << " blocks allocated of " << block_ids_.size()
+            << std::endl;
+  std::vector<Eigen::Vector3d> clipped_starts, clipped_ends;
+  std::vector<bool> clipped;
+  auto calculate = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends, std::vector<double> &,
+                       std::vector<RGBA> &colours) {
+    telemetry.addRays(ends.size());
+    bounds_.clipRays(starts, ends, clipped_starts, clipped_ends, clipped, 1e-10);
+    for (size_t i = 0; i < ends.size(); ++i)
+    {
+      if (!clipped[i])
+      {
+        continue;  // ray is outside of bounds
+      }
+      bounded_ = colours[i].alpha > 0;
+      walkGrid((clipped_starts[i] - bounds_.min_bound_) / voxel_width_,
+               (clipped_ends[i] - bounds_.min_bound_) / voxel_width_, *this);
+    }
+  };
+  Cloud::read(file_name, calculate);
+}
+
+bool SparseDensityGrid::operator()(const Eigen::Vector3i &p, const Eigen::Vector3i &target, double in_length,
+                                   double out_length, double max_length)
+{
+  DensityGrid::Voxel *voxel = inBounds(p) ? rawVoxel(p) : nullptr;
+  if (!voxel)
+  {
+    return false;
+  }
+  if (p == target && bounded_)
+  {
+    double length_in_voxel = std::min(out_length, max_length) - in_length;
+    voxel->addHitRay(static_cast<float>(length_in_voxel * voxel_width_));
+  }
+  else
+  {
+    voxel->addMissRay(static_cast<float>((out_length - in_length) * voxel_width_));
+  }
+  return false;
+}
+
+DensityGrid::Voxel SparseDensityGrid::voxel(const Eigen::Vector3i &inds) const
+{
+#if DENSITY_MIN_RAYS > 0
+  // addNeighbourPriors only processes the interior voxels, storing each result one voxel lower on every axis
+  const Eigen::Vector3i c = inds + Eigen::Vector3i(1, 1, 1);
+  for (int i = 0; i < 3; i++)
+  {
+    if (c[i] < 1 || c[i] > voxel_dims_[i] - 2)
+    {
+      return raw(inds);
+    }
+  }
+  // the same prior as addNeighbourPriors, so that the results are identical
+  DensityGrid::Voxel voxel = raw(c);
+  addNeighbourPrior(voxel, [&](const Eigen::Vector3i &offset) { return raw(c + offset); });
+  return voxel;
+#else
+  return raw(inds);
+#endif
+}
+
 bool renderCloud(const std::string &cloud_file, const Cuboid &bounds, ViewDirection view_direction, RenderStyle style,
                  double pix_width, const std::string &image_file, const std::string &projection_file, bool mark_origin,
                  const std::string *const transform_file)
@@ -456,9 +557,16 @@ bool renderCloud(const std::string &cloud_file, const Cuboid &bounds, ViewDirect
     }
     else  // otherwise we use a common algorithm, specialising on render style only per-ray
     {
+      std::vector<Eigen::Vector3d> clipped_starts, clipped_ends;
+      std::vector<bool> clipped;
       // this lambda expression lets us chunk load the ray cloud file, so we don't run out of RAM
       auto render = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends, std::vector<double> &,
                         std::vector<RGBA> &colours) {
+        // clip the rays to within the image (since we exclude unbounded rays from the image bounds)
+        if (style == RenderStyle::Rays)
+        {
+          bounds.clipRays(starts, ends, clipped_starts, clipped_ends, clipped);
+        }
         for (size_t i = 0; i < ends.size(); i++)
         {
           const RGBA &colour = colours[i];
@@ -489,13 +597,12 @@ bool renderCloud(const std::string &cloud_file, const Cuboid &bounds, ViewDirect
             break;
           case RenderStyle::Rays:
           {
-            Eigen::Vector3d cloud_start = starts[i];
-            Eigen::Vector3d cloud_end = ends[i];
-            // clip to within the image (since we exclude unbounded rays from the image bounds)
-            if (!bounds.clipRay(cloud_start, cloud_end))
+            if (!clipped[i])
             {
               continue;
             }
+            const Eigen::Vector3d &cloud_start = clipped_starts[i];
+            const Eigen::Vector3d &cloud_end = clipped_ends[i];
             Eigen::Vector3d start = (cloud_start - bounds.min_bound_) / pix_width;
             Eigen::Vector3d end = (cloud_end - bounds.min_bound_) / pix_width;
             const Eigen::Vector3d dir = cloud_end - cloud_start;
@@ -118,6 +118,83 @@ private:
   bool bounded_;
 };
 
+/// A sparse version of DensityGrid, for large clouds where the dense grid would not fit in memory. The voxels are
+/// stored in 8x8x8 blocks, which are only allocated around the voxels passed to requireVoxel(), so the memory scales
+/// with the occupied (e.g. canopy) volume rather than the bounding volume. The voxel() values match those of a
+/// DensityGrid of the same bounds and dimensions after calling addNeighbourPriors().
+class RAYLIB_EXPORT SparseDensityGrid
+{
+public:
+  SparseDensityGrid(const Cuboid &grid_bounds, double vox_width, const Eigen::Vector3i &dims);
+
+  /// allocate the storage needed to calculate voxel(@c inds)
+  void requireVoxel(const Eigen::Vector3i &inds);
+  /// This streams in a ray cloud file, and fills in the density information of the allocated voxels
+  void calculateDensities(const std::string &file_name);
+  /// the voxel at @c inds, with the neighbour priors applied as in DensityGrid::addNeighbourPriors()
+  DensityGrid::Voxel voxel(const Eigen::Vector3i &inds) const;
+
+  /// the voxel indices containing @c pos, these may be out of bounds
+  inline Eigen::Vector3i getInds(const Eigen::Vector3d &pos) const
+  {
+    return ((pos - bounds_.min_bound_) / voxel_width_).cast<int>();
+  }
+  inline bool inBounds(const Eigen::Vector3i &inds) const
+  {
+    return inds[0] >= 0 && inds[1] >= 0 && inds[2] >= 0 && inds[0] < voxel_dims_[0] && inds[1] < voxel_dims_[1] &&
+           inds[2] < voxel_dims_[2];
+  }
+  /// the index that the voxel would have in a dense DensityGrid
+  inline int64_t getIndex(const Eigen::Vector3i &inds) const
+  {
+    return static_cast<int64_t>(inds[0]) + static_cast<int64_t>(inds[1]) * voxel_dims_[0] +
+           static_cast<int64_t>(inds[2]) * voxel_dims_[0] * voxel_dims_[1];
+  }
+  inline const Eigen::Vector3i &dimensions() const { return voxel_dims_; }
+  inline double voxelWidth() const { return voxel_width_; }
+  // used in walking grid only
+  bool operator()(const Eigen::Vector3i &p, const Eigen::Vector3i &target, double in_length, double out_length,
+                  double max_length);
+
+private:
+  static const int kBlockShift = 3;  // 8 voxels wide
+  static const int kBlockWidth = 1 << kBlockShift;
+  static const int kBlockSize = kBlockWidth * kBlockWidth * kBlockWidth;
+
+  /// the stored voxel at @c inds before any priors, or nullptr if it is not allocated
+  inline DensityGrid::Voxel *rawVoxel(const Eigen::Vector3i &inds)
+  {
+    const int id = block_ids_[blockIndex(inds)];
+    return id < 0 ? nullptr : &voxels_[static_cast<size_t>(id) * kBlockSize + localIndex(inds)];
+  }
+  inline DensityGrid::Voxel raw(const Eigen::Vector3i &inds) const
+  {
+    if (!inBounds(inds))
+      return DensityGrid::Voxel();
+    const int id = block_ids_[blockIndex(inds)];
+    return id < 0 ? DensityGrid::Voxel() : voxels_[static_cast<size_t>(id) * kBlockSize + localIndex(inds)];
+  }
+  inline size_t blockIndex(const Eigen::Vector3i &inds) const
+  {
+    return static_cast<size_t>(inds[0] >> kBlockShift) +
+           static_cast<size_t>(inds[1] >> kBlockShift) * block_dims_[0] +
+           static_cast<size_t>(inds[2] >> kBlockShift) * block_dims_[0] * block_dims_[1];
+  }
+  inline int localIndex(const Eigen::Vector3i &inds) const
+  {
+    const int mask = kBlockWidth - 1;
+    return (inds[0] & mask) + ((inds[1] & mask) << kBlockShift) + ((inds[2] & mask) << (2 * kBlockShift));
+  }
+
+  Cuboid bounds_;
+  double voxel_width_;
+  Eigen::Vector3i voxel_dims_;
+  Eigen::Vector3i block_dims_;
+  std::vector<int> block_ids_;             // index into the blocks of voxels_ per block, or -1 when unallocated
+  std::vector<DensityGrid::Voxel> voxels_;  // the allocated blocks, kBlockSize voxels each
+  bool bounded_;
+};
+
 // inline functions
 double DensityGrid::Voxel::numerator() const
 {
@@ -0,0 +1,505 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raysort.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <limits>
+
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
+namespace ray
+{
+namespace
+{
+const std::string order_property = "property double order";
+const int kNumCellBits = 21;        // the rays are bucketed by cells of the key, with 2^21 cells in total
+const size_t kBlockRows = 65536;    // number of rows read from the input at a time
+const size_t kFlushRows = 1024;     // number of rows buffered per bucket before they are written
+
+/// The layout of the rows in a ray cloud .ply file
+struct PlyLayout
+{
+  std::vector<std::string> header;  // the header lines, without their line endings
+  size_t vertex_line = 0;           // the 'element vertex' line
+  size_t data_start = 0;            // position of the first row in the file
+  size_t row_size = 0;
+  uint64_t num_rows = 0;
+  int position_offset = -1;
+  bool position_is_float = false;
+  int order_offset = -1;
+  size_t order_line = 0;
+};
+
+bool readLayout(const std::string &file_name, PlyLayout &layout)
+{
+  std::ifstream input(file_name.c_str(), std::ios::in | std::ios::binary);
+  if (input.fail())
+  {
+    std::cerr << "Couldn't open file: " << file_name << std::endl;
+    return false;
+  }
+  std::string line;
+  bool has_vertices = false;
+  while (line != "end_header")
+  {
+    if (!getline(input, line))
+    {
+      std::cerr << "Error: could not find the end of the header in " << file_name << std::endl;
+      return false;
+    }
+    if (!line.empty() && line.back() == '\r')
+    {
+      line.pop_back();
+    }
+    if (line.find("format ascii") != std::string::npos)
+    {
+      std::cerr << "ASCII PLY not supported " << file_name << std::endl;
+      return false;
+    }
+    if (line.find("element") == 0)
+    {
+      if (has_vertices || line.find("element vertex") != 0)
+      {
+        std::cerr << "Error: only ray cloud files with a single vertex element can be sorted" << std::endl;
+        return false;
+      }
+      has_vertices = true;
+      layout.vertex_line = layout.header.size();
+    }
+    else if (line.find("property") == 0)
+    {
+      int size = 0;
+      if (line.find("property float") == 0)
+        size = 4;
+      else if (line.find("property double") == 0)
+        size = 8;
+      else if (line.find("property uchar") == 0 || line.find("property uint8") == 0)
+        size = 1;
+      else if (line.find("property ushort") == 0)
+        size = 2;
+      else if (line.find("property int") == 0)
+        size = 4;
+      else
+      {
+        std::cerr << "Error: unsupported property type: " << line << std::endl;
+        return false;
+      }
+      if (line == "property float x" || line == "property double x")
+      {
+        layout.position_offset = static_cast<int>(layout.row_size);
+        layout.position_is_float = size == 4;
+      }
+      if (line == order_property)
+      {
+        layout.order_offset = static_cast<int>(layout.row_size);
+        layout.order_line = layout.header.size();
+      }
+      layout.row_size += static_cast<size_t>(size);
+    }
+    layout.header.push_back(line);
+  }
+  if (layout.position_offset == -1)
+  {
+    std::cerr << "could not find position properties of file: " << file_name << std::endl;
+    return false;
+  }
+  layout.data_start = static_cast<size_t>(input.tellg());
+  input.seekg(0, input.end);
+  layout.num_rows = (static_cast<size_t>(input.tellg()) - layout.data_start) / layout.row_size;
+  return true;
+}
+
+/// write the header lines, with the vertex count in the zero-padded form of writeRayCloudChunkEnd()
+bool writeHeader(std::ofstream &out, const std::vector<std::string> &header, size_t vertex_line, uint64_t num_rows)
+{
+  std::string count(std::numeric_limits<unsigned long>::digits10, '0');
+  const std::string digits = std::to_string(num_rows);
+  count.replace(count.size() - std::min(count.size(), digits.size()), digits.size(), digits);
+  for (size_t i = 0; i < header.size(); i++)
+  {
+    out << (i == vertex_line ? "element vertex " + count : header[i]) << std::endl;
+  }
+  return out.good();
+}
+
+inline Eigen::Vector3d rowPosition(const uint8_t *row, const PlyLayout &layout)
+{
+  if (layout.position_is_float)
+  {
+    float pos[3];
+    std::memcpy(pos, row + layout.position_offset, sizeof(pos));
+    return Eigen::Vector3d(pos[0], pos[1], pos[2]);
+  }
+  double pos[3];
+  std::memcpy(pos, row + layout.position_offset, sizeof(pos));
+  return Eigen::Vector3d(pos[0], pos[1], pos[2]);
+}
+
+/// call @c process for each block of rows in the file, with the index of the first row in the block
+bool forEachBlock(const std::string &file_name, const PlyLayout &layout,
+                  const std::function<bool(const uint8_t *rows, size_t num_rows, uint64_t first_row)> &process)
+{
+  std::ifstream input(file_name.c_str(), std::ios::in | std::ios::binary);
+  input.seekg(layout.data_start);
+  std::vector<uint8_t> rows(kBlockRows * layout.row_size);
+  for (uint64_t first_row = 0; first_row < layout.num_rows; first_row += kBlockRows)
+  {
+    const size_t num_rows = static_cast<size_t>(std::min<uint64_t>(kBlockRows, layout.num_rows - first_row));
+    if (!input.read(reinterpret_cast<char *>(rows.data()), num_rows * layout.row_size))
+    {
+      std::cerr << "Error reading from " << file_name << std::endl;
+      return false;
+    }
+    if (!process(rows.data(), num_rows, first_row))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+/// The key of each row, in parallel
+void rowKeys(const uint8_t *rows, size_t num_rows, uint64_t first_row, size_t row_size,
+             const std::function<uint64_t(const uint8_t *row, uint64_t index)> &key, std::vector<uint64_t> &keys)
+{
+  keys.resize(num_rows);
+  auto get_key = [&](size_t i) { keys[i] = key(rows + i * row_size, first_row + i); };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, num_rows, get_key);
+#else
+  #pragma omp parallel for
+  for (int64_t i = 0; i < static_cast<int64_t>(num_rows); i++)
+  {
+    get_key(static_cast<size_t>(i));
+  }
+#endif  // RAYLIB_WITH_TBB
+}
+
+/// Write the rows of @c in_file_name to @c out_file_name in increasing order of their @c key, converting each one
+/// with @c convert_row. The rows are first distributed into a temporary file, in buckets of consecutive key cells (the
+/// key shifted right by @c cell_shift), each of up to around @c max_rows rows. Then each bucket is sorted in memory.
+/// Returns the keys of the sorted rows to @c check_keys, one bucket at a time
+bool sortRows(const std::string &in_file_name, const PlyLayout &layout, const std::string &out_file_name,
+              const std::vector<std::string> &out_header, size_t out_row_size,
+              const std::function<uint64_t(const uint8_t *row, uint64_t index)> &key, int cell_shift,
+              const std::function<void(const uint8_t *row, uint64_t index, uint8_t *out_row)> &convert_row,
+              size_t max_rows, const std::function<bool(const std::vector<uint64_t> &keys)> &check_keys)
+{
+  // 1. count the rows in each cell
+  const size_t num_cells = static_cast<size_t>(1) << kNumCellBits;
+  std::vector<uint64_t> cell_counts(num_cells, 0);
+  std::vector<uint64_t> keys;
+  bool success = forEachBlock(in_file_name, layout, [&](const uint8_t *rows, size_t num_rows, uint64_t first_row) {
+    rowKeys(rows, num_rows, first_row, layout.row_size, key, keys);
+    for (auto &row_key : keys)
+    {
+      cell_counts[static_cast<size_t>(row_key >> cell_shift)]++;
+    }
+    return true;
+  });
+  if (!success)
+  {
+    return false;
+  }
+
+  // 2. group consecutive cells into buckets. A single cell with more than max_rows rows is a bucket of its own
+  std::vector<uint32_t> cell_buckets(num_cells);
+  std::vector<uint64_t> bucket_starts(1, 0);  // first row of each bucket, followed by the total
+  uint64_t bucket_size = 0;
+  for (size_t i = 0; i < num_cells; i++)
+  {
+    if (bucket_size > 0 && bucket_size + cell_counts[i] > max_rows)
+    {
+      bucket_starts.push_back(bucket_starts.back() + bucket_size);
+      bucket_size = 0;
+    }
+    cell_buckets[i] = static_cast<uint32_t>(bucket_starts.size() - 1);
+    bucket_size += cell_counts[i];
+  }
+  bucket_starts.push_back(bucket_starts.back() + bucket_size);
+  const size_t num_buckets = bucket_starts.size() - 1;
+  cell_counts.clear();
+  cell_counts.shrink_to_fit();
+
+  // 3. distribute the rows, each prefixed by its key, into their buckets in the temporary file
+  const std::string temp_file_name = out_file_name + ".sorting";
+  const size_t temp_row_size = sizeof(uint64_t) + out_row_size;
+  {
+    std::ofstream temp(temp_file_name.c_str(), std::ios::binary | std::ios::out);
+    if (temp.fail())
+    {
+      std::cerr << "Error: cannot open " << temp_file_name << " for writing." << std::endl;
+      return false;
+    }
+    std::vector<uint64_t> bucket_ends = bucket_starts;  // rows written so far in each bucket
+    bucket_ends.pop_back();
+    std::vector<std::vector<uint8_t>> buffers(num_buckets);
+    auto flush = [&](size_t bucket) {
+      temp.seekp(static_cast<std::streamoff>(bucket_ends[bucket] * temp_row_size));
+      temp.write(reinterpret_cast<const char *>(buffers[bucket].data()), buffers[bucket].size());
+      bucket_ends[bucket] += buffers[bucket].size() / temp_row_size;
+      buffers[bucket].clear();
+    };
+    success = forEachBlock(in_file_name, layout, [&](const uint8_t *rows, size_t num_rows, uint64_t first_row) {
+      rowKeys(rows, num_rows, first_row, layout.row_size, key, keys);
+      for (size_t i = 0; i < num_rows; i++)
+      {
+        const size_t bucket = cell_buckets[static_cast<size_t>(keys[i] >> cell_shift)];
+        std::vector<uint8_t> &buffer = buffers[bucket];
+        buffer.resize(buffer.size() + temp_row_size);
+        uint8_t *temp_row = &buffer[buffer.size() - temp_row_size];
+        std::memcpy(temp_row, &keys[i], sizeof(uint64_t));
+        convert_row(rows + i * layout.row_size, first_row + i, temp_row + sizeof(uint64_t));
+        if (buffer.size() >= kFlushRows * temp_row_size)
+        {
+          flush(bucket);
+        }
+      }
+      return temp.good();
+    });
+    for (size_t bucket = 0; bucket < num_buckets; bucket++)
+    {
+      flush(bucket);
+    }
+    if (!success || !temp.good())
+    {
+      std::cerr << "Error writing to file " << temp_file_name << std::endl;
+      std::remove(temp_file_name.c_str());
+      return false;
+    }
+  }
+
+  // 4. sort each bucket in memory, and append it to the output
+  std::ifstream temp(temp_file_name.c_str(), std::ios::binary | std::ios::in);
+  std::ofstream out(out_file_name.c_str(), std::ios::binary | std::ios::out);
+  if (out.fail())
+  {
+    std::cerr << "Error: cannot open " << out_file_name << " for writing." << std::endl;
+    std::remove(temp_file_name.c_str());
+    return false;
+  }
+  success = writeHeader(out, out_header, layout.vertex_line, layout.num_rows);
+  std::vector<uint8_t> bucket_rows, sorted_rows;
+  std::vector<std::pair<uint64_t, size_t>> order;
+  for (size_t bucket = 0; bucket < num_buckets && success; bucket++)
+  {
+    const size_t num_rows = static_cast<size_t>(bucket_starts[bucket + 1] - bucket_starts[bucket]);
+    bucket_rows.resize(num_rows * temp_row_size);
+    if (!temp.read(reinterpret_cast<char *>(bucket_rows.data()), bucket_rows.size()))
+    {
+      std::cerr << "Error reading from " << temp_file_name << std::endl;
+      success = false;
+      break;
+    }
+    // sorting by key then position keeps rows with the same key in their input order
+    order.resize(num_rows);
+    for (size_t i = 0; i < num_rows; i++)
+    {
+      std::memcpy(&order[i].first, &bucket_rows[i * temp_row_size], sizeof(uint64_t));
+      order[i].second = i;
+    }
+    std::sort(order.begin(), order.end());
+    sorted_rows.resize(num_rows * out_row_size);
+    keys.resize(num_rows);
+    for (size_t i = 0; i < num_rows; i++)
+    {
+      keys[i] = order[i].first;
+      std::memcpy(&sorted_rows[i * out_row_size], &bucket_rows[order[i].second * temp_row_size + sizeof(uint64_t)],
+                  out_row_size);
+    }
+    success = check_keys(keys);
+    out.write(reinterpret_cast<const char *>(sorted_rows.data()), sorted_rows.size());
+    success &= out.good();
+  }
+  temp.close();
+  std::remove(temp_file_name.c_str());
+  if (!success)
+  {
+    std::cerr << "Error writing to file " << out_file_name << std::endl;
+    return false;
+  }
+  std::cout << layout.num_rows << " rays sorted in " << num_buckets << " chunks and saved to " << out_file_name
+            << std::endl;
+  return true;
+}
+}  // namespace
+
+bool sortCloudSpatially(const std::string &in_file_name, const std::string &out_file_name, size_t max_rays_in_memory)
+{
+  PlyLayout layout;
+  if (!readLayout(in_file_name, layout))
+  {
+    return false;
+  }
+
+  // the Morton codes are relative to the bounds of the end points, the same as the in-memory sort. The ray bounds in
+  // the statistics sidecar also include the start points, so would give a different order
+  Eigen::Vector3d min_bound = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+  Eigen::Vector3d max_bound = Eigen::Vector3d::Constant(std::numeric_limits<double>::lowest());
+  const bool bounded = forEachBlock(in_file_name, layout, [&](const uint8_t *rows, size_t num_rows, uint64_t) {
+    for (size_t i = 0; i < num_rows; i++)
+    {
+      const Eigen::Vector3d pos = rowPosition(rows + i * layout.row_size, layout);
+      if (pos == pos)  // not nan
+      {
+        min_bound = minVector<Eigen::Vector3d>(min_bound, pos);
+        max_bound = maxVector<Eigen::Vector3d>(max_bound, pos);
+      }
+    }
+    return true;
+  });
+  if (!bounded)
+  {
+    return false;
+  }
+  const double max_extent = std::max(1e-10, (max_bound - min_bound).maxCoeff());
+  const double scale = static_cast<double>((1 << kMortonBits) - 1) / max_extent;
+
+  std::vector<std::string> out_header = layout.header;
+  size_t out_row_size = layout.row_size;
+  const bool add_order = layout.order_offset == -1;
+  if (add_order)
+  {
+    out_header.insert(out_header.end() - 1, order_property);  // before end_header
+    out_row_size += sizeof(double);
+  }
+  const size_t row_size = layout.row_size;
+  auto key = [&](const uint8_t *row, uint64_t) {
+    const Eigen::Vector3d pos = rowPosition(row, layout);
+    return pos == pos ? mortonCode(pos, min_bound, scale) : std::numeric_limits<uint64_t>::max();
+  };
+  auto convert_row = [&](const uint8_t *row, uint64_t index, uint8_t *out_row) {
+    std::memcpy(out_row, row, row_size);
+    if (add_order)
+    {
+      const double order = static_cast<double>(index);
+      std::memcpy(out_row + row_size, &order, sizeof(double));
+    }
+  };
+  const int cell_shift = 3 * kMortonBits - kNumCellBits;
+  return sortRows(in_file_name, layout, out_file_name, out_header, out_row_size, key, cell_shift, convert_row,
+                  max_rays_in_memory, [](const std::vector<uint64_t> &) { return true; });
+}
+
+bool restoreCloudOrder(const std::string &in_file_name, const std::string &out_file_name, size_t max_rays_in_memory)
+{
+  PlyLayout layout;
+  if (!readLayout(in_file_name, layout))
+  {
+    return false;
+  }
+  if (layout.order_offset == -1)
+  {
+    std::cerr << "Error: " << in_file_name << " has no order property, it needs to be sorted with raysort"
+              << std::endl;
+    return false;
+  }
+  std::vector<std::string> out_header = layout.header;
+  out_header.erase(out_header.begin() + layout.order_line);
+  const size_t order_offset = static_cast<size_t>(layout.order_offset);
+  const size_t out_row_size = layout.row_size - sizeof(double);
+
+  const uint64_t num_rows = layout.num_rows;
+  auto key = [&](const uint8_t *row, uint64_t) {
+    double order;
+    std::memcpy(&order, row + order_offset, sizeof(double));
+    // invalid orders are placed at the end, and reported by check_keys
+    return order >= 0.0 && order < static_cast<double>(num_rows) ? static_cast<uint64_t>(order) : num_rows;
+  };
+  auto convert_row = [&](const uint8_t *row, uint64_t, uint8_t *out_row) {
+    std::memcpy(out_row, row, order_offset);
+    std::memcpy(out_row + order_offset, row + order_offset + sizeof(double), out_row_size - order_offset);
+  };
+  int cell_shift = 0;
+  while ((num_rows >> cell_shift) >= (static_cast<uint64_t>(1) << kNumCellBits))
+  {
+    cell_shift++;
+  }
+  // the orders of the restored rays should count up from 0
+  uint64_t next_order = 0;
+  auto check_keys = [&](const std::vector<uint64_t> &keys) {
+    for (auto &order : keys)
+    {
+      if (order != next_order++)
+      {
+        std::cerr << "Error: the order property of " << in_file_name << " is not a list of the ray indices"
+                  << std::endl;
+        return false;
+      }
+    }
+    return true;
+  };
+  return sortRows(in_file_name, layout, out_file_name, out_header, out_row_size, key, cell_shift, convert_row,
+                  max_rays_in_memory, check_keys);
+}
+
+namespace
+{
+/// Rearrange the rays of @c cloud so that ray i moves to index @c destination(i)
+template <class DestinationFunc>
+void permuteRays(Cloud &cloud, const DestinationFunc &destination)
+{
+  Cloud permuted;
+  permuted.resize(cloud.rayCount());
+  for (size_t i = 0; i < cloud.rayCount(); i++)
+  {
+    const size_t j = destination(i);
+    permuted.starts[j] = cloud.starts[i];
+    permuted.ends[j] = cloud.ends[i];
+    permuted.times[j] = cloud.times[i];
+    permuted.colours[j] = cloud.colours[i];
+  }
+  std::swap(cloud.starts, permuted.starts);
+  std::swap(cloud.ends, permuted.ends);
+  std::swap(cloud.times, permuted.times);
+  std::swap(cloud.colours, permuted.colours);
+}
+}  // namespace
+
+void sortCloudSpatially(Cloud &cloud, std::vector<size_t> &order)
+{
+  Eigen::Vector3d min_bound = Eigen::Vector3d::Constant(std::numeric_limits<double>::max());
+  Eigen::Vector3d max_bound = Eigen::Vector3d::Constant(std::numeric_limits<double>::lowest());
+  for (const auto &pos : cloud.ends)
+  {
+    if (pos == pos)  // not nan
+    {
+      min_bound = minVector<Eigen::Vector3d>(min_bound, pos);
+      max_bound = maxVector<Eigen::Vector3d>(max_bound, pos);
+    }
+  }
+  const double max_extent = std::max(1e-10, (max_bound - min_bound).maxCoeff());
+  const double scale = static_cast<double>((1 << kMortonBits) - 1) / max_extent;
+  // the index breaks ties, so the sort matches the stable file sort
+  std::vector<std::pair<uint64_t, size_t>> codes(cloud.rayCount());
+  for (size_t i = 0; i < codes.size(); i++)
+  {
+    const Eigen::Vector3d &pos = cloud.ends[i];
+    codes[i].first = pos == pos ? mortonCode(pos, min_bound, scale) : std::numeric_limits<uint64_t>::max();
+    codes[i].second = i;
+  }
+  std::sort(codes.begin(), codes.end());
+  order.resize(codes.size());
+  std::vector<size_t> destination(codes.size());
+  for (size_t i = 0; i < codes.size(); i++)
+  {
+    order[i] = codes[i].second;
+    destination[codes[i].second] = i;
+  }
+  permuteRays(cloud, [&](size_t i) { return destination[i]; });
+}
+
+void restoreCloudOrder(Cloud &cloud, const std::vector<size_t> &order)
+{
+  permuteRays(cloud, [&](size_t i) { return order[i]; });
+}
+
+}  // namespace ray
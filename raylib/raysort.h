@@ -0,0 +1,40 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYSORT_H
+#define RAYLIB_RAYSORT_H
+
+#include "raylib/raylibconfig.h"
+#include "raycloud.h"
+#include "rayutils.h"
+
+namespace ray
+{
+/// Out of core sorting of ray cloud files, so clouds larger than memory can be rearranged. The rays are copied
+/// unchanged, with every property kept at its stored precision.
+
+/// Rewrite the ray cloud @c in_file_name to @c out_file_name, with its rays in Morton (Z-curve) order of their end
+/// points. Nearby rays are then close together in the file, which improves the memory locality of neighbourhood
+/// searches. The sort is done in chunks of whole octree cells of up to around @c max_rays_in_memory rays each.
+/// A double precision 'order' property is appended to each ray, holding its index in the input file, so that the
+/// order can be recovered with restoreCloudOrder(). A cloud that already has this property keeps it unchanged
+bool RAYLIB_EXPORT sortCloudSpatially(const std::string &in_file_name, const std::string &out_file_name,
+                                      size_t max_rays_in_memory = 8000000);
+
+/// Rewrite the sorted ray cloud @c in_file_name to @c out_file_name in the order of its 'order' property, removing
+/// the property, which restores the cloud that was passed to sortCloudSpatially()
+bool RAYLIB_EXPORT restoreCloudOrder(const std::string &in_file_name, const std::string &out_file_name,
+                                     size_t max_rays_in_memory = 8000000);
+
+/// Reorder the rays of the in-memory @c cloud into the same Morton order of their end points as sortCloudSpatially(),
+/// so that tools that search neighbourhoods, such as Cloud::getSurfels(), can opt in to the better memory locality
+/// without sorting the file. @c order receives the original index of each ray, for restoreCloudOrder()
+void RAYLIB_EXPORT sortCloudSpatially(Cloud &cloud, std::vector<size_t> &order);
+
+/// Put the rays of @c cloud back in the order they had before sortCloudSpatially() gave the @c order
+void RAYLIB_EXPORT restoreCloudOrder(Cloud &cloud, const std::vector<size_t> &order);
+}  // namespace ray
+
+#endif  // RAYLIB_RAYSORT_H
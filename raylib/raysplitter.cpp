@@ -8,6 +8,7 @@
 #include <limits>
 #include <map>
 #include "extraction/rayforest.h"
+#include "raycloudstream.h"
 #include "raycloudwriter.h"
 #include "raycuboid.h"
 #include "extraction/raytrees.h"
@@ -19,276 +20,210 @@ namespace ray
 bool split(const std::string &file_name, const std::string &in_name, const std::string &out_name,
            std::function<bool(const Cloud &cloud, int i)> is_outside)
 {
-  Cloud cloud_buffer;
-  CloudWriter in_writer, out_writer;
-  if (!in_writer.begin(in_name))
-    return false;
-  if (!out_writer.begin(out_name))
-    return false;
-  Cloud in_chunk, out_chunk;
-
-  /// move each ray into either the in_chunk or out_chunk, depending on the condition function is_outside
-  auto per_chunk = [&cloud_buffer, &in_writer, &out_writer, &in_chunk, &out_chunk, &is_outside](
-                     std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
-                     std::vector<double> &times, std::vector<RGBA> &colours) {
-    // I move these into the cloud buffer, so that they can be indexed easily in is_outside (by index).
-    cloud_buffer.starts = starts;
-    cloud_buffer.ends = ends;
-    cloud_buffer.times = times;
-    cloud_buffer.colours = colours;
-
-    for (int i = 0; i < (int)cloud_buffer.ends.size(); i++)
-    {
-      Cloud &cloud = is_outside(cloud_buffer, i) ? out_chunk : in_chunk;
-      cloud.addRay(cloud_buffer.starts[i], cloud_buffer.ends[i], cloud_buffer.times[i], cloud_buffer.colours[i]);
-    }
-    in_writer.writeChunk(in_chunk);
-    out_writer.writeChunk(out_chunk);
-    in_chunk.clear();
-    out_chunk.clear();
-  };
-  if (!Cloud::read(file_name, per_chunk))
-    return false;
-  in_writer.end();
-  out_writer.end();
-  return true;
+  Cloud ray_buffer;  // a single ray, so that is_outside can index it
+  ray_buffer.resize(1);
+  CloudStream stream;
+  CloudStream &outside = stream.split([&](const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time,
+                                          const RGBA &colour) {
+    ray_buffer.starts[0] = start;
+    ray_buffer.ends[0] = end;
+    ray_buffer.times[0] = time;
+    ray_buffer.colours[0] = colour;
+    return is_outside(ray_buffer, 0);
+  });
+  stream.write(in_name);
+  outside.write(out_name);
+  return stream.run(file_name);
 }
 
-/// Special case for splitting around a plane.
-bool splitPlane(const std::string &file_name, const std::string &in_name, const std::string &out_name,
-                const Eigen::Vector3d &plane)
+void splitRayPlane(const Eigen::Vector3d &plane, const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time,
+                   const RGBA &colour, Cloud &inside, Cloud &outside)
 {
-  CloudWriter inside_writer, outside_writer;
-  if (!inside_writer.begin(in_name))
-    return false;
-  if (!outside_writer.begin(out_name))
-    return false;
-  Cloud in_chunk, out_chunk;
-
-  // the split operation
-  auto per_chunk = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
-                       std::vector<double> &times, std::vector<RGBA> &colours) {
-    const Eigen::Vector3d plane_vec = plane / plane.dot(plane);
-    for (size_t i = 0; i < ends.size(); i++)
+  const Eigen::Vector3d plane_vec = plane / plane.dot(plane);
+  const double d1 = start.dot(plane_vec) - 1.0;
+  const double d2 = end.dot(plane_vec) - 1.0;
+  if (d1 * d2 > 0.0)  // start and end are on the same side of the plane, so don't split...
+  {
+    Cloud &chunk = d1 > 0.0 ? outside : inside;
+    chunk.addRay(start, end, time, colour);
+  }
+  else  // split the ray...
+  {
+    RGBA col = colour;
+    col.red = col.green = col.blue = col.alpha = 0;
+    const Eigen::Vector3d mid = start + (end - start) * d1 / (d1 - d2);
+    if (d1 > 0.0)
     {
-      const double d1 = starts[i].dot(plane_vec) - 1.0;
-      const double d2 = ends[i].dot(plane_vec) - 1.0;
-      if (d1 * d2 > 0.0)  // start and end are on the same side of the plane, so don't split...
-      {
-        Cloud &chunk = d1 > 0.0 ? out_chunk : in_chunk;
-        chunk.addRay(starts[i], ends[i], times[i], colours[i]);
-      }
-      else  // split the ray...
-      {
-        RGBA col = colours[i];
-        col.red = col.green = col.blue = col.alpha = 0;
-        const Eigen::Vector3d mid = starts[i] + (ends[i] - starts[i]) * d1 / (d1 - d2);
-        if (d1 > 0.0)
-        {
-          out_chunk.addRay(starts[i], mid, times[i], col);
-          in_chunk.addRay(mid, ends[i], times[i], colours[i]);
-        }
-        else
-        {
-          in_chunk.addRay(starts[i], mid, times[i], col);
-          out_chunk.addRay(mid, ends[i], times[i], colours[i]);
-        }
-      }
+      outside.addRay(start, mid, time, col);
+      inside.addRay(mid, end, time, colour);
     }
-    inside_writer.writeChunk(in_chunk);
-    outside_writer.writeChunk(out_chunk);
-    in_chunk.clear();
-    out_chunk.clear();
-  };
-  if (!readPly(file_name, true, per_chunk, 0))
-    return false;
-
-  inside_writer.end();
-  outside_writer.end();
-  return true;
+    else
+    {
+      inside.addRay(start, mid, time, col);
+      outside.addRay(mid, end, time, colour);
+    }
+  }
 }
 
-/// Special case for splitting a capsule.
-bool splitCapsule(const std::string &file_name, const std::string &in_name, const std::string &out_name,
-                  const Eigen::Vector3d &end1, const Eigen::Vector3d &end2, double radius)
+void splitRayCapsule(const Eigen::Vector3d &end1, const Eigen::Vector3d &end2, double radius,
+                     const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time, const RGBA &colour,
+                     Cloud &inside, Cloud &outside)
 {
-  CloudWriter inside_writer, outside_writer;
-  if (!inside_writer.begin(in_name))
-    return false;
-  if (!outside_writer.begin(out_name))
-    return false;
-  Cloud in_chunk, out_chunk;
-
   Eigen::Vector3d dir = end2 - end1;
   double length = dir.norm();
   if (length > 0.0)
   {
     dir /= length;
   }
-
-  // splitting per chunk
-  auto per_chunk = [&end1, &end2, &dir, &length, &radius, &in_chunk, &out_chunk, &inside_writer, &outside_writer](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
-                       std::vector<double> &times, std::vector<RGBA> &colours) {
-    for (size_t i = 0; i < ends.size(); i++)
+  Eigen::Vector3d ray = end - start;
+  // The approach is to find the d value (ratio along ray) for the first and second intersection with 
+  // the capsule. This can be found by breaking it into a cylinder and two spheres, and
+  // a few min/maxs.
+
+  // cylinder part:
+  double cylinder_intersection1 = 1e10;
+  double cylinder_intersection2 = -1e10;
+  Eigen::Vector3d up = dir.cross(ray);
+  double mag = up.norm();
+  if (mag > 0.0) // two rays are not inline
+  {
+    up /= mag;
+    double gap = std::abs((start - end1).dot(up));
+    if (gap >= radius)
+    {
+      outside.addRay(start, end, time, colour);
+      return; // if it doesn't hit the endless cylinder it won't hit the capsule
+    }
+    Eigen::Vector3d lateral_dir = ray - dir * ray.dot(dir);
+    double lateral_length = lateral_dir.norm();
+    double d_mid = (end1 - start).dot(lateral_dir) / ray.dot(lateral_dir);
+    
+    double shift = std::sqrt(radius*radius - gap*gap) / lateral_length;
+    double d_min = d_mid - shift;
+    double d_max = d_mid + shift;
+    double d1 = (start + ray*d_min - end1).dot(dir) / length;
+    double d2 = (start + ray*d_max - end1).dot(dir) / length;
+    if (d1 > 0.0 && d1 < 1.0)
+    {
+      cylinder_intersection1 = d_min;
+    }
+    if (d2 > 0.0 && d2 < 1.0)
     {
-      Eigen::Vector3d start = starts[i];
-      Eigen::Vector3d end = ends[i];
-      Eigen::Vector3d ray = end - start;
-      // The approach is to find the d value (ratio along ray) for the first and second intersection with 
-      // the capsule. This can be found by breaking it into a cylinder and two spheres, and
-      // a few min/maxs.
+      cylinder_intersection2 = d_max;
+    }
+  }
 
-      // cylinder part:
-      double cylinder_intersection1 = 1e10;
-      double cylinder_intersection2 = -1e10;
-      Eigen::Vector3d up = dir.cross(ray);
-      double mag = up.norm();
-      if (mag > 0.0) // two rays are not inline
-      {
-        up /= mag;
-        double gap = std::abs((start - end1).dot(up));
-        if (gap >= radius)
-        {
-          out_chunk.addRay(start, end, times[i], colours[i]);
-          continue; // if it doesn't hit the endless cylinder it won't hit the capsule
-        }
-        Eigen::Vector3d lateral_dir = ray - dir * ray.dot(dir);
-        double lateral_length = lateral_dir.norm();
-        double d_mid = (end1 - start).dot(lateral_dir) / ray.dot(lateral_dir);
-        
-        double shift = std::sqrt(radius*radius - gap*gap) / lateral_length;
-        double d_min = d_mid - shift;
-        double d_max = d_mid + shift;
-        double d1 = (start + ray*d_min - end1).dot(dir) / length;
-        double d2 = (start + ray*d_max - end1).dot(dir) / length;
-        if (d1 > 0.0 && d1 < 1.0)
-        {
-          cylinder_intersection1 = d_min;
-        }
-        if (d2 > 0.0 && d2 < 1.0)
-        {
-          cylinder_intersection2 = d_max;
-        }
-      }
+  // the spheres part:
+  double ray_length = ray.norm();
+  double sphere_intersection1[2] = {1e10, 1e10};
+  double sphere_intersection2[2] = {-1e10, -1e10};
+  Eigen::Vector3d ends[2] = {end1, end2};
+  for (int e = 0; e<2; e++)
+  {
+    double mid_d = (ends[e] - start).dot(ray) / (ray_length * ray_length);
+    Eigen::Vector3d shortest_dir = (ends[e] - start) - ray * mid_d;
+    double shortest_sqr = shortest_dir.squaredNorm();
+    if (shortest_sqr < radius*radius)
+    {
+      double shift = std::sqrt(radius * radius - shortest_sqr) / ray_length;
+      sphere_intersection1[e] = mid_d - shift;
+      sphere_intersection2[e] = mid_d + shift;
+    }
+  }
 
-      // the spheres part:
-      double ray_length = ray.norm();
-      double sphere_intersection1[2] = {1e10, 1e10};
-      double sphere_intersection2[2] = {-1e10, -1e10};
-      Eigen::Vector3d ends[2] = {end1, end2};
-      for (int e = 0; e<2; e++)
-      {
-        double mid_d = (ends[e] - start).dot(ray) / (ray_length * ray_length);
-        Eigen::Vector3d shortest_dir = (ends[e] - start) - ray * mid_d;
-        double shortest_sqr = shortest_dir.squaredNorm();
-        if (shortest_sqr < radius*radius)
-        {
-          double shift = std::sqrt(radius * radius - shortest_sqr) / ray_length;
-          sphere_intersection1[e] = mid_d - shift;
-          sphere_intersection2[e] = mid_d + shift;
-        }
-      }
+  // combining together
+  double closest_d = std::min( {cylinder_intersection1, sphere_intersection1[0], sphere_intersection1[1]} );
+  double farthest_d = std::max( {cylinder_intersection2, sphere_intersection2[0], sphere_intersection2[1]} );
 
-      // combining together
-      double closest_d = std::min( {cylinder_intersection1, sphere_intersection1[0], sphere_intersection1[1]} );
-      double farthest_d = std::max( {cylinder_intersection2, sphere_intersection2[0], sphere_intersection2[1]} );
+  RGBA black;
+  black.red = black.green = black.blue = black.alpha = 0;
+  // easy case
+  if (closest_d >= 1.0 || farthest_d <= 0.0)
+  {
+    outside.addRay(start, end, time, colour);
+    return;
+  }
+  // first outside ray
+  if (closest_d > 0.0)
+  {
+    outside.addRay(start, start + ray*closest_d, time, black);
+  }
+  // second outside ray
+  if (farthest_d < 1.0)
+  {
+    outside.addRay(start + ray * farthest_d, end, time, colour);
+  }
+  // inside ray
+  if (farthest_d < 1.0)
+  {
+    inside.addRay(start + ray * std::max(0.0, closest_d), start + ray*std::min(farthest_d, 1.0), time, black);
+  }
+  else
+  {
+    inside.addRay(start + ray * std::max(0.0, closest_d), end, time, colour);
+  }
+}
 
-      RGBA black;
-      black.red = black.green = black.blue = black.alpha = 0;
-      // easy case
-      if (closest_d >= 1.0 || farthest_d <= 0.0)
-      {
-        out_chunk.addRay(start, end, times[i], colours[i]);
-        continue;
-      }
-      // first outside ray
-      if (closest_d > 0.0)
-      {
-        out_chunk.addRay(start, start + ray*closest_d, times[i], black);
-      }
-      // second outside ray
-      if (farthest_d < 1.0)
-      {
-        out_chunk.addRay(start + ray * farthest_d, end, times[i], colours[i]);
-      }
-      // inside ray
-      if (farthest_d < 1.0)
-      {
-        in_chunk.addRay(start + ray * std::max(0.0, closest_d), start + ray*std::min(farthest_d, 1.0), times[i], black);
-      }
-      else
-      {
-        in_chunk.addRay(start + ray * std::max(0.0, closest_d), end, times[i], colours[i]);
-      }
+void splitRayBox(const Cuboid &cuboid, const Eigen::Vector3d &ray_start, const Eigen::Vector3d &ray_end, double time,
+                 const RGBA &colour, Cloud &inside, Cloud &outside)
+{
+  Eigen::Vector3d start = ray_start;
+  Eigen::Vector3d end = ray_end;
+  if (cuboid.clipRay(start, end))  // true if ray intersects the cuboid
+  {
+    RGBA col = colour;
+    if (!cuboid.intersects(ray_end))  // mark as unbounded for the inside
+    {
+      col.red = col.green = col.blue = col.alpha = 0;
     }
-    inside_writer.writeChunk(in_chunk);
-    outside_writer.writeChunk(out_chunk);
-    in_chunk.clear();
-    out_chunk.clear();
-  };
-  if (!readPly(file_name, true, per_chunk, 0))
-    return false;
+    inside.addRay(start, end, time, col);
+    if (start != ray_start)  // start part is clipped
+    {
+      col.red = col.green = col.blue = col.alpha = 0;
+      outside.addRay(ray_start, start, time, col);
+    }
+    if (ray_end != end)  // end part is clipped
+    {
+      outside.addRay(end, ray_end, time, colour);
+    }
+  }
+  else  // no intersection
+  {
+    outside.addRay(ray_start, ray_end, time, colour);
+  }
+}
 
-  inside_writer.end();
-  outside_writer.end();
-  return true;
+/// Special case for splitting around a plane.
+bool splitPlane(const std::string &file_name, const std::string &in_name, const std::string &out_name,
+                const Eigen::Vector3d &plane)
+{
+  CloudStream stream;
+  CloudStream &outside = stream.splitPlane(plane);
+  stream.write(in_name);
+  outside.write(out_name);
+  return stream.run(file_name);
 }
 
+/// Special case for splitting a capsule.
+bool splitCapsule(const std::string &file_name, const std::string &in_name, const std::string &out_name,
+                  const Eigen::Vector3d &end1, const Eigen::Vector3d &end2, double radius)
+{
+  CloudStream stream;
+  CloudStream &outside = stream.splitCapsule(end1, end2, radius);
+  stream.write(in_name);
+  outside.write(out_name);
+  return stream.run(file_name);
+}
 
 /// Special case for splitting a box.
 bool splitBox(const std::string &file_name, const std::string &in_name, const std::string &out_name,
               const Eigen::Vector3d &centre, const Eigen::Vector3d &extents)
 {
-  CloudWriter inside_writer, outside_writer;
-  if (!inside_writer.begin(in_name))
-    return false;
-  if (!outside_writer.begin(out_name))
-    return false;
-  Cloud in_chunk, out_chunk;
-
-  // splitting per chunk
-  auto per_chunk = [&](std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends,
-                       std::vector<double> &times, std::vector<RGBA> &colours) {
-    // I move these into the cloud buffer, so that they can be indexed easily in fptr (by index).
-    const Cuboid cuboid(centre - extents, centre + extents);
-    for (size_t i = 0; i < ends.size(); i++)
-    {
-      Eigen::Vector3d start = starts[i];
-      Eigen::Vector3d end = ends[i];
-      if (cuboid.clipRay(start, end))  // true if ray intersects the cuboid
-      {
-        RGBA col = colours[i];
-        if (!cuboid.intersects(ends[i]))  // mark as unbounded for the in_chunk
-        {
-          col.red = col.green = col.blue = col.alpha = 0;
-        }
-        in_chunk.addRay(start, end, times[i], col);
-        if (start != starts[i])  // start part is clipped
-        {
-          col.red = col.green = col.blue = col.alpha = 0;
-          out_chunk.addRay(starts[i], start, times[i], col);
-        }
-        if (ends[i] != end)  // end part is clipped
-        {
-          out_chunk.addRay(end, ends[i], times[i], colours[i]);
-        }
-      }
-      else  // no intersection
-      {
-        out_chunk.addRay(starts[i], ends[i], times[i], colours[i]);
-      }
-    }
-    inside_writer.writeChunk(in_chunk);
-    outside_writer.writeChunk(out_chunk);
-    in_chunk.clear();
-    out_chunk.clear();
-  };
-  if (!readPly(file_name, true, per_chunk, 0))
-    return false;
-
-  inside_writer.end();
-  outside_writer.end();
-  return true;
+  CloudStream stream;
+  CloudStream &outside = stream.splitBox(centre, extents);
+  stream.write(in_name);
+  outside.write(out_name);
+  return stream.run(file_name);
 }
 
 /// Special case for splitting based on a grid.
@@ -305,7 +240,7 @@ bool splitGrid(const std::string &file_name, const std::string &cloud_name_stub,
 {
   overlap /= 2.0;  // it now means overlap relative to grid edge
   Cloud::Info info;
-  Cloud::getInfo(cloud_name_stub + ".ply", info);
+  Cloud::getInfo(file_name, info);
   const Eigen::Vector3d &min_bound = info.rays_bound.min_bound_;
   const Eigen::Vector3d &max_bound = info.rays_bound.max_bound_;
 
@@ -9,6 +9,7 @@
 #include <iostream>
 #include <limits>
 #include "raycloud.h"
+#include "raycuboid.h"
 #include "rayutils.h"
 
 namespace ray
@@ -50,6 +51,17 @@ bool RAYLIB_EXPORT splitColour(const std::string &file_name, const std::string &
 bool splitCapsule(const std::string &file_name, const std::string &in_name, const std::string &out_name,
                   const Eigen::Vector3d &end1, const Eigen::Vector3d &end2, double radius);
 
+/// Per-ray versions of splitPlane, splitBox and splitCapsule, as used by the CloudStream split nodes. Each adds the
+/// parts of the ray from @c start to @c end that are inside the shape to @c inside, and the remainder to @c outside
+void RAYLIB_EXPORT splitRayPlane(const Eigen::Vector3d &plane, const Eigen::Vector3d &start,
+                                 const Eigen::Vector3d &end, double time, const RGBA &colour, Cloud &inside,
+                                 Cloud &outside);
+void RAYLIB_EXPORT splitRayBox(const Cuboid &cuboid, const Eigen::Vector3d &start, const Eigen::Vector3d &end,
+                               double time, const RGBA &colour, Cloud &inside, Cloud &outside);
+void RAYLIB_EXPORT splitRayCapsule(const Eigen::Vector3d &end1, const Eigen::Vector3d &end2, double radius,
+                                   const Eigen::Vector3d &start, const Eigen::Vector3d &end, double time,
+                                   const RGBA &colour, Cloud &inside, Cloud &outside);
+
 
 }  // namespace ray
 
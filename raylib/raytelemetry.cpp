@@ -0,0 +1,212 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raytelemetry.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <mutex>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define RAYLIB_TELEMETRY_RUSAGE 1
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+namespace ray
+{
+namespace
+{
+/// The shared output of all telemetry. This is initialised from the environment on first use
+struct TelemetrySink
+{
+  TelemetrySink()
+    : file(nullptr)
+    , owns_file(false)
+  {
+    const char *target = std::getenv("RAYCLOUD_TELEMETRY");
+    if (target && target[0] != '\0')
+    {
+      open(target);
+    }
+  }
+  ~TelemetrySink() { close(); }
+
+  bool open(const std::string &target)
+  {
+    close();
+    if (target.compare(0, 3, "fd:") == 0)
+    {
+#if RAYLIB_TELEMETRY_RUSAGE
+      const int fd = std::atoi(target.c_str() + 3);
+      file = fdopen(dup(fd), "a");
+#endif
+    }
+    else
+    {
+      file = std::fopen(target.c_str(), "a");
+    }
+    if (!file)
+    {
+      std::cerr << "Warning: cannot open telemetry output " << target << std::endl;
+      return false;
+    }
+    owns_file = true;
+    return true;
+  }
+  void close()
+  {
+    if (file && owns_file)
+    {
+      std::fclose(file.load());
+    }
+    file = nullptr;
+    owns_file = false;
+  }
+
+  std::mutex mutex;
+  std::atomic<FILE *> file;  // atomic so that enabled() can be checked without locking
+  bool owns_file;
+};
+
+TelemetrySink &sink()
+{
+  static TelemetrySink telemetry_sink;
+  return telemetry_sink;
+}
+
+/// write a JSON string, escaping the characters that would break the line
+void writeJsonString(FILE *file, const std::string &text)
+{
+  std::fputc('"', file);
+  for (auto &c : text)
+  {
+    if (c == '"' || c == '\\')
+    {
+      std::fputc('\\', file);
+      std::fputc(c, file);
+    }
+    else if (static_cast<unsigned char>(c) < 0x20)
+    {
+      std::fprintf(file, "\\u%04x", static_cast<unsigned>(c));
+    }
+    else
+    {
+      std::fputc(c, file);
+    }
+  }
+  std::fputc('"', file);
+}
+}  // namespace
+
+bool Telemetry::enabled()
+{
+  return sink().file != nullptr;
+}
+
+bool Telemetry::open(const std::string &target)
+{
+  TelemetrySink &telemetry_sink = sink();
+  std::unique_lock<std::mutex> lock(telemetry_sink.mutex);
+  return telemetry_sink.open(target);
+}
+
+void Telemetry::close()
+{
+  TelemetrySink &telemetry_sink = sink();
+  std::unique_lock<std::mutex> lock(telemetry_sink.mutex);
+  telemetry_sink.close();
+}
+
+void Telemetry::write(const std::string &phase, double wall_seconds, double cpu_seconds, size_t rays, size_t bytes,
+                      size_t items)
+{
+  TelemetrySink &telemetry_sink = sink();
+  const double peak_rss = peakRssMegabytes();
+  std::unique_lock<std::mutex> lock(telemetry_sink.mutex);
+  FILE *file = telemetry_sink.file;
+  if (!file)
+  {
+    return;
+  }
+  const double rate_scale = wall_seconds > 0.0 ? 1.0 / wall_seconds : 0.0;
+  std::fputs("{\"phase\":", file);
+  writeJsonString(file, phase);
+  std::fprintf(file, ",\"wall_s\":%.6f,\"cpu_s\":%.6f,\"peak_rss_mb\":%.1f,\"rays\":%zu,\"bytes\":%zu", wall_seconds,
+               cpu_seconds, peak_rss, rays, bytes);
+  std::fprintf(file, ",\"items\":%zu", items);
+  std::fprintf(file, ",\"rays_per_s\":%.1f,\"bytes_per_s\":%.1f", static_cast<double>(rays) * rate_scale,
+               static_cast<double>(bytes) * rate_scale);
+#if RAYLIB_TELEMETRY_RUSAGE
+  std::fprintf(file, ",\"pid\":%ld", static_cast<long>(getpid()));
+#endif
+  std::fputs("}\n", file);
+  std::fflush(file);
+}
+
+double Telemetry::processCpuSeconds()
+{
+#if RAYLIB_TELEMETRY_RUSAGE
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           1e-6 * static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec);
+  }
+#endif
+  return static_cast<double>(std::clock()) / static_cast<double>(CLOCKS_PER_SEC);
+}
+
+double Telemetry::peakRssMegabytes()
+{
+#if RAYLIB_TELEMETRY_RUSAGE
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+#if defined(__APPLE__)
+    return static_cast<double>(usage.ru_maxrss) / (1024.0 * 1024.0);  // bytes
+#else
+    return static_cast<double>(usage.ru_maxrss) / 1024.0;  // kilobytes
+#endif
+  }
+#endif
+  return 0.0;
+}
+
+TelemetryPhase::TelemetryPhase(const std::string &name)
+  : cpu_start_(0.0)
+  , rays_(0)
+  , bytes_(0)
+  , items_(0)
+  , active_(Telemetry::enabled())
+{
+  if (active_)
+  {
+    name_ = name;
+    start_ = std::chrono::steady_clock::now();
+    cpu_start_ = Telemetry::processCpuSeconds();
+  }
+}
+
+TelemetryPhase::~TelemetryPhase()
+{
+  end();
+}
+
+void TelemetryPhase::end()
+{
+  if (!active_)
+  {
+    return;
+  }
+  active_ = false;
+  const double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_).count();
+  Telemetry::write(name_, wall, Telemetry::processCpuSeconds() - cpu_start_, rays_, bytes_, items_);
+}
+
+}  // namespace ray
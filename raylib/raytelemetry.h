@@ -0,0 +1,80 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#ifndef RAYLIB_RAYTELEMETRY_H
+#define RAYLIB_RAYTELEMETRY_H
+
+#include "raylib/raylibconfig.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+namespace ray
+{
+/// Machine-readable timing of the phases of processing, for sizing jobs and catching performance regressions.
+/// Each completed phase is written as a single line of JSON, for example:
+/// {"phase":"readPly","wall_s":1.25,"cpu_s":1.19,"peak_rss_mb":812.4,"rays":10000000,"bytes":360000000,"items":0,
+///  "rays_per_s":8000000,"bytes_per_s":288000000,"pid":1234}
+/// where items is a phase-specific count, such as the final value of a @c Progress phase.
+/// Telemetry is off by default. It is enabled by setting the environment variable RAYCLOUD_TELEMETRY to a file
+/// name to append to, or to fd:N to write to an open file descriptor (e.g. fd:2 for stderr), or by calling @c open()
+class RAYLIB_EXPORT Telemetry
+{
+public:
+  /// whether telemetry is being recorded
+  static bool enabled();
+
+  /// start writing telemetry to @c target, which is a file name or fd:N. This replaces any previous target.
+  static bool open(const std::string &target);
+
+  /// stop writing telemetry
+  static void close();
+
+  /// write a completed phase as a line of JSON. This is thread safe
+  static void write(const std::string &phase, double wall_seconds, double cpu_seconds, size_t rays, size_t bytes,
+                    size_t items);
+
+  /// the CPU time used so far by all threads of the process, in seconds
+  static double processCpuSeconds();
+
+  /// the peak resident memory of the process so far, in megabytes (0 where unavailable)
+  static double peakRssMegabytes();
+};
+
+/// Records a single phase from construction until destruction (or @c end()), when telemetry is enabled.
+/// The number of rays and bytes processed can be accumulated in order to report throughput.
+/// Usage:
+///   TelemetryPhase phase("decimate");
+///   ... phase.addRays(n); phase.addBytes(b);
+class RAYLIB_EXPORT TelemetryPhase
+{
+public:
+  TelemetryPhase(const std::string &name);
+  ~TelemetryPhase();
+
+  /// add to the number of rays processed
+  inline void addRays(size_t rays) { rays_ += rays; }
+  /// add to the number of bytes read or written
+  inline void addBytes(size_t bytes) { bytes_ += bytes; }
+  /// add to the phase-specific item count
+  inline void addItems(size_t items) { items_ += items; }
+
+  /// write the phase's telemetry now, rather than on destruction
+  void end();
+
+private:
+  std::string name_;
+  std::chrono::steady_clock::time_point start_;
+  double cpu_start_;
+  size_t rays_;
+  size_t bytes_;
+  size_t items_;
+  bool active_;
+};
+
+}  // namespace ray
+
+#endif  // RAYLIB_RAYTELEMETRY_H
@@ -7,6 +7,10 @@
 #include "raymesh.h"
 #include "rayply.h"
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
 class PlanarWave
@@ -23,6 +27,15 @@ public:
 
 // Some outdoor hilly terrain
 void TerrainGen::generate(const TerrainParams &params)
+{
+  generate(params, [&](const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends) 
+  {
+    ray_starts_.insert(ray_starts_.end(), starts.begin(), starts.end());
+    ray_ends_.insert(ray_ends_.end(), ends.begin(), ends.end());
+  });
+}
+
+void TerrainGen::generate(const TerrainParams &params, const RayChunkFunction &add_rays)
 {
   // 1. build the surface
   std::vector<PlanarWave> waves;
@@ -43,42 +56,81 @@ void TerrainGen::generate(const TerrainParams &params)
   double boundary_area = kPi * boundary_rad * boundary_rad;
   double num_rays = params.point_density * boundary_area;
   double phase_step = 2.0 * kPi / num_rays;
-  for (double phase = 0.0; phase < 2.0 * kPi; phase += phase_step)
-  {
-    // Now generate a trajectory around the landscape. This is a lissajous-type curve
-    Eigen::Vector2d traj_pos = traj_centre + traj_radius * Eigen::Vector2d(sin(phase), cos(phase)) +
-                               traj_radius2 * Eigen::Vector2d(sin(phase / rad_scale), cos(phase / rad_scale));
 
-    double floor_y = 0.0;
-    for (auto &wave : waves) 
+  // each ray uses a fixed number of random values, so the generator for any ray can be found by skipping ahead
+  const uint64_t randoms_per_ray = 4;
+  PCGRandomGenerator &random_generator = PCGRandomGenerator::instance();
+  const PCGRandomGenerator first_ray_random = random_generator;
+  uint64_t ray_index = 0;
+
+  const size_t chunk_size = 65536;
+  std::vector<double> phases;
+  std::vector<Eigen::Vector3d> starts, ends;
+  double phase = 0.0;
+  while (phase < 2.0 * kPi)
+  {
+    // the phase is accumulated in order, to give the same phases as a serial loop
+    phases.clear();
+    for (; phase < 2.0 * kPi && phases.size() < chunk_size; phase += phase_step)
     {
-      floor_y += wave.amplitude * sin(traj_pos.dot(wave.dir));
+      phases.push_back(phase);
     }
-
-    Eigen::Vector3d start(traj_pos[0], traj_pos[1], floor_y + params.ray_height);
-    Eigen::Vector3d dir(random(-1.0, 1.0), random(-1.0, 1.0), random(-1.0, -0.6));
-    dir.normalize();
-
-    // now project the ray onto the terrain... how?
-    // well we use an iterative scheme where we add the distance to the ground iteratively as a next guess
-    double range = params.ray_height;
-    const int num_intersection_iterations = 5;
-    for (int i = 0; i < num_intersection_iterations; i++)
+    starts.resize(phases.size());
+    ends.resize(phases.size());
+    const uint64_t first_index = ray_index;
+    auto generate_ray = [&](size_t r) 
     {
-      Eigen::Vector3d pos = start + range * dir;
-      Eigen::Vector2d p(pos[0], pos[1]);
+      PCGRandomGenerator random = first_ray_random;
+      random.advance(randoms_per_ray * (first_index + r));
+      // Now generate a trajectory around the landscape. This is a lissajous-type curve
+      Eigen::Vector2d traj_pos =
+        traj_centre + traj_radius * Eigen::Vector2d(sin(phases[r]), cos(phases[r])) +
+        traj_radius2 * Eigen::Vector2d(sin(phases[r] / rad_scale), cos(phases[r] / rad_scale));
+
       double floor_y = 0.0;
       for (auto &wave : waves) 
       {
-        floor_y += wave.amplitude * sin(p.dot(wave.dir));
+        floor_y += wave.amplitude * sin(traj_pos.dot(wave.dir));
       }
-      range += pos[2] - floor_y;
-    }
 
-    Eigen::Vector3d end = start + (range + random(-params.range_noise, params.range_noise)) * dir;
-    ray_starts_.push_back(start);
-    ray_ends_.push_back(end);
+      Eigen::Vector3d start(traj_pos[0], traj_pos[1], floor_y + params.ray_height);
+      Eigen::Vector3d dir(ray::random(random, -1.0, 1.0), ray::random(random, -1.0, 1.0),
+                          ray::random(random, -1.0, -0.6));
+      dir.normalize();
+
+      // now project the ray onto the terrain... how?
+      // well we use an iterative scheme where we add the distance to the ground iteratively as a next guess
+      double range = params.ray_height;
+      const int num_intersection_iterations = 5;
+      for (int i = 0; i < num_intersection_iterations; i++)
+      {
+        Eigen::Vector3d pos = start + range * dir;
+        Eigen::Vector2d p(pos[0], pos[1]);
+        double floor_y = 0.0;
+        for (auto &wave : waves) 
+        {
+          floor_y += wave.amplitude * sin(p.dot(wave.dir));
+        }
+        range += pos[2] - floor_y;
+      }
+
+      starts[r] = start;
+      ends[r] = start + (range + ray::random(random, -params.range_noise, params.range_noise)) * dir;
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, phases.size(), generate_ray);
+#else
+    #pragma omp parallel for
+    for (int64_t r = 0; r < static_cast<int64_t>(phases.size()); r++)
+    {
+      generate_ray(static_cast<size_t>(r));
+    }
+#endif  // RAYLIB_WITH_TBB
+    ray_index += phases.size();
+    add_rays(starts, ends);
   }
+  random_generator = first_ray_random;
+  random_generator.advance(randoms_per_ray * ray_index);
 }
 
 // generate the terrain based on a .ply mesh file
@@ -34,6 +34,9 @@ class RAYLIB_EXPORT TerrainGen
 public:
   /// terrain generation function. The random seed can be specified with @c srand()
   void generate(const TerrainParams &params = TerrainParams());
+  /// generate the same terrain rays as generate(), passing them to @c add_rays one chunk at a time, rather than storing
+  /// them. The rays of each chunk are generated in parallel
+  void generate(const TerrainParams &params, const RayChunkFunction &add_rays);
 
   /// generate terrain from a mesh file @c filename, and according to the @c params
   bool generateFromFile(const std::string &filename, const TerrainParams &params = TerrainParams());
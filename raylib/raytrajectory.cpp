@@ -5,15 +5,225 @@
 // Author: Thomas Lowe
 #include "raytrajectory.h"
 
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
+namespace
+{
+/// The binary trajectory file is a small header followed by the times, then the points, as stored in memory:
+/// magic (8 bytes), number of nodes (uint64), source text file size (uint64) and modification time (int64)
+const char trajectory_binary_magic[8] = { 'R', 'A', 'Y', 'T', 'R', 'A', 'J', '1' };
+const size_t trajectory_binary_header_size = 32;
+
+/// the binary copy of a trajectory text file is stored alongside it, with this name
+std::string binaryTrajectoryName(const std::string &file_name)
+{
+  return file_name + ".bin";
+}
+
+/// the value that is read back from a trajectory text file, which stores 15 significant digits
+inline double textValue(double value)
+{
+  char text[32];
+  std::snprintf(text, sizeof(text), "%.15g", value);
+  return std::strtod(text, nullptr);
+}
+
+/// write the binary copy of the trajectory text file @c text_file_name, with the values as they are in the text
+void saveBinaryTrajectory(const std::string &text_file_name, const std::vector<double> &times,
+                          const std::vector<Eigen::Vector3d> &points)
+{
+  uint64_t header[4] = { 0, times.size(), 0, 0 };
+  int64_t modified = 0;
+  if (!fileStamp(text_file_name, header[2], modified))
+  {
+    return;
+  }
+  std::memcpy(&header[0], trajectory_binary_magic, sizeof(trajectory_binary_magic));
+  std::memcpy(&header[3], &modified, sizeof(modified));
+  std::vector<double> values(times.size() * 4);
+  for (size_t i = 0; i < times.size(); i++)
+  {
+    values[i] = textValue(times[i]);
+    for (int j = 0; j < 3; j++)
+    {
+      values[times.size() + 3 * i + j] = textValue(points[i][j]);
+    }
+  }
+  const std::string file_name = binaryTrajectoryName(text_file_name);
+  std::ofstream ofs(file_name.c_str(), std::ios::out | std::ios::binary);
+  ofs.write(reinterpret_cast<const char *>(header), trajectory_binary_header_size);
+  ofs.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(double));
+  if (ofs.fail())
+  {
+    std::cerr << "Warning: cannot write binary trajectory file " << file_name << std::endl;
+  }
+}
+
+/// load a binary trajectory file. When @c text_file_name is set, the file is only used if it is a copy of the current
+/// version of that text file. Returns false without a message if the file is not a valid binary trajectory
+bool loadBinaryTrajectory(const std::string &file_name, const std::string *text_file_name, std::vector<double> &times,
+                          std::vector<Eigen::Vector3d> &points)
+{
+  std::ifstream ifs(file_name.c_str(), std::ios::in | std::ios::binary);
+  uint64_t header[4];
+  if (!ifs || !ifs.read(reinterpret_cast<char *>(header), trajectory_binary_header_size) ||
+      std::memcmp(&header[0], trajectory_binary_magic, sizeof(trajectory_binary_magic)) != 0)
+  {
+    return false;
+  }
+  if (text_file_name)
+  {
+    uint64_t size;
+    int64_t modified;
+    if (!fileStamp(*text_file_name, size, modified) || size != header[2] ||
+        std::memcmp(&modified, &header[3], sizeof(modified)) != 0)
+    {
+      return false;
+    }
+  }
+  times.resize(header[1]);
+  points.resize(header[1]);
+  if (!ifs.read(reinterpret_cast<char *>(times.data()), times.size() * sizeof(double)) ||
+      !ifs.read(reinterpret_cast<char *>(points.data()), points.size() * 3 * sizeof(double)))
+  {
+    times.clear();
+    points.clear();
+    return false;
+  }
+  return true;
+}
+
+/// parse a number from @c text, skipping leading blanks. Returns the position after the number, or nullptr if there is
+/// no valid number. @c end must be within a null terminated string
+inline const char *parseDouble(const char *text, const char *end, double &value)
+{
+  while (text < end && (*text == ' ' || *text == '\t' || *text == '\r'))
+  {
+    text++;
+  }
+  char *number_end = nullptr;
+  value = std::strtod(text, &number_end);
+  return (number_end == text || number_end > end) ? nullptr : number_end;
+}
+
+/// The nodes parsed from a block of lines of a trajectory text file
+struct TrajectoryTextBlock
+{
+  std::vector<double> times;
+  std::vector<Eigen::Vector3d> points;
+  bool valid = true;
+};
+
+/// parse the lines that start within [begin, end) of the text. Each line is "time x y z userfields", lines that are
+/// empty or begin with % are ignored
+void parseTrajectoryBlock(const std::string &text, size_t begin, size_t end, TrajectoryTextBlock &block)
+{
+  const char *data = text.c_str();
+  size_t line_start = begin;
+  while (line_start < end)
+  {
+    size_t line_end = text.find('\n', line_start);
+    if (line_end == std::string::npos)
+    {
+      line_end = text.size();
+    }
+    const char *line = data + line_start;
+    const char *line_finish = data + line_end;
+    line_start = line_end + 1;
+    if (line == line_finish || line[0] == '%' || (line[0] == '\r' && line + 1 == line_finish))
+    {
+      continue;
+    }
+    double values[4];
+    for (int j = 0; j < 4 && line; j++)
+    {
+      line = parseDouble(line, line_finish, values[j]);
+    }
+    if (!line)
+    {
+      block.valid = false;
+      return;
+    }
+    block.times.push_back(values[0]);
+    block.points.push_back(Eigen::Vector3d(values[1], values[2], values[3]));
+  }
+}
+}  // namespace
+
 void Trajectory::calculateStartPoints(const std::vector<double> &times, std::vector<Eigen::Vector3d> &starts)
 {
   if (points_.empty() || times_.empty())
     std::cout << "Warning: can only calculate start points when a trajectory is available" << std::endl;
 
   starts.resize(times.size());
-  for (size_t i = 0; i < times.size(); i++) starts[i] = linear(times[i]);
+  if (points_.size() < 2)
+  {
+    for (size_t i = 0; i < times.size(); i++) starts[i] = linear(times[i]);
+    return;
+  }
+
+  // Ray times are almost always non-decreasing, so rather than a binary search per ray (as in linear()), a cursor is
+  // advanced along the trajectory. The rays are split into blocks, which each start with a binary search, so that
+  // they can be interpolated in parallel.
+  const size_t block_size = 1024;
+  const size_t num_blocks = (times.size() + block_size - 1) / block_size;
+  auto interpolate_block = [&](size_t block) {
+    const size_t first = block * block_size;
+    const size_t count = std::min(block_size, times.size() - first);
+    size_t segments[block_size];
+    double blends[block_size];
+    size_t index = std::lower_bound(times_.begin(), times_.end(), times[first]) - times_.begin();
+    for (size_t j = 0; j < count; j++)
+    {
+      const double time = times[first + j];
+      if (j > 0 && time < times[first + j - 1])
+      {
+        index = std::lower_bound(times_.begin(), times_.end(), time) - times_.begin();
+      }
+      else
+      {
+        // a few steps forward, then a binary search of the remainder for larger time jumps
+        const size_t max_steps = 4;
+        size_t steps = 0;
+        while (index < times_.size() && times_[index] < time && steps < max_steps)
+        {
+          index++;
+          steps++;
+        }
+        if (steps == max_steps)
+        {
+          index = std::lower_bound(times_.begin() + index, times_.end(), time) - times_.begin();
+        }
+      }
+      // matching getIndexAndNormaliseTime()
+      const size_t segment = std::min(std::max<size_t>(index, 1), times_.size() - 1) - 1;
+      segments[j] = segment;
+      blends[j] = (time - times_[segment]) / (times_[segment + 1] - times_[segment]);
+    }
+    // then interpolate the block's positions in a separate loop, free of the search's branches
+    for (size_t j = 0; j < count; j++)
+    {
+      const double blend = blends[j];
+      starts[first + j] = points_[segments[j]] * (1 - blend) + points_[segments[j] + 1] * blend;
+    }
+  };
+#if RAYLIB_WITH_TBB
+  tbb::parallel_for<size_t>(0, num_blocks, interpolate_block);
+#else
+  #pragma omp parallel for
+  for (int b = 0; b < static_cast<int>(num_blocks); b++)
+  {
+    interpolate_block(static_cast<size_t>(b));
+  }
+#endif  // RAYLIB_WITH_TBB
 }
 
 bool Trajectory::save(const std::string &file_name)
@@ -33,6 +243,8 @@ bool Trajectory::save(const std::string &file_name)
     const Eigen::Vector3d &pos = points_[i];
     ofs << times_[i] << " " << pos[0] << " " << pos[1] << " " << pos[2] << " " << std::endl;
   }
+  ofs.close();
+  saveBinaryTrajectory(file_name, times_, points_);
   return true;
 }
 
@@ -52,6 +264,15 @@ bool saveTrajectory(const std::vector<TrajectoryNode> &nodes, const std::string
   {
     ofs << node.time << " " << node.point[0] << " " << node.point[1] << " " << node.point[2] << " " << std::endl;
   }
+  ofs.close();
+  std::vector<double> times(nodes.size());
+  std::vector<Eigen::Vector3d> points(nodes.size());
+  for (size_t i = 0; i < nodes.size(); i++)
+  {
+    times[i] = nodes[i].time;
+    points[i] = nodes[i].point;
+  }
+  saveBinaryTrajectory(file_name, times, points);
   return true;
 }
 
@@ -60,62 +281,75 @@ bool saveTrajectory(const std::vector<TrajectoryNode> &nodes, const std::string
 bool Trajectory::load(const std::string &file_name)
 {
   std::cout << "loading trajectory " << file_name << std::endl;
-  std::string line;
-  int size = 0;
+  // use the binary copy where it is up to date, or the file itself if it is a binary trajectory
+  if (!loadBinaryTrajectory(binaryTrajectoryName(file_name), &file_name, times_, points_) &&
+      !loadBinaryTrajectory(file_name, nullptr, times_, points_))
   {
-    std::ifstream ifs(file_name.c_str(), std::ios::in);
-    if (!ifs)
+    std::string text;
     {
-      std::cerr << "Failed to open trajectory file: " << file_name << std::endl;
-      return false;
+      std::ifstream ifs(file_name.c_str(), std::ios::in | std::ios::binary);
+      if (!ifs)
+      {
+        std::cerr << "Failed to open trajectory file: " << file_name << std::endl;
+        return false;
+      }
+      ifs.seekg(0, std::ios::end);
+      text.resize(static_cast<size_t>(ifs.tellg()));
+      ifs.seekg(0, std::ios::beg);
+      if (!ifs.read(&text[0], text.size()))
+      {
+        std::cerr << "Invalid stream when loading trajectory file: " << file_name << std::endl;
+        return false;
+      }
     }
-    ASSERT(!ifs.fail());
 
-    while (getline(ifs, line))
+    // parse blocks of lines in parallel. Each block starts at the first line beginning within it
+    const size_t block_size = 1 << 20;
+    const size_t num_blocks = std::max<size_t>(1, (text.size() + block_size - 1) / block_size);
+    std::vector<size_t> block_starts(num_blocks + 1, text.size());
+    block_starts[0] = 0;
+    for (size_t b = 1; b < num_blocks; b++)
     {
-      if (line.length() == 0 || line[0] == '%')
-        continue;
-      size++;
+      const size_t line_end = text.find('\n', b * block_size - 1);
+      block_starts[b] = line_end == std::string::npos ? text.size() : line_end + 1;
     }
-  }
-  std::ifstream ifs(file_name.c_str(), std::ios::in);
-  if (!ifs)
-  {
-    std::cerr << "Failed to open trajectory file: " << file_name << std::endl;
-    return false;
-  }
-  points_.resize(size);
-  times_.resize(size);
-  bool ordered = true;
-  int i = 0; // index along trajectory
-  while (i < size)
-  {
-    if (ifs.fail())
+    std::vector<TrajectoryTextBlock> blocks(num_blocks);
+    auto parse_block = [&](size_t b) { parseTrajectoryBlock(text, block_starts[b], block_starts[b + 1], blocks[b]); };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, num_blocks, parse_block);
+#else
+    #pragma omp parallel for
+    for (int b = 0; b < static_cast<int>(num_blocks); b++)
     {
-      std::cerr << "Invalid stream when loading trajectory file: " << file_name << std::endl;
-      return false;
+      parse_block(static_cast<size_t>(b));
     }
-    getline(ifs, line);
-    if (line.length() == 0 || line[0] == '%')
-      continue;
+#endif  // RAYLIB_WITH_TBB
 
-    std::istringstream iss(line);
-    iss >> times_[i] >> points_[i][0] >> points_[i][1] >> points_[i][2];
-    if (iss.fail())
+    size_t size = 0;
+    for (auto &block : blocks)
     {
-      std::cerr << "Invalid fields at line " << i << " of " << file_name << std::endl;
-      return false;
+      if (!block.valid)
+      {
+        std::cerr << "Invalid fields at line " << size + block.times.size() << " of " << file_name << std::endl;
+        return false;
+      }
+      size += block.times.size();
     }
-    if (i > 0 && times_[i] < times_[i - 1])
+    times_.clear();
+    points_.clear();
+    times_.reserve(size);
+    points_.reserve(size);
+    for (auto &block : blocks)
     {
-      ordered = false;
+      times_.insert(times_.end(), block.times.begin(), block.times.end());
+      points_.insert(points_.end(), block.points.begin(), block.points.end());
     }
-    i++;
   }
-  if (ifs.fail())
+
+  bool ordered = true;
+  for (size_t i = 1; i < times_.size() && ordered; i++)
   {
-    std::cerr << "Invalid stream when loading trajectory file: " << file_name << std::endl;
-    return false;
+    ordered = times_[i] >= times_[i - 1];
   }
   if (!ordered)
   {
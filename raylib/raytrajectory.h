@@ -22,10 +22,13 @@ public:
   inline std::vector<double> &times() { return times_; }
   inline const std::vector<double> &times() const { return times_; }
 
-  /// Save trajectory to a text file. One line per Node
+  /// Save trajectory to a text file. One line per Node.
+  /// A binary copy is also saved, as @c file_name with a .bin suffix, so that it can be reloaded quickly
   bool save(const std::string &file_name);
 
-  /// Load trajectory from file. The file is expected to be a text file, with one Node entry per line
+  /// Load trajectory from file. The file is expected to be a text file, with one Node entry per line.
+  /// The binary copy from @c save() is used instead when it is present and the text file has not changed since.
+  /// A binary copy can also be loaded directly, by passing its own file name
   bool load(const std::string &file_name);
 
   /// Interpolation of the set @c starts based on the @c times_ of the trajectory
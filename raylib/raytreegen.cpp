@@ -8,6 +8,10 @@
 #include <cstdlib>
 #include <fstream>
 
+#if RAYLIB_WITH_TBB
+#include <tbb/parallel_for.h>
+#endif  // RAYLIB_WITH_TBB
+
 namespace ray
 {
 // given the input @c main_branch_angle of the larger branch, we can obtain the second branch angle and the
@@ -146,17 +150,31 @@ void TreeGen::make(const TreeParams &params)
 // create a set of rays covering the tree at a roughly uniform distribution
 void TreeGen::generateRays(double ray_density)
 {
-  ASSERT(segments_.size() > 0);
-  const double path_trunk_multiplier = 12.0;   // observe the tree from this many trunk radii away
-  const double ground_path_multiplier = 5.0;   // observe the tree from this many trunk radii in height
-  const double flight_path_multiplier = 20.0;  // overhead path is at this many trunk radii above the ground
-  double path_radius = segments_[0].radius * path_trunk_multiplier;
-  double ring_heights[2] = { segments_[0].radius * ground_path_multiplier,
-                             segments_[0].radius * flight_path_multiplier };
-  Eigen::Vector3d root = segments_[0].tip;
+  generateRays(ray_density, [&](const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends)
+  {
+    ray_starts_.insert(ray_starts_.end(), starts.begin(), starts.end());
+    ray_ends_.insert(ray_ends_.end(), ends.begin(), ends.end());
+  });
+}
 
-  std::vector<double> cumulative_size(segments_.size());
-  cumulative_size[0] = 0;
+void TreeGen::generateRays(double ray_density, const RayChunkFunction &add_rays)
+{
+  std::vector<RayRun> runs;
+  const int run_size = 65536;
+  planRays(ray_density, run_size, runs);
+  std::vector<std::pair<const TreeGen *, RayRun>> tree_runs;
+  for (auto &run : runs)
+  {
+    tree_runs.push_back(std::make_pair(this, run));
+  }
+  generateRuns(tree_runs, add_rays);
+}
+
+void TreeGen::planRays(double ray_density, int run_size, std::vector<RayRun> &runs)
+{
+  ASSERT(segments_.size() > 0);
+  cumulative_size_.resize(segments_.size());
+  cumulative_size_[0] = 0;
   for (int i = 1; i < (int)segments_.size(); i++)
   {
     Segment &branch = segments_[i];
@@ -164,34 +182,69 @@ void TreeGen::generateRays(double ray_density)
     double area = (branch.tip - parent_branch.tip).norm() * 2.0 * kPi * (branch.radius + parent_branch.radius) /
                   2.0;  // slightly approximate
     area *= random(0.10, 1.0);
-    cumulative_size[i] = cumulative_size[i - 1] + area;
+    cumulative_size_[i] = cumulative_size_[i - 1] + area;
   }
 
-  int num_rays = (int)(ray_density * cumulative_size.back());
-  double area_per_ray = cumulative_size.back() / (double)num_rays;
+  int num_rays = (int)(ray_density * cumulative_size_.back());
+  area_per_ray_ = cumulative_size_.back() / (double)num_rays;
+  // the segment of each ray depends on the running total area, so we record it at the start of each run
+  PCGRandomGenerator &random = PCGRandomGenerator::instance();
+  const uint64_t randoms_per_ray = 5;
   double total_area = 0.0;
   int i = 0;
   for (int j = 0; j < num_rays; j++)
   {
-    total_area += area_per_ray;
-    while (i < (int)cumulative_size.size() - 1 && cumulative_size[i] < total_area) i++;
+    if (j % run_size == 0)
+    {
+      RayRun run;
+      run.random = random;
+      run.first_ray = j;
+      run.num_rays = std::min(run_size, num_rays - j);
+      run.total_area = total_area;
+      run.segment_id = i;
+      runs.push_back(run);
+      random.advance(randoms_per_ray * run.num_rays);
+    }
+    total_area += area_per_ray_;
+    while (i < (int)cumulative_size_.size() - 1 && cumulative_size_[i] < total_area) i++;
+  }
+}
 
-    Segment &branch = segments_[i];
-    Segment &parent_branch = segments_[branch.parent_id];
+void TreeGen::generateRays(const RayRun &run, std::vector<Eigen::Vector3d> &starts,
+                           std::vector<Eigen::Vector3d> &ends) const
+{
+  const double path_trunk_multiplier = 12.0;   // observe the tree from this many trunk radii away
+  const double ground_path_multiplier = 5.0;   // observe the tree from this many trunk radii in height
+  const double flight_path_multiplier = 20.0;  // overhead path is at this many trunk radii above the ground
+  double path_radius = segments_[0].radius * path_trunk_multiplier;
+  double ring_heights[2] = { segments_[0].radius * ground_path_multiplier,
+                             segments_[0].radius * flight_path_multiplier };
+  Eigen::Vector3d root = segments_[0].tip;
+
+  PCGRandomGenerator random = run.random;
+  double total_area = run.total_area;
+  int i = run.segment_id;
+  for (int j = 0; j < run.num_rays; j++)
+  {
+    total_area += area_per_ray_;
+    while (i < (int)cumulative_size_.size() - 1 && cumulative_size_[i] < total_area) i++;
+
+    const Segment &branch = segments_[i];
+    const Segment &parent_branch = segments_[branch.parent_id];
 
     // simplest is to randomise a point on a cone.... it will have overlap and gaps, but it is a starting point...
-    double t = random(0.0, 1.0);
+    double t = ray::random(random, 0.0, 1.0);
     double r = branch.radius + (parent_branch.radius - branch.radius) * t;
     Eigen::Vector3d online = branch.tip + (parent_branch.tip - branch.tip) * t;
-    double angle = random(0.0, 2.0 * kPi);
+    double angle = ray::random(random, 0.0, 2.0 * kPi);
     Eigen::Vector3d up = (branch.tip - parent_branch.tip).normalized();
     Eigen::Vector3d side = up.cross(Eigen::Vector3d(1, 2, 3));
     Eigen::Vector3d fwd = up.cross(side).normalized();
     side = fwd.cross(up);
     Eigen::Vector3d offset = side * sin(angle) + fwd * cos(angle);
     Eigen::Vector3d pos = online + offset * r;
-    ray_ends_.push_back(pos);
-    Eigen::Vector3d from = Eigen::Vector3d(random(-1, 1), random(-1, 1), random(-1, 1));
+    ends.push_back(pos);
+    Eigen::Vector3d from = Eigen::Vector3d(ray::random(random, -1, 1), ray::random(random, -1, 1), ray::random(random, -1, 1));
     if (from.dot(offset) < 0.0)
     {
       from = -from;
@@ -226,7 +279,37 @@ void TreeGen::generateRays(double ray_density)
         min_dist2 = dist2;
       }
     }
-    ray_starts_.push_back(best_start);
+    starts.push_back(best_start);
+  }
+}
+
+void TreeGen::generateRuns(const std::vector<std::pair<const TreeGen *, RayRun>> &runs, const RayChunkFunction &add_rays)
+{
+  // generate a block of runs at a time, to bound the memory used
+  const size_t block_size = 64;
+  std::vector<std::vector<Eigen::Vector3d>> starts(block_size), ends(block_size);
+  for (size_t block_start = 0; block_start < runs.size(); block_start += block_size)
+  {
+    const size_t num_runs = std::min(block_size, runs.size() - block_start);
+    auto generate_run = [&](size_t i) 
+    {
+      starts[i].clear();
+      ends[i].clear();
+      runs[block_start + i].first->generateRays(runs[block_start + i].second, starts[i], ends[i]);
+    };
+#if RAYLIB_WITH_TBB
+    tbb::parallel_for<size_t>(0, num_runs, generate_run);
+#else
+    #pragma omp parallel for schedule(dynamic)
+    for (int64_t i = 0; i < static_cast<int64_t>(num_runs); i++)
+    {
+      generate_run(static_cast<size_t>(i));
+    }
+#endif  // RAYLIB_WITH_TBB
+    for (size_t i = 0; i < num_runs; i++)
+    {
+      add_rays(starts[i], ends[i]);
+    }
   }
 }
 }  // namespace ray
\ No newline at end of file
@@ -50,6 +50,25 @@ public:
 
   /// generate a set of rays as though the tree has been observed by a viewer circling it
   void generateRays(double ray_density);
+  /// generate the same rays as generateRays(), passing them to @c add_rays one chunk at a time, rather than storing them
+  void generateRays(double ray_density, const RayChunkFunction &add_rays);
+
+  /// A run of consecutive rays of a tree, with the state needed to generate it independently of the other runs
+  struct RayRun
+  {
+    PCGRandomGenerator random;  // the random generator at the start of the run
+    int first_ray;
+    int num_rays;
+    double total_area;  // the cumulative area covered before the first ray
+    int segment_id;     // the segment of the first ray
+  };
+  /// draw the random area of each segment from the shared random generator, then split the tree's rays into runs of up
+  /// to @c run_size rays. The shared random generator is left as though the rays had been generated
+  void planRays(double ray_density, int run_size, std::vector<RayRun> &runs);
+  /// generate the rays of a run from planRays(), appending them to @c starts and @c ends
+  void generateRays(const RayRun &run, std::vector<Eigen::Vector3d> &starts, std::vector<Eigen::Vector3d> &ends) const;
+  /// generate the rays of a list of tree runs in parallel, passing them to @c add_rays in the order of the list
+  static void generateRuns(const std::vector<std::pair<const TreeGen *, RayRun>> &runs, const RayChunkFunction &add_rays);
 
   /// the rays generated from generateRays
   inline const std::vector<Eigen::Vector3d> rayStarts() const { return ray_starts_; }
@@ -70,6 +89,8 @@ public:
 private:
   std::vector<Eigen::Vector3d> leaves_;
   std::vector<Eigen::Vector3d> ray_starts_, ray_ends_;
+  std::vector<double> cumulative_size_;  // cumulative surface area (randomly scaled) over the segments, for ray generation
+  double area_per_ray_ = 0.0;
 
   void addBranch(int parent_index, Pose pose, double radius, const TreeParams &params);
 };
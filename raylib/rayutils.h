@@ -23,6 +23,9 @@
 #include <string>
 #include <vector>
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
 namespace ray
 {
 const double kPi = M_PI;
@@ -97,6 +100,16 @@ inline double random(double min, double max)
   return min + ((max - min) * randUniformDouble());
 }
 
+/// Uniform distribution within range, from the given @c generator
+inline double random(PCGRandomGenerator &generator, double min, double max)
+{
+  return min + ((max - min) * randUniformDouble(generator));
+}
+
+/// receives a chunk of generated rays, in the order that they are generated
+using RayChunkFunction =
+  std::function<void(const std::vector<Eigen::Vector3d> &starts, const std::vector<Eigen::Vector3d> &ends)>;
+
 class RAYLIB_EXPORT Vector3iLess
 {
 public:
@@ -110,6 +123,17 @@ public:
   }
 };
 
+class RAYLIB_EXPORT Vector2iLess
+{
+public:
+  bool operator()(const Eigen::Vector2i &a, const Eigen::Vector2i &b) const
+  {
+    if (a[0] != b[0])
+      return a[0] < b[0];
+    return a[1] < b[1];
+  }
+};
+
 inline void voxelSubsample(const std::vector<Eigen::Vector3d> &points, double voxel_width,
                            std::vector<int64_t> &indices, std::set<Eigen::Vector3i, Vector3iLess> &vox_set)
 {
@@ -131,6 +155,35 @@ inline void voxelSubsample(const std::vector<Eigen::Vector3d> &points, double vo
   voxelSubsample(points, voxel_width, indices, vox_set);
 }
 
+/// number of bits per axis in a mortonCode(), so that the code fits in 63 bits
+const int kMortonBits = 21;
+
+/// spread the lower kMortonBits bits of @c x out to every third bit
+inline uint64_t spreadBits(uint64_t x)
+{
+  x &= 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffULL;
+  x = (x | x << 16) & 0x1f0000ff0000ffULL;
+  x = (x | x << 8) & 0x100f00f00f00f00fULL;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ULL;
+  x = (x | x << 2) & 0x1249249249249249ULL;
+  return x;
+}
+
+/// The Morton (Z-order) code of @c pos, which is quantised into cells of width 1/@c scale from @c min_bound. So the
+/// codes of points within a cube of width (2^kMortonBits - 1)/scale are in octree order, each octree cell covering a
+/// contiguous range of codes. Positions outside the cube are clamped to it
+inline uint64_t mortonCode(const Eigen::Vector3d &pos, const Eigen::Vector3d &min_bound, double scale)
+{
+  const double max_cell = static_cast<double>((1 << kMortonBits) - 1);
+  uint64_t cells[3];
+  for (int i = 0; i < 3; i++)
+  {
+    cells[i] = static_cast<uint64_t>(std::min(std::max((pos[i] - min_bound[i]) * scale, 0.0), max_cell));
+  }
+  return spreadBits(cells[0]) | spreadBits(cells[1]) << 1 | spreadBits(cells[2]) << 2;
+}
+
 /// Square a value
 template <class T>
 inline T sqr(const T &val)
@@ -301,6 +354,26 @@ void readPlainOldDataArray(std::ifstream &in, std::vector<T> &array)
   for (unsigned int i = 0; i < size; i++) readPlainOldData(in, array[i]);
 }
 
+/// the size and modification time of a file, used to check whether files derived from it are up to date.
+/// The time is in nanoseconds where the platform provides it. Returns false if the file cannot be found
+inline bool fileStamp(const std::string &file_name, uint64_t &size, int64_t &modified)
+{
+  struct stat file_stat;
+  if (stat(file_name.c_str(), &file_stat) != 0)
+  {
+    return false;
+  }
+  size = static_cast<uint64_t>(file_stat.st_size);
+#if defined(__APPLE__)
+  modified = static_cast<int64_t>(file_stat.st_mtimespec.tv_sec) * 1000000000 + file_stat.st_mtimespec.tv_nsec;
+#elif defined(__unix__)
+  modified = static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+#else
+  modified = static_cast<int64_t>(file_stat.st_mtime) * 1000000000;
+#endif
+  return true;
+}
+
 /// Log a @c std::chrono::clock::duration to an output stream.
 ///
 /// The resulting string displays in the smallest possible unit to show three three
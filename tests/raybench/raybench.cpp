@@ -0,0 +1,412 @@
+// Copyright (c) 2022
+// Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+// ABN 41 687 119 230
+//
+// Author: Thomas Lowe
+#include "raylib/extraction/rayterrain.h"
+#include "raylib/extraction/raytrees.h"
+#include "raylib/raybuildinggen.h"
+#include "raylib/raycloud.h"
+#include "raylib/raydecimation.h"
+#include "raylib/rayforestgen.h"
+#include "raylib/raygrid.h"
+#include "raylib/raymerger.h"
+#include "raylib/rayply.h"
+#include "raylib/rayrenderer.h"
+#include "raylib/rayroomgen.h"
+#include "raylib/raytelemetry.h"
+#include "raylib/rayterraingen.h"
+#include "raylib/raytreegen.h"
+
+#include <benchmark/benchmark.h>
+
+#include <map>
+
+// Performance benchmarks for the raylib hot paths. The input clouds are generated by the raycreate generators from a
+// fixed seed, so the results are comparable between runs and machines. Each benchmark reports its ray throughput
+// (rays_per_s) and the process's peak memory (peak_rss_mb).
+//
+// Run from an empty working directory, as the file based benchmarks write their inputs and outputs there:
+//   raybench --benchmark_filter=ReadPly
+namespace
+{
+enum CloudType
+{
+  Room,
+  Building,
+  Forest,
+  Terrain
+};
+const char *cloud_names[] = { "room", "building", "forest", "terrain" };
+
+/// generate the ray cloud of @c type, as created by raycreate with seed 1
+void generateCloud(CloudType type, ray::Cloud &cloud)
+{
+  ray::srand(1);
+  const double time_delta = 0.001;  // between rays
+  if (type == Room)
+  {
+    ray::RoomGen room_gen;
+    room_gen.generate();
+    cloud.starts = room_gen.rayStarts();
+    cloud.ends = room_gen.rayEnds();
+  }
+  else if (type == Building)
+  {
+    ray::BuildingGen building_gen;
+    building_gen.generate();
+    cloud.starts = building_gen.rayStarts();
+    cloud.ends = building_gen.rayEnds();
+  }
+  else if (type == Forest)
+  {
+    const double density = 500.0;  // density of points on the branches of the trees
+    ray::fillBranchAngleLookup();
+    ray::ForestParams params;
+    params.random_factor = 0.25;
+    ray::ForestGen forest_gen;
+    forest_gen.make(params);
+    forest_gen.generateRays(density);
+    for (auto &tree : forest_gen.trees())
+    {
+      const std::vector<Eigen::Vector3d> &ray_starts = tree.rayStarts();
+      const std::vector<Eigen::Vector3d> &ray_ends = tree.rayEnds();
+      cloud.starts.insert(cloud.starts.end(), ray_starts.begin(), ray_starts.end());
+      cloud.ends.insert(cloud.ends.end(), ray_ends.begin(), ray_ends.end());
+    }
+    // the ground plane, with rays from above
+    const double extent = 10.0;
+    const int num = int(0.25 * density * 4.0 * extent * extent);
+    for (int i = 0; i < num; i++)
+    {
+      Eigen::Vector3d pos(ray::random(-extent, extent), ray::random(-extent, extent), ray::random(-0.125, 0.125));
+      cloud.ends.push_back(pos);
+      cloud.starts.push_back(pos + Eigen::Vector3d(ray::random(-0.1, 0.1), ray::random(-0.1, 0.1), 1.5));
+    }
+  }
+  else
+  {
+    ray::TerrainGen terrain;
+    terrain.generate();
+    cloud.starts = terrain.rayStarts();
+    cloud.ends = terrain.rayEnds();
+  }
+  cloud.times.resize(cloud.ends.size());
+  for (size_t i = 0; i < cloud.times.size(); i++)
+  {
+    cloud.times[i] = static_cast<double>(i) * time_delta;
+  }
+  ray::colourByTime(cloud.times, cloud.colours);
+}
+
+/// the generated cloud of @c type. These are only generated once per run
+const ray::Cloud &benchCloud(CloudType type)
+{
+  static std::map<CloudType, ray::Cloud> clouds;
+  auto it = clouds.find(type);
+  if (it == clouds.end())
+  {
+    it = clouds.emplace(type, ray::Cloud()).first;
+    generateCloud(type, it->second);
+  }
+  return it->second;
+}
+
+/// the generated cloud of @c type saved to a ply file, which is returned without the extension
+std::string benchCloudFile(CloudType type)
+{
+  static std::map<CloudType, std::string> file_stubs;
+  auto it = file_stubs.find(type);
+  if (it == file_stubs.end())
+  {
+    const std::string file_stub = std::string("raybench_") + cloud_names[type];
+    benchCloud(type).save(file_stub + ".ply");
+    it = file_stubs.emplace(type, file_stub).first;
+  }
+  return it->second;
+}
+
+/// the bounds of all of the rays in @c cloud
+ray::Cuboid cloudBounds(const ray::Cloud &cloud)
+{
+  Eigen::Vector3d min_bound, max_bound;
+  cloud.calcBounds(&min_bound, &max_bound, ray::kBFEnd | ray::kBFStart);
+  return ray::Cuboid(min_bound, max_bound);
+}
+
+/// set the standard counters, for @c num_rays processed per iteration
+void setCounters(benchmark::State &state, size_t num_rays)
+{
+  state.counters["rays"] = static_cast<double>(num_rays);
+  state.counters["rays_per_s"] =
+    benchmark::Counter(static_cast<double>(num_rays), benchmark::Counter::kIsIterationInvariantRate);
+  state.counters["peak_rss_mb"] = ray::Telemetry::peakRssMegabytes();
+}
+
+void cloudArguments(benchmark::internal::Benchmark *benchmark)
+{
+  for (int type = Room; type <= Terrain; type++)
+  {
+    benchmark->Arg(type);
+  }
+  benchmark->Unit(benchmark::kMillisecond)->UseRealTime();  // wall clock time, as much of raylib is multi-threaded
+}
+
+// File input and output
+
+void BM_WriteRayCloudChunk(benchmark::State &state)
+{
+  const ray::Cloud &cloud = benchCloud(static_cast<CloudType>(state.range(0)));
+  ray::RayPlyBuffer buffer;
+  for (auto _ : state)
+  {
+    std::ofstream ofs;
+    ray::writeRayCloudChunkStart("raybench_write.ply", ofs);
+    bool has_warned = false;
+    ray::writeRayCloudChunk(ofs, buffer, cloud.starts, cloud.ends, cloud.times, cloud.colours, has_warned);
+    ray::writeRayCloudChunkEnd(ofs);
+  }
+  setCounters(state, cloud.ends.size());
+}
+BENCHMARK(BM_WriteRayCloudChunk)->Apply(cloudArguments);
+
+void BM_ReadPly(benchmark::State &state)
+{
+  const std::string file_stub = benchCloudFile(static_cast<CloudType>(state.range(0)));
+  size_t num_rays = 0;
+  for (auto _ : state)
+  {
+    num_rays = 0;
+    auto count = [&num_rays](std::vector<Eigen::Vector3d> &, std::vector<Eigen::Vector3d> &ends,
+                             std::vector<double> &, std::vector<ray::RGBA> &) { num_rays += ends.size(); };
+    ray::readPly(file_stub + ".ply", true, count, 0);
+  }
+  setCounters(state, num_rays);
+}
+BENCHMARK(BM_ReadPly)->Apply(cloudArguments);
+
+// Spatial structures
+
+void BM_GridInsert(benchmark::State &state)
+{
+  const ray::Cloud &cloud = benchCloud(static_cast<CloudType>(state.range(0)));
+  const ray::Cuboid bounds = cloudBounds(cloud);
+  const double voxel_width = 0.25;
+  for (auto _ : state)
+  {
+    ray::Grid<int> grid(bounds.min_bound_, bounds.max_bound_, voxel_width);
+    for (size_t i = 0; i < cloud.ends.size(); i++)
+    {
+      grid.insert(grid.index(cloud.ends[i]), static_cast<int>(i));
+    }
+    benchmark::DoNotOptimize(grid);
+  }
+  setCounters(state, cloud.ends.size());
+}
+BENCHMARK(BM_GridInsert)->Apply(cloudArguments);
+
+/// counts the voxels that are walked through
+struct VoxelCounter
+{
+  bool operator()(const Eigen::Vector3i &, const Eigen::Vector3i &, double, double, double)
+  {
+    num_voxels++;
+    return false;
+  }
+  size_t num_voxels = 0;
+};
+
+void BM_WalkGrid(benchmark::State &state)
+{
+  const ray::Cloud &cloud = benchCloud(static_cast<CloudType>(state.range(0)));
+  const double voxel_width = 0.1;
+  for (auto _ : state)
+  {
+    VoxelCounter counter;
+    for (size_t i = 0; i < cloud.ends.size(); i++)
+    {
+      ray::walkGrid(cloud.starts[i] / voxel_width, cloud.ends[i] / voxel_width, counter);
+    }
+    benchmark::DoNotOptimize(counter.num_voxels);
+  }
+  setCounters(state, cloud.ends.size());
+}
+BENCHMARK(BM_WalkGrid)->Apply(cloudArguments);
+
+/// clips the cloud to the central half of its bounds, one ray at a time (0) or batched (1)
+void BM_ClipRays(benchmark::State &state)
+{
+  const ray::Cloud &cloud = benchCloud(static_cast<CloudType>(state.range(0)));
+  const ray::Cuboid bounds = cloudBounds(cloud);
+  const Eigen::Vector3d quarter = (bounds.max_bound_ - bounds.min_bound_) / 4.0;
+  const ray::Cuboid cuboid(bounds.min_bound_ + quarter, bounds.max_bound_ - quarter);
+  const bool batched = state.range(1) != 0;
+  std::vector<Eigen::Vector3d> clipped_starts, clipped_ends;
+  std::vector<bool> clipped;
+  for (auto _ : state)
+  {
+    if (batched)
+    {
+      cuboid.clipRays(cloud.starts, cloud.ends, clipped_starts, clipped_ends, clipped);
+    }
+    else
+    {
+      clipped_starts.resize(cloud.ends.size());
+      clipped_ends.resize(cloud.ends.size());
+      clipped.resize(cloud.ends.size());
+      for (size_t i = 0; i < cloud.ends.size(); i++)
+      {
+        clipped_starts[i] = cloud.starts[i];
+        clipped_ends[i] = cloud.ends[i];
+        clipped[i] = cuboid.clipRay(clipped_starts[i], clipped_ends[i]);
+      }
+    }
+    benchmark::DoNotOptimize(clipped_ends.data());
+  }
+  setCounters(state, cloud.ends.size());
+}
+BENCHMARK(BM_ClipRays)
+  ->ArgsProduct({ { Room, Building, Forest, Terrain }, { 0, 1 } })
+  ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_GetSurfels(benchmark::State &state)
+{
+  const ray::Cloud &cloud = benchCloud(static_cast<CloudType>(state.range(0)));
+  const int search_size = 16;
+  for (auto _ : state)
+  {
+    std::vector<Eigen::Vector3d> centroids, normals;
+    cloud.getSurfels(search_size, &centroids, &normals, nullptr, nullptr, nullptr);
+    benchmark::DoNotOptimize(normals.data());
+  }
+  setCounters(state, cloud.ends.size());
+}
+BENCHMARK(BM_GetSurfels)->Apply(cloudArguments);
+
+// Whole cloud operations
+
+void BM_MergerFilter(benchmark::State &state)
+{
+  const ray::Cloud &cloud = benchCloud(static_cast<CloudType>(state.range(0)));
+  ray::MergerConfig config;
+  config.merge_type = ray::MergeType::Mininum;
+  for (auto _ : state)
+  {
+    ray::Merger merger(config);
+    merger.filter(cloud);
+    benchmark::DoNotOptimize(merger.fixedCloud().ends.data());
+  }
+  setCounters(state, cloud.ends.size());
+}
+BENCHMARK(BM_MergerFilter)->Apply(cloudArguments);
+
+#if RAYLIB_WITH_QHULL  // terrain extraction requires QHull, and the trees reconstruction uses the terrain mesh
+void BM_TerrainExtract(benchmark::State &state)
+{
+  const CloudType type = static_cast<CloudType>(state.range(0));
+  const ray::Cloud &cloud = benchCloud(type);
+  const double gradient = 1.0;
+  for (auto _ : state)
+  {
+    ray::Terrain terrain;
+    terrain.extract(cloud, Eigen::Vector3d(0, 0, 0), std::string("raybench_") + cloud_names[type], gradient, false);
+    benchmark::DoNotOptimize(terrain.mesh().vertices().data());
+  }
+  setCounters(state, cloud.ends.size());
+}
+BENCHMARK(BM_TerrainExtract)->Arg(Forest)->Arg(Terrain)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_Trees(benchmark::State &state)
+{
+  const ray::Cloud &forest = benchCloud(Forest);
+  ray::Terrain terrain;
+  terrain.extract(forest, Eigen::Vector3d(0, 0, 0), "raybench_forest", 1.0, false);
+  ray::TreesParams params;
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    ray::Cloud cloud = forest;  // the trees reconstruction recolours the cloud
+    state.ResumeTiming();
+    ray::Trees trees(cloud, Eigen::Vector3d(0, 0, 0), terrain.mesh(), params, false);
+    benchmark::DoNotOptimize(trees);
+  }
+  setCounters(state, forest.ends.size());
+}
+BENCHMARK(BM_Trees)->Unit(benchmark::kMillisecond)->UseRealTime();
+#endif  // RAYLIB_WITH_QHULL
+
+// File based tools. These read the cloud file and write a _decimated.ply or image file in each iteration
+
+enum DecimationType
+{
+  Spatial,
+  Temporal,
+  SpatioTemporal,
+  RaysSpatial,
+  Angular
+};
+
+void BM_Decimate(benchmark::State &state)
+{
+  const CloudType type = static_cast<CloudType>(state.range(0));
+  const std::string file_stub = benchCloudFile(type);
+  const DecimationType decimation = static_cast<DecimationType>(state.range(1));
+  const double vox_width = 0.1;
+  for (auto _ : state)
+  {
+    bool success = false;
+    switch (decimation)
+    {
+    case Spatial:
+      success = ray::decimateSpatial(file_stub, vox_width);
+      break;
+    case Temporal:
+      success = ray::decimateTemporal(file_stub, 10);
+      break;
+    case SpatioTemporal:
+      success = ray::decimateSpatioTemporal(file_stub, vox_width, 4);
+      break;
+    case RaysSpatial:
+      success = ray::decimateRaysSpatial(file_stub, vox_width);
+      break;
+    case Angular:
+      success = ray::decimateAngular(file_stub, 0.01);
+      break;
+    }
+    if (!success)
+    {
+      state.SkipWithError("decimation failed");
+      break;
+    }
+  }
+  setCounters(state, benchCloud(type).ends.size());
+}
+BENCHMARK(BM_Decimate)
+  ->ArgsProduct({ { Room, Building, Forest, Terrain }, { Spatial, Temporal, SpatioTemporal, RaysSpatial, Angular } })
+  ->Unit(benchmark::kMillisecond)->UseRealTime();
+
+void BM_RenderCloud(benchmark::State &state)
+{
+  const CloudType type = static_cast<CloudType>(state.range(0));
+  const std::string file_stub = benchCloudFile(type);
+  const ray::RenderStyle style = static_cast<ray::RenderStyle>(state.range(1));
+  const ray::Cuboid bounds = cloudBounds(benchCloud(type));
+  const double pixel_width = 0.05;
+  for (auto _ : state)
+  {
+    if (!ray::renderCloud(file_stub + ".ply", bounds, ray::ViewDirection::Top, style, pixel_width,
+                          file_stub + "_render.png", "", false))
+    {
+      state.SkipWithError("render failed");
+      break;
+    }
+  }
+  setCounters(state, benchCloud(type).ends.size());
+}
+BENCHMARK(BM_RenderCloud)
+  ->ArgsProduct({ { Room, Building, Forest, Terrain },
+                  { static_cast<int>(ray::RenderStyle::Ends), static_cast<int>(ray::RenderStyle::Density) } })
+  ->Unit(benchmark::kMillisecond)->UseRealTime();
+}  // namespace
+
+BENCHMARK_MAIN();
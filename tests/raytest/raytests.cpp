@@ -5,9 +5,22 @@
 // Author: Thomas Lowe
 
 #include "raycloud.h"
+#include "raycloudindex.h"
+#include "raycloudstream.h"
+#include "rayconcavehull.h"
+#include "raycuboid.h"
+#include "raydecimation.h"
+#include "raylaz.h"
 #include "raymesh.h"
+#include "raymeshwriter.h"
+#include "rayneighbours.h"
+#include "raypipeline.h"
 #include "rayply.h"
+#include "raysort.h"
 #include "rayforeststructure.h"
+#include "rayforestgen.h"
+#include <fstream>
+#include <map>
 #include <vector>
 #include <gtest/gtest.h>
 #include <cstdlib>
@@ -47,6 +60,28 @@ namespace raytest
     }
   }
 
+  /// Compare the moments of two clouds that have both been computed, such as the results of two equivalent
+  /// processing paths.
+  void compareMoments(const Eigen::ArrayXd &m1, const Eigen::ArrayXd &m2, double eps)
+  {
+    compareMoments(m1, std::vector<double>(m2.data(), m2.data() + m2.size()), eps);
+  }
+
+  /// Generates and saves a ray cloud of 20000 random rays over a 20 x 20 x 2 m block, with every third ray unbounded.
+  /// The @c seed gives a repeatable cloud, which is returned.
+  ray::Cloud saveRandomCloud(unsigned int seed, const std::string &file_name)
+  {
+    ray::srand(seed);
+    ray::Cloud generated;
+    for (int i = 0; i < 20000; i++)
+    {
+      Eigen::Vector3d end(ray::random(-10.0, 10.0), ray::random(-10.0, 10.0), ray::random(0.0, 2.0));
+      generated.addRay(end + Eigen::Vector3d(0, 0, 1), end, i, ray::RGBA(255, 255, 255, i % 3 == 0 ? 0 : 255));
+    }
+    generated.save(file_name);
+    return generated;
+  }
+
   /// Compare the statistical (1st and 2nd order) moments of the two ray clouds. This almost surely
   /// detects differing clouds, and always equal clouds, given a tolerance @c eps.
   void compareMomentsPercentageError(const Eigen::ArrayXd &m1, const std::vector<double> &m2, double percentage = 5.0)
@@ -124,6 +159,295 @@ namespace raytest
     compareMoments(cloud.getMoments(), {-0.108066, -0.0410134, 0.052168, 8.67026e-08, 8.81787e-08, 2.24394e-08, -0.464107, -0.113806, 0.161496, 2.82122, 2.34281, 1.35279, 17.81, 10.2005, 0.297047, 0.758802, 0.440232, 0.975166, 0.317215, 0.226682, 0.390971, 0.155618});
   }
 
+  /// Saves a trees file in the binary format, and compares the full and partial loads to the text file
+  TEST(Basic, RayForestBinary)
+  {
+    std::ofstream ofs("grid_trees.txt");
+    ofs << "height, x,y,z,radius,parent_id,section" << std::endl;
+    for (int i = 0; i<10; i++)
+    {
+      for (int j = 0; j<10; j++)
+      {
+        ofs << 5 + i + j << ", " << 4*i << "," << 4*j << ",0,0.2,-1,0, " << 4*i << "," << 4*j << "," << 5 + i + j << ",0.1,0,1" << std::endl;
+      }
+    }
+    ofs.close();
+    ray::ForestStructure text_forest, binary_forest, part_forest;
+    EXPECT_TRUE(text_forest.load("grid_trees.txt"));
+    EXPECT_TRUE(text_forest.saveBinary("grid_trees.bin"));
+    EXPECT_TRUE(binary_forest.load("grid_trees.bin"));
+    EXPECT_EQ(binary_forest.trees.size(), text_forest.trees.size());
+    compareMoments(binary_forest.getMoments(), text_forest.getMoments(), 1e-10);
+
+    // the box spans the trunks of the 3x2 trees at x = 8-16, y = 20-24
+    EXPECT_TRUE(part_forest.load("grid_trees.bin", ray::Cuboid(Eigen::Vector3d(8, 20, 1), Eigen::Vector3d(16, 24, 2))));
+    EXPECT_EQ(part_forest.trees.size(), 6u);
+    for (auto &tree: part_forest.trees)
+    {
+      EXPECT_GE(tree.root()[0], 8.0 - 0.2);
+      EXPECT_LE(tree.root()[1], 24.0 + 0.2);
+    }
+  }
+
+  /// Streams the mesh of a large grid of trees to file, and compares it to the mesh generated in memory
+  TEST(Basic, RayForestMesh)
+  {
+    std::ofstream ofs("large_grid_trees.txt");
+    ofs << "x,y,z,radius,parent_id" << std::endl;
+    for (int i = 0; i<40; i++)
+    {
+      for (int j = 0; j<40; j++)
+      {
+        ofs << 2*i << "," << 2*j << ",0,0.2,-1, " << 2*i << "," << 2*j << ",4,0.1,0, " << 2*i + 1 << "," << 2*j << ",6,0.05,1" << std::endl;
+      }
+    }
+    ofs.close();
+    ray::ForestStructure forest;
+    EXPECT_TRUE(forest.load("large_grid_trees.txt"));
+    ray::Mesh mesh;
+    forest.generateSmoothMesh(mesh, -1, 1, 1, 1);
+    EXPECT_TRUE(ray::writePlyMesh("large_grid_mesh.ply", mesh, true));
+    EXPECT_TRUE(forest.writeSmoothMesh("large_grid_streamed_mesh.ply", -1, 1, 1, 1, true));
+
+    ray::Mesh whole_read, streamed_read;
+    EXPECT_TRUE(ray::readPlyMesh("large_grid_mesh.ply", whole_read));
+    EXPECT_TRUE(ray::readPlyMesh("large_grid_streamed_mesh.ply", streamed_read));
+    EXPECT_EQ(streamed_read.vertices().size(), whole_read.vertices().size());
+    EXPECT_EQ(streamed_read.indexList().size(), whole_read.indexList().size());
+    compareMoments(streamed_read.getMoments(), whole_read.getMoments(), 1e-5);
+  }
+
+  /// Checks that skipping ahead in the random sequence matches drawing in order, and that the forest rays generated in
+  /// parallel runs match those generated tree by tree
+  TEST(Basic, RayParallelGeneration)
+  {
+    ray::PCGRandomGenerator sequential;
+    sequential.seed(1, 2, 3, 4);
+    ray::PCGRandomGenerator skipped = sequential;
+    for (int i = 0; i < 1000; i++) sequential();
+    skipped.advance(1000);
+    EXPECT_EQ(sequential(), skipped());
+
+    ray::fillBranchAngleLookup();
+    ray::ForestParams params;
+    params.random_factor = 0.25;
+    ray::srand(3);
+    ray::ForestGen forest;
+    forest.make(params);
+    ray::ForestGen forest_copy = forest;
+    const unsigned int seed = ray::rand();
+    ray::srand(seed);
+    forest.generateRays(500.0);
+    const unsigned int next_random = ray::rand();
+    std::vector<Eigen::Vector3d> starts, ends;
+    ray::srand(seed);
+    forest_copy.generateRays(500.0, [&](const std::vector<Eigen::Vector3d> &chunk_starts, const std::vector<Eigen::Vector3d> &chunk_ends)
+    {
+      starts.insert(starts.end(), chunk_starts.begin(), chunk_starts.end());
+      ends.insert(ends.end(), chunk_ends.begin(), chunk_ends.end());
+    });
+    EXPECT_EQ(ray::rand(), next_random);
+    size_t i = 0;
+    for (auto &tree : forest.trees())
+    {
+      for (size_t j = 0; j < tree.rayEnds().size(); j++, i++)
+      {
+        ASSERT_LT(i, ends.size());
+        EXPECT_EQ(starts[i], tree.rayStarts()[j]);
+        EXPECT_EQ(ends[i], tree.rayEnds()[j]);
+      }
+    }
+    EXPECT_EQ(i, ends.size());
+  }
+
+  /// Saves a spatial index alongside a cloud, and checks that the neighbours found with the loaded index match those
+  /// found with a kd-tree
+  TEST(Basic, RayCloudIndex)
+  {
+    saveRandomCloud(5, "index_test.ply");
+    ray::Cloud cloud;  // the saved end points may be at a lower precision
+    EXPECT_TRUE(cloud.load("index_test.ply"));
+    ray::CloudIndex built;
+    EXPECT_TRUE(built.build("index_test.ply"));
+    ray::CloudIndex index;
+    EXPECT_TRUE(index.load("index_test.ply"));
+    std::vector<bool> bounded(cloud.ends.size());
+    for (size_t i = 0; i < bounded.size(); i++) bounded[i] = cloud.rayBounded(i);
+    EXPECT_TRUE(index.indexes(cloud.ends, &bounded));
+    EXPECT_FALSE(index.indexes(cloud.ends));
+
+    ray::NeighbourGraph kd_graph, index_graph;
+    kd_graph.build(cloud.ends, 8, 0.5, &bounded);
+    index_graph.useIndex(&index);
+    index_graph.build(cloud.ends, 8, 0.5, &bounded);
+    for (size_t i = 0; i < cloud.ends.size(); i++)
+    {
+      const ray::NeighbourGraph::Neighbours kd = kd_graph.neighbours(i);
+      const ray::NeighbourGraph::Neighbours indexed = index_graph.neighbours(i);
+      ASSERT_EQ(kd.size, indexed.size);
+      for (int j = 0; j < kd.size; j++)
+      {
+        EXPECT_EQ(kd.ids[j], indexed.ids[j]);
+        EXPECT_EQ(kd.dists2[j], indexed.dists2[j]);
+      }
+    }
+
+    // an index with an invalid node is not loaded
+    {
+      std::fstream file(ray::CloudIndex::fileName("index_test.ply"), std::ios::in | std::ios::out | std::ios::binary);
+      const uint32_t num_children = 9;
+      file.seekp(8 + 4 * sizeof(uint64_t) + offsetof(ray::CloudIndex::Node, num_children));
+      file.write(reinterpret_cast<const char *>(&num_children), sizeof(num_children));
+    }
+    ray::CloudIndex corrupt;
+    EXPECT_FALSE(corrupt.load("index_test.ply"));
+  }
+
+  /// Sorts a cloud in small chunks, checks that it is spatially coherent, then restores it to the original file
+  TEST(Basic, RaySort)
+  {
+    const ray::Cloud generated = saveRandomCloud(7, "sort_test.ply");
+    EXPECT_TRUE(ray::sortCloudSpatially("sort_test.ply", "sort_test_sorted.ply", 3000));
+    ray::Cloud sorted;
+    EXPECT_TRUE(sorted.load("sort_test_sorted.ply"));
+    ASSERT_EQ(sorted.ends.size(), generated.ends.size());
+    double generated_gaps = 0.0, sorted_gaps = 0.0;
+    for (size_t i = 1; i < sorted.ends.size(); i++)
+    {
+      generated_gaps += (generated.ends[i] - generated.ends[i - 1]).norm();
+      sorted_gaps += (sorted.ends[i] - sorted.ends[i - 1]).norm();
+    }
+    EXPECT_LT(sorted_gaps, 0.1 * generated_gaps);
+
+    EXPECT_TRUE(ray::restoreCloudOrder("sort_test_sorted.ply", "sort_test_restored.ply", 3000));
+    std::ifstream original("sort_test.ply", std::ios::binary), restored("sort_test_restored.ply", std::ios::binary);
+    const std::string original_data((std::istreambuf_iterator<char>(original)), std::istreambuf_iterator<char>());
+    const std::string restored_data((std::istreambuf_iterator<char>(restored)), std::istreambuf_iterator<char>());
+    EXPECT_TRUE(original_data == restored_data);
+
+    // the in-memory sort matches the file sort, and restores the cloud exactly
+    ray::Cloud cloud = generated;
+    std::vector<size_t> order;
+    ray::sortCloudSpatially(cloud, order);
+    for (size_t i = 0; i < cloud.ends.size(); i++)
+    {
+      EXPECT_EQ(cloud.times[i], sorted.times[i]);
+    }
+    ray::restoreCloudOrder(cloud, order);
+    for (size_t i = 0; i < cloud.ends.size(); i++)
+    {
+      EXPECT_EQ(cloud.ends[i], generated.ends[i]);
+      EXPECT_EQ(cloud.times[i], generated.times[i]);
+    }
+  }
+
+  /// Clips a batch of rays, including ones that are parallel to the cuboid faces, and compares it to clipping each ray
+  TEST(Basic, RayCuboidClipRays)
+  {
+    ray::srand(11);
+    const ray::Cuboid cuboid(Eigen::Vector3d(-1.0, -2.0, 0.0), Eigen::Vector3d(2.0, 1.0, 1.5));
+    std::vector<Eigen::Vector3d> starts, ends;
+    for (int i = 0; i < 1003; i++)
+    {
+      Eigen::Vector3d start(ray::random(-3.0, 3.0), ray::random(-3.0, 3.0), ray::random(-1.0, 3.0));
+      Eigen::Vector3d end(ray::random(-3.0, 3.0), ray::random(-3.0, 3.0), ray::random(-1.0, 3.0));
+      if (i % 5 == 1)
+        end[i % 3] = start[i % 3];
+      else if (i % 5 == 2)
+        end = start;
+      starts.push_back(start);
+      ends.push_back(end);
+    }
+    std::vector<Eigen::Vector3d> clipped_starts, clipped_ends;
+    std::vector<bool> valid;
+    cuboid.clipRays(starts, ends, clipped_starts, clipped_ends, valid, 1e-3);
+    int num_valid = 0;
+    for (size_t i = 0; i < ends.size(); i++)
+    {
+      Eigen::Vector3d start = starts[i];
+      Eigen::Vector3d end = ends[i];
+      const bool clipped = cuboid.clipRay(start, end, 1e-3);
+      ASSERT_EQ(clipped, valid[i]);
+      EXPECT_LT((clipped_starts[i] - start).norm(), 1e-10);
+      EXPECT_LT((clipped_ends[i] - end).norm(), 1e-10);
+      num_valid += clipped ? 1 : 0;
+    }
+    EXPECT_GT(num_valid, 100);
+    EXPECT_LT(num_valid, 1000);
+    // the clipped rays can overwrite the input rays
+    cuboid.clipRays(starts, ends, starts, ends, valid, 1e-3);
+    for (size_t i = 0; i < ends.size(); i++)
+    {
+      EXPECT_LT((clipped_starts[i] - starts[i]).norm(), 1e-10);
+      EXPECT_LT((clipped_ends[i] - ends[i]).norm(), 1e-10);
+    }
+  }
+
+  /// Writes georeferenced points to a las file, beyond the range of coordinates without an offset, and reads them back
+  TEST(Basic, RayLasWriter)
+  {
+    ray::srand(13);
+    std::vector<Eigen::Vector3d> points;
+    std::vector<double> times;
+    std::vector<ray::RGBA> colours;
+    for (int i = 0; i < 1000; i++)
+    {
+      points.push_back(Eigen::Vector3d(500000.0, 6000000.0, 100.0) +
+                       Eigen::Vector3d(ray::random(-50.0, 50.0), ray::random(-50.0, 50.0), ray::random(0.0, 20.0)));
+      times.push_back(static_cast<double>(i));
+      colours.push_back(ray::RGBA(0, 0, 0, 100));
+    }
+    EXPECT_TRUE(ray::writeLas("las_test.las", points, times, colours));
+    std::vector<Eigen::Vector3d> positions;
+    std::vector<double> read_times;
+    std::vector<ray::RGBA> read_colours;
+    EXPECT_TRUE(ray::readLas("las_test.las", positions, read_times, read_colours, 100.0));
+    ASSERT_EQ(positions.size(), points.size());
+    for (size_t i = 0; i < points.size(); i++)
+    {
+      EXPECT_LT((positions[i] - points[i]).norm(), 1e-4);
+      EXPECT_EQ(read_times[i], times[i]);
+    }
+
+    // points too far from the offset set by the first chunk are not written, and the incomplete file is reported
+    ray::LasWriter writer("las_range_test.las");
+    EXPECT_TRUE(writer.writeChunk(points, times, colours));
+    std::vector<Eigen::Vector3d> far_points(1, points[0] + Eigen::Vector3d(0.0, 300000.0, 0.0));
+    EXPECT_FALSE(writer.writeChunk(far_points, { 0.0 }, { colours[0] }));
+    EXPECT_FALSE(writer.end());
+  }
+
+  /// Writes a mesh one chunk at a time, and compares it to the same mesh written in one go
+  TEST(Basic, RayMeshWriter)
+  {
+    ray::Mesh whole, chunks[2];
+    for (int c = 0; c<2; c++)
+    {
+      for (int i = 0; i<10; i++)
+      {
+        Eigen::Vector3d pos(i, c + 0.1*i*i, 0.5*c);
+        int num_verts = (int)chunks[c].vertices().size();
+        chunks[c].vertices().insert(chunks[c].vertices().end(), {pos, pos + Eigen::Vector3d(1,0,0), pos + Eigen::Vector3d(0,1,1)});
+        chunks[c].indexList().push_back(Eigen::Vector3i(num_verts, num_verts+1, num_verts+2));
+        whole.indexList().push_back(chunks[c].indexList().back() + Eigen::Vector3i::Constant((int)whole.vertices().size() - num_verts));
+        whole.vertices().insert(whole.vertices().end(), chunks[c].vertices().end() - 3, chunks[c].vertices().end());
+      }
+    }
+    EXPECT_TRUE(ray::writePlyMesh("whole_mesh.ply", whole));
+    ray::MeshWriter writer;
+    EXPECT_TRUE(writer.begin("chunked_mesh.ply"));
+    EXPECT_TRUE(writer.writeChunk(chunks[0]));
+    EXPECT_TRUE(writer.writeChunk(chunks[1]));
+    EXPECT_TRUE(writer.end());
+
+    ray::Mesh whole_read, chunked_read;
+    EXPECT_TRUE(ray::readPlyMesh("whole_mesh.ply", whole_read));
+    EXPECT_TRUE(ray::readPlyMesh("chunked_mesh.ply", chunked_read));
+    EXPECT_EQ(chunked_read.vertices().size(), whole_read.vertices().size());
+    EXPECT_EQ(chunked_read.indexList().size(), whole_read.indexList().size());
+    compareMoments(chunked_read.getMoments(), whole_read.getMoments(), 1e-5);
+  }
+
   /// Creates two rooms, the second is decimated and transformed, then rayrestore is called to apply this transformation to
   /// the first (high resolution) room
   TEST(Basic, RayRestore)
@@ -159,6 +483,22 @@ namespace raytest
     compareMoments(cloud.getMoments(), {-0.108066, -0.0410134, 0.052168, 7.05134e-08, 8.45038e-08, 1.93877e-08, -0.27615, -0.0761079, 0.0656267, 2.42413, 2.13691, 1.28163, 17.539, 10.1994, 0.304682, 0.761892, 0.429502, 0.987362, 0.318932, 0.225742, 0.389901, 0.111705});
   }  
 
+  /// Denoises then decimates a room in a single in-memory pipeline, comparing against the same chain of tools
+  TEST(Basic, RayPipeline)
+  {
+    EXPECT_EQ(command("raycreate room 1"), 0);
+    EXPECT_EQ(command("raydenoise room.ply 3 cm"), 0);
+    EXPECT_EQ(command("raydecimate room_denoised.ply 10 cm"), 0);
+    ray::Pipeline pipeline;
+    pipeline.add("denoise", [](ray::Cloud &cloud) { ray::denoiseDistance(cloud, 0.03); return true; })
+            .add("decimate", [](ray::Cloud &cloud) { return ray::decimateSpatial(cloud, 10.0); });
+    EXPECT_TRUE(pipeline.run("room.ply", "room_pipeline.ply"));
+    ray::Cloud chained, piped;
+    EXPECT_TRUE(chained.load("room_denoised_decimated.ply"));
+    EXPECT_TRUE(piped.load("room_pipeline.ply"));
+    compareMoments(piped.getMoments(), chained.getMoments(), 0.01);
+  }
+
   /// Creates a room, then splits it around a plane, comparing agaisnt the expected result
   TEST(Basic, RaySplit)
   {
@@ -169,6 +509,35 @@ namespace raytest
     compareMoments(cloud.getMoments(), {-0.467731, 1.05075, 1.43662, 2.20441, 1.60162, 0.106775, -0.77974, 1.03139, 1.57353, 3.67521, 2.64766, 0.485084, 17.3995, 10.279, 0.311066, 0.759795, 0.425206, 0.951355, 0.321609, 0.226785, 0.39073, 0.215125});
   }  
 
+  /// Translates, rotates, colours and box-splits a room in a single streamed pass, comparing against the same chain of tools
+  TEST(Basic, RayStream)
+  {
+    EXPECT_EQ(command("raycreate room 1"), 0);
+    EXPECT_EQ(copy("room.ply room_chain.ply"), 0);
+    EXPECT_EQ(command("raytranslate room_chain.ply 1,2,3"), 0);
+    EXPECT_EQ(command("rayrotate room_chain.ply 0,0,30"), 0);
+    EXPECT_EQ(command("raycolour room_chain.ply height"), 0);
+    EXPECT_EQ(command("raysplit room_chain_coloured.ply box 1,2,3 2,2,1"), 0);
+
+    ray::CloudStream stream;
+    Eigen::Quaterniond rotation(Eigen::AngleAxisd(30.0 * ray::kPi / 180.0, Eigen::Vector3d(0, 0, 1)));
+    ray::CloudStream &outside = stream.translate(Eigen::Vector3d(1, 2, 3))
+                                  .rotate(rotation)
+                                  .colourByHeight()
+                                  .splitBox(Eigen::Vector3d(1, 2, 3), Eigen::Vector3d(2, 2, 1));
+    stream.write("room_stream_inside.ply");
+    outside.write("room_stream_outside.ply");
+    EXPECT_TRUE(stream.run("room.ply"));
+
+    for (auto &side : { "inside", "outside" })
+    {
+      ray::Cloud chained, streamed;
+      EXPECT_TRUE(chained.load(std::string("room_chain_coloured_") + side + ".ply"));
+      EXPECT_TRUE(streamed.load(std::string("room_stream_") + side + ".ply"));
+      compareMoments(streamed.getMoments(), chained.getMoments(), 0.01);
+    }
+  }
+
   /// Creates a room and runs raytransients, comparing the identified transients ray cloud to the expected results
   TEST(Basic, RayTransients)
   {
@@ -200,6 +569,47 @@ namespace raytest
     compareMoments(mesh.getMoments(), {0.0386662, -1.52168, -0.139079, 3.30621, 3.35391, 0.705937});
   }  
 
+  /// Wraps a random terrain in tiles and as a whole, and checks that the tiled mesh covers the same area, with no
+  /// overlapping triangles along the seams
+  TEST(Basic, RayTiledConcaveHull)
+  {
+    ray::srand(17);
+    std::vector<Eigen::Vector3d> points;
+    for (int i = 0; i < 8000; i++)
+    {
+      const double x = ray::random(-10.0, 10.0), y = ray::random(-10.0, 10.0);
+      points.push_back(Eigen::Vector3d(x, y, 0.5 * std::sin(0.3 * x) + 0.3 * std::cos(0.4 * y)));
+    }
+    ray::ConcaveHull whole(points);
+    whole.growUpwards(1.0);
+    ray::TiledConcaveHull tiled(5.0, 2.0);
+    tiled.addPoints(points);
+    tiled.grow([](ray::ConcaveHull &hull) { hull.growUpwards(1.0); });
+
+    auto projected_area = [](const ray::Mesh &mesh) {
+      double area = 0.0;
+      for (const auto &tri : mesh.indexList())
+      {
+        const std::vector<Eigen::Vector3d> &verts = mesh.vertices();
+        area += 0.5 * std::abs((verts[tri[1]] - verts[tri[0]]).cross(verts[tri[2]] - verts[tri[0]])[2]);
+      }
+      return area;
+    };
+    EXPECT_NEAR(projected_area(tiled.mesh()), projected_area(whole.mesh()), 0.02 * projected_area(whole.mesh()));
+    std::map<std::pair<int, int>, int> edge_counts;
+    for (const auto &tri : tiled.mesh().indexList())
+    {
+      for (int i = 0; i < 3; i++)
+      {
+        edge_counts[std::make_pair(std::min(tri[i], tri[(i + 1) % 3]), std::max(tri[i], tri[(i + 1) % 3]))]++;
+      }
+    }
+    for (const auto &edge : edge_counts)
+    {
+      EXPECT_LE(edge.second, 2);
+    }
+  }
+
   /// Tests extraction of terrain and extraction of trees
   TEST(Basic, RayExtract)
   {